@@ -14,10 +14,24 @@
 #define BUFFER_TARGET_HIGH   80   // Above this: consume faster
 #define BUFFER_TARGET_LOW    70   // Below this: consume slower
 
-// Frame intervals in seconds (30 FPS base = 0.033s)
-#define FRAME_INTERVAL_FAST   0.032  // ~31.25 FPS - drain buffer
-#define FRAME_INTERVAL_NORMAL 0.033  // ~30.30 FPS - maintain buffer
-#define FRAME_INTERVAL_SLOW   0.034  // ~29.41 FPS - fill buffer
+// Frame interval scale relative to the media frame interval (1 / fps)
+#define FRAME_INTERVAL_FAST   0.97  // ~3% faster - drain buffer
+#define FRAME_INTERVAL_NORMAL 1.00  // media rate - maintain buffer
+#define FRAME_INTERVAL_SLOW   1.03  // ~3% slower - fill buffer
+
+// Highest media frame rate the UI loop can keep up with
+#define UI_MAX_FPS 60
+
+// A timestamp gap of more frames than this is a jump, not skipped frames
+#define UI_MAX_FRAME_SPAN 16
+
+// Media frame rate reported by the server in its SETUP reply
+static double client_ui_fps(client_ui_t *ui) {
+    pthread_mutex_lock(&ui->client->state_mutex);
+    double fps = ui->client->framerate;
+    pthread_mutex_unlock(&ui->client->state_mutex);
+    return fps;
+}
 
 // Helper function to check if mouse is hovering over a rectangle
 static bool IsMouseOver(Rectangle rect) {
@@ -165,10 +179,17 @@ void client_ui_init(
     ui->current_frame_number = 0;
     ui->last_frame_time = 0;
     ui->consecutive_empty_frames = 0;
+    ui->timestamp_known = false;
+    ui->frame_span = 1;
+
+    // Connection setup
+    ui->connecting = false;
+    atomic_store(&ui->describe_done, 0);
 
-    // Auto-play after seek
-    ui->seek_time_pending = 0;
-    ui->auto_play_after_seek = false;
+    // Seek latency tracking
+    ui->seek_sent_time = 0;
+    atomic_store(&ui->seek_epoch, -1);
+    ui->awaiting_seek_frame = false;
 
     // Statistics initialization
     memset(&ui->last_stats, 0, sizeof(rtp_stats_t));
@@ -183,7 +204,7 @@ void client_ui_init(
 
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     InitWindow(ui->screen_width, ui->screen_height, "RTSP Client");
-    SetTargetFPS(30);
+    SetTargetFPS(UI_MAX_FPS);
 
     client_ui_update_layout(ui);
 
@@ -196,6 +217,28 @@ void client_ui_init(
     EndTextureMode();
 }
 
+// Size the window and video texture for the video resolution
+static void client_ui_resize_video(client_ui_t *ui, int width, int height) {
+    ui->video_width = width;
+    ui->video_height = height;
+    ui->screen_width = width;
+    ui->screen_height = height + (int)TIMER_HEIGHT + (int)STATS_HEIGHT + (int)TOOLBAR_HEIGHT;
+    ui->video_size_detected = true;
+
+    // Resize window to match video
+    SetWindowSize(ui->screen_width, ui->screen_height);
+
+    // Recreate video texture with correct size
+    UnloadRenderTexture(ui->video_texture);
+    ui->video_texture = LoadRenderTexture(ui->video_width, ui->video_height);
+    BeginTextureMode(ui->video_texture);
+    ClearBackground(BLACK);
+    EndTextureMode();
+
+    // Update layout
+    client_ui_update_layout(ui);
+}
+
 static void client_ui_update_video(client_ui_t *ui, const uint8_t *frame_data, size_t frame_size) {
     if (frame_size <= 0) {
         return;
@@ -205,24 +248,9 @@ static void client_ui_update_video(client_ui_t *ui, const uint8_t *frame_data, s
     Image img = LoadImageFromMemory(".jpg", frame_data, frame_size);
 
     if (img.data != NULL) {
-        // Detect video resolution from first frame and resize window
+        // Servers without DESCRIBE: take the resolution from the first frame
         if (!ui->video_size_detected && img.width > 0 && img.height > 0) {
-            ui->video_width = img.width;
-            ui->video_height = img.height;
-            ui->screen_width = img.width;
-            ui->screen_height = img.height + (int)TIMER_HEIGHT + (int)STATS_HEIGHT + (int)TOOLBAR_HEIGHT;
-            ui->video_size_detected = true;
-
-            // Resize window to match video
-            SetWindowSize(ui->screen_width, ui->screen_height);
-
-            // Recreate video texture with correct size
-            UnloadRenderTexture(ui->video_texture);
-            ui->video_texture = LoadRenderTexture(ui->video_width, ui->video_height);
-
-            // Update layout
-            client_ui_update_layout(ui);
-
+            client_ui_resize_video(ui, img.width, img.height);
             logger_log("video resolution detected: %dx%d", img.width, img.height);
         }
 
@@ -241,6 +269,120 @@ static void client_ui_update_video(client_ui_t *ui, const uint8_t *frame_data, s
     }
 }
 
+// Runs on the rtsp reply thread once the server has described the video
+// The texture can only be touched on the UI thread, so just flag it
+static void on_describe_reply(rtsp_client_t *client, const rtsp_reply_t *reply, void *arg) {
+    (void)client;
+    client_ui_t *ui = (client_ui_t *)arg;
+    if (reply->status_code != 200) {
+        logger_log("describe rejected with status %d, sizing from the first frame", reply->status_code);
+    }
+    atomic_store(&ui->describe_done, 1);
+}
+
+// Runs on the rtsp reply thread once a multicast SETUP is answered
+static void on_setup_reply(rtsp_client_t *client, const rtsp_reply_t *reply, void *arg) {
+    (void)client;
+    client_ui_t *ui = (client_ui_t *)arg;
+    if (reply->status_code != 200) {
+        logger_log("multicast setup rejected with status %d", reply->status_code);
+        return;
+    }
+    atomic_store(&ui->setup_done, 1);
+}
+
+// Preallocate for the described video, then set up the session
+static void client_ui_setup(client_ui_t *ui) {
+    pthread_mutex_lock(&ui->client->state_mutex);
+    int width = ui->client->width;
+    int height = ui->client->height;
+    size_t max_frame_size = ui->client->max_frame_size;
+    pthread_mutex_unlock(&ui->client->state_mutex);
+
+    if (width > 0 && height > 0) {
+        client_ui_resize_video(ui, width, height);
+        logger_log("video resolution from describe: %dx%d", width, height);
+    }
+    if (max_frame_size > 0) {
+        unsigned char *buffer = (unsigned char *)realloc(ui->frame_data_buffer, max_frame_size);
+        if (buffer != NULL) {
+            ui->frame_data_buffer = buffer;
+        } else {
+            max_frame_size = 0; // keep the worst case buffers
+        }
+    }
+
+    if (ui->client->multicast) {
+        ui->max_frame_size = max_frame_size;
+        rtsp_client_send_setup(ui->client, on_setup_reply, ui);
+        return;
+    }
+    if (rtp_client_open_port(ui->rtp, ui->rtp_port, max_frame_size, NULL) == 0) {
+        rtsp_client_send_setup(ui->client, NULL, NULL);
+        rtp_client_start_listener(ui->rtp);
+    }
+}
+
+// Join the group from the SETUP reply and start receiving
+static void client_ui_join_group(client_ui_t *ui) {
+    pthread_mutex_lock(&ui->client->state_mutex);
+    char group[sizeof(ui->client->multicast_group)];
+    memcpy(group, ui->client->multicast_group, sizeof(group));
+    int port = ui->client->multicast_port;
+    pthread_mutex_unlock(&ui->client->state_mutex);
+
+    if (group[0] == '\0' || port <= 0) {
+        logger_log("setup reply has no multicast group");
+        return;
+    }
+    if (rtp_client_open_port(ui->rtp, port, ui->max_frame_size, group) == 0) {
+        rtp_client_start_listener(ui->rtp);
+    }
+}
+
+// Runs on the rtsp reply thread once the server has answered a seek
+static void on_seek_reply(rtsp_client_t *client, const rtsp_reply_t *reply, void *arg) {
+    (void)client;
+    client_ui_t *ui = (client_ui_t *)arg;
+    if (reply->status_code != 200) {
+        logger_log("seek (cseq %d) rejected with status %d", reply->cseq, reply->status_code);
+        return;
+    }
+
+    // Frames of the new epoch start at the seek target, older ones are
+    // flushed from the cache right away
+    if (reply->epoch >= 0) {
+        atomic_store(&ui->seek_epoch, reply->epoch);
+        rtp_client_set_epoch(ui->rtp, (uint8_t)reply->epoch);
+    }
+}
+
+// A seek is a PLAY with an X-Frame header: the server repositions and keeps
+// streaming, so no follow-up PLAY (and no delay before it) is needed
+static void client_ui_seek(client_ui_t *ui, int target_frame) {
+    // Cleared before sending, the reply may set it before this returns
+    atomic_store(&ui->seek_epoch, -1);
+    if (rtsp_client_send_seek_frame(ui->client, target_frame, on_seek_reply, ui) < 0) {
+        return;
+    }
+
+    // Server will send frames starting from target_frame
+    ui->frame_count = 0;                      // Reset frame counter (server starts from target)
+    ui->frame_count_at_seek = target_frame;   // Anchor absolute frame number for upcoming frames
+    ui->current_frame_number = target_frame;  // Set absolute frame number immediately
+    ui->elapsed_time = 0;                     // Reset timer to 0
+    ui->timer_running = true;
+
+    ui->video_ended = false;  // Reset EOF flag after seek (don't stop during seek)
+    ui->consecutive_empty_frames = 0;
+    ui->last_frame_time = GetTime();
+    ui->seek_sent_time = GetTime();
+    ui->awaiting_seek_frame = true;
+
+    // No cache clear here: the frames already buffered keep playing until
+    // the first frame of the new stream epoch arrives and replaces them
+}
+
 static void client_ui_update_logic(client_ui_t *ui) {
     if (WindowShouldClose()) {
         ui->close_signal = true;
@@ -258,37 +400,47 @@ static void client_ui_update_logic(client_ui_t *ui) {
     pthread_mutex_lock(&ui->client->state_mutex);
     client_state_t current_state = ui->client->state;
     pthread_mutex_unlock(&ui->client->state_mutex);
+    const double fps = client_ui_fps(ui);
 
     // Update timer based on absolute frame number (frame / FPS)
     // Timer reflects the absolute position in the video regardless of seeks
     if (ui->timer_running) {
-        const double FPS = 20.0;
-        ui->elapsed_time = ((double)ui->current_frame_number) / FPS;
+        ui->elapsed_time = ((double)ui->current_frame_number) / fps;
     }
 
-    // Update statistics periodically
+    // Update statistics periodically, and keep the session from timing out
+    // while the user is idle
     if (current_state != STATE_INIT) {
         rtp_client_get_stats(ui->rtp, &ui->last_stats);
         ui->last_buffer_level = rtp_client_get_buffer_level(ui->rtp);
+        rtsp_client_keepalive(ui->client);
     }
 
     // Connect button - only works in INIT state
-    if (IsButtonClicked(ui->connect_btn_rect) && current_state == STATE_INIT) {
+    // The video is described first so buffers and texture are sized before
+    // the first packet arrives
+    if (IsButtonClicked(ui->connect_btn_rect) && current_state == STATE_INIT && !ui->connecting) {
         logger_log("connect button clicked");
         if (rtsp_client_connect(ui->client, ui->server_ip, ui->server_port, ui->video_file, ui->rtp_port) == 0) {
-            if (rtp_client_open_port(ui->rtp, ui->rtp_port) == 0) {
-                rtsp_client_send_setup(ui->client);
-                rtsp_client_start_reply_listener(ui->client);
-                rtp_client_start_listener(ui->rtp);
+            rtsp_client_start_reply_listener(ui->client);
+            if (rtsp_client_send_describe(ui->client, on_describe_reply, ui) > 0) {
+                ui->connecting = true;
             }
         }
     }
+    if (ui->connecting && atomic_load(&ui->describe_done)) {
+        ui->connecting = false;
+        client_ui_setup(ui);
+    }
+    if (atomic_exchange(&ui->setup_done, 0)) {
+        client_ui_join_group(ui);
+    }
 
     // Play/Pause toggle button
     if (IsButtonClicked(ui->playpause_btn_rect)) {
         if (current_state == STATE_READY) {
             logger_log("play button clicked");
-            rtsp_client_send_play(ui->client);
+            rtsp_client_send_play(ui->client, NULL, NULL);
             ui->play_start_time = GetTime();
             // Anchor the seek/frame counters to the current absolute frame
             ui->frame_count = 0;
@@ -297,7 +449,7 @@ static void client_ui_update_logic(client_ui_t *ui) {
             ui->timer_running = true;
         } else if (current_state == STATE_PLAYING) {
             logger_log("pause button clicked");
-            rtsp_client_send_pause(ui->client);
+            rtsp_client_send_pause(ui->client, NULL, NULL);
             ui->timer_running = false;
         }
     }
@@ -305,58 +457,20 @@ static void client_ui_update_logic(client_ui_t *ui) {
     // Seek back button - go back 3 seconds
     if (IsButtonClicked(ui->seek_back_btn_rect) && current_state != STATE_INIT) {
         // Compute target frame relative to the absolute current frame
-        const double FPS = 20.0;
-        int current_frame = ui->current_frame_number;
-        int target_frame = current_frame - (int)(3.0 * FPS);
+        int target_frame = ui->current_frame_number - (int)(3.0 * fps + 0.5);
         if (target_frame < 0) target_frame = 0;
-        double new_time = (double)target_frame / FPS;
-        logger_log("seek back button clicked - seeking to frame %d (%.1f seconds)", target_frame, new_time);
-        rtsp_client_send_seek_frame(ui->client, target_frame);
-        
-        // Reset frame counter and elapsed_time after seek
-        // Server will send frames starting from target_frame
-        ui->frame_count = 0;                 // Reset frame counter (server starts from target)
-        ui->frame_count_at_seek = target_frame; // Anchor absolute frame number for upcoming frames
-        ui->current_frame_number = target_frame;  // Set absolute frame number immediately
-        ui->elapsed_time = 0;          // Reset timer to 0
-        
-        ui->video_ended = false;  // Reset EOF flag after seek (don't stop during seek)
-        ui->consecutive_empty_frames = 0;
-        ui->last_frame_time = GetTime();
-        // Clear cache to discard old frames and start buffering from new position
-        rtp_client_clear_cache(ui->rtp);
-        
-        // Set auto-play after seek with 0.2s delay
-        ui->seek_time_pending = GetTime();
-        ui->auto_play_after_seek = true;
+        logger_log("seek back button clicked - seeking to frame %d (%.1f seconds)",
+            target_frame, (double)target_frame / fps);
+        client_ui_seek(ui, target_frame);
     }
 
     // Seek forward button - go forward 3 seconds
     if (IsButtonClicked(ui->seek_forward_btn_rect) && current_state != STATE_INIT) {
         // Compute target frame relative to the absolute current frame
-        const double FPS = 20.0;
-        int current_frame = ui->current_frame_number;
-        int target_frame = current_frame + (int)(3.0 * FPS);
-        
-        double new_time = (double)target_frame / FPS;
-        logger_log("seek forward button clicked - seeking to frame %d (%.1f seconds)", target_frame, new_time);
-        rtsp_client_send_seek_frame(ui->client, target_frame);
-        
-        // Reset frame counter and elapsed_time after seek
-        // Server will send frames starting from target_frame
-        ui->frame_count = 0;                 // Reset frame counter (server starts from target)
-        ui->frame_count_at_seek = target_frame; // Anchor absolute frame number for upcoming frames
-        ui->current_frame_number = target_frame;  // Set absolute frame number immediately
-        ui->elapsed_time = 0;          // Reset timer to 0
-        
-        ui->video_ended = false;  // Reset EOF flag after seek (don't stop during seek)
-        ui->consecutive_empty_frames = 0;
-        ui->last_frame_time = GetTime();
-        // Clear cache to discard old frames and start buffering from new position
-        rtp_client_clear_cache(ui->rtp);
-        // Set auto-play after seek with 0.2s delay
-        ui->seek_time_pending = GetTime();
-        ui->auto_play_after_seek = true;
+        int target_frame = ui->current_frame_number + (int)(3.0 * fps + 0.5);
+        logger_log("seek forward button clicked - seeking to frame %d (%.1f seconds)",
+            target_frame, (double)target_frame / fps);
+        client_ui_seek(ui, target_frame);
     }
 
     // Stop button - teardown
@@ -365,21 +479,6 @@ static void client_ui_update_logic(client_ui_t *ui) {
         ui->close_signal = true;
     }
 
-    // Auto-play after seek (0.2s delay)
-    if (ui->auto_play_after_seek && current_state != STATE_INIT) {
-        double now = GetTime();
-        double elapsed = now - ui->seek_time_pending;
-        if (elapsed >= 0.2) {
-            logger_log("auto-play triggered after 0.2s seek delay");
-            // Send PLAY command
-            if (current_state == STATE_READY) {
-                rtsp_client_send_play(ui->client);
-                ui->timer_running = true;
-            }
-            ui->auto_play_after_seek = false;
-        }
-    }
-
     if (current_state == STATE_PLAYING) {
         // Only update video if not buffering
         if (!rtp_client_is_buffering(ui->rtp)) {
@@ -388,24 +487,48 @@ static void client_ui_update_logic(client_ui_t *ui) {
             int buffer_level = ui->last_buffer_level;
             
             // Adjust consume rate based on buffer level vs target
-            double frame_interval;
+            double frame_interval = ui->frame_span / fps;
             if (buffer_level > BUFFER_TARGET_HIGH) {
-                frame_interval = FRAME_INTERVAL_FAST;  // Consume faster to drain buffer
+                frame_interval *= FRAME_INTERVAL_FAST;  // Consume faster to drain buffer
             } else if (buffer_level < BUFFER_TARGET_LOW) {
-                frame_interval = FRAME_INTERVAL_SLOW;  // Consume slower to fill buffer
+                frame_interval *= FRAME_INTERVAL_SLOW;  // Consume slower to fill buffer
             } else {
-                frame_interval = FRAME_INTERVAL_NORMAL;  // Normal rate
+                frame_interval *= FRAME_INTERVAL_NORMAL;  // Normal rate
             }
             
             if (now - ui->last_frame_time >= frame_interval) {
-                size_t frame_size = rtp_client_get_frame(ui->rtp, ui->frame_data_buffer);
+                uint8_t frame_epoch = 0;
+                uint32_t timestamp = 0;
+                size_t frame_size = rtp_client_get_frame(ui->rtp, ui->frame_data_buffer, &frame_epoch, &timestamp);
                 
                 if (frame_size > 0) {
-                    // Got a frame - reset EOF counter and increment frame count
+                    // Got a frame - reset EOF counter
                     ui->consecutive_empty_frames = 0;
-                    ui->frame_count++;
-                    // Update absolute frame number: frame_count tương đối từ seek được cộng vào seek position
-                    ui->current_frame_number = ui->frame_count_at_seek + ui->frame_count;
+
+                    // Frames skipped before this one are made up by showing
+                    // it for longer
+                    ui->frame_span = 1;
+                    if (ui->timestamp_known && frame_epoch == ui->last_epoch) {
+                        int span = (int)((uint32_t)(timestamp - ui->last_timestamp) * fps / RTP_CLOCK_RATE + 0.5);
+                        if (span > 1 && span <= UI_MAX_FRAME_SPAN) {
+                            ui->frame_span = span;
+                        }
+                    }
+                    ui->timestamp_known = true;
+                    ui->last_timestamp = timestamp;
+                    ui->last_epoch = frame_epoch;
+
+                    // Frames from before a pending seek are still shown, but
+                    // don't move the frame counter away from the seek target
+                    if (ui->awaiting_seek_frame && frame_epoch == atomic_load(&ui->seek_epoch)) {
+                        logger_log("seek to first frame: %.0f ms", (now - ui->seek_sent_time) * 1000.0);
+                        ui->awaiting_seek_frame = false;
+                    }
+                    if (!ui->awaiting_seek_frame) {
+                        ui->frame_count += ui->frame_span;
+                        // Update absolute frame number: frame_count relative to the seek is added to the seek position
+                        ui->current_frame_number = ui->frame_count_at_seek + ui->frame_count;
+                    }
                     client_ui_update_video(ui, ui->frame_data_buffer, frame_size);
                 } else {
                     // No frame available
@@ -446,9 +569,18 @@ static void client_ui_draw(client_ui_t *ui) {
     int total_seconds = (int)ui->elapsed_time;
     int minutes = total_seconds / 60;
     int seconds = total_seconds % 60;
-    char timer_text[16];
+    char timer_text[32];
     sprintf(timer_text, "%02d:%02d", minutes, seconds);
 
+    // Show the duration once the server has described the video
+    pthread_mutex_lock(&ui->client->state_mutex);
+    int duration_seconds = (int)ui->client->duration;
+    pthread_mutex_unlock(&ui->client->state_mutex);
+    if (duration_seconds > 0) {
+        sprintf(timer_text, "%02d:%02d / %02d:%02d", minutes, seconds,
+            duration_seconds / 60, duration_seconds % 60);
+    }
+
     int timer_font_size = 20;
     int timer_text_width = MeasureText(timer_text, timer_font_size);
     DrawText(timer_text,
@@ -615,7 +747,7 @@ void client_ui_cleanup(client_ui_t *ui) {
 
     // Send TEARDOWN if we are connected
     if (ui->client->state != STATE_INIT) {
-        rtsp_client_send_teardown(ui->client);
+        rtsp_client_send_teardown(ui->client, NULL, NULL);
     }
 
     // Stop network threads
@@ -5,6 +5,8 @@
 #include "rtp_client.h"
 #include "raylib.h"
 
+#include <stdatomic.h>
+
 // Initial window size (will be resized when video loads)
 #define INITIAL_VIDEO_WIDTH 640
 #define INITIAL_VIDEO_HEIGHT 480
@@ -70,13 +72,30 @@ typedef struct {
     int frame_count_at_seek;       // Frame count when last seek was done
     int current_frame_number;      // Absolute frame number (0-500) being displayed
 
-    // Frame rate control - throttle to match server's 20 FPS
+    // Frame rate control - throttle to the media frame rate
     double last_frame_time;
     int consecutive_empty_frames;   // Counter for EOF detection
 
-    // Auto-play after seek
-    double seek_time_pending;      // Time when seek happened (for auto-play delay)
-    bool auto_play_after_seek;     // Flag to trigger auto-play after delay
+    // Frames the server skipped on a congested link leave gaps in the RTP
+    // timestamps, the frame after one is shown for the frames it stands for
+    bool timestamp_known;
+    uint32_t last_timestamp;
+    uint8_t last_epoch;
+    int frame_span;                 // media frames the frame on screen covers
+
+    // Connection setup: DESCRIBE is answered before SETUP is sent
+    bool connecting;
+    _Atomic int describe_done;     // Set by the reply thread
+
+    // Multicast: the group is only known from the SETUP reply, so the port
+    // is opened after it
+    _Atomic int setup_done;        // Set by the reply thread
+    size_t max_frame_size;
+
+    // Seek latency tracking
+    double seek_sent_time;         // Time the last seek request was sent
+    bool awaiting_seek_frame;      // True until the first frame after a seek is shown
+    _Atomic int seek_epoch;        // Epoch the reply thread got in the seek reply, -1 until then
 
     // Statistics display
     rtp_stats_t last_stats;
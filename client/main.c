@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../common/logger.h"
 #include "client_ui.h"
@@ -11,21 +12,36 @@
 int main(int argc, char *argv[]) {
     logger_init(LOG_SRC_CLIENT);
 
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s [srv_ip] [srv_port] [rtp_port] [file]\n", argv[0]);
+    // -m asks for the channel on its multicast group, rtp_port is then unused
+    int multicast = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "m")) != -1) {
+        switch (opt) {
+        case 'm':
+            multicast = 1;
+            break;
+        default:
+            argc = 0; // print usage
+            break;
+        }
+    }
+
+    if (argc - optind != 4) {
+        fprintf(stderr, "Usage: %s [-m] [srv_ip] [srv_port] [rtp_port] [file]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    char *server_ip = argv[1];
-    int server_port = atoi(argv[2]);
-    int rtp_port = atoi(argv[3]);
-    char *video_file = argv[4];
+    char *server_ip = argv[optind];
+    int server_port = atoi(argv[optind + 1]);
+    int rtp_port = atoi(argv[optind + 2]);
+    char *video_file = argv[optind + 3];
 
     logger_log("client starting up");
 
     rtsp_client_t client;
     memset(&client, 0, sizeof(rtsp_client_t));
     pthread_mutex_init(&client.state_mutex, NULL);
+    client.multicast = multicast;
 
     rtp_client_t rtp;
     memset(&rtp, 0, sizeof(rtp_client_t));
@@ -1,4 +1,8 @@
+#define _DEFAULT_SOURCE // struct ip_mreq
+
 #include "../common/logger.h"
+#include "../common/rtcp.h"
+#include "../common/rtp_fec.h"
 #include "../common/rtp_packet.h"
 #include "../common/rtp_fragment.h"
 #include "../common/protocol.h"
@@ -11,8 +15,10 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <time.h>
 
 // Max single packet: RTP header + fragment header + MTU payload
 #define RTP_RECV_BUFFER_SIZE (RTP_HEADER_SIZE + RTP_FRAG_HEADER_SIZE + RTP_MTU_PAYLOAD + 64)
@@ -20,8 +26,65 @@
 // Minimum frames to buffer before starting playback (75% of CACHE_SIZE)
 #define MIN_BUFFER_FRAMES 15
 
+// Frames in flight are checked for lost fragments at most this often
+#define RTP_NACK_SCAN_MS 10
+
+// A packet this many frames behind the window is from a restarted stream,
+// not a late retransmission
+#define RTP_RESTART_FRAMES 256
+
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Drop every cached frame and move to a newer epoch
+// Must be called with cache.mutex held
+static void switch_epoch_locked(rtp_client_t *rtp, uint8_t epoch) {
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        rtp->cache.frames[i].valid = 0;
+    }
+    rtp->cache.write_idx = 0;
+    rtp->cache.read_idx = 0;
+    rtp->cache.count = 0;
+
+    // The seek target should be displayed as soon as it arrives
+    rtp->cache.buffering = 0;
+
+    logger_log("stream epoch %u -> %u, cache flushed", (unsigned)rtp->epoch, (unsigned)epoch);
+    rtp->epoch = epoch;
+}
+
+// Return 1 if packets from this epoch should be processed, 0 if stale
+static int accept_epoch(rtp_client_t *rtp, uint8_t epoch) {
+    pthread_mutex_lock(&rtp->cache.mutex);
+    if (!rtp->epoch_known) {
+        rtp->epoch_known = 1;
+        rtp->epoch = epoch;
+    }
+
+    // Serial number arithmetic, the epoch wraps around after 255 seeks
+    int8_t age = (int8_t)(uint8_t)(epoch - rtp->epoch);
+    if (age > 0) {
+        switch_epoch_locked(rtp, epoch);
+    }
+    pthread_mutex_unlock(&rtp->cache.mutex);
+    return age >= 0;
+}
+
 // Add a completed frame to the cache
-static void cache_add_frame(rtp_client_t *rtp, const uint8_t *data, size_t size, uint16_t seqnum) {
+static void cache_add_frame(rtp_client_t *rtp,
+                            const uint8_t *data,
+                            size_t size,
+                            uint16_t seqnum,
+                            uint8_t epoch,
+                            uint32_t timestamp) {
+    if (rtp->on_frame != NULL) {
+        rtp->on_frame(data, size, epoch, rtp->on_frame_arg);
+        return;
+    }
+
     pthread_mutex_lock(&rtp->cache.mutex);
 
     // If cache is full, drop the OLDEST frame to make room for new one
@@ -45,10 +108,12 @@ static void cache_add_frame(rtp_client_t *rtp, const uint8_t *data, size_t size,
         return;
     }
 
-    if (size <= FRAME_BUFFER_SIZE) {
+    if (size <= rtp->frame_capacity) {
         memcpy(frame->data, data, size);
         frame->size = size;
         frame->seqnum = seqnum;
+        frame->epoch = epoch;
+        frame->timestamp = timestamp;
         frame->valid = 1;
 
         rtp->cache.write_idx = (rtp->cache.write_idx + 1) % CACHE_SIZE;
@@ -64,8 +129,237 @@ static void cache_add_frame(rtp_client_t *rtp, const uint8_t *data, size_t size,
     pthread_mutex_unlock(&rtp->cache.mutex);
 }
 
-// Process a fragment and reassemble frames
-static void process_fragment(rtp_client_t *rtp, const uint8_t *payload, size_t payload_size, uint16_t seqnum) {
+_Static_assert(RTP_REASSEMBLY_SLOTS >= RTP_NACK_DEADLINE_MS * RTP_MAX_FPS / 1000 &&
+               (RTP_REASSEMBLY_SLOTS & (RTP_REASSEMBLY_SLOTS - 1)) == 0,
+               "reassembly slots must cover the NACK deadline and divide 65536");
+
+static fragment_buffer_t *frame_slot(rtp_client_t *rtp, uint16_t seqnum) {
+    return &rtp->frag_bufs[seqnum % RTP_REASSEMBLY_SLOTS];
+}
+
+static int has_fragment(const fragment_buffer_t *buf, int index) {
+    return (buf->frags_bitmap[index / 32] & (1u << (index % 32))) != 0;
+}
+
+// Forget every frame in flight, e.g. because of a seek
+static void reset_reassembly(rtp_client_t *rtp) {
+    for (int i = 0; i < RTP_REASSEMBLY_SLOTS; i++) {
+        rtp->frag_bufs[i].in_progress = 0;
+    }
+    rtp->window_known = 0;
+}
+
+// Start tracking frame seqnum, before any of its fragments may have arrived
+static void open_frame(rtp_client_t *rtp, uint16_t seqnum, uint8_t epoch, double now) {
+    fragment_buffer_t *buf = frame_slot(rtp, seqnum);
+    buf->seqnum = seqnum;
+    buf->epoch = epoch;
+    buf->total_size = 0;
+    buf->received_size = 0;
+    buf->frags_received = 0;
+    buf->total_frags = 0;
+    buf->highest_frag = -1;
+    memset(buf->frags_bitmap, 0, sizeof(buf->frags_bitmap));
+    buf->in_progress = 1;
+    buf->complete = 0;
+    buf->nacked = 0;
+    memset(buf->nacked_bitmap, 0, sizeof(buf->nacked_bitmap));
+    buf->frags_first_pass = 0;
+    buf->started_at = now;
+    buf->nacked_at = 0;
+}
+
+// Hand the oldest frame in flight on to the cache if it is complete, or
+// count it as dropped, and move the window past it
+static void advance_window(rtp_client_t *rtp) {
+    fragment_buffer_t *buf = frame_slot(rtp, rtp->next_seqnum);
+    int tracked = buf->in_progress && buf->seqnum == rtp->next_seqnum;
+    if (tracked && buf->complete) {
+        cache_add_frame(rtp, buf->data, buf->received_size, buf->seqnum, buf->epoch, buf->timestamp);
+    }
+
+    // A frame nothing arrived of lost at least one fragment
+    int expected = tracked && buf->total_frags > 0 ? buf->total_frags : 1;
+    int lost = tracked ? expected - buf->frags_first_pass : 1;
+
+    pthread_mutex_lock(&rtp->stats_mutex);
+    rtp->stats.fragments_expected += (uint32_t)expected;
+    rtp->stats.fragments_lost += (uint32_t)lost;
+    if (tracked && buf->complete) {
+        rtp->stats.frames_received++;
+        if (buf->nacked) {
+            rtp->stats.frames_recovered++;
+        }
+    } else {
+        rtp->stats.frames_dropped++;
+    }
+    pthread_mutex_unlock(&rtp->stats_mutex);
+
+    if (tracked) {
+        buf->in_progress = 0;
+    }
+    rtp->next_seqnum++;
+}
+
+// Hand on the frames at the front of the window that are complete, and
+// give up on those past their deadline. Without NACKs a frame is given up
+// as soon as a later one arrives, its fragments won't come anymore
+static void flush_frames(rtp_client_t *rtp, double now) {
+    while (rtp->window_known && (int16_t)(rtp->newest_seqnum - rtp->next_seqnum) >= 0) {
+        fragment_buffer_t *buf = frame_slot(rtp, rtp->next_seqnum);
+        int later_arrived = rtp->next_seqnum != rtp->newest_seqnum;
+        int expired = now - buf->started_at >= RTP_NACK_DEADLINE_MS / 1000.0;
+        if (!buf->complete && !expired && (rtp->nack || !later_arrived)) {
+            break;
+        }
+        advance_window(rtp);
+    }
+}
+
+// NACK the fragments still missing from frames in flight. Fragments below
+// the highest one received are lost, and all missing ones once a later
+// frame arrived (only the first of a frame nothing arrived of, its count
+// is unknown). Each frame is asked for again every RTP_NACK_RETRY_MS until
+// its deadline
+static void request_lost_fragments(rtp_client_t *rtp, double now) {
+    if (!rtp->nack || !rtp->sender_known || !rtp->window_known ||
+        now - rtp->nack_scan_at < RTP_NACK_SCAN_MS / 1000.0) {
+        return;
+    }
+    rtp->nack_scan_at = now;
+
+    rtcp_nack_entry_t entries[RTCP_NACK_MAX_ENTRIES];
+    int count = 0;
+    for (uint16_t seqnum = rtp->next_seqnum;
+         (int16_t)(rtp->newest_seqnum - seqnum) >= 0 && count < RTCP_NACK_MAX_ENTRIES; seqnum++) {
+        fragment_buffer_t *buf = frame_slot(rtp, seqnum);
+        if (buf->complete || now - buf->nacked_at < RTP_NACK_RETRY_MS / 1000.0 ||
+            now - buf->started_at >= RTP_NACK_DEADLINE_MS / 1000.0) {
+            continue;
+        }
+        int limit = buf->highest_frag;
+        if (seqnum != rtp->newest_seqnum) {
+            limit = buf->total_frags > 0 ? buf->total_frags : 1;
+        }
+
+        int first_entry = count;
+        for (int i = 0; i < limit && count < RTCP_NACK_MAX_ENTRIES; i++) {
+            if (has_fragment(buf, i)) {
+                continue;
+            }
+            // One entry covers the fragment and the 8 after it
+            rtcp_nack_entry_t *entry = &entries[count++];
+            entry->seqnum = seqnum;
+            entry->frag_index = (uint8_t)i;
+            entry->following = 0;
+            buf->nacked_bitmap[i / 32] |= 1u << (i % 32);
+            for (int j = 1; j <= 8 && i + j < limit; j++) {
+                if (!has_fragment(buf, i + j)) {
+                    entry->following |= (uint8_t)(1u << (j - 1));
+                    buf->nacked_bitmap[(i + j) / 32] |= 1u << ((i + j) % 32);
+                }
+            }
+            i += 8;
+        }
+        if (count > first_entry) {
+            buf->nacked = 1;
+            buf->nacked_at = now;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+
+    uint8_t packet[RTCP_NACK_HEADER_SIZE + RTCP_NACK_MAX_ENTRIES * RTCP_NACK_ENTRY_SIZE];
+    size_t size = rtcp_nack_encode(packet, 0, 0, entries, count);
+    if (sendto(rtp->rtp_socket_fd, packet, size, 0, (struct sockaddr *)&rtp->sender, sizeof(rtp->sender)) < 0) {
+        logger_log("error sending nack: %s", strerror(errno));
+        return;
+    }
+    pthread_mutex_lock(&rtp->stats_mutex);
+    rtp->stats.nacks_sent++;
+    pthread_mutex_unlock(&rtp->stats_mutex);
+}
+
+// Count fragment index, of size bytes, as received
+static void mark_fragment(fragment_buffer_t *buf, int index, size_t size) {
+    buf->received_size += size;
+    buf->frags_received++;
+    buf->frags_bitmap[index / 32] |= 1u << (index % 32);
+    if (index > buf->highest_frag) {
+        buf->highest_frag = index;
+    }
+    buf->complete = buf->frags_received == buf->total_frags;
+}
+
+// Copy fragment index into its frame, unless it is a duplicate
+static void add_fragment(rtp_client_t *rtp, fragment_buffer_t *buf, int index, const uint8_t *data, size_t size) {
+    size_t offset = (size_t)index * RTP_MTU_PAYLOAD;
+    if (buf->complete || index >= buf->total_frags || has_fragment(buf, index) ||
+        offset + size > rtp->frame_capacity) {
+        return;
+    }
+    memcpy(buf->data + offset, data, size);
+    mark_fragment(buf, index, size);
+    if ((buf->nacked_bitmap[index / 32] & (1u << (index % 32))) == 0) {
+        buf->frags_first_pass++;
+    }
+}
+
+// Rebuild the fragment missing from a parity group, see rtp_fec.h. Parity
+// follows its group, so by then a group missing one fragment lost it
+static void repair_fragment(rtp_client_t *rtp,
+                            fragment_buffer_t *buf,
+                            const rtp_frag_header_t *header,
+                            const uint8_t *parity,
+                            size_t parity_size) {
+    int first = header->frag_index;
+    int end = first + rtp_fec_group_size(header);
+    if (buf->complete || end > buf->total_frags) {
+        return;
+    }
+    int missing = -1;
+    for (int i = first; i < end; i++) {
+        if (!has_fragment(buf, i)) {
+            if (missing >= 0) {
+                return; // two lost, only a retransmission helps
+            }
+            missing = i;
+        }
+    }
+    if (missing < 0) {
+        return;
+    }
+
+    // Every fragment but the last is full, the last holds the remainder
+    size_t offset = (size_t)missing * RTP_MTU_PAYLOAD;
+    size_t size = missing == buf->total_frags - 1 ? buf->total_size - offset : RTP_MTU_PAYLOAD;
+    if (buf->total_size <= offset || size > parity_size || offset + size > rtp->frame_capacity) {
+        return;
+    }
+    uint8_t *rebuilt = buf->data + offset;
+    memcpy(rebuilt, parity, size);
+    for (int i = first; i < end; i++) {
+        if (i != missing) {
+            size_t other = i == buf->total_frags - 1 ? buf->total_size - (size_t)i * RTP_MTU_PAYLOAD : RTP_MTU_PAYLOAD;
+            rtp_fec_xor(rebuilt, buf->data + (size_t)i * RTP_MTU_PAYLOAD, other < size ? other : size);
+        }
+    }
+
+    mark_fragment(buf, missing, size);
+
+    pthread_mutex_lock(&rtp->stats_mutex);
+    rtp->stats.fragments_repaired++;
+    pthread_mutex_unlock(&rtp->stats_mutex);
+}
+
+// Process a fragment and reassemble frames. Any fragment carries the
+// frame's size and fragment count, so a frame can start from any of them
+static void process_fragment(rtp_client_t *rtp,
+                             const uint8_t *payload,
+                             size_t payload_size,
+                             uint16_t seqnum,
+                             uint32_t timestamp) {
     if (payload_size < RTP_FRAG_HEADER_SIZE) {
         return;
     }
@@ -75,63 +369,127 @@ static void process_fragment(rtp_client_t *rtp, const uint8_t *payload, size_t p
 
     const uint8_t *frag_data = payload + RTP_FRAG_HEADER_SIZE;
     size_t frag_size = payload_size - RTP_FRAG_HEADER_SIZE;
+    double now = monotonic_seconds();
+
+    // Packets sent before the latest seek are stale
+    if (!accept_epoch(rtp, frag_header.epoch)) {
+        return;
+    }
+    if (rtp->window_known && rtp->window_epoch != frag_header.epoch) {
+        reset_reassembly(rtp); // frames from before the seek, not a loss
+    }
+    if (rtp->window_known && (int16_t)(seqnum - rtp->next_seqnum) < -RTP_RESTART_FRAMES) {
+        reset_reassembly(rtp);
+    }
+    if (!rtp->window_known) {
+        rtp->window_known = 1;
+        rtp->window_epoch = frag_header.epoch;
+        rtp->next_seqnum = seqnum;
+        rtp->newest_seqnum = seqnum;
+        open_frame(rtp, seqnum, frag_header.epoch, now);
+    }
 
-    fragment_buffer_t *buf = &rtp->frag_buf;
+    // Already handed on or given up, e.g. a retransmission that came late
+    if ((int16_t)(seqnum - rtp->next_seqnum) < 0) {
+        return;
+    }
+
+    if ((int16_t)(seqnum - rtp->newest_seqnum) > 0) {
+        // The window spans at most RTP_REASSEMBLY_SLOTS frames, a longer gap
+        // ends the frames in flight
+        if ((uint16_t)(seqnum - rtp->next_seqnum) >= RTP_REASSEMBLY_SLOTS) {
+            while ((int16_t)(rtp->newest_seqnum - rtp->next_seqnum) >= 0) {
+                advance_window(rtp);
+            }
+            rtp->next_seqnum = seqnum;
+            rtp->newest_seqnum = seqnum - 1;
+        }
 
-    if (rtp_frag_is_first(&frag_header)) {
-        // Start of new frame - abandon any incomplete previous frame
-        if (buf->in_progress && buf->seqnum != seqnum) {
-            // Previous frame was incomplete, drop it
-            pthread_mutex_lock(&rtp->stats_mutex);
-            rtp->stats.frames_dropped++;
-            pthread_mutex_unlock(&rtp->stats_mutex);
+        // Frames in between lost every packet so far, tracking them lets
+        // their first fragment be NACKed
+        for (uint16_t s = rtp->newest_seqnum + 1; s != (uint16_t)(seqnum + 1); s++) {
+            open_frame(rtp, s, frag_header.epoch, now);
         }
-        buf->seqnum = seqnum;
+        rtp->newest_seqnum = seqnum;
+    }
+
+    fragment_buffer_t *buf = frame_slot(rtp, seqnum);
+    if (buf->total_frags == 0) {
+        buf->total_frags = frag_header.total_frags;
         buf->total_size = frag_header.total_size;
-        buf->received_size = 0;
-        buf->frags_received = 0;
-        buf->frags_bitmap = 0;  // Reset bitmap
-        buf->total_frags = frag_header.total_frags;  // Use value from header
-        buf->in_progress = 1;
+        buf->timestamp = timestamp;
     }
 
-    // All fragments of same frame share the same seqnum
-    if (!buf->in_progress || buf->seqnum != seqnum) {
-        // No frame in progress or fragment from different frame, skip
-        return;
+    if (rtp_frag_is_parity(&frag_header)) {
+        repair_fragment(rtp, buf, &frag_header, frag_data, frag_size);
+    } else {
+        add_fragment(rtp, buf, frag_header.frag_index, frag_data, frag_size);
     }
 
-    // Check if we already received this fragment (duplicate)
-    if (frag_header.frag_index < 32 && (buf->frags_bitmap & (1u << frag_header.frag_index))) {
-        return;  // Already have this fragment
+    request_lost_fragments(rtp, now);
+    flush_frames(rtp, now);
+}
+
+// RFC 3550 interarrival jitter, over the first packet of each frame, the
+// others share its timestamp. A jump of over a second is a seek or a
+// pause, not jitter. Called with stats_mutex held
+static void update_jitter(rtp_client_t *rtp, uint32_t timestamp, int first) {
+    double transit = monotonic_seconds() * RTP_CLOCK_RATE - timestamp;
+    double d = transit - rtp->transit;
+    rtp->transit = transit;
+    if (d < 0) {
+        d = -d;
     }
+    if (first || d > RTP_CLOCK_RATE) {
+        return;
+    }
+    rtp->jitter += (d - rtp->jitter) / 16;
+    rtp->stats.jitter = (uint32_t)rtp->jitter;
+}
 
-    // Copy fragment data
-    size_t offset = frag_header.frag_index * RTP_MTU_PAYLOAD;
-    if (offset + frag_size <= FRAME_BUFFER_SIZE) {
-        memcpy(buf->data + offset, frag_data, frag_size);
-        buf->received_size += frag_size;
-        buf->frags_received++;
-        if (frag_header.frag_index < 32) {
-            buf->frags_bitmap |= (1u << frag_header.frag_index);
-        }
+// Answer a sender report with a receiver report on the link since the
+// previous one, so the server learns the loss, jitter and round trip time
+static void answer_sender_report(rtp_client_t *rtp, const uint8_t *packet, size_t size,
+                                 const struct sockaddr_in *from) {
+    rtcp_sr_t sr;
+    if (rtcp_sr_decode(packet, size, &sr) != 0) {
+        return;
     }
 
-    // Check if frame is complete
-    if (buf->frags_received == buf->total_frags) {
-        // Frame complete, add to cache
-        cache_add_frame(rtp, buf->data, buf->received_size, seqnum);
-        buf->in_progress = 0;
+    rtcp_report_block_t block;
+    pthread_mutex_lock(&rtp->stats_mutex);
+    uint64_t expected = rtp->stats.fragments_expected - rtp->reported_expected;
+    uint64_t lost = rtp->stats.fragments_lost - rtp->reported_lost;
+    rtp->reported_expected = rtp->stats.fragments_expected;
+    rtp->reported_lost = rtp->stats.fragments_lost;
+    block.ssrc = sr.ssrc;
+    block.fraction_lost = expected > 0 ? (uint8_t)(lost * 256 / expected > 255 ? 255 : lost * 256 / expected) : 0;
+    block.cumulative_lost = rtp->stats.fragments_lost;
+    block.highest_seqnum = (rtp->seq_cycles << 16) | rtp->stats.last_seqnum;
+    block.jitter = rtp->stats.jitter;
+    pthread_mutex_unlock(&rtp->stats_mutex);
+    block.lsr = rtcp_ntp_middle(sr.ntp_seconds, sr.ntp_fraction);
+    block.dlsr = 0; // answered right away
 
-        pthread_mutex_lock(&rtp->stats_mutex);
-        rtp->stats.frames_received++;
-        pthread_mutex_unlock(&rtp->stats_mutex);
+    uint8_t report[RTCP_RR_SIZE];
+    size_t report_size = rtcp_rr_encode(report, 0, &block);
+    if (sendto(rtp->rtp_socket_fd, report, report_size, 0, (const struct sockaddr *)from, sizeof(*from)) < 0) {
+        logger_log("error sending receiver report: %s", strerror(errno));
+        return;
     }
+    pthread_mutex_lock(&rtp->stats_mutex);
+    rtp->stats.reports_sent++;
+    pthread_mutex_unlock(&rtp->stats_mutex);
 }
 
 // Process a non-fragmented frame (legacy/small frames)
-static void process_single_frame(rtp_client_t *rtp, const uint8_t *payload, size_t payload_size, uint16_t seqnum) {
-    cache_add_frame(rtp, payload, payload_size, seqnum);
+static void process_single_frame(rtp_client_t *rtp,
+                                 const uint8_t *payload,
+                                 size_t payload_size,
+                                 uint16_t seqnum,
+                                 uint32_t timestamp) {
+    // Legacy packets carry no epoch, treat them as part of the current one
+    cache_add_frame(rtp, payload, payload_size, seqnum, rtp->epoch, timestamp);
 
     pthread_mutex_lock(&rtp->stats_mutex);
     rtp->stats.frames_received++;
@@ -141,12 +499,15 @@ static void process_single_frame(rtp_client_t *rtp, const uint8_t *payload, size
 static void *rtp_listen_thread(void *arg) {
     rtp_client_t *rtp = (rtp_client_t *)arg;
     uint8_t recv_buffer[RTP_RECV_BUFFER_SIZE];
+    struct sockaddr_in from;
+    socklen_t from_len;
 
     logger_log("rtp listen thread started (with caching)");
 
     while (rtp->stop_thread == 0) {
+        from_len = sizeof(from);
         ssize_t bytes_read = recvfrom(
-            rtp->rtp_socket_fd, recv_buffer, RTP_RECV_BUFFER_SIZE, 0, NULL, NULL
+            rtp->rtp_socket_fd, recv_buffer, RTP_RECV_BUFFER_SIZE, 0, (struct sockaddr *)&from, &from_len
         );
         if (bytes_read <= 0) {
             if (rtp->stop_thread != 0) {
@@ -155,8 +516,20 @@ static void *rtp_listen_thread(void *arg) {
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
                 logger_log("rtp recv error: %s", strerror(errno));
             }
+
+            // Lost fragments are asked for again and frames past their
+            // deadline given up even while nothing arrives
+            double now = monotonic_seconds();
+            request_lost_fragments(rtp, now);
+            flush_frames(rtp, now);
             continue;
         }
+        if (rtcp_is_rtcp(recv_buffer, (size_t)bytes_read)) {
+            answer_sender_report(rtp, recv_buffer, (size_t)bytes_read, &from);
+            continue;
+        }
+        rtp->sender = from;
+        rtp->sender_known = 1;
 
         // Received a packet, now decode it
         rtp_header_t header;
@@ -174,14 +547,22 @@ static void *rtp_listen_thread(void *arg) {
         if (!rtp->stats.first_packet) {
             rtp->stats.first_packet = 1;
             rtp->stats.last_seqnum = header.seqnum;
+            update_jitter(rtp, header.timestamp, 1);
         } else {
-            // Check for packet loss (sequence number gap)
+            // Check for packet loss (sequence number gap). Retransmissions
+            // carry the older number of their frame
             uint16_t expected = rtp->stats.last_seqnum + 1;
             if (header.seqnum != expected && header.seqnum > expected) {
                 uint16_t lost = header.seqnum - expected;
                 rtp->stats.packets_lost += lost;
             }
-            rtp->stats.last_seqnum = header.seqnum;
+            if ((int16_t)(header.seqnum - rtp->stats.last_seqnum) > 0) {
+                if (header.seqnum < rtp->stats.last_seqnum) {
+                    rtp->seq_cycles++;
+                }
+                rtp->stats.last_seqnum = header.seqnum;
+                update_jitter(rtp, header.timestamp, 0);
+            }
         }
         pthread_mutex_unlock(&rtp->stats_mutex);
 
@@ -190,10 +571,10 @@ static void *rtp_listen_thread(void *arg) {
         // Fragmented packets have fragment header first
         if (payload_size >= 2 && payload[0] == 0xFF && payload[1] == 0xD8) {
             // Raw JPEG frame (non-fragmented)
-            process_single_frame(rtp, payload, payload_size, header.seqnum);
+            process_single_frame(rtp, payload, payload_size, header.seqnum, header.timestamp);
         } else if (payload_size >= RTP_FRAG_HEADER_SIZE) {
             // Fragmented packet
-            process_fragment(rtp, payload, payload_size, header.seqnum);
+            process_fragment(rtp, payload, payload_size, header.seqnum, header.timestamp);
         }
     }
 
@@ -201,15 +582,27 @@ static void *rtp_listen_thread(void *arg) {
     return NULL;
 }
 
-int rtp_client_open_port(rtp_client_t *rtp, int port) {
+int rtp_client_open_port(rtp_client_t *rtp, int port, size_t max_frame_size, const char *group) {
+    // Size every frame buffer for the largest frame in the video when the
+    // server described it, otherwise for the worst case
+    rtp->frame_capacity = max_frame_size > 0 ? max_frame_size : FRAME_BUFFER_SIZE;
+
     // Initialize cache
     memset(&rtp->cache, 0, sizeof(frame_cache_t));
     pthread_mutex_init(&rtp->cache.mutex, NULL);
+    rtp->epoch = 0;
+    rtp->epoch_known = 0;
     rtp->cache.buffering = 1;  // Start in buffering mode
+    rtp->on_frame = NULL;
+    rtp->on_frame_arg = NULL;
+    rtp->window_known = 0;
+    rtp->nack = group == NULL;
+    rtp->sender_known = 0;
+    rtp->nack_scan_at = 0;
 
     // Allocate heap memory for each cached frame
     for (int i = 0; i < CACHE_SIZE; i++) {
-        rtp->cache.frames[i].data = (uint8_t *)malloc(FRAME_BUFFER_SIZE);
+        rtp->cache.frames[i].data = (uint8_t *)malloc(rtp->frame_capacity);
         if (rtp->cache.frames[i].data == NULL) {
             logger_log("error allocating cache frame %d", i);
             // Free already allocated frames
@@ -221,15 +614,20 @@ int rtp_client_open_port(rtp_client_t *rtp, int port) {
         rtp->cache.frames[i].valid = 0;
     }
 
-    // Initialize fragment buffer with heap allocation
-    memset(&rtp->frag_buf, 0, sizeof(fragment_buffer_t));
-    rtp->frag_buf.data = (uint8_t *)malloc(FRAME_BUFFER_SIZE);
-    if (rtp->frag_buf.data == NULL) {
-        logger_log("error allocating fragment buffer");
-        for (int i = 0; i < CACHE_SIZE; i++) {
-            free(rtp->cache.frames[i].data);
+    // Initialize fragment buffers with heap allocation
+    memset(rtp->frag_bufs, 0, sizeof(rtp->frag_bufs));
+    for (int i = 0; i < RTP_REASSEMBLY_SLOTS; i++) {
+        rtp->frag_bufs[i].data = (uint8_t *)malloc(rtp->frame_capacity);
+        if (rtp->frag_bufs[i].data == NULL) {
+            logger_log("error allocating fragment buffer");
+            for (int j = 0; j < i; j++) {
+                free(rtp->frag_bufs[j].data);
+            }
+            for (int j = 0; j < CACHE_SIZE; j++) {
+                free(rtp->cache.frames[j].data);
+            }
+            return -1;
         }
-        return -1;
     }
 
     // Initialize statistics
@@ -252,18 +650,31 @@ int rtp_client_open_port(rtp_client_t *rtp, int port) {
         logger_log("warning: could not set socket receive buffer size: %s", strerror(errno));
     }
 
-    // Set a short timeout on socket
+    // Set a short timeout on socket, lost fragments are NACKed again and
+    // frames given up on the way out of the wait
     struct timeval tv;
-    tv.tv_sec = 1; // 1 sec timeout
-    tv.tv_usec = 0;
+    tv.tv_sec = 0;
+    tv.tv_usec = RTP_NACK_SCAN_MS * 2 * 1000;
     setsockopt(rtp->rtp_socket_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-    // Bind the socket to the port
+    // Bind the socket to the port. A multicast socket binds to the group, so
+    // it doesn't also get other groups sent to the same port
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(port);
+    if (group != NULL && inet_pton(AF_INET, group, &addr.sin_addr) != 1) {
+        logger_log("invalid multicast group %s", group);
+        close(rtp->rtp_socket_fd);
+        return -1;
+    }
+
+    // Several viewers on one host may join the same group and port
+    int reuse = 1;
+    if (group != NULL) {
+        setsockopt(rtp->rtp_socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
 
     if (bind(rtp->rtp_socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         logger_log("error binding rtp socket: %s", strerror(errno));
@@ -271,20 +682,39 @@ int rtp_client_open_port(rtp_client_t *rtp, int port) {
         return -1;
     }
 
+    // Membership ends when the socket is closed
+    if (group != NULL) {
+        struct ip_mreq membership;
+        membership.imr_multiaddr = addr.sin_addr;
+        membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(rtp->rtp_socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+            logger_log("error joining multicast group %s: %s", group, strerror(errno));
+            close(rtp->rtp_socket_fd);
+            return -1;
+        }
+        logger_log("joined multicast group %s:%d", group, port);
+    }
+
     logger_log("rtp port opened and bound to %d (with %d-frame cache, heap allocated)", port, CACHE_SIZE);
     return 0;
 }
 
+void rtp_client_set_frame_callback(rtp_client_t *rtp, rtp_frame_cb_t callback, void *arg) {
+    rtp->on_frame = callback;
+    rtp->on_frame_arg = arg;
+}
+
 int rtp_client_start_listener(rtp_client_t *rtp) {
     rtp->stop_thread = 0;
     if (pthread_create(&rtp->listen_thread_id, NULL, rtp_listen_thread, (void *)rtp) != 0) {
         logger_log("error creating rtp listen thread");
+        rtp->stop_thread = 1; // nothing to join
         return -1;
     }
     return 0;
 }
 
-size_t rtp_client_get_frame(rtp_client_t *rtp, uint8_t *out_buffer) {
+size_t rtp_client_get_frame(rtp_client_t *rtp, uint8_t *out_buffer, uint8_t *out_epoch, uint32_t *out_timestamp) {
     size_t frame_size = 0;
 
     pthread_mutex_lock(&rtp->cache.mutex);
@@ -302,6 +732,12 @@ size_t rtp_client_get_frame(rtp_client_t *rtp, uint8_t *out_buffer) {
         if (frame->valid) {
             memcpy(out_buffer, frame->data, frame->size);
             frame_size = frame->size;
+            if (out_epoch != NULL) {
+                *out_epoch = frame->epoch;
+            }
+            if (out_timestamp != NULL) {
+                *out_timestamp = frame->timestamp;
+            }
             frame->valid = 0;
 
             rtp->cache.read_idx = (rtp->cache.read_idx + 1) % CACHE_SIZE;
@@ -316,6 +752,15 @@ size_t rtp_client_get_frame(rtp_client_t *rtp, uint8_t *out_buffer) {
     return frame_size;
 }
 
+void rtp_client_set_epoch(rtp_client_t *rtp, uint8_t epoch) {
+    pthread_mutex_lock(&rtp->cache.mutex);
+    if (!rtp->epoch_known || (int8_t)(uint8_t)(epoch - rtp->epoch) > 0) {
+        rtp->epoch_known = 1;
+        switch_epoch_locked(rtp, epoch);
+    }
+    pthread_mutex_unlock(&rtp->cache.mutex);
+}
+
 void rtp_client_get_stats(rtp_client_t *rtp, rtp_stats_t *out_stats) {
     pthread_mutex_lock(&rtp->stats_mutex);
     memcpy(out_stats, &rtp->stats, sizeof(rtp_stats_t));
@@ -344,11 +789,8 @@ void rtp_client_clear_cache(rtp_client_t *rtp) {
     rtp->cache.buffering = 1;  // Start buffering again after seek
     pthread_mutex_unlock(&rtp->cache.mutex);
     
-    // Also reset fragment reassembly buffer to discard any pending fragments
-    rtp->frag_buf.in_progress = 0;
-    rtp->frag_buf.received_size = 0;
-    rtp->frag_buf.frags_received = 0;
-    rtp->frag_buf.frags_bitmap = 0;
+    // Also reset fragment reassembly to discard any pending fragments
+    reset_reassembly(rtp);
     
     // Reset RTP seqnum tracking to allow jump from seek
     pthread_mutex_lock(&rtp->stats_mutex);
@@ -357,6 +799,7 @@ void rtp_client_clear_cache(rtp_client_t *rtp) {
     rtp->stats.frames_received = 0;  // Reset frame counter after seek
     rtp->stats.packets_received = 0;  // Reset packet counter after seek
     rtp->stats.packets_lost = 0;  // Reset packet loss counter after seek
+    rtp->seq_cycles = 0;
     pthread_mutex_unlock(&rtp->stats_mutex);
     
     logger_log("rtp cache cleared for seek (cache, fragments, and seqnum tracking reset)");
@@ -381,10 +824,10 @@ void rtp_client_stop_listener(rtp_client_t *rtp) {
         }
     }
     
-    // Free fragment buffer
-    if (rtp->frag_buf.data != NULL) {
-        free(rtp->frag_buf.data);
-        rtp->frag_buf.data = NULL;
+    // Free fragment buffers
+    for (int i = 0; i < RTP_REASSEMBLY_SLOTS; i++) {
+        free(rtp->frag_bufs[i].data);
+        rtp->frag_bufs[i].data = NULL;
     }
     
     pthread_mutex_destroy(&rtp->cache.mutex);
@@ -1,6 +1,7 @@
 #ifndef RTP_CLIENT_H
 #define RTP_CLIENT_H
 
+#include <netinet/in.h>
 #include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -8,12 +9,41 @@
 #define FRAME_BUFFER_SIZE 524288  // 512KB for FHD frames
 #define CACHE_SIZE 20             // Pre-buffer frames
 
+// The server's RTP timestamp clock
+#define RTP_CLOCK_RATE 90000
+
+// Fragments a frame can have at most, the fragment index is one byte
+#define RTP_MAX_FRAGS 256
+
+// Lost fragments are NACKed again every RTP_NACK_RETRY_MS, and their frame
+// is given up RTP_NACK_DEADLINE_MS after its first packet, well before the
+// jitter buffer runs dry
+#define RTP_NACK_RETRY_MS 60
+#define RTP_NACK_DEADLINE_MS 300
+
+// Highest frame rate the reassembly window is sized for
+#define RTP_MAX_FPS 100
+
+// Frames being reassembled at once: a frame missing fragments waits for
+// them to be sent again while later frames arrive, frames still reach the
+// cache in order. Holds the frames of RTP_NACK_DEADLINE_MS at RTP_MAX_FPS,
+// so no frame is given up early for lack of a slot, rounded up to a power
+// of two so slots stay distinct where sequence numbers wrap
+#define RTP_REASSEMBLY_SLOTS 32
+
 // Statistics for packet tracking
 typedef struct {
     uint32_t packets_received;
     uint32_t packets_lost;
     uint32_t frames_received;
     uint32_t frames_dropped;
+    uint32_t nacks_sent;
+    uint32_t frames_recovered; // completed by retransmitted fragments
+    uint32_t fragments_repaired; // rebuilt from parity packets
+    uint32_t fragments_expected; // of the frames handed on or given up
+    uint32_t fragments_lost;     // of those, lost on the way however repaired
+    uint32_t jitter;             // RFC 3550 interarrival jitter, 90 kHz units
+    uint32_t reports_sent;       // RTCP receiver reports
     uint16_t last_seqnum;
     int first_packet;  // Flag for first packet
 } rtp_stats_t;
@@ -23,6 +53,8 @@ typedef struct {
     uint8_t *data;      // Heap-allocated frame data
     size_t size;
     uint16_t seqnum;    // RTP sequence number (for ordering)
+    uint8_t epoch;      // Stream epoch the frame was sent in
+    uint32_t timestamp; // RTP timestamp, 90 kHz
     int valid;          // 1 if frame is ready to display
 } cached_frame_t;
 
@@ -32,10 +64,19 @@ typedef struct {
     size_t received_size;
     size_t total_size;
     uint16_t seqnum;
-    uint8_t frags_received;
-    uint8_t total_frags;
-    uint32_t frags_bitmap;  // Bitmap to track which fragments received (up to 32)
+    uint8_t epoch;
+    uint32_t timestamp;
+    int frags_received;
+    int total_frags;    // 0 while no fragment of the frame arrived yet
+    int highest_frag;   // highest fragment index received, -1 if none
+    uint32_t frags_bitmap[RTP_MAX_FRAGS / 32]; // which fragments arrived
     int in_progress;    // 1 if currently receiving fragments
+    int complete;       // waiting for older frames to be handed on
+    int nacked;         // some fragments were asked for again
+    uint32_t nacked_bitmap[RTP_MAX_FRAGS / 32]; // which ones
+    int frags_first_pass; // received without being asked for again
+    double started_at;  // when the frame was first known of
+    double nacked_at;
 } fragment_buffer_t;
 
 // Circular frame cache for jitter buffering
@@ -48,28 +89,77 @@ typedef struct {
     pthread_mutex_t mutex;
 } frame_cache_t;
 
+// Receives each reassembled frame on the listen thread, the data is only
+// valid during the call
+typedef void (*rtp_frame_cb_t)(const uint8_t *data, size_t size, uint8_t epoch, void *arg);
+
 typedef struct {
     int rtp_socket_fd;
     pthread_t listen_thread_id;
     int stop_thread;
 
-    // Fragment reassembly
-    fragment_buffer_t frag_buf;
+    // Fragment reassembly, frame s in frag_bufs[s % RTP_REASSEMBLY_SLOTS].
+    // Frames next_seqnum to newest_seqnum are in flight, older ones were
+    // handed on or given up. Only the listen thread uses them
+    fragment_buffer_t frag_bufs[RTP_REASSEMBLY_SLOTS];
+    uint16_t next_seqnum;
+    uint16_t newest_seqnum;
+    uint8_t window_epoch;
+    int window_known;
+
+    // Lost fragments are NACKed to where the stream comes from (RTCP on the
+    // RTP ports), for unicast only
+    int nack;
+    struct sockaddr_in sender;
+    int sender_known;
+    double nack_scan_at;
+
+    // Each RTCP sender report is answered with a receiver report on the
+    // link since the previous one (protected by stats_mutex)
+    uint32_t seq_cycles;       // wraps of stats.last_seqnum
+    double jitter;
+    double transit;            // of the latest frame's first packet
+    uint32_t reported_expected;
+    uint32_t reported_lost;
 
     // Frame cache for jitter buffering
     frame_cache_t cache;
+    size_t frame_capacity; // bytes allocated per frame buffer
+
+    // Set to hand frames over as they complete instead of caching them
+    rtp_frame_cb_t on_frame;
+    void *on_frame_arg;
+
+    // Newest stream epoch seen (protected by cache.mutex). The server bumps
+    // it on every seek, packets from older epochs are discarded
+    uint8_t epoch;
+    int epoch_known;
 
     // Statistics
     rtp_stats_t stats;
     pthread_mutex_t stats_mutex;
 } rtp_client_t;
 
-int rtp_client_open_port(rtp_client_t *rtp, int port);
+// max_frame_size sizes the frame buffers, 0 uses FRAME_BUFFER_SIZE.
+// With a multicast group the socket binds to it and joins it, NULL for
+// unicast, which also NACKs lost fragments
+int rtp_client_open_port(rtp_client_t *rtp, int port, size_t max_frame_size, const char *group);
+
+// Hand every frame to callback instead of the cache, for receivers that
+// forward frames rather than play them out. Call before starting the listener
+void rtp_client_set_frame_callback(rtp_client_t *rtp, rtp_frame_cb_t callback, void *arg);
 
 int rtp_client_start_listener(rtp_client_t *rtp);
 
 // Get a frame from the cache (returns 0 if no frame available yet)
-size_t rtp_client_get_frame(rtp_client_t *rtp, uint8_t *out_buffer);
+// If out_epoch is not NULL it receives the stream epoch of the frame, and
+// out_timestamp its RTP timestamp, which shows frames the server skipped
+size_t rtp_client_get_frame(rtp_client_t *rtp, uint8_t *out_buffer, uint8_t *out_epoch, uint32_t *out_timestamp);
+
+// Switch to a newer stream epoch announced by the server after a seek
+// Frames from older epochs are flushed and the first frame of the new epoch
+// is shown as soon as it arrives, without re-buffering
+void rtp_client_set_epoch(rtp_client_t *rtp, uint8_t epoch);
 
 // Get current statistics (thread-safe copy)
 void rtp_client_get_stats(rtp_client_t *rtp, rtp_stats_t *out_stats);
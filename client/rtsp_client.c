@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "rtsp_client.h"
 
 #include <arpa/inet.h>
@@ -7,79 +9,234 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../common/logger.h"
 
-#define RECV_BUFFER_SIZE 1024
+#define RECV_BUFFER_SIZE 4096
 #define SEND_BUFFER_SIZE 1024
 
-static rtsp_status_t process_rtsp_reply(rtsp_client_t *client, const char *reply_str) {
-    logger_log("recevied reply:\n%s", reply_str);
+static const char *method_name(rtsp_method_t method) {
+    switch (method) {
+    case METHOD_SETUP:
+        return "SETUP";
+    case METHOD_PLAY:
+        return "PLAY";
+    case METHOD_PAUSE:
+        return "PAUSE";
+    case METHOD_TEARDOWN:
+        return "TEARDOWN";
+    case METHOD_DESCRIBE:
+        return "DESCRIBE";
+    case METHOD_GET_PARAMETER:
+        return "GET_PARAMETER";
+    default:
+        return "UNKNOWN";
+    }
+}
 
-    char *buffer = strdup(reply_str);
-    if (buffer == NULL) {
-        return STATUS_SRV_ERR_500;
+// Remove the outstanding request with this CSeq, returning 0 if found
+static int take_pending(rtsp_client_t *client, int cseq, rtsp_pending_t *out) {
+    for (int i = 0; i < RTSP_MAX_PENDING; i++) {
+        if (client->pending[i].cseq == cseq && cseq != 0) {
+            *out = client->pending[i];
+            client->pending[i].cseq = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Pick the media attributes out of an SDP body
+static void parse_sdp(const char *line, rtsp_reply_t *reply) {
+    while (line != NULL && *line != '\0') {
+        double range_start;
+        if (sscanf(line, "a=framerate:%lf", &reply->framerate) == 1) {
+            // Frame rate found
+        } else if (sscanf(line, "a=x-dimensions:%d,%d", &reply->width, &reply->height) == 2) {
+            // Resolution found
+        } else if (sscanf(line, "a=x-frame-count:%d", &reply->frame_count) == 1) {
+            // Frame count found
+        } else if (sscanf(line, "a=x-max-frame-size:%zu", &reply->max_frame_size) == 1) {
+            // Largest frame found
+        } else if (sscanf(line, "a=range:npt=%lf-%lf", &range_start, &reply->duration) == 2) {
+            // Duration found
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            line++;
+        }
     }
+}
+
+// Parse one complete, NUL-terminated reply and complete its request
+static rtsp_status_t process_rtsp_reply(rtsp_client_t *client, const char *reply_str) {
+    logger_log("recevied reply:\n%s", reply_str);
 
-    char *save_ptr;
-    char *line = strtok_r(buffer, "\n", &save_ptr);
+    rtsp_reply_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.method = METHOD_UNKNOWN;
+    reply.epoch = -1;
 
     char version[32];
-    int status_code = 0;
-    if (line != NULL) {
-        sscanf(line, "%31s %d", version, &status_code);
+    if (sscanf(reply_str, "%31s %d", version, &reply.status_code) != 2) {
+        logger_log("malformed reply status line");
+        return STATUS_SRV_ERR_500;
     }
 
-    int cseq = 0;
-    int session_id = 0;
-
-    while ((line = strtok_r(NULL, "\n", &save_ptr)) != NULL) {
-        if (strlen(line) <= 1) {
-            break;
+    // Walk the header lines, the status line has already been parsed
+    const char *line = strchr(reply_str, '\n');
+    while (line != NULL) {
+        line++;
+        if (*line == '\r' || *line == '\n' || *line == '\0') {
+            break; // an empty line signal the end of headers
         }
-        if (sscanf(line, "CSeq: %d", &cseq) == 1) {
+        if (sscanf(line, "CSeq: %d", &reply.cseq) == 1) {
             // CSeq header found
-        } else if (sscanf(line, "Session: %d", &session_id) == 1) {
-            // Session header found
+        } else if (sscanf(line, "Session: %d;timeout=%d", &reply.session_id, &reply.timeout) >= 1) {
+            // Session header found, the timeout is optional
+        } else if (sscanf(line, "X-Epoch: %d", &reply.epoch) == 1) {
+            // Stream epoch header found (seek replies)
+        } else if (sscanf(line, "X-Framerate: %lf", &reply.framerate) == 1) {
+            // Media frame rate found (setup replies)
+        } else if (sscanf(line, "X-Frame-Count: %d", &reply.frame_count) == 1) {
+            // Frame count found (setup replies)
+        } else if (strncmp(line, "Transport:", 10) == 0) {
+            // Multicast group to join (setup replies)
+            const char *end = strchr(line, '\n');
+            const char *destination = strstr(line, "destination=");
+            const char *port = strstr(line, ";port=");
+            if (destination != NULL && (end == NULL || destination < end)) {
+                sscanf(destination, "destination=%15[0-9.]", reply.multicast_group);
+            }
+            if (port != NULL && (end == NULL || port < end)) {
+                sscanf(port, ";port=%d", &reply.multicast_port);
+            }
         }
+        line = strchr(line, '\n');
     }
 
-    free(buffer);
+    // DESCRIBE replies carry an SDP body after the blank line
+    if (line != NULL) {
+        parse_sdp(strchr(line, '\n'), &reply);
+    }
 
-    // Check status code
-    if (status_code == 200) {
-        pthread_mutex_lock(&client->state_mutex);
+    // Match the reply to the request that caused it, replies can't be
+    // assumed to arrive in the order their requests were sent
+    pthread_mutex_lock(&client->state_mutex);
 
-        if (client->state == STATE_INIT) {
-            client->session_id = session_id;
+    rtsp_pending_t pending;
+    if (take_pending(client, reply.cseq, &pending) != 0) {
+        pthread_mutex_unlock(&client->state_mutex);
+        logger_log("ignoring reply with unknown cseq %d", reply.cseq);
+        return STATUS_SRV_ERR_500;
+    }
+    reply.method = pending.method;
+
+    if (reply.status_code == 200) {
+        switch (pending.method) {
+        case METHOD_SETUP:
+            client->session_id = reply.session_id;
+            client->session_timeout = reply.timeout;
+            memcpy(client->multicast_group, reply.multicast_group, sizeof(client->multicast_group));
+            client->multicast_port = reply.multicast_port;
+            if (reply.framerate > 0) {
+                client->framerate = reply.framerate;
+            }
+            client->frame_count = reply.frame_count;
             client->state = STATE_READY;
-            logger_log("state changed to READY from INIT");
-        } else if (client->state == STATE_READY) {
+            logger_log("state changed to READY after SETUP");
+            break;
+        case METHOD_DESCRIBE:
+            if (reply.framerate > 0) {
+                client->framerate = reply.framerate;
+            }
+            client->frame_count = reply.frame_count;
+            client->width = reply.width;
+            client->height = reply.height;
+            client->max_frame_size = reply.max_frame_size;
+            client->duration = reply.duration;
+            logger_log("described %dx%d, %d frames at %.3f fps",
+                       reply.width, reply.height, reply.frame_count, reply.framerate);
+            break;
+        case METHOD_PLAY:
             client->state = STATE_PLAYING;
-            logger_log("state changed to PLAYING from READY");
-        } else if (client->state == STATE_PLAYING) {
+            logger_log("state changed to PLAYING after PLAY");
+            break;
+        case METHOD_PAUSE:
             client->state = STATE_READY;
-            logger_log("state changed to READY from PAUSE");
+            logger_log("state changed to READY after PAUSE");
+            break;
+        case METHOD_TEARDOWN:
+            client->state = STATE_INIT;
+            logger_log("state changed to INIT after TEARDOWN");
+            break;
+        default:
+            break;
         }
-        pthread_mutex_unlock(&client->state_mutex);
-        return STATUS_OK_200;
     } else {
-        logger_log("server returned error %d", status_code);
-        return STATUS_SRV_ERR_500;
+        logger_log("server returned error %d for %s (cseq %d)",
+                   reply.status_code,
+                   method_name(pending.method),
+                   reply.cseq);
+    }
+    pthread_mutex_unlock(&client->state_mutex);
+
+    // Run the callback without the lock so it may send follow-up requests
+    if (pending.callback != NULL) {
+        pending.callback(client, &reply, pending.callback_arg);
+    }
+    return reply.status_code == 200 ? STATUS_OK_200 : STATUS_SRV_ERR_500;
+}
+
+// Length of the first complete reply in buffer (headers + body), or 0 if
+// more bytes are needed
+static size_t find_reply_end(const char *buffer, size_t len) {
+    const char *headers_end = NULL;
+    for (size_t i = 0; i + 3 < len; i++) {
+        if (memcmp(buffer + i, "\r\n\r\n", 4) == 0) {
+            headers_end = buffer + i + 4;
+            break;
+        }
+    }
+    if (headers_end == NULL) {
+        return 0;
+    }
+
+    size_t body_len = 0;
+    for (const char *p = buffer; p < headers_end; p++) {
+        if ((p == buffer || p[-1] == '\n') && strncasecmp(p, "Content-Length:", 15) == 0) {
+            body_len = (size_t)strtoul(p + 15, NULL, 10);
+            break;
+        }
     }
+
+    size_t total = (size_t)(headers_end - buffer) + body_len;
+    return total <= len ? total : 0;
 }
 
 static void *rtsp_reply_thread(void *arg) {
     rtsp_client_t *client = (rtsp_client_t *)arg;
+
+    // One read may hold a partial reply or several pipelined ones
     char recv_buffer[RECV_BUFFER_SIZE];
+    size_t buffered = 0;
 
     logger_log("rtsp reply thread started");
 
     while (client->stop_reply_thread == 0) {
-        ssize_t bytes_read = read(client->rtsp_socket_fd, recv_buffer, RECV_BUFFER_SIZE - 1);
+        if (buffered == RECV_BUFFER_SIZE - 1) {
+            logger_log("reply too large, dropping buffered data");
+            buffered = 0;
+        }
+
+        ssize_t bytes_read = read(client->rtsp_socket_fd,
+                                  recv_buffer + buffered,
+                                  RECV_BUFFER_SIZE - 1 - buffered);
 
         if (bytes_read <= 0) {
             if (client->stop_reply_thread != 0) {
@@ -88,8 +245,19 @@ static void *rtsp_reply_thread(void *arg) {
             logger_log("server disconnected or read error");
             break;
         }
-        recv_buffer[bytes_read] = '\0';
-        process_rtsp_reply(client, recv_buffer);
+        buffered += (size_t)bytes_read;
+
+        size_t reply_len;
+        while ((reply_len = find_reply_end(recv_buffer, buffered)) > 0) {
+            // Terminate the reply in place, restoring the byte afterwards
+            char saved = recv_buffer[reply_len];
+            recv_buffer[reply_len] = '\0';
+            process_rtsp_reply(client, recv_buffer);
+            recv_buffer[reply_len] = saved;
+
+            buffered -= reply_len;
+            memmove(recv_buffer, recv_buffer + reply_len, buffered);
+        }
     }
 
     logger_log("rtsp reply thread stopping");
@@ -106,8 +274,19 @@ int rtsp_client_connect(rtsp_client_t *client,
     client->rtsp_socket_fd = -1;
     client->rtsp_seq = 0;
     client->session_id = 0;
+    client->session_timeout = 0;
+    client->last_request_at = 0;
     client->state = STATE_INIT;
+    client->framerate = RTSP_DEFAULT_FRAMERATE;
+    client->frame_count = 0;
+    client->width = 0;
+    client->height = 0;
+    client->max_frame_size = 0;
+    client->duration = 0;
     client->stop_reply_thread = 1;
+    memset(client->pending, 0, sizeof(client->pending));
+    memset(client->multicast_group, 0, sizeof(client->multicast_group));
+    client->multicast_port = 0;
 
     // Store args for SETUP request
     strncpy(client->video_file, filename, sizeof(client->video_file) - 1);
@@ -153,108 +332,139 @@ int rtsp_client_start_reply_listener(rtsp_client_t *client) {
     return 0;
 }
 
-static int send_rtsp_request(rtsp_client_t *client, const char *request_str) {
-    logger_log("sending request:\n%s", request_str);
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Give the request the next CSeq and register it as outstanding, both under
+// the lock so concurrent senders never share a CSeq, then send it. headers
+// are the lines after CSeq and, with with_session, the Session header
+// Return the CSeq, or -1 on error
+static int send_rtsp_request(rtsp_client_t *client,
+                             rtsp_method_t method,
+                             int with_session,
+                             const char *headers,
+                             rtsp_reply_cb_t callback,
+                             void *arg) {
+    char send_buffer[SEND_BUFFER_SIZE];
 
-    if (send(client->rtsp_socket_fd, request_str, strlen(request_str), 0) < 0) {
+    // Register before sending, the reply may arrive before send() returns
+    pthread_mutex_lock(&client->state_mutex);
+    rtsp_pending_t *slot = NULL;
+    for (int i = 0; i < RTSP_MAX_PENDING; i++) {
+        if (client->pending[i].cseq == 0) {
+            slot = &client->pending[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        pthread_mutex_unlock(&client->state_mutex);
+        logger_log("too many requests in flight, dropping %s", method_name(method));
+        return -1;
+    }
+    int cseq = ++client->rtsp_seq;
+    char session[32] = "";
+    if (with_session) {
+        snprintf(session, sizeof(session), "Session: %d\r\n", client->session_id);
+    }
+    snprintf(send_buffer, sizeof(send_buffer), "%s %s %s\r\nCSeq: %d\r\n%s%s\r\n",
+             method_name(method), client->video_file, RTSP_VERSION, cseq, session, headers);
+    slot->cseq = cseq;
+    slot->method = method;
+    slot->callback = callback;
+    slot->callback_arg = arg;
+    pthread_mutex_unlock(&client->state_mutex);
+
+    logger_log("sending request:\n%s", send_buffer);
+
+    // A server gone away is an error, not SIGPIPE: this also runs inside
+    // the server, relaying from upstream
+    if (send(client->rtsp_socket_fd, send_buffer, strlen(send_buffer), MSG_NOSIGNAL) < 0) {
         logger_log("error sending request: %s", strerror(errno));
+        pthread_mutex_lock(&client->state_mutex);
+        slot->cseq = 0;
+        pthread_mutex_unlock(&client->state_mutex);
         return -1;
     }
-    return 0;
+    client->last_request_at = monotonic_seconds();
+    return cseq;
 }
 
-int rtsp_client_send_setup(rtsp_client_t *client) {
-    char send_buffer[SEND_BUFFER_SIZE];
-    client->rtsp_seq++;
-
-    sprintf(send_buffer,
-            "SETUP %s %s\r\nCSeq: %d\r\nTransport: RTP/UDP;client_port=%d\r\n\r\n",
-            client->video_file,
-            RTSP_VERSION,
-            client->rtsp_seq,
-            client->rtp_port);
-    return send_rtsp_request(client, send_buffer);
+int rtsp_client_send_describe(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg) {
+    return send_rtsp_request(client, METHOD_DESCRIBE, 0, "Accept: application/sdp\r\n", callback, arg);
 }
 
-int rtsp_client_send_play(rtsp_client_t *client) {
-    char send_buffer[SEND_BUFFER_SIZE];
-    client->rtsp_seq++;
-
-    sprintf(send_buffer,
-            "PLAY %s %s\r\nCSeq: %d\r\nSession: %d\r\n\r\n",
-            client->video_file,
-            RTSP_VERSION,
-            client->rtsp_seq,
-            client->session_id);
-
-    return send_rtsp_request(client, send_buffer);
+int rtsp_client_send_setup(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg) {
+    char transport[64];
+    if (client->multicast) {
+        snprintf(transport, sizeof(transport), "Transport: RTP/AVP;multicast\r\n");
+    } else {
+        snprintf(transport, sizeof(transport), "Transport: RTP/UDP;client_port=%d\r\n", client->rtp_port);
+    }
+    return send_rtsp_request(client, METHOD_SETUP, 0, transport, callback, arg);
 }
 
-int rtsp_client_send_pause(rtsp_client_t *client) {
-    char send_buffer[SEND_BUFFER_SIZE];
-    client->rtsp_seq++;
-
-    sprintf(send_buffer,
-            "PAUSE %s %s\r\nCSeq: %d\r\nSession: %d\r\n\r\n",
-            client->video_file,
-            RTSP_VERSION,
-            client->rtsp_seq,
-            client->session_id);
-
-    return send_rtsp_request(client, send_buffer);
+int rtsp_client_send_play(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg) {
+    return send_rtsp_request(client, METHOD_PLAY, 1, "", callback, arg);
 }
 
-int rtsp_client_send_teardown(rtsp_client_t *client) {
-    char send_buffer[SEND_BUFFER_SIZE];
-    client->rtsp_seq++;
-
-    sprintf(send_buffer,
-            "TEARDOWN %s %s\r\nCSeq: %d\r\nSession: %d\r\n\r\n",
-            client->video_file,
-            RTSP_VERSION,
-            client->rtsp_seq,
-            client->session_id);
-
-    return send_rtsp_request(client, send_buffer);
+int rtsp_client_send_pause(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg) {
+    return send_rtsp_request(client, METHOD_PAUSE, 1, "", callback, arg);
 }
 
-int rtsp_client_send_seek(rtsp_client_t *client, double position) {
-    char send_buffer[SEND_BUFFER_SIZE];
-    client->rtsp_seq++;
+int rtsp_client_send_teardown(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg) {
+    return send_rtsp_request(client, METHOD_TEARDOWN, 1, "", callback, arg);
+}
 
+int rtsp_client_send_seek(rtsp_client_t *client, double position, rtsp_reply_cb_t callback, void *arg) {
     // Format position as mm:ss.ff (minutes:seconds.centiseconds)
     int total_seconds = (int)position;
     int centiseconds = (int)((position - total_seconds) * 100);
     int minutes = total_seconds / 60;
     int seconds = total_seconds % 60;
 
-    sprintf(send_buffer,
-            "PLAY %s %s\r\nCSeq: %d\r\nSession: %d\r\nRange: npt=%02d:%02d.%02d-\r\n\r\n",
-            client->video_file,
-            RTSP_VERSION,
-            client->rtsp_seq,
-            client->session_id,
-            minutes,
-            seconds,
-            centiseconds);
-
-    return send_rtsp_request(client, send_buffer);
+    char range[64];
+    snprintf(range, sizeof(range), "Range: npt=%02d:%02d.%02d-\r\n", minutes, seconds, centiseconds);
+    return send_rtsp_request(client, METHOD_PLAY, 1, range, callback, arg);
 }
 
-int rtsp_client_send_seek_frame(rtsp_client_t *client, int frame_number) {
-    char send_buffer[SEND_BUFFER_SIZE];
-    client->rtsp_seq++;
-
+int rtsp_client_send_seek_frame(rtsp_client_t *client,
+                                int frame_number,
+                                rtsp_reply_cb_t callback,
+                                void *arg) {
     // Send PLAY with custom header X-Frame: frame_number
-    sprintf(send_buffer,
-            "PLAY %s %s\r\nCSeq: %d\r\nSession: %d\r\nX-Frame: %d\r\n\r\n",
-            client->video_file,
-            RTSP_VERSION,
-            client->rtsp_seq,
-            client->session_id,
-            frame_number);
-
-    return send_rtsp_request(client, send_buffer);
+    char frame[32];
+    snprintf(frame, sizeof(frame), "X-Frame: %d\r\n", frame_number);
+    return send_rtsp_request(client, METHOD_PLAY, 1, frame, callback, arg);
+}
+
+int rtsp_client_send_get_parameter(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg) {
+    return send_rtsp_request(client, METHOD_GET_PARAMETER, 1, "", callback, arg);
+}
+
+void rtsp_client_keepalive(rtsp_client_t *client) {
+    pthread_mutex_lock(&client->state_mutex);
+    int timeout = client->session_id != 0 ? client->session_timeout : 0;
+    pthread_mutex_unlock(&client->state_mutex);
+
+    // Half the timeout leaves room for a lost or slow keepalive
+    if (timeout > 0 && monotonic_seconds() - client->last_request_at >= timeout / 2.0) {
+        rtsp_client_send_get_parameter(client, NULL, NULL);
+    }
+}
+
+int rtsp_client_pending_count(rtsp_client_t *client) {
+    int count = 0;
+    pthread_mutex_lock(&client->state_mutex);
+    for (int i = 0; i < RTSP_MAX_PENDING; i++) {
+        if (client->pending[i].cseq != 0) {
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&client->state_mutex);
+    return count;
 }
 
 void rtsp_client_disconnect(rtsp_client_t *client) {
@@ -262,9 +472,10 @@ void rtsp_client_disconnect(rtsp_client_t *client) {
 
     if (client->stop_reply_thread == 0) {
         client->stop_reply_thread = 1;
-        // Close the socket, which will unblock the read()  in the reply thread
-        // causing it to exit
+        // Shut the socket down, which unblocks the read() in the reply thread
+        // causing it to exit (close() alone doesn't wake it on Linux)
         if (client->rtsp_socket_fd > 0) {
+            shutdown(client->rtsp_socket_fd, SHUT_RDWR);
             close(client->rtsp_socket_fd);
         }
         pthread_join(client->reply_thread_id, NULL);
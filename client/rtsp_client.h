@@ -4,23 +4,83 @@
 #include "../common/protocol.h"
 
 #include <netinet/in.h>
+#include <stddef.h>
 #include <pthread.h>
 
+// Requests that may be awaiting a reply at the same time
+#define RTSP_MAX_PENDING 16
+
+// Frame rate assumed until the server reports one
+#define RTSP_DEFAULT_FRAMERATE 30.0
+
+typedef struct rtsp_client rtsp_client_t;
+
+// A parsed reply, handed to the completion callback of its request
+typedef struct {
+    rtsp_method_t method; // method of the request this reply answers
+    int status_code;
+    int cseq;
+    int session_id;
+    int timeout;          // session timeout in seconds (Session ;timeout=), 0 if absent
+    int epoch;            // stream epoch after a seek (X-Epoch), -1 if absent
+    double framerate;     // media frame rate (X-Framerate or SDP), 0 if absent
+    int frame_count;      // frames in the video (X-Frame-Count or SDP), 0 if absent
+
+    // Only in DESCRIBE replies, 0 if absent
+    int width;
+    int height;
+    size_t max_frame_size;
+    double duration;      // seconds
+
+    // Only in SETUP replies for multicast, empty and 0 if absent
+    char multicast_group[16];
+    int multicast_port;
+} rtsp_reply_t;
+
+// Called from the reply thread once the matching reply arrives
+typedef void (*rtsp_reply_cb_t)(rtsp_client_t *client, const rtsp_reply_t *reply, void *arg);
+
+// An outstanding request, matched to its reply by CSeq
 typedef struct {
+    int cseq;             // 0 when the slot is free
+    rtsp_method_t method;
+    rtsp_reply_cb_t callback;
+    void *callback_arg;
+} rtsp_pending_t;
+
+struct rtsp_client {
     int rtsp_socket_fd;
     struct sockaddr_in server_addr;
 
     int rtsp_seq;       // CSeq number
     int session_id;     // Session ID from server
+    int session_timeout; // Seconds the server keeps an idle session, 0 if it never expires
+    double last_request_at; // Monotonic time of the last request sent
     client_state_t state;
+    double framerate;   // Media frame rate reported by DESCRIBE or SETUP
+    int frame_count;    // Frames in the video, 0 if unknown
+
+    // Media description from DESCRIBE, 0 until it is answered
+    int width;
+    int height;
+    size_t max_frame_size;
+    double duration;
 
     char video_file[256];
     int rtp_port;
+
+    // Set before connecting to ask for a channel's multicast group instead
+    // of unicast to rtp_port. SETUP fills in the group to join
+    int multicast;
+    char multicast_group[16];
+    int multicast_port;
+
     pthread_t reply_thread_id; // thread to listen for replies
     int stop_reply_thread;
-    pthread_mutex_t state_mutex;     // mutex to protect state
+    pthread_mutex_t state_mutex;     // mutex to protect state and pending
 
-} rtsp_client_t;
+    rtsp_pending_t pending[RTSP_MAX_PENDING];
+};
 
 int rtsp_client_connect(
     rtsp_client_t *client,
@@ -32,12 +92,28 @@ int rtsp_client_connect(
 
 int rtsp_client_start_reply_listener(rtsp_client_t *client);
 
-int rtsp_client_send_setup(rtsp_client_t *client);
-int rtsp_client_send_play(rtsp_client_t *client);
-int rtsp_client_send_pause(rtsp_client_t *client);
-int rtsp_client_send_teardown(rtsp_client_t *client);
-int rtsp_client_send_seek(rtsp_client_t *client, double position);
-int rtsp_client_send_seek_frame(rtsp_client_t *client, int frame_number);
+// Requests are sent without waiting for earlier replies. The optional
+// callback runs on the reply thread when the reply with the same CSeq
+// arrives; the state change it implies has already been applied by then
+// Return the request's CSeq, or -1 on error
+int rtsp_client_send_describe(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg);
+int rtsp_client_send_setup(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg);
+int rtsp_client_send_play(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg);
+int rtsp_client_send_pause(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg);
+int rtsp_client_send_teardown(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg);
+int rtsp_client_send_seek(rtsp_client_t *client, double position, rtsp_reply_cb_t callback, void *arg);
+int rtsp_client_send_seek_frame(rtsp_client_t *client,
+                                int frame_number,
+                                rtsp_reply_cb_t callback,
+                                void *arg);
+int rtsp_client_send_get_parameter(rtsp_client_t *client, rtsp_reply_cb_t callback, void *arg);
+
+// Send a GET_PARAMETER keepalive once half of the session timeout passed
+// without a request, call it regularly while a session is set up
+void rtsp_client_keepalive(rtsp_client_t *client);
+
+// Number of requests still waiting for a reply
+int rtsp_client_pending_count(rtsp_client_t *client);
 
 void rtsp_client_disconnect(rtsp_client_t *client);
 
@@ -10,6 +10,10 @@ typedef enum {
     METHOD_PLAY,
     METHOD_PAUSE,
     METHOD_TEARDOWN,
+    METHOD_DESCRIBE,
+    METHOD_GET_PARAMETER,
+    METHOD_ANNOUNCE,
+    METHOD_RECORD,
     METHOD_UNKNOWN
 } rtsp_method_t;
 
@@ -22,7 +26,13 @@ typedef enum {
 typedef enum {
     STATUS_OK_200 = 0,
     STATUS_NOT_FOUND_404 = 1,
-    STATUS_SRV_ERR_500 = 2
+    STATUS_SRV_ERR_500 = 2,
+    STATUS_SESSION_NOT_FOUND_454 = 3,
+    STATUS_INVALID_STATE_455 = 4,
+    STATUS_NOT_IMPLEMENTED_501 = 5,
+    STATUS_NOT_ENOUGH_BANDWIDTH_453 = 6,
+    STATUS_UNAVAILABLE_503 = 7,
+    STATUS_UNSUPPORTED_TRANSPORT_461 = 8
 } rtsp_status_t;
 
 #endif // PROTOCOL_H
@@ -0,0 +1,220 @@
+#ifndef RTCP_H
+#define RTCP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// RTCP packets travel on the RTP ports (RFC 5761 muxing), not on RTP port
+// + 1: the server sends its reports from the socket it sends the video
+// from, and the client sends its reports and NACKs from its RTP socket to
+// the address the video comes from. Their packet
+// types, 200-206 in byte 1, can't be mistaken for an RTP packet of payload
+// type 26 with or without the marker bit
+#define RTCP_PT_SR 200    // sender report (RFC 3550)
+#define RTCP_PT_RR 201    // receiver report
+#define RTCP_PT_RTPFB 205 // transport layer feedback (RFC 4585)
+#define RTCP_FMT_NACK 1   // generic NACK
+
+// Generic NACK format (12-byte header, then 4-byte FCI entries):
+// Byte 0: V=2, P=0, FMT=1
+// Byte 1: Packet type (205)
+// Byte 2-3: Length in 32-bit words minus one
+// Byte 4-7: Sender SSRC
+// Byte 8-11: Media SSRC
+// Each entry asks for fragments of one frame again. Every fragment of a
+// frame shares its RTP sequence number, so the PID names the frame and the
+// 16-bit BLP is split: the first missing fragment index, then a bitmap of
+// which of the 8 fragments after it are missing as well
+// Byte 0-1: Frame sequence number (PID)
+// Byte 2: First missing fragment index
+// Byte 3: Bitmap of fragments index + 1 (bit 0) to index + 8 (bit 7)
+#define RTCP_NACK_HEADER_SIZE 12
+#define RTCP_NACK_ENTRY_SIZE 4
+
+// Entries per NACK packet, keeps it in one small datagram
+#define RTCP_NACK_MAX_ENTRIES 64
+
+typedef struct {
+    uint16_t seqnum;
+    uint8_t frag_index;
+    uint8_t following;
+} rtcp_nack_entry_t;
+
+// Sender report without report blocks, the server receives no media:
+// Byte 0: V=2, P=0, RC=0
+// Byte 1: Packet type (200)
+// Byte 2-3: Length in 32-bit words minus one (6)
+// Byte 4-7: Sender SSRC
+// Byte 8-15: NTP timestamp (seconds, fraction)
+// Byte 16-19: RTP timestamp
+// Byte 20-23: Packets sent
+// Byte 24-27: Payload octets sent
+#define RTCP_SR_SIZE 28
+
+typedef struct {
+    uint32_t ssrc;
+    uint32_t ntp_seconds;
+    uint32_t ntp_fraction;
+    uint32_t rtp_timestamp;
+    uint32_t packets;
+    uint32_t octets;
+} rtcp_sr_t;
+
+// Receiver report with one report block:
+// Byte 0: V=2, P=0, RC=1
+// Byte 1: Packet type (201)
+// Byte 2-3: Length in 32-bit words minus one (7)
+// Byte 4-7: Reporter SSRC
+// Byte 8-11: Media SSRC
+// Byte 12: Fraction lost since the last report, in 1/256
+// Byte 13-15: Cumulative packets lost
+// Byte 16-19: Extended highest sequence number
+// Byte 20-23: Interarrival jitter, in RTP timestamp units
+// Byte 24-27: LSR, middle 32 bits of the last SR's NTP timestamp
+// Byte 28-31: DLSR, delay since that SR in 1/65536 seconds
+// Packets are fragments here: every fragment of a frame shares its
+// sequence number, so the highest one counts frames while the loss counts
+// the fragments the link lost, whatever repaired them later
+#define RTCP_RR_SIZE 32
+#define RTCP_RR_MAX_LOST 0x7FFFFF
+
+typedef struct {
+    uint32_t ssrc;
+    uint8_t fraction_lost;
+    uint32_t cumulative_lost;
+    uint32_t highest_seqnum;
+    uint32_t jitter;
+    uint32_t lsr;
+    uint32_t dlsr;
+} rtcp_report_block_t;
+
+// Whether a datagram received on an RTP port is RTCP
+static inline int rtcp_is_rtcp(const uint8_t *packet, size_t size) {
+    return size >= 8 && (packet[0] >> 6) == 2 && packet[1] >= 200 && packet[1] <= 206;
+}
+
+static inline void rtcp_write_be32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static inline uint32_t rtcp_read_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// Middle 32 bits of an NTP timestamp, the clock LSR and DLSR use
+static inline uint32_t rtcp_ntp_middle(uint32_t seconds, uint32_t fraction) {
+    return (seconds << 16) | (fraction >> 16);
+}
+
+static inline size_t rtcp_sr_encode(uint8_t *buffer, const rtcp_sr_t *sr) {
+    buffer[0] = 0x80;
+    buffer[1] = RTCP_PT_SR;
+    buffer[2] = 0;
+    buffer[3] = RTCP_SR_SIZE / 4 - 1;
+    rtcp_write_be32(buffer + 4, sr->ssrc);
+    rtcp_write_be32(buffer + 8, sr->ntp_seconds);
+    rtcp_write_be32(buffer + 12, sr->ntp_fraction);
+    rtcp_write_be32(buffer + 16, sr->rtp_timestamp);
+    rtcp_write_be32(buffer + 20, sr->packets);
+    rtcp_write_be32(buffer + 24, sr->octets);
+    return RTCP_SR_SIZE;
+}
+
+// Return 0 on success, -1 if the packet isn't a sender report
+static inline int rtcp_sr_decode(const uint8_t *packet, size_t size, rtcp_sr_t *sr) {
+    if (!rtcp_is_rtcp(packet, size) || packet[1] != RTCP_PT_SR || size < RTCP_SR_SIZE) {
+        return -1;
+    }
+    sr->ssrc = rtcp_read_be32(packet + 4);
+    sr->ntp_seconds = rtcp_read_be32(packet + 8);
+    sr->ntp_fraction = rtcp_read_be32(packet + 12);
+    sr->rtp_timestamp = rtcp_read_be32(packet + 16);
+    sr->packets = rtcp_read_be32(packet + 20);
+    sr->octets = rtcp_read_be32(packet + 24);
+    return 0;
+}
+
+static inline size_t rtcp_rr_encode(uint8_t *buffer, uint32_t reporter_ssrc, const rtcp_report_block_t *block) {
+    uint32_t lost = block->cumulative_lost < RTCP_RR_MAX_LOST ? block->cumulative_lost : RTCP_RR_MAX_LOST;
+    buffer[0] = 0x80 | 1;
+    buffer[1] = RTCP_PT_RR;
+    buffer[2] = 0;
+    buffer[3] = RTCP_RR_SIZE / 4 - 1;
+    rtcp_write_be32(buffer + 4, reporter_ssrc);
+    rtcp_write_be32(buffer + 8, block->ssrc);
+    rtcp_write_be32(buffer + 12, ((uint32_t)block->fraction_lost << 24) | lost);
+    rtcp_write_be32(buffer + 16, block->highest_seqnum);
+    rtcp_write_be32(buffer + 20, block->jitter);
+    rtcp_write_be32(buffer + 24, block->lsr);
+    rtcp_write_be32(buffer + 28, block->dlsr);
+    return RTCP_RR_SIZE;
+}
+
+// Decode the first report block of a receiver report
+// Return 0 on success, -1 if the packet isn't a receiver report with one
+static inline int rtcp_rr_decode(const uint8_t *packet, size_t size, rtcp_report_block_t *block) {
+    if (!rtcp_is_rtcp(packet, size) || packet[1] != RTCP_PT_RR || (packet[0] & 0x1F) == 0 ||
+        size < RTCP_RR_SIZE) {
+        return -1;
+    }
+    uint32_t loss = rtcp_read_be32(packet + 12);
+    block->ssrc = rtcp_read_be32(packet + 8);
+    block->fraction_lost = (uint8_t)(loss >> 24);
+    block->cumulative_lost = loss & 0xFFFFFF;
+    block->highest_seqnum = rtcp_read_be32(packet + 16);
+    block->jitter = rtcp_read_be32(packet + 20);
+    block->lsr = rtcp_read_be32(packet + 24);
+    block->dlsr = rtcp_read_be32(packet + 28);
+    return 0;
+}
+
+// Encode a NACK with count entries (at most RTCP_NACK_MAX_ENTRIES)
+// Return the packet size
+static inline size_t rtcp_nack_encode(uint8_t *buffer,
+                                      uint32_t sender_ssrc,
+                                      uint32_t media_ssrc,
+                                      const rtcp_nack_entry_t *entries,
+                                      int count) {
+    size_t size = RTCP_NACK_HEADER_SIZE + (size_t)count * RTCP_NACK_ENTRY_SIZE;
+    buffer[0] = 0x80 | RTCP_FMT_NACK;
+    buffer[1] = RTCP_PT_RTPFB;
+    buffer[2] = (uint8_t)((size / 4 - 1) >> 8);
+    buffer[3] = (uint8_t)(size / 4 - 1);
+    rtcp_write_be32(buffer + 4, sender_ssrc);
+    rtcp_write_be32(buffer + 8, media_ssrc);
+    for (int i = 0; i < count; i++) {
+        uint8_t *entry = buffer + RTCP_NACK_HEADER_SIZE + i * RTCP_NACK_ENTRY_SIZE;
+        entry[0] = (uint8_t)(entries[i].seqnum >> 8);
+        entry[1] = (uint8_t)entries[i].seqnum;
+        entry[2] = entries[i].frag_index;
+        entry[3] = entries[i].following;
+    }
+    return size;
+}
+
+// Decode the entries of a NACK, up to max of them
+// Return the number decoded, -1 if the packet isn't a valid NACK
+static inline int rtcp_nack_decode(const uint8_t *packet, size_t size, rtcp_nack_entry_t *entries, int max) {
+    if (!rtcp_is_rtcp(packet, size) || packet[1] != RTCP_PT_RTPFB ||
+        (packet[0] & 0x1F) != RTCP_FMT_NACK || size < RTCP_NACK_HEADER_SIZE) {
+        return -1;
+    }
+    size_t length = ((size_t)(((uint16_t)packet[2] << 8) | packet[3]) + 1) * 4;
+    if (length > size) {
+        return -1;
+    }
+    int count = 0;
+    for (size_t offset = RTCP_NACK_HEADER_SIZE; offset + RTCP_NACK_ENTRY_SIZE <= length && count < max;
+         offset += RTCP_NACK_ENTRY_SIZE) {
+        entries[count].seqnum = (uint16_t)((packet[offset] << 8) | packet[offset + 1]);
+        entries[count].frag_index = packet[offset + 2];
+        entries[count].following = packet[offset + 3];
+        count++;
+    }
+    return count;
+}
+
+#endif // RTCP_H
@@ -0,0 +1,90 @@
+#ifndef RTP_FEC_H
+#define RTP_FEC_H
+
+#include "rtp_fragment.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// XOR forward error correction. After every group of up to
+// RTP_FEC_MAX_GROUP fragments of a frame the sender may add a parity
+// packet, with the frame's sequence number, whose payload is the XOR of
+// the group's payloads, each zero-padded to the longest. A receiver missing
+// exactly one fragment of a group rebuilds it from the others and the
+// parity without waiting for a retransmission.
+// A parity packet's fragment header differs from a fragment's in:
+// Byte 0: FRAG_FLAG_PARITY, bits 0-4: number of fragments in the group
+// Byte 1: Index of the group's first fragment
+#define RTP_FEC_GROUP_MASK 0x1F
+#define RTP_FEC_MAX_GROUP 31
+
+// Parity of a group being sent
+typedef struct {
+    uint8_t payload[RTP_MTU_PAYLOAD];
+    size_t size;   // longest fragment so far
+    int first;     // index of the group's first fragment
+    int count;     // fragments so far, 0 starts a new group
+} rtp_fec_group_t;
+
+static inline int rtp_frag_is_parity(const rtp_frag_header_t *header) {
+    return (header->flags & FRAG_FLAG_PARITY) != 0;
+}
+
+static inline int rtp_fec_group_size(const rtp_frag_header_t *header) {
+    return header->flags & RTP_FEC_GROUP_MASK;
+}
+
+// Encode the fragment header of a group's parity packet
+static inline void rtp_fec_encode(uint8_t *buffer, const rtp_fec_group_t *group, int total_frags,
+                                  size_t total_size, uint8_t epoch) {
+    rtp_frag_encode(buffer, group->first, total_frags, total_size, epoch);
+    buffer[0] = FRAG_FLAG_PARITY | (uint8_t)group->count;
+}
+
+// dst ^= src over size bytes, 16 at a time where the CPU has vectors
+static inline void rtp_fec_xor(uint8_t *dst, const uint8_t *src, size_t size) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a, b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= size; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+    }
+#endif
+    for (; i < size; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+// Add fragment index, of size bytes, to the group's parity
+// Return 0 on success, -1 if the fragment is larger than RTP_MTU_PAYLOAD,
+// leaving the group unchanged
+static inline int rtp_fec_add(rtp_fec_group_t *group, int index, const uint8_t *data, size_t size) {
+    if (size > RTP_MTU_PAYLOAD) {
+        return -1;
+    }
+    if (group->count == 0) {
+        group->first = index;
+        group->size = 0;
+    }
+    if (size > group->size) {
+        memset(group->payload + group->size, 0, size - group->size);
+        group->size = size;
+    }
+    rtp_fec_xor(group->payload, data, size);
+    group->count++;
+    return 0;
+}
+
+#endif // RTP_FEC_H
@@ -9,19 +9,21 @@
 #define RTP_MTU_PAYLOAD 1400
 
 // Fragment header format (8 bytes):
-// Byte 0: Fragment flags (bit 7: first, bit 6: last, bits 0-5: reserved)
+// Byte 0: Fragment flags (bit 7: first, bit 6: last, bit 5: parity, bits
+//         0-4: parity group size, see rtp_fec.h)
 // Byte 1: Fragment index (0-255)
 // Byte 2: Total fragment count
-// Byte 3: Reserved (padding for alignment)
+// Byte 3: Stream epoch (bumped by the server on every seek)
 // Byte 4-7: Total frame size (32-bit, big-endian) - supports up to 4GB frames
 #define FRAG_FLAG_FIRST 0x80
 #define FRAG_FLAG_LAST  0x40
+#define FRAG_FLAG_PARITY 0x20
 
 typedef struct {
     uint8_t flags;           // FRAG_FLAG_FIRST | FRAG_FLAG_LAST
     uint8_t frag_index;      // Fragment number (0, 1, 2, ...)
     uint8_t total_frags;     // Total number of fragments
-    uint8_t reserved;        // Padding
+    uint8_t epoch;           // Stream epoch, packets from an older epoch are stale
     uint32_t total_size;     // Total frame size (32-bit for large frames)
 } rtp_frag_header_t;
 
@@ -33,7 +35,7 @@ static inline int rtp_calc_fragments(size_t frame_size) {
 }
 
 // Encode a fragment header
-static inline void rtp_frag_encode(uint8_t *buffer, int frag_index, int total_frags, size_t total_size) {
+static inline void rtp_frag_encode(uint8_t *buffer, int frag_index, int total_frags, size_t total_size, uint8_t epoch) {
     uint8_t flags = 0;
     if (frag_index == 0) flags |= FRAG_FLAG_FIRST;
     if (frag_index == total_frags - 1) flags |= FRAG_FLAG_LAST;
@@ -41,7 +43,7 @@ static inline void rtp_frag_encode(uint8_t *buffer, int frag_index, int total_fr
     buffer[0] = flags;
     buffer[1] = (uint8_t)frag_index;
     buffer[2] = (uint8_t)total_frags;
-    buffer[3] = 0;  // Reserved
+    buffer[3] = epoch;
     // 32-bit total_size in big-endian
     buffer[4] = (uint8_t)((total_size >> 24) & 0xFF);
     buffer[5] = (uint8_t)((total_size >> 16) & 0xFF);
@@ -54,7 +56,7 @@ static inline void rtp_frag_decode(const uint8_t *buffer, rtp_frag_header_t *hea
     header->flags = buffer[0];
     header->frag_index = buffer[1];
     header->total_frags = buffer[2];
-    header->reserved = buffer[3];
+    header->epoch = buffer[3];
     // 32-bit total_size from big-endian
     header->total_size = ((uint32_t)buffer[4] << 24) | 
                          ((uint32_t)buffer[5] << 16) | 
@@ -4,7 +4,6 @@
 #include <stdint.h>
 #include <string.h>
 #include <arpa/inet.h>
-#include <time.h>
 
 size_t rtp_packet_encode(
     uint8_t *packet_buffer,
@@ -16,6 +15,7 @@ size_t rtp_packet_encode(
     uint16_t seqnum,
     uint8_t marker,
     uint8_t pt,
+    uint32_t timestamp,
     uint32_t ssrc,
     const uint8_t *payload,
     size_t payload_size
@@ -35,7 +35,7 @@ size_t rtp_packet_encode(
     header->pt = pt;
     header->seqnum = htons(seqnum);
     header->ssrc = htonl(ssrc);
-    header->timestamp = htonl((uint32_t)time(NULL));
+    header->timestamp = htonl(timestamp);
 
     // Copy the payload data into the buffer following the 12-byte header
     memcpy(packet_buffer + RTP_HEADER_SIZE, payload, payload_size);
@@ -35,6 +35,7 @@ size_t rtp_packet_encode(
     uint16_t seqnum,
     uint8_t marker,
     uint8_t pt,
+    uint32_t timestamp,
     uint32_t ssrc,
     const uint8_t *payload,
     size_t payload_size
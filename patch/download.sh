@@ -35,6 +35,12 @@ done
 echo ""
 echo "=== Converting files for streaming ==="
 
+if [ ! -x ../bin/mjpeg-index ]; then
+    echo "bin/mjpeg-index not found, run make first"
+    exit 1
+fi
+
+PENDING=()
 for file in "${FILES[@]}"; do
     base="${file%.mjpeg}"
     patched="${base}_patched.mjpeg"
@@ -42,13 +48,17 @@ for file in "${FILES[@]}"; do
     if [ -f "../samples/$patched" ]; then
         echo "$patched already exists, skipping"
     elif [ -f "../samples/$file" ]; then
-        echo "Converting $file -> $patched..."
-        python3 converter.py "../samples/$file" "../samples/$patched"
+        PENDING+=("../samples/$file")
     else
         echo "$file not found, skipping conversion"
     fi
 done
 
+# Converted in parallel, each with its sidecar index
+if [ ${#PENDING[@]} -gt 0 ]; then
+    ../bin/mjpeg-index -f lp -s _patched "${PENDING[@]}"
+fi
+
 echo ""
 echo "=== Done! ==="
 echo "Sample files are in samples/"
@@ -0,0 +1,449 @@
+#define _GNU_SOURCE
+
+#include "async_io.h"
+#include "../common/logger.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+// Submission queue depth of the shared ring, also the cap on reads in flight
+#define URING_ENTRIES 256
+
+// Buffer size classes, 4 KiB to 64 MiB
+#define BUFFER_MIN_SHIFT 12
+#define BUFFER_MAX_SHIFT 26
+#define BUFFER_POOL_MAX_FREE 64 // free buffers kept per class
+
+static async_io_backend_t g_backend = ASYNC_IO_BACKEND_NONE;
+
+static void complete_request(async_io_request_t *request, ssize_t result) {
+    pthread_mutex_lock(request->mutex);
+    request->result = result;
+    request->done = 1;
+    pthread_cond_broadcast(request->cond);
+    pthread_mutex_unlock(request->mutex);
+}
+
+// io_uring backend, driven through the raw system calls so there is no
+// library dependency. One ring is shared by every session: submitters take
+// a mutex, a single thread reaps completions
+#ifdef __linux__
+
+typedef struct {
+    int fd;
+    unsigned entries;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t slot_cond; // signaled when reads complete
+    unsigned in_flight;
+    pthread_t completion_thread;
+} uring_t;
+
+static uring_t g_uring;
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Queue one SQE, called with the ring mutex held and a free slot
+static int uring_push(uring_t *ring, uint8_t opcode, async_io_request_t *request) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = -1;
+    if (request != NULL) {
+        request->iov.iov_base = request->buffer;
+        request->iov.iov_len = request->length;
+        sqe->fd = request->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&request->iov;
+        sqe->len = 1;
+        sqe->off = (uint64_t)request->offset;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)request;
+    ring->sq_array[index] = index;
+    atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, tail + 1, memory_order_release);
+
+    int result;
+    do {
+        result = uring_enter(ring->fd, 1, 0, 0);
+    } while (result < 0 && errno == EINTR);
+    return result == 1 ? 0 : -1;
+}
+
+static void *uring_completion_thread(void *arg) {
+    uring_t *ring = (uring_t *)arg;
+    int running = 1;
+    while (running) {
+        if (uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            logger_log("io_uring wait failed: %s", strerror(errno));
+            break;
+        }
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire);
+        unsigned reaped = 0;
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            async_io_request_t *request = (async_io_request_t *)(uintptr_t)cqe->user_data;
+            if (request == NULL) {
+                running = 0; // the wakeup queued by async_io_shutdown
+                continue;
+            }
+            complete_request(request, cqe->res);
+            reaped++;
+        }
+        atomic_store_explicit((_Atomic unsigned *)ring->cq_head, head, memory_order_release);
+
+        if (reaped > 0) {
+            pthread_mutex_lock(&ring->mutex);
+            ring->in_flight -= reaped;
+            pthread_cond_broadcast(&ring->slot_cond);
+            pthread_mutex_unlock(&ring->mutex);
+        }
+    }
+    return NULL;
+}
+
+static void uring_unmap(uring_t *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+}
+
+static int uring_init(uring_t *ring) {
+    memset(ring, 0, sizeof(uring_t));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        logger_log("io_uring unavailable: %s", strerror(errno));
+        return -1;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring :
+        mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        logger_log("error mapping io_uring: %s", strerror(errno));
+        uring_unmap(ring);
+        return -1;
+    }
+
+    uint8_t *sq = (uint8_t *)ring->sq_ring;
+    uint8_t *cq = (uint8_t *)ring->cq_ring;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->slot_cond, NULL);
+    if (pthread_create(&ring->completion_thread, NULL, uring_completion_thread, ring) != 0) {
+        logger_log("error creating io_uring completion thread");
+        uring_unmap(ring);
+        return -1;
+    }
+    return 0;
+}
+
+static int uring_submit(uring_t *ring, async_io_request_t *request) {
+    pthread_mutex_lock(&ring->mutex);
+    // The completion queue is twice the submission queue, capping reads in
+    // flight at the latter means it can never overflow
+    while (ring->in_flight >= ring->entries) {
+        pthread_cond_wait(&ring->slot_cond, &ring->mutex);
+    }
+    ring->in_flight++;
+    int result = uring_push(ring, IORING_OP_READV, request);
+    if (result != 0) {
+        ring->in_flight--;
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return result;
+}
+
+static void uring_shutdown(uring_t *ring) {
+    pthread_mutex_lock(&ring->mutex);
+    while (ring->in_flight > 0) {
+        pthread_cond_wait(&ring->slot_cond, &ring->mutex);
+    }
+    uring_push(ring, IORING_OP_NOP, NULL);
+    pthread_mutex_unlock(&ring->mutex);
+
+    pthread_join(ring->completion_thread, NULL);
+    uring_unmap(ring);
+    pthread_mutex_destroy(&ring->mutex);
+    pthread_cond_destroy(&ring->slot_cond);
+}
+
+#endif // __linux__
+
+// Fallback backend: worker threads doing blocking preads off a FIFO queue
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    async_io_request_t *head;
+    async_io_request_t *tail;
+    int stopping;
+    pthread_t *threads;
+    int thread_count;
+} read_pool_t;
+
+static read_pool_t g_pool;
+
+static void *read_pool_thread(void *arg) {
+    read_pool_t *pool = (read_pool_t *)arg;
+    while (1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->head == NULL && !pool->stopping) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        async_io_request_t *request = pool->head;
+        if (request == NULL) {
+            pthread_mutex_unlock(&pool->mutex);
+            break; // stopping and drained
+        }
+        pool->head = request->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        size_t total = 0;
+        ssize_t result = 0;
+        while (total < request->length) {
+            ssize_t n = pread(request->fd, (uint8_t *)request->buffer + total,
+                request->length - total, request->offset + (off_t)total);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                result = -errno;
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+            total += (size_t)n;
+        }
+        complete_request(request, result < 0 ? result : (ssize_t)total);
+    }
+    return NULL;
+}
+
+static int read_pool_init(read_pool_t *pool, int thread_count) {
+    memset(pool, 0, sizeof(read_pool_t));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->threads = (pthread_t *)malloc((size_t)thread_count * sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, read_pool_thread, pool) != 0) {
+            logger_log("error creating read pool thread");
+            break;
+        }
+        pool->thread_count++;
+    }
+    return pool->thread_count > 0 ? 0 : -1;
+}
+
+static void read_pool_submit(read_pool_t *pool, async_io_request_t *request) {
+    request->next = NULL;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tail != NULL) {
+        pool->tail->next = request;
+    } else {
+        pool->head = request;
+    }
+    pool->tail = request;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void read_pool_shutdown(read_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+}
+
+int async_io_init(int force_threads, int pool_threads) {
+#ifdef __linux__
+    if (!force_threads && uring_init(&g_uring) == 0) {
+        g_backend = ASYNC_IO_BACKEND_URING;
+        logger_log("async reads: io_uring, %u entries", g_uring.entries);
+        return 0;
+    }
+#else
+    (void)force_threads;
+#endif
+    if (pool_threads < 1) {
+        pool_threads = 1;
+    }
+    if (read_pool_init(&g_pool, pool_threads) != 0) {
+        logger_log("error starting the read pool");
+        return -1;
+    }
+    g_backend = ASYNC_IO_BACKEND_THREADS;
+    logger_log("async reads: pool of %d pread threads", g_pool.thread_count);
+    return 0;
+}
+
+async_io_backend_t async_io_backend(void) {
+    return g_backend;
+}
+
+const char *async_io_backend_name(void) {
+    switch (g_backend) {
+    case ASYNC_IO_BACKEND_URING:
+        return "io_uring";
+    case ASYNC_IO_BACKEND_THREADS:
+        return "threads";
+    default:
+        return "none";
+    }
+}
+
+int async_io_submit(async_io_request_t *request) {
+    request->done = 0;
+    request->result = 0;
+    switch (g_backend) {
+#ifdef __linux__
+    case ASYNC_IO_BACKEND_URING:
+        return uring_submit(&g_uring, request);
+#endif
+    case ASYNC_IO_BACKEND_THREADS:
+        read_pool_submit(&g_pool, request);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+void async_io_shutdown(void) {
+    switch (g_backend) {
+#ifdef __linux__
+    case ASYNC_IO_BACKEND_URING:
+        uring_shutdown(&g_uring);
+        break;
+#endif
+    case ASYNC_IO_BACKEND_THREADS:
+        read_pool_shutdown(&g_pool);
+        break;
+    default:
+        break;
+    }
+    g_backend = ASYNC_IO_BACKEND_NONE;
+}
+
+// Free buffers are chained through their first bytes
+typedef struct free_buffer {
+    struct free_buffer *next;
+} free_buffer_t;
+
+static pthread_mutex_t g_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static free_buffer_t *g_free_buffers[BUFFER_MAX_SHIFT + 1];
+static int g_free_counts[BUFFER_MAX_SHIFT + 1];
+
+static int size_class(size_t size) {
+    int shift = BUFFER_MIN_SHIFT;
+    while (shift <= BUFFER_MAX_SHIFT && ((size_t)1 << shift) < size) {
+        shift++;
+    }
+    return shift;
+}
+
+void *async_io_buffer_get(size_t size) {
+    int shift = size_class(size);
+    if (shift > BUFFER_MAX_SHIFT) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_buffer_mutex);
+    free_buffer_t *buffer = g_free_buffers[shift];
+    if (buffer != NULL) {
+        g_free_buffers[shift] = buffer->next;
+        g_free_counts[shift]--;
+    }
+    pthread_mutex_unlock(&g_buffer_mutex);
+
+    if (buffer == NULL && posix_memalign((void **)&buffer, (size_t)1 << BUFFER_MIN_SHIFT, (size_t)1 << shift) != 0) {
+        return NULL;
+    }
+    return buffer;
+}
+
+void async_io_buffer_put(void *buffer, size_t size) {
+    if (buffer == NULL) {
+        return;
+    }
+    int shift = size_class(size);
+    pthread_mutex_lock(&g_buffer_mutex);
+    if (g_free_counts[shift] < BUFFER_POOL_MAX_FREE) {
+        free_buffer_t *node = (free_buffer_t *)buffer;
+        node->next = g_free_buffers[shift];
+        g_free_buffers[shift] = node;
+        g_free_counts[shift]++;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&g_buffer_mutex);
+    free(buffer);
+}
@@ -0,0 +1,56 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Process-wide engine for asynchronous positioned reads. It uses io_uring
+// when the kernel allows it and a pool of pread threads otherwise; callers
+// see the same interface either way
+
+typedef enum {
+    ASYNC_IO_BACKEND_NONE,
+    ASYNC_IO_BACKEND_URING,
+    ASYNC_IO_BACKEND_THREADS
+} async_io_backend_t;
+
+// One read in flight. The owner keeps it alive until done is set, which the
+// engine does under *mutex before broadcasting *cond
+typedef struct async_io_request {
+    int fd;
+    void *buffer;
+    size_t length;
+    off_t offset;
+
+    ssize_t result; // bytes read or -errno
+    int done;
+    pthread_mutex_t *mutex;
+    pthread_cond_t *cond;
+
+    struct iovec iov;              // io_uring backend
+    struct async_io_request *next; // thread pool queue link
+} async_io_request_t;
+
+// Start the engine, trying io_uring first unless force_threads is set.
+// pool_threads sizes the fallback pool. Return 0 on success, -1 on error
+int async_io_init(int force_threads, int pool_threads);
+
+async_io_backend_t async_io_backend(void);
+const char *async_io_backend_name(void);
+
+// Queue a read. The request must not be touched until done is set
+// Return 0 on success, -1 if the engine isn't running
+int async_io_submit(async_io_request_t *request);
+
+// Stop the engine once all submitted reads have completed
+void async_io_shutdown(void);
+
+// Buffers suitable for any backend, O_DIRECT included: page-aligned and
+// recycled through a free list per power-of-two size class
+void *async_io_buffer_get(size_t size);
+void async_io_buffer_put(void *buffer, size_t size);
+
+#endif // ASYNC_IO_H
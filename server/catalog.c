@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "catalog.h"
+#include "../common/logger.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CATALOG_BUCKETS 256
+
+enum {
+    ENTRY_LOADING,
+    ENTRY_READY,
+    ENTRY_FAILED
+};
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_loaded = PTHREAD_COND_INITIALIZER;
+static catalog_entry_t *g_buckets[CATALOG_BUCKETS];
+static catalog_entry_t *g_lru_head; // most recently released
+static catalog_entry_t *g_lru_tail;
+static int g_lru_count;
+static int g_capacity = CATALOG_DEFAULT_CAPACITY;
+
+// FNV-1a
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (; *path != '\0'; path++) {
+        hash = (hash ^ (uint8_t)*path) * 16777619u;
+    }
+    return hash % CATALOG_BUCKETS;
+}
+
+static catalog_entry_t *find(const char *path) {
+    for (catalog_entry_t *entry = g_buckets[hash_path(path)]; entry != NULL; entry = entry->hash_next) {
+        if (strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void hash_insert(catalog_entry_t *entry) {
+    uint32_t bucket = hash_path(entry->path);
+    entry->hash_next = g_buckets[bucket];
+    g_buckets[bucket] = entry;
+    entry->cached = 1;
+}
+
+static void hash_remove(catalog_entry_t *entry) {
+    catalog_entry_t **link = &g_buckets[hash_path(entry->path)];
+    while (*link != NULL && *link != entry) {
+        link = &(*link)->hash_next;
+    }
+    if (*link != NULL) {
+        *link = entry->hash_next;
+    }
+    entry->cached = 0;
+}
+
+static void lru_push(catalog_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = g_lru_head;
+    if (g_lru_head != NULL) {
+        g_lru_head->lru_prev = entry;
+    } else {
+        g_lru_tail = entry;
+    }
+    g_lru_head = entry;
+    g_lru_count++;
+}
+
+static void lru_remove(catalog_entry_t *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        g_lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        g_lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+    g_lru_count--;
+}
+
+static void destroy(catalog_entry_t *entry) {
+    rtp_hint_free(&entry->hints);
+    video_stream_close(&entry->stream);
+    free(entry);
+}
+
+// Close the least recently used videos beyond the capacity
+static void evict_locked(void) {
+    while (g_lru_count > g_capacity) {
+        catalog_entry_t *entry = g_lru_tail;
+        lru_remove(entry);
+        hash_remove(entry);
+        logger_log("catalog: closing %s", entry->path);
+        destroy(entry);
+    }
+}
+
+static void release_locked(catalog_entry_t *entry) {
+    if (--entry->refcount > 0) {
+        return;
+    }
+    if (entry->cached) {
+        lru_push(entry);
+        evict_locked();
+    } else {
+        destroy(entry); // replaced on disk or failed, nobody can find it
+    }
+}
+
+// Whether the file at the entry's path is no longer the one that was opened
+static int is_stale(catalog_entry_t *entry) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - entry->validated_at < CATALOG_REVALIDATE_S) {
+        return 0;
+    }
+    entry->validated_at = now.tv_sec;
+
+    struct stat st;
+    return stat(entry->path, &st) != 0 ||
+        st.st_dev != entry->device ||
+        st.st_ino != entry->inode ||
+        st.st_size != entry->size ||
+        st.st_mtim.tv_sec != entry->mtime.tv_sec ||
+        st.st_mtim.tv_nsec != entry->mtime.tv_nsec;
+}
+
+// Open, index and hint a video, without the catalog lock held
+static int load(catalog_entry_t *entry) {
+    if (video_stream_open(&entry->stream, entry->path) != 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fileno(entry->stream.file), &st) != 0) {
+        video_stream_close(&entry->stream);
+        return -1;
+    }
+    entry->device = st.st_dev;
+    entry->inode = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    entry->validated_at = now.tv_sec;
+
+    // Hot files may come with a precomputed packet layout (see mjpeg-hint)
+    rtp_hint_load(&entry->hints, entry->path, &entry->stream);
+    return 0;
+}
+
+void catalog_set_capacity(int entries) {
+    pthread_mutex_lock(&g_mutex);
+    g_capacity = entries >= 0 ? entries : 0;
+    evict_locked();
+    pthread_mutex_unlock(&g_mutex);
+}
+
+catalog_entry_t *catalog_acquire(const char *path) {
+    pthread_mutex_lock(&g_mutex);
+    catalog_entry_t *entry = find(path);
+
+    // A replaced file gets a new entry, sessions still playing the old one
+    // keep it until they release it
+    if (entry != NULL && entry->state == ENTRY_READY && is_stale(entry)) {
+        logger_log("catalog: %s changed on disk, reopening", path);
+        hash_remove(entry);
+        if (entry->refcount == 0) {
+            lru_remove(entry);
+            destroy(entry);
+        }
+        entry = NULL;
+    }
+
+    if (entry != NULL) {
+        if (entry->refcount++ == 0) {
+            lru_remove(entry);
+        }
+        // Another session is opening it, share the result
+        while (entry->state == ENTRY_LOADING) {
+            pthread_cond_wait(&g_loaded, &g_mutex);
+        }
+        if (entry->state == ENTRY_FAILED) {
+            release_locked(entry);
+            pthread_mutex_unlock(&g_mutex);
+            return NULL;
+        }
+        pthread_mutex_unlock(&g_mutex);
+        metrics_counter_add(METRIC_CACHE_HITS, 1);
+        return entry;
+    }
+
+    entry = (catalog_entry_t *)calloc(1, sizeof(catalog_entry_t));
+    if (entry == NULL) {
+        pthread_mutex_unlock(&g_mutex);
+        logger_log("error allocating catalog entry");
+        return NULL;
+    }
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    entry->state = ENTRY_LOADING;
+    entry->refcount = 1;
+    hash_insert(entry);
+    pthread_mutex_unlock(&g_mutex);
+    metrics_counter_add(METRIC_CACHE_MISSES, 1);
+
+    int result = load(entry);
+
+    pthread_mutex_lock(&g_mutex);
+    entry->state = result == 0 ? ENTRY_READY : ENTRY_FAILED;
+    pthread_cond_broadcast(&g_loaded);
+    if (result != 0) {
+        // Let the next SETUP retry, the file may show up later
+        hash_remove(entry);
+        release_locked(entry);
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return entry;
+}
+
+void catalog_release(catalog_entry_t *entry) {
+    if (entry == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&g_mutex);
+    release_locked(entry);
+    pthread_mutex_unlock(&g_mutex);
+}
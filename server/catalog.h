@@ -0,0 +1,51 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "rtp_hint.h"
+#include "video_stream.h"
+
+#include <sys/types.h>
+#include <time.h>
+
+// Unreferenced videos kept open by default
+#define CATALOG_DEFAULT_CAPACITY 64
+
+// A cached video is checked against the file on disk at most this often
+#define CATALOG_REVALIDATE_S 2
+
+// One video shared by every session playing it: the open file, its frame
+// index and metadata, and its hint track. Sessions attach their own stream
+// position to it with video_stream_attach
+typedef struct catalog_entry {
+    char path[256];
+    video_stream_t stream;
+    rtp_hint_track_t hints; // frame_first_packet is NULL without a hint file
+
+    // stat() of the file when it was opened, to notice it being replaced
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    time_t validated_at;
+
+    // Protected by the catalog lock
+    int state;
+    int refcount;
+    int cached; // reachable by path, cleared once replaced or failed
+    struct catalog_entry *hash_next;
+    struct catalog_entry *lru_prev; // only unreferenced entries are in the LRU
+    struct catalog_entry *lru_next;
+} catalog_entry_t;
+
+// Most unreferenced videos to keep open, the least recently used are closed
+void catalog_set_capacity(int entries);
+
+// Get the video at path, opening and indexing it only if no session has it
+// open and it isn't cached. Concurrent first opens of a path share one load
+// Return the entry, or NULL if the video can't be opened
+catalog_entry_t *catalog_acquire(const char *path);
+
+// Drop a reference taken with catalog_acquire
+void catalog_release(catalog_entry_t *entry);
+
+#endif // CATALOG_H
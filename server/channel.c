@@ -0,0 +1,469 @@
+#define _GNU_SOURCE // sendmmsg
+
+#include "channel.h"
+#include "../common/logger.h"
+#include "../common/protocol.h"
+#include "../common/rtp_fragment.h"
+#include "../common/rtp_packet.h"
+#include "fec.h"
+#include "metrics.h"
+#include "rtp_hint.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// RTP media clock for video (RFC 3551)
+#define CHANNEL_CLOCK_RATE 90000
+#define CHANNEL_SNDBUF_SIZE (1024 * 1024)
+
+// A channel being started, on the stack of the thread starting it. Others
+// asking for the same path wait for that start instead of opening the
+// video twice, and share its result
+typedef struct channel_start {
+    const char *path;
+    struct channel_start *next;
+} channel_start_t;
+
+// Guards the channels and the starts. Not held while a channel starts, so
+// loading one video doesn't hold up sessions joining other channels
+static pthread_mutex_t g_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_channel_started = PTHREAD_COND_INITIALIZER;
+static channel_t *g_channels;
+static channel_start_t *g_starts;
+
+// Multicast configuration, groups are handed out under the registry lock
+static int g_multicast;
+static struct in_addr g_next_group;
+static struct in_addr g_multicast_interface;
+static int g_multicast_ttl = CHANNEL_MULTICAST_DEFAULT_TTL;
+
+int channel_set_multicast(const char *group, int ttl, const char *interface_addr) {
+    if (inet_pton(AF_INET, group, &g_next_group) != 1 || !IN_MULTICAST(ntohl(g_next_group.s_addr))) {
+        logger_log("invalid multicast group %s", group);
+        return -1;
+    }
+    g_multicast_interface.s_addr = htonl(INADDR_ANY);
+    if (interface_addr != NULL && inet_pton(AF_INET, interface_addr, &g_multicast_interface) != 1) {
+        logger_log("invalid multicast interface address %s", interface_addr);
+        return -1;
+    }
+    g_multicast_ttl = ttl;
+    g_multicast = 1;
+    logger_log("channels multicast from %s:%d, ttl %d", group, CHANNEL_MULTICAST_PORT, ttl);
+    return 0;
+}
+
+int channel_multicast_ttl(void) {
+    return g_multicast_ttl;
+}
+
+// Give a new channel the next group and prepare its socket to send there
+static int setup_multicast(channel_t *channel) {
+    unsigned char ttl = (unsigned char)g_multicast_ttl;
+    unsigned char loop = 1; // viewers on the server host receive it too
+    if (setsockopt(channel->socket_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+        setsockopt(channel->socket_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        setsockopt(channel->socket_fd, IPPROTO_IP, IP_MULTICAST_IF,
+                   &g_multicast_interface, sizeof(g_multicast_interface)) < 0) {
+        logger_log("error setting multicast options: %s", strerror(errno));
+        return -1;
+    }
+    channel->group.sin_family = AF_INET;
+    channel->group.sin_addr = g_next_group;
+    channel->group.sin_port = htons(CHANNEL_MULTICAST_PORT);
+    g_next_group.s_addr = htonl(ntohl(g_next_group.s_addr) + 1);
+    logger_log("channel %s: multicast group %s", channel->path, inet_ntoa(channel->group.sin_addr));
+    return 0;
+}
+
+int channel_url_is_channel(const char *url) {
+    // The video is the last path segment, the channel prefix the one before
+    const char *last = strrchr(url, '/');
+    if (last == NULL || last[1] == '\0') {
+        return 0;
+    }
+    size_t prefix_len = strlen(CHANNEL_PREFIX);
+    const char *segment = last + 1 - prefix_len;
+    return segment >= url && strncmp(segment, CHANNEL_PREFIX, prefix_len) == 0 &&
+        (segment == url || segment[-1] == '/');
+}
+
+// Send packet to every viewer, batching them into sendmmsg calls. Only the
+// sequence number and SSRC differ between viewers
+static void send_to_subscribers(channel_t *channel, const uint8_t *header, const uint8_t *payload, size_t payload_size) {
+    uint8_t headers[CHANNEL_SEND_BATCH][RTP_HINT_HEADER_SIZE];
+    struct iovec iov[CHANNEL_SEND_BATCH][2];
+    struct mmsghdr messages[CHANNEL_SEND_BATCH];
+    int count = 0;
+
+    for (int i = 0; i <= channel->subscriber_capacity; i++) {
+        const channel_subscriber_t *subscriber = i < channel->subscriber_capacity ? &channel->subscribers[i] : NULL;
+        if (subscriber != NULL && subscriber->id != 0) {
+            memcpy(headers[count], header, RTP_HINT_HEADER_SIZE);
+            headers[count][2] = (uint8_t)(subscriber->seqnum >> 8);
+            headers[count][3] = (uint8_t)subscriber->seqnum;
+            headers[count][8] = (uint8_t)(subscriber->ssrc >> 24);
+            headers[count][9] = (uint8_t)(subscriber->ssrc >> 16);
+            headers[count][10] = (uint8_t)(subscriber->ssrc >> 8);
+            headers[count][11] = (uint8_t)subscriber->ssrc;
+
+            iov[count][0].iov_base = headers[count];
+            iov[count][0].iov_len = RTP_HINT_HEADER_SIZE;
+            iov[count][1].iov_base = (void *)payload;
+            iov[count][1].iov_len = payload_size;
+
+            memset(&messages[count], 0, sizeof(messages[count]));
+            messages[count].msg_hdr.msg_name = (void *)&subscriber->addr;
+            messages[count].msg_hdr.msg_namelen = sizeof(subscriber->addr);
+            messages[count].msg_hdr.msg_iov = iov[count];
+            messages[count].msg_hdr.msg_iovlen = 2;
+            count++;
+        }
+
+        // Flush a full batch, or what is left after the last viewer
+        if (count == CHANNEL_SEND_BATCH || (subscriber == NULL && count > 0)) {
+            int sent = 0;
+            while (sent < count) {
+                int n = sendmmsg(channel->socket_fd, messages + sent, (unsigned)(count - sent), 0);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    logger_log("error sending channel packet: %s", strerror(errno));
+                    metrics_counter_add(METRIC_SEND_ERRORS, (uint64_t)(count - sent));
+                    break;
+                }
+                for (int k = sent; k < sent + n; k++) {
+                    metrics_counter_add(METRIC_BYTES_SENT, messages[k].msg_len);
+                }
+                metrics_counter_add(METRIC_PACKETS_SENT, (uint64_t)n);
+                sent += n;
+            }
+            count = 0;
+        }
+    }
+}
+
+// Packetize a frame once and send every packet to every viewer, with the
+// parity packets when FEC is on. Parity matters most here: channels don't
+// retransmit
+static void broadcast_frame(channel_t *channel, size_t frame_size, uint32_t timestamp) {
+    uint8_t header[RTP_HINT_HEADER_SIZE];
+    int total_frags = rtp_calc_fragments(frame_size);
+    rtp_fec_group_t parity = {.count = 0};
+
+    pthread_mutex_lock(&channel->mutex);
+    int viewers = 0;
+    for (int i = 0; i < channel->subscriber_capacity; i++) {
+        viewers += channel->subscribers[i].id != 0;
+    }
+
+    // Packet-major order spaces out each viewer's packets by the others'
+    for (int i = 0; viewers > 0 && i < total_frags; i++) {
+        size_t offset = (size_t)i * RTP_MTU_PAYLOAD;
+        size_t chunk_size = frame_size - offset;
+        if (chunk_size > RTP_MTU_PAYLOAD) {
+            chunk_size = RTP_MTU_PAYLOAD;
+        }
+
+        // The channel never seeks, so its epoch stays 0
+        uint8_t frag_header[RTP_FRAG_HEADER_SIZE];
+        rtp_frag_encode(frag_header, i, total_frags, frame_size, 0);
+        rtp_packet_encode(
+            header, sizeof(header),
+            2, 0, 0, 0,
+            0,
+            (i == total_frags - 1) ? 1 : 0,
+            MJPEG_TYPE, timestamp, 0,
+            frag_header, RTP_FRAG_HEADER_SIZE
+        );
+        send_to_subscribers(channel, header, channel->frame_buffer + offset, chunk_size);
+
+        if (fec_group() > 0) {
+            rtp_fec_add(&parity, i, channel->frame_buffer + offset, chunk_size);
+            if (fec_group_done(&parity, i, total_frags)) {
+                rtp_fec_encode(frag_header, &parity, total_frags, frame_size, 0);
+                rtp_packet_encode(
+                    header, sizeof(header),
+                    2, 0, 0, 0,
+                    0, 0,
+                    MJPEG_TYPE, timestamp, 0,
+                    frag_header, RTP_FRAG_HEADER_SIZE
+                );
+                parity.count = 0;
+                send_to_subscribers(channel, header, parity.payload, parity.size);
+                metrics_counter_add(METRIC_FEC_PACKETS_SENT, (uint64_t)viewers);
+            }
+        }
+    }
+
+    for (int i = 0; i < channel->subscriber_capacity; i++) {
+        if (channel->subscribers[i].id != 0) {
+            channel->subscribers[i].seqnum++;
+        }
+    }
+    pthread_mutex_unlock(&channel->mutex);
+    metrics_counter_add(METRIC_FRAMES_SENT, (uint64_t)viewers);
+}
+
+static void *producer_thread(void *arg) {
+    channel_t *channel = (channel_t *)arg;
+    double fps = channel->stream.fps;
+    uint64_t frames = 0; // keeps counting across loops, so timestamps only grow
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long interval_ns = (long)(1e9 / fps);
+
+    logger_log("channel %s: producer started at %.3f fps", channel->path, fps);
+    while (!atomic_load(&channel->stop_producer)) {
+        ssize_t frame_size = video_stream_next_frame(&channel->stream, channel->frame_buffer,
+            channel->stream.max_frame_size);
+        if (frame_size == 0) {
+            video_stream_seek_frame(&channel->stream, 0); // live channels loop
+            continue;
+        }
+        if (frame_size < 0) {
+            logger_log("channel %s: read error, stopping", channel->path);
+            break;
+        }
+
+        uint32_t timestamp = (uint32_t)(frames * (double)CHANNEL_CLOCK_RATE / fps + 0.5);
+        broadcast_frame(channel, (size_t)frame_size, timestamp);
+        frames++;
+
+        // Absolute deadlines, so send time doesn't accumulate as drift
+        next.tv_nsec += interval_ns;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    logger_log("channel %s: producer stopped after %llu frames", channel->path, (unsigned long long)frames);
+    return NULL;
+}
+
+static void free_channel(channel_t *channel) {
+    if (channel->socket_fd >= 0) {
+        close(channel->socket_fd);
+    }
+    free(channel->frame_buffer);
+    free(channel->subscribers);
+    video_stream_close(&channel->stream);
+    catalog_release(channel->video_entry);
+    pthread_mutex_destroy(&channel->mutex);
+    free(channel);
+}
+
+static channel_t *start_channel(const char *path) {
+    channel_t *channel = (channel_t *)calloc(1, sizeof(channel_t));
+    if (channel == NULL) {
+        logger_log("error allocating channel");
+        return NULL;
+    }
+    snprintf(channel->path, sizeof(channel->path), "%s", path);
+    channel->socket_fd = -1;
+    pthread_mutex_init(&channel->mutex, NULL);
+
+    channel->video_entry = catalog_acquire(path);
+    if (channel->video_entry == NULL) {
+        free_channel(channel);
+        return NULL;
+    }
+    video_stream_attach(&channel->stream, &channel->video_entry->stream);
+    if (channel->stream.total_frames == 0) {
+        logger_log("channel %s: video has no frames", path);
+        free_channel(channel);
+        return NULL;
+    }
+    channel->frame_buffer = (uint8_t *)malloc(channel->stream.max_frame_size > 0 ? channel->stream.max_frame_size : 1);
+    channel->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (channel->frame_buffer == NULL || channel->socket_fd < 0) {
+        logger_log("error setting up channel %s", path);
+        free_channel(channel);
+        return NULL;
+    }
+
+    // One socket carries every viewer's packets
+    int sndbuf_size = CHANNEL_SNDBUF_SIZE;
+    if (setsockopt(channel->socket_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf_size, sizeof(sndbuf_size)) < 0) {
+        logger_log("warning: could not set channel send buffer size: %s", strerror(errno));
+    }
+
+    // Without a group the channel still serves unicast viewers
+    pthread_mutex_lock(&g_registry_mutex);
+    if (g_multicast && setup_multicast(channel) != 0) {
+        memset(&channel->group, 0, sizeof(channel->group));
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    if (pthread_create(&channel->producer_thread, NULL, producer_thread, channel) != 0) {
+        logger_log("error creating channel producer thread");
+        free_channel(channel);
+        return NULL;
+    }
+    return channel;
+}
+
+static channel_t *find_channel(const char *path) {
+    channel_t *channel = g_channels;
+    while (channel != NULL && strcmp(channel->path, path) != 0) {
+        channel = channel->next;
+    }
+    return channel;
+}
+
+static channel_start_t *find_start(const char *path) {
+    channel_start_t *start = g_starts;
+    while (start != NULL && strcmp(start->path, path) != 0) {
+        start = start->next;
+    }
+    return start;
+}
+
+static void remove_start(channel_start_t *start) {
+    channel_start_t **link = &g_starts;
+    while (*link != start) {
+        link = &(*link)->next;
+    }
+    *link = start->next;
+}
+
+channel_t *channel_acquire(const char *path) {
+    pthread_mutex_lock(&g_registry_mutex);
+    channel_t *channel;
+    int waited = 0;
+    while ((channel = find_channel(path)) == NULL && find_start(path) != NULL) {
+        pthread_cond_wait(&g_channel_started, &g_registry_mutex);
+        waited = 1;
+    }
+    if (channel == NULL && !waited) {
+        channel_start_t start = {path, g_starts};
+        g_starts = &start;
+        pthread_mutex_unlock(&g_registry_mutex);
+        channel = start_channel(path);
+        pthread_mutex_lock(&g_registry_mutex);
+        remove_start(&start);
+        pthread_cond_broadcast(&g_channel_started);
+        if (channel != NULL) {
+            channel->next = g_channels;
+            g_channels = channel;
+        }
+    }
+    if (channel != NULL) {
+        channel->refcount++;
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+    return channel;
+}
+
+void channel_release(channel_t *channel) {
+    if (channel == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&g_registry_mutex);
+    int last = --channel->refcount == 0;
+    if (last) {
+        channel_t **link = &g_channels;
+        while (*link != channel) {
+            link = &(*link)->next;
+        }
+        *link = channel->next;
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    if (last) {
+        atomic_store(&channel->stop_producer, 1);
+        pthread_join(channel->producer_thread, NULL);
+        free_channel(channel);
+    }
+}
+
+static int subscribe_locked(channel_t *channel, const struct sockaddr_in *addr, uint32_t ssrc) {
+    int slot = -1;
+    for (int i = 0; i < channel->subscriber_capacity; i++) {
+        if (channel->subscribers[i].id == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        int capacity = channel->subscriber_capacity > 0 ? channel->subscriber_capacity * 2 : 16;
+        channel_subscriber_t *grown = (channel_subscriber_t *)realloc(channel->subscribers,
+            (size_t)capacity * sizeof(channel_subscriber_t));
+        if (grown == NULL) {
+            logger_log("error growing channel subscribers");
+            return -1;
+        }
+        memset(grown + channel->subscriber_capacity, 0,
+            (size_t)(capacity - channel->subscriber_capacity) * sizeof(channel_subscriber_t));
+        slot = channel->subscriber_capacity;
+        channel->subscribers = grown;
+        channel->subscriber_capacity = capacity;
+    }
+
+    channel_subscriber_t *subscriber = &channel->subscribers[slot];
+    subscriber->addr = *addr;
+    subscriber->ssrc = ssrc;
+    subscriber->seqnum = 0;
+    subscriber->id = ++channel->next_id;
+    return subscriber->id;
+}
+
+static void unsubscribe_locked(channel_t *channel, int id) {
+    for (int i = 0; i < channel->subscriber_capacity; i++) {
+        if (channel->subscribers[i].id == id) {
+            channel->subscribers[i].id = 0;
+            break;
+        }
+    }
+}
+
+int channel_subscribe(channel_t *channel, const struct sockaddr_in *addr, uint32_t ssrc) {
+    pthread_mutex_lock(&channel->mutex);
+    int id = subscribe_locked(channel, addr, ssrc);
+    pthread_mutex_unlock(&channel->mutex);
+    return id;
+}
+
+void channel_unsubscribe(channel_t *channel, int id) {
+    pthread_mutex_lock(&channel->mutex);
+    unsubscribe_locked(channel, id);
+    pthread_mutex_unlock(&channel->mutex);
+}
+
+int channel_join_multicast(channel_t *channel) {
+    if (channel->group.sin_family != AF_INET) {
+        return -1;
+    }
+    int result = 0;
+    pthread_mutex_lock(&channel->mutex);
+    if (channel->multicast_viewers == 0) {
+        // The group is one more subscriber, with an SSRC of its own
+        channel->multicast_subscriber = subscribe_locked(channel, &channel->group, (uint32_t)rand());
+        result = channel->multicast_subscriber < 0 ? -1 : 0;
+    }
+    if (result == 0) {
+        channel->multicast_viewers++;
+    }
+    pthread_mutex_unlock(&channel->mutex);
+    return result;
+}
+
+void channel_leave_multicast(channel_t *channel) {
+    pthread_mutex_lock(&channel->mutex);
+    if (channel->multicast_viewers > 0 && --channel->multicast_viewers == 0) {
+        unsubscribe_locked(channel, channel->multicast_subscriber);
+    }
+    pthread_mutex_unlock(&channel->mutex);
+}
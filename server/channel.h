@@ -0,0 +1,92 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "catalog.h"
+#include "video_stream.h"
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+
+// "channel/<video>" plays <video> as a live channel: every viewer sees the
+// same position, and one producer thread reads and packetizes each frame
+// once for all of them. It loops at the end of the video and can't seek
+#define CHANNEL_PREFIX "channel/"
+
+// Messages handed to one sendmmsg call
+#define CHANNEL_SEND_BATCH 64
+
+// With multicast on, each channel gets its own group on this port
+#define CHANNEL_MULTICAST_PORT 5004
+#define CHANNEL_MULTICAST_DEFAULT_TTL 1
+
+typedef struct channel_subscriber {
+    struct sockaddr_in addr;
+    uint32_t ssrc;
+    uint16_t seqnum; // next frame's sequence number for this viewer
+    int id;          // 0 when the slot is free
+} channel_subscriber_t;
+
+typedef struct channel {
+    char path[256];
+    int refcount; // sessions set up on the channel, protected by the registry lock
+
+    catalog_entry_t *video_entry;
+    video_stream_t stream; // the producer's position in the shared video
+    uint8_t *frame_buffer;
+    int socket_fd;         // every viewer is sent to from this socket
+
+    pthread_t producer_thread;
+    _Atomic int stop_producer;
+
+    // Viewers, protected by mutex. The producer holds it while sending a
+    // frame, so a viewer leaving never misses half of one
+    pthread_mutex_t mutex;
+    channel_subscriber_t *subscribers;
+    int subscriber_capacity;
+    int next_id;
+
+    // Multicast group the channel is sent to once for all LAN viewers,
+    // sin_family is 0 when multicast is off. It is a subscriber while at
+    // least one viewer plays it
+    struct sockaddr_in group;
+    int multicast_viewers;
+    int multicast_subscriber;
+
+    struct channel *next;
+} channel_t;
+
+// Whether a request URL ("[rtsp://host/]channel/<video>") names a channel
+int channel_url_is_channel(const char *url);
+
+// Send channels to multicast groups, the first one to group and each later
+// channel to the next address, with this TTL and from the interface with
+// address interface_addr (NULL for the default). Call before any SETUP
+// Return 0 on success, -1 if an address is invalid
+int channel_set_multicast(const char *group, int ttl, const char *interface_addr);
+
+// TTL of multicast packets, for the Transport header
+int channel_multicast_ttl(void);
+
+// Join the channel playing path, starting it if it isn't running
+// Return the channel, or NULL on error
+channel_t *channel_acquire(const char *path);
+
+// Leave a channel, the last session stops its producer
+void channel_release(channel_t *channel);
+
+// Start sending the channel to addr from its current position
+// Return a subscriber id for channel_unsubscribe, or -1 on error
+int channel_subscribe(channel_t *channel, const struct sockaddr_in *addr, uint32_t ssrc);
+
+void channel_unsubscribe(channel_t *channel, int id);
+
+// Count a viewer of the channel's multicast group, the first one starts
+// sending to the group
+// Return 0 on success, -1 if the channel has no group
+int channel_join_multicast(channel_t *channel);
+
+// The last viewer leaving stops sending to the group
+void channel_leave_multicast(channel_t *channel);
+
+#endif // CHANNEL_H
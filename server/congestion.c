@@ -0,0 +1,109 @@
+#include "congestion.h"
+#include "metrics.h"
+
+#include <string.h>
+
+static int g_adaptive = 1;
+
+void congestion_set_adaptive(int adaptive) {
+    g_adaptive = adaptive;
+}
+
+void congestion_init(congestion_t *congestion) {
+    memset(congestion, 0, sizeof(*congestion));
+    congestion->share = 1;
+    congestion->window_start_us = metrics_now_us();
+    congestion->resend_filled_us = congestion->window_start_us;
+}
+
+int congestion_admit_frame(congestion_t *congestion, size_t size) {
+    congestion->due_bytes += size;
+    congestion->credit += congestion->share;
+    if (congestion->credit < 1) {
+        return 0;
+    }
+    congestion->credit -= 1;
+    congestion->sent_bytes += size;
+    return 1;
+}
+
+int congestion_admit_resend(congestion_t *congestion, size_t size) {
+    uint64_t now_us = metrics_now_us();
+    double rate = congestion->estimate_bps * CONGESTION_RESEND_SHARE / 8e6; // bytes per microsecond
+    double burst = rate * CONGESTION_RESEND_BURST_MS * 1000;
+    congestion->resend_tokens += (double)(now_us - congestion->resend_filled_us) * rate;
+    if (congestion->resend_tokens > burst) {
+        congestion->resend_tokens = burst;
+    }
+    congestion->resend_filled_us = now_us;
+
+    // Unlimited until there is an estimate to limit them to
+    if (congestion->estimate_bps > 0) {
+        if (congestion->resend_tokens < (double)size) {
+            return 0;
+        }
+        congestion->resend_tokens -= (double)size;
+    }
+    congestion->sent_bytes += size;
+    return 1;
+}
+
+// Frames get what the estimate leaves for them, all of them once it covers
+// the full stream and its share of retransmissions
+static void set_estimate(congestion_t *congestion, double estimate, double due_bps) {
+    double needed = due_bps / (1 - CONGESTION_RESEND_SHARE);
+    congestion->estimate_bps = estimate < needed ? estimate : needed;
+    double share = congestion->estimate_bps / needed;
+    congestion->share = share < CONGESTION_MIN_SHARE ? CONGESTION_MIN_SHARE : share;
+}
+
+int congestion_report(congestion_t *congestion, uint8_t fraction_lost) {
+    uint64_t now_us = metrics_now_us();
+    uint64_t elapsed_us = now_us - congestion->window_start_us;
+    congestion->report_us = now_us;
+    if (congestion->due_bytes == 0 || elapsed_us < CONGESTION_MIN_WINDOW_MS * 1000ULL) {
+        return 0; // paused or waiting on a live source, or too short to tell a rate from
+    }
+    double due_bps = congestion->due_bytes * 8e6 / elapsed_us;
+    double sent_bps = congestion->sent_bytes * 8e6 / elapsed_us;
+    congestion->due_bytes = 0;
+    congestion->sent_bytes = 0;
+    congestion->window_start_us = now_us;
+    if (!g_adaptive) {
+        return 0;
+    }
+
+    // The loss-based half of GCC (draft-ietf-rmcat-gcc): back off by half
+    // the loss from what was sent, and probe upwards while the link is clean
+    double loss = fraction_lost / 256.0;
+    double estimate = congestion->estimate_bps > 0 ? congestion->estimate_bps : sent_bps;
+    int cut = loss > CONGESTION_LOSS_HIGH;
+    if (cut) {
+        estimate = (estimate < sent_bps ? estimate : sent_bps) * (1 - loss / 2);
+    } else if (loss < CONGESTION_LOSS_LOW) {
+        estimate *= CONGESTION_INCREASE;
+    }
+    set_estimate(congestion, estimate, due_bps);
+    return cut;
+}
+
+int congestion_check_feedback(congestion_t *congestion) {
+    if (!g_adaptive || congestion->report_us == 0) {
+        return 0; // a client that never reports isn't adapted to
+    }
+    uint64_t now_us = metrics_now_us();
+    if (now_us - congestion->report_us < CONGESTION_FEEDBACK_TIMEOUT_MS * 1000ULL) {
+        return 0;
+    }
+    congestion->report_us = now_us;
+    double estimate = congestion->estimate_bps;
+    if (estimate == 0) {
+        estimate = congestion->sent_bytes * 8e6 / (now_us - congestion->window_start_us);
+    }
+    congestion->estimate_bps = estimate / 2;
+    congestion->share /= 2;
+    if (congestion->share < CONGESTION_MIN_SHARE) {
+        congestion->share = CONGESTION_MIN_SHARE;
+    }
+    return 1;
+}
@@ -0,0 +1,68 @@
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A receiver report with more than CONGESTION_LOSS_HIGH of the fragments
+// lost cuts the session's estimate to what got through, one with less than
+// CONGESTION_LOSS_LOW grows it by CONGESTION_INCREASE, in between it holds
+#define CONGESTION_LOSS_HIGH 0.10
+#define CONGESTION_LOSS_LOW 0.02
+#define CONGESTION_INCREASE 1.15
+
+// Reports that come sooner after the last one than this are too little to
+// tell a rate from, e.g. the one answering a session's first frame
+#define CONGESTION_MIN_WINDOW_MS 500
+
+// Share of the frames a congested session still gets at least
+#define CONGESTION_MIN_SHARE 0.125
+
+// Packets sent again for NACKs may take this share of the estimate, in
+// bursts of up to CONGESTION_RESEND_BURST_MS of it, and frames the rest.
+// Lost retransmissions are NACKed again, unchecked they crowd out the frames
+#define CONGESTION_RESEND_SHARE 0.25
+#define CONGESTION_RESEND_BURST_MS 200
+
+// Reports stop coming when the link is congested enough to lose them as
+// well: a session that had them and then none for this long backs off by
+// half, again every CONGESTION_FEEDBACK_TIMEOUT_MS
+#define CONGESTION_FEEDBACK_TIMEOUT_MS 3000
+
+// A session's estimate of the bandwidth its link has, from the loss its
+// client reports, and the share of the frames that fits in it. Frames are
+// all independent JPEGs, so the ones that don't fit are skipped rather than
+// sent to be lost. Only the RTP thread of the session uses it
+typedef struct {
+    double estimate_bps;     // payload bits per second, 0 until a report
+    double share;            // of the frames sent, 1 sends them all
+    double credit;           // spreads the frames sent evenly
+    uint64_t due_bytes;      // of every frame due since the last report
+    uint64_t sent_bytes;     // of those that were sent, and of resent packets
+    uint64_t window_start_us;
+    uint64_t report_us;      // when the last report came, 0 before one did
+    double resend_tokens;    // bytes that may be sent again right away
+    uint64_t resend_filled_us;
+} congestion_t;
+
+// Whether sessions adapt to their links, on by default
+void congestion_set_adaptive(int adaptive);
+
+void congestion_init(congestion_t *congestion);
+
+// Whether to send a frame of size bytes that is due now or skip it
+int congestion_admit_frame(congestion_t *congestion, size_t size);
+
+// Whether a packet of size bytes may be sent again for a NACK, and if so
+// count it as sent
+int congestion_admit_resend(congestion_t *congestion, size_t size);
+
+// Update the estimate from a receiver report's fraction lost (in 1/256)
+// Return 1 if the loss cut it, 0 otherwise
+int congestion_report(congestion_t *congestion, uint8_t fraction_lost);
+
+// Back off if reports stopped coming, call regularly
+// Return 1 if the estimate was cut, 0 otherwise
+int congestion_check_feedback(congestion_t *congestion);
+
+#endif // CONGESTION_H
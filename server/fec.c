@@ -0,0 +1,22 @@
+#include "fec.h"
+
+static int g_group = 0;
+
+void fec_set_group(int fragments) {
+    if (fragments > RTP_FEC_MAX_GROUP) {
+        fragments = RTP_FEC_MAX_GROUP;
+    }
+    g_group = fragments > 0 ? fragments : 0;
+}
+
+int fec_group(void) {
+    return g_group;
+}
+
+int fec_group_done(const rtp_fec_group_t *group, int index, int total_frags) {
+    return g_group > 0 && group->count > 0 && (group->count == g_group || index == total_frags - 1);
+}
+
+int fec_parity_packets(int total_frags) {
+    return g_group > 0 ? (total_frags + g_group - 1) / g_group : 0;
+}
@@ -0,0 +1,20 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include "../common/rtp_fec.h"
+
+// Fragments per parity packet ("-F"), between 1 (twice the packets) and
+// RTP_FEC_MAX_GROUP. 0 turns parity off, the default
+void fec_set_group(int fragments);
+
+// Fragments per parity packet, 0 when off
+int fec_group(void);
+
+// Whether the group's parity is due after fragment index of a frame of
+// total_frags, and the group should be sent and restarted
+int fec_group_done(const rtp_fec_group_t *group, int index, int total_frags);
+
+// Parity packets sent with a frame of total_frags fragments
+int fec_parity_packets(int total_frags);
+
+#endif // FEC_H
@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "frame_reader.h"
+#include "../common/logger.h"
+#include "placement.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int frame_reader_init(frame_reader_t *reader, video_stream_t *stream, int depth) {
+    memset(reader, 0, sizeof(frame_reader_t));
+    if (depth > FRAME_READER_MAX_DEPTH) {
+        depth = FRAME_READER_MAX_DEPTH;
+    }
+    reader->stream = stream;
+    reader->depth = depth;
+    reader->buffer_size = stream->max_frame_size > 0 ? stream->max_frame_size : 1;
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->cond, NULL);
+
+    for (int i = 0; i < depth; i++) {
+        frame_slot_t *slot = &reader->slots[i];
+        slot->frame = -1;
+        slot->request.mutex = &reader->mutex;
+        slot->request.cond = &reader->cond;
+        slot->buffer = (uint8_t *)async_io_buffer_get(reader->buffer_size);
+        if (slot->buffer == NULL) {
+            logger_log("error allocating read-ahead buffers");
+            frame_reader_close(reader);
+            return -1;
+        }
+        // Pooled buffers may come from a session on another node
+        placement_bind_memory(slot->buffer, reader->buffer_size);
+    }
+    return 0;
+}
+
+// Wait for the read in a slot to finish, if there is one
+static void wait_slot(frame_reader_t *reader, frame_slot_t *slot) {
+    if (!slot->pending) {
+        return;
+    }
+    pthread_mutex_lock(&reader->mutex);
+    while (!slot->request.done) {
+        pthread_cond_wait(&reader->cond, &reader->mutex);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+    slot->pending = 0;
+}
+
+static void issue(frame_reader_t *reader, int frame) {
+    frame_slot_t *slot = &reader->slots[frame % reader->depth];
+    if (slot->frame == frame) {
+        return;
+    }
+    // After a seek the slot may still hold a read for the old position
+    wait_slot(reader, slot);
+
+    const video_frame_entry_t *entry = &reader->stream->index[frame];
+    slot->frame = frame;
+    slot->request.fd = fileno(reader->stream->file);
+    slot->request.buffer = slot->buffer;
+    slot->request.length = entry->size;
+    slot->request.offset = (off_t)entry->offset;
+    if (async_io_submit(&slot->request) != 0) {
+        // Read it on the spot rather than fail the session
+        slot->request.result = pread(slot->request.fd, slot->buffer, entry->size, slot->request.offset);
+        slot->request.done = 1;
+    }
+    slot->pending = 1;
+}
+
+ssize_t frame_reader_next(frame_reader_t *reader, const uint8_t **data) {
+    video_stream_t *stream = reader->stream;
+    int frame = stream->frame_num;
+    if (frame >= stream->total_frames) {
+        logger_log("end of video reached");
+        return 0;
+    }
+
+    video_stream_advise(stream, frame);
+
+    // Keep the window [frame, frame + depth) in flight
+    for (int i = 0; i < reader->depth && frame + i < stream->total_frames; i++) {
+        issue(reader, frame + i);
+    }
+
+    frame_slot_t *slot = &reader->slots[frame % reader->depth];
+    wait_slot(reader, slot);
+    stream->frame_num++;
+
+    ssize_t size = slot->request.result;
+    if (size != (ssize_t)stream->index[frame].size) {
+        logger_log("incomplete frame read: got %zd, expected %u", size, stream->index[frame].size);
+        slot->frame = -1;
+        return -1;
+    }
+    *data = slot->buffer;
+    return size;
+}
+
+void frame_reader_close(frame_reader_t *reader) {
+    for (int i = 0; i < reader->depth; i++) {
+        frame_slot_t *slot = &reader->slots[i];
+        wait_slot(reader, slot);
+        async_io_buffer_put(slot->buffer, reader->buffer_size);
+        slot->buffer = NULL;
+    }
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->cond);
+}
@@ -0,0 +1,45 @@
+#ifndef FRAME_READER_H
+#define FRAME_READER_H
+
+#include "async_io.h"
+#include "video_stream.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FRAME_READER_MAX_DEPTH 32
+
+// A frame being read ahead, frame i always lives in slot i % depth
+typedef struct {
+    async_io_request_t request;
+    uint8_t *buffer;
+    int frame;   // frame held or being read, -1 if none
+    int pending; // submitted and not yet waited for
+} frame_slot_t;
+
+// Reads a session's next frames ahead of time through the async I/O engine,
+// so the sending thread only waits when the disk is slower than playback
+typedef struct {
+    video_stream_t *stream;
+    frame_slot_t slots[FRAME_READER_MAX_DEPTH];
+    int depth;
+    size_t buffer_size;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} frame_reader_t;
+
+// Keep up to depth frames in flight. The async I/O engine must be running
+// Return 0 on success, -1 on error
+int frame_reader_init(frame_reader_t *reader, video_stream_t *stream, int depth);
+
+// Return the frame at the stream position and advance it like
+// video_stream_next_frame. *data stays valid until the next call.
+// Return the size of the frame, or 0 if EOF, or -1 on error
+ssize_t frame_reader_next(frame_reader_t *reader, const uint8_t **data);
+
+// Wait for reads still in flight and release the buffers
+void frame_reader_close(frame_reader_t *reader);
+
+#endif // FRAME_READER_H
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include "listener.h"
+#include "../common/logger.h"
+#include "metrics.h"
+#include "server_worker.h"
+#include "session_table.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef struct {
+    int index;
+    int socket_fd;
+    int pin_cpu;
+    cpu_set_t worker_cpus; // what the server may run on, before any pinning
+} listener_t;
+
+static int open_socket(const listener_config_t *config) {
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd < 0) {
+        logger_log("error creating socket");
+        return -1;
+    }
+
+    // Set the SO_REUSEADDR option, allow restarting the server immediately
+    // without waiting for the OS to the free the port
+    int opt = 1;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        logger_log("error setting socket options");
+        close(socket_fd);
+        return -1;
+    }
+
+    // Several sockets bound to the port, the kernel spreads incoming
+    // connections over their accept queues
+    if (config->count > 1 && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        logger_log("error setting SO_REUSEPORT: %s", strerror(errno));
+        close(socket_fd);
+        return -1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(config->port);
+
+    if (bind(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        logger_log("error binding socket");
+        close(socket_fd);
+        return -1;
+    }
+
+    if (listen(socket_fd, config->backlog) < 0) {
+        logger_log("error listening on socket");
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+// Only the accept loop stays on the CPU, see accept_loop for its workers
+static void pin_to_cpu(int index) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET((int)(index % cpus), &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        logger_log("listener %d: could not pin to cpu %ld", index, index % cpus);
+        return;
+    }
+    logger_log("listener %d pinned to cpu %ld", index, index % cpus);
+}
+
+static void *accept_loop(void *arg) {
+    listener_t *listener = (listener_t *)arg;
+
+    // A pinned listener's workers would inherit its CPU, and their RTP
+    // threads with them, so they start on every CPU the server may use.
+    // Session placement (-P) still pins them to their own core
+    pthread_attr_t worker_attr;
+    pthread_attr_init(&worker_attr);
+    if (listener->pin_cpu) {
+        if (pthread_attr_setaffinity_np(&worker_attr, sizeof(cpu_set_t), &listener->worker_cpus) != 0) {
+            logger_log("listener %d: could not unpin workers", listener->index);
+        }
+        pin_to_cpu(listener->index);
+    }
+
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+        // Blocking here, waiting for new client to connect
+        int client_socket_fd = accept(
+            listener->socket_fd, (struct sockaddr *)&client_addr, &client_len
+        );
+        if (client_socket_fd < 0) {
+            logger_log("error accepting connection");
+            continue;
+        }
+
+        // WHEN CLIENT CONNECTED
+        // A full table sheds the connection right away, before it costs a
+        // thread
+        session_t *session = session_table_open(client_socket_fd);
+        if (session == NULL) {
+            logger_log("session table full, dropping connection");
+            metrics_counter_add(METRIC_CONNECTIONS_REJECTED, 1);
+            close(client_socket_fd);
+            continue;
+        }
+
+        session->client_addr = client_addr;
+        session->state = STATE_INIT;
+        session->session_id = 0;
+        logger_log("new connection from %s:%d on listener %d",
+            inet_ntoa(client_addr.sin_addr),
+            ntohs(client_addr.sin_port),
+            listener->index
+        );
+
+        // SPAWN SERVER WORKER THREAD
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, &worker_attr, server_worker_thread, (void*)session) != 0) {
+            logger_log("error creating client thread");
+            session_table_close(session);
+            continue;
+        }
+
+        // This thread will now run independently
+        pthread_detach(thread_id);
+    }
+    return NULL;
+}
+
+int listener_run(const listener_config_t *config) {
+    int count = config->count > 0 ? config->count : 1;
+    listener_t *listeners = (listener_t *)calloc((size_t)count, sizeof(listener_t));
+    if (listeners == NULL) {
+        logger_log("error allocating listeners");
+        return -1;
+    }
+
+    // Bind every socket before accepting on any, so a port taken by another
+    // process fails the startup instead of one listener
+    listener_config_t effective = *config;
+    effective.count = count;
+    cpu_set_t worker_cpus;
+    CPU_ZERO(&worker_cpus);
+    if (config->pin_cpus && pthread_getaffinity_np(pthread_self(), sizeof(worker_cpus), &worker_cpus) != 0) {
+        logger_log("error reading the cpu affinity");
+        free(listeners);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        listeners[i].index = i;
+        listeners[i].pin_cpu = config->pin_cpus;
+        listeners[i].worker_cpus = worker_cpus;
+        listeners[i].socket_fd = open_socket(&effective);
+        if (listeners[i].socket_fd < 0) {
+            for (int j = 0; j < i; j++) {
+                close(listeners[j].socket_fd);
+            }
+            free(listeners);
+            return -1;
+        }
+    }
+    logger_log("server listening on port %d: %d listener(s), backlog %d",
+        config->port, count, config->backlog);
+
+    for (int i = 1; i < count; i++) {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, accept_loop, &listeners[i]) != 0) {
+            logger_log("error creating listener thread %d", i);
+            return -1;
+        }
+        pthread_detach(thread_id);
+    }
+    accept_loop(&listeners[0]);
+    return -1;
+}
@@ -0,0 +1,21 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <sys/socket.h>
+
+// Pending connections per listening socket, capped by net.core.somaxconn
+#define LISTENER_DEFAULT_BACKLOG SOMAXCONN
+
+typedef struct {
+    int port;
+    int count;    // accept threads, each with its own SO_REUSEPORT socket when > 1
+    int backlog;  // listen() backlog of each socket
+    int pin_cpus; // pin listener i to CPU i (mod the CPU count)
+} listener_config_t;
+
+// Open the listening sockets and accept connections on them, handing each
+// to a worker thread. The calling thread runs the first accept loop
+// Only returns on error, with -1
+int listener_run(const listener_config_t *config);
+
+#endif // LISTENER_H
@@ -0,0 +1,486 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "live.h"
+#include "../common/logger.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Producer bytes framed per step, on top of the largest frame
+#define LIVE_FEED_CHUNK 65536
+
+static pthread_mutex_t g_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static live_source_t *g_sources; // sources with a producer
+static int g_ring_frames = LIVE_DEFAULT_RING_FRAMES;
+static double g_dvr_seconds; // 0 when time-shift is off
+static size_t g_dvr_segment_size = (size_t)LIVE_DVR_DEFAULT_SEGMENT_MIB << 20;
+
+int live_url_is_live(const char *url) {
+    // The name is the last path segment, the live prefix the one before
+    const char *last = strrchr(url, '/');
+    if (last == NULL || last[1] == '\0') {
+        return 0;
+    }
+    size_t prefix_len = strlen(LIVE_PREFIX);
+    const char *segment = last + 1 - prefix_len;
+    return segment >= url && strncmp(segment, LIVE_PREFIX, prefix_len) == 0 &&
+        (segment == url || segment[-1] == '/');
+}
+
+void live_set_ring_frames(int frames) {
+    g_ring_frames = frames > 0 ? frames : LIVE_DEFAULT_RING_FRAMES;
+}
+
+uint64_t live_ring_memory(void) {
+    return (uint64_t)g_ring_frames * LIVE_MAX_FRAME_SIZE;
+}
+
+void live_set_dvr(double seconds, int segment_mib) {
+    g_dvr_seconds = seconds > 0 ? seconds : 0;
+    if (segment_mib > 0) {
+        g_dvr_segment_size = (size_t)segment_mib << 20;
+    }
+}
+
+// Map an unlinked segment file for a source's time-shift window
+static int open_segment(live_source_t *source) {
+    const char *dir = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/streamsrv-dvr-XXXXXX", dir != NULL ? dir : "/var/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        logger_log("live source %s: cannot create segment in %s: %s", source->name, path, strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    if (ftruncate(fd, (off_t)g_dvr_segment_size) != 0) {
+        logger_log("live source %s: cannot size segment: %s", source->name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *segment = mmap(NULL, g_dvr_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        logger_log("live source %s: cannot map segment: %s", source->name, strerror(errno));
+        return -1;
+    }
+
+    source->dvr_capacity = (int)(g_dvr_seconds * source->fps + 1);
+    source->dvr = (live_dvr_entry_t *)calloc((size_t)source->dvr_capacity, sizeof(live_dvr_entry_t));
+    if (source->dvr == NULL) {
+        munmap(segment, g_dvr_segment_size);
+        return -1;
+    }
+    source->segment = (uint8_t *)segment;
+    source->segment_size = g_dvr_segment_size;
+    return 0;
+}
+
+void live_frame_release(live_frame_t *frame) {
+    if (frame != NULL && atomic_fetch_sub(&frame->refs, 1) == 1) {
+        free(frame);
+    }
+}
+
+static void free_source(live_source_t *source) {
+    for (int i = 0; i < source->capacity; i++) {
+        live_frame_release(source->ring[i]);
+    }
+    free(source->ring);
+    free(source->pending);
+    if (source->segment != NULL) {
+        munmap(source->segment, source->segment_size);
+    }
+    free(source->dvr);
+    pthread_cond_destroy(&source->cond);
+    pthread_mutex_destroy(&source->mutex);
+    free(source);
+}
+
+static live_source_t *create_source(const char *name, double fps) {
+    live_source_t *source = (live_source_t *)calloc(1, sizeof(live_source_t));
+    if (source == NULL) {
+        logger_log("error allocating live source");
+        return NULL;
+    }
+    snprintf(source->name, sizeof(source->name), "%s", name);
+    source->fps = fps;
+    source->start_us = metrics_now_us();
+    source->capacity = g_ring_frames;
+
+    // Viewers wait on the monotonic clock, like the channel producers
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&source->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&source->mutex, NULL);
+
+    mjpeg_framer_init(&source->framer);
+    source->ring = (live_frame_t **)calloc((size_t)source->capacity, sizeof(live_frame_t *));
+    source->pending = (uint8_t *)malloc(LIVE_MAX_FRAME_SIZE + LIVE_FEED_CHUNK);
+    if (source->ring == NULL || source->pending == NULL) {
+        logger_log("error allocating live source %s", name);
+        free_source(source);
+        return NULL;
+    }
+
+    // Without a segment the source still plays live
+    if (g_dvr_seconds > 0 && open_segment(source) != 0) {
+        logger_log("live source %s: time-shift disabled", name);
+    }
+    return source;
+}
+
+live_source_t *live_announce(const char *name, double fps) {
+    pthread_mutex_lock(&g_registry_mutex);
+    live_source_t *source = g_sources;
+    while (source != NULL && strcmp(source->name, name) != 0) {
+        source = source->next;
+    }
+    if (source != NULL) {
+        pthread_mutex_unlock(&g_registry_mutex);
+        logger_log("live source %s already has a producer", name);
+        return NULL;
+    }
+
+    source = create_source(name, fps);
+    if (source != NULL) {
+        source->refcount = 1;
+        source->next = g_sources;
+        g_sources = source;
+        logger_log("live source %s announced at %.3f fps, %d frame ring", name, fps, source->capacity);
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+    return source;
+}
+
+// Remove a source from the registry, with the registry lock held
+static void unlink_locked(live_source_t *source) {
+    live_source_t **link = &g_sources;
+    while (*link != NULL && *link != source) {
+        link = &(*link)->next;
+    }
+    if (*link == source) {
+        *link = source->next;
+    }
+}
+
+void live_end(live_source_t *source) {
+    // A new producer can announce the name while viewers drain this one
+    pthread_mutex_lock(&g_registry_mutex);
+    unlink_locked(source);
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    pthread_mutex_lock(&source->mutex);
+    source->ended = 1;
+    pthread_cond_broadcast(&source->cond);
+    pthread_mutex_unlock(&source->mutex);
+    logger_log("live source %s ended after %llu frames", source->name, (unsigned long long)source->next_number);
+}
+
+live_source_t *live_acquire(const char *name) {
+    pthread_mutex_lock(&g_registry_mutex);
+    live_source_t *source = g_sources;
+    while (source != NULL && strcmp(source->name, name) != 0) {
+        source = source->next;
+    }
+    if (source != NULL) {
+        source->refcount++;
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+    return source;
+}
+
+void live_release(live_source_t *source) {
+    if (source == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&g_registry_mutex);
+    int last = --source->refcount == 0;
+    if (last) {
+        unlink_locked(source);
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    if (last) {
+        free_source(source);
+    }
+}
+
+int live_viewer_count(live_source_t *source) {
+    pthread_mutex_lock(&g_registry_mutex);
+    int viewers = source->refcount - 1;
+    pthread_mutex_unlock(&g_registry_mutex);
+    return viewers;
+}
+
+// Copy a frame leaving the ring to the head of the segment. Frames whose
+// bytes it overwrites leave the window first, under the lock, so a viewer
+// copying one of them out notices (see read_dvr_frame). The copy itself is
+// made without the lock
+static void spill_frame(live_source_t *source, const live_frame_t *frame) {
+    pthread_mutex_lock(&source->mutex);
+    if (frame->size > source->segment_size) {
+        // The window restarts after a frame it can't hold
+        source->dvr_first = source->dvr_next = frame->number + 1;
+        pthread_mutex_unlock(&source->mutex);
+        return;
+    }
+    if (source->dvr_next != frame->number) {
+        source->dvr_first = source->dvr_next = frame->number;
+    }
+
+    size_t offset = source->segment_head;
+    if (offset + frame->size > source->segment_size) {
+        // The tail is too short: wrap around. Frames in the tail are the
+        // oldest, so they leave first
+        while (source->dvr_first < source->dvr_next &&
+               source->dvr[source->dvr_first % (uint64_t)source->dvr_capacity].offset >= offset) {
+            source->dvr_first++;
+        }
+        offset = 0;
+    }
+    while (source->dvr_first < source->dvr_next) {
+        const live_dvr_entry_t *oldest = &source->dvr[source->dvr_first % (uint64_t)source->dvr_capacity];
+        int overlaps = oldest->offset < offset + frame->size && offset < oldest->offset + oldest->size;
+        if (!overlaps && source->dvr_next - source->dvr_first < (uint64_t)source->dvr_capacity) {
+            break;
+        }
+        source->dvr_first++;
+    }
+    source->segment_head = offset + frame->size;
+    pthread_mutex_unlock(&source->mutex);
+
+    memcpy(source->segment + offset, frame->data, frame->size);
+
+    pthread_mutex_lock(&source->mutex);
+    live_dvr_entry_t *entry = &source->dvr[frame->number % (uint64_t)source->dvr_capacity];
+    entry->arrival_us = frame->arrival_us;
+    entry->offset = offset;
+    entry->size = frame->size;
+    source->dvr_next = frame->number + 1;
+    pthread_mutex_unlock(&source->mutex);
+}
+
+// Put a copy of a complete frame into the ring. The slot's previous frame
+// is only freed here if no viewer is still sending it
+static void publish_frame(live_source_t *source, const uint8_t *data, size_t size, int width, int height) {
+    live_frame_t *frame = (live_frame_t *)malloc(sizeof(live_frame_t) + size);
+    if (frame == NULL) {
+        logger_log("live source %s: error allocating frame", source->name);
+        return;
+    }
+    atomic_init(&frame->refs, 1);
+    frame->arrival_us = metrics_now_us();
+    frame->size = size;
+    memcpy(frame->data, data, size);
+
+    // Only this thread replaces frames, so the one about to leave the ring
+    // can be spilled before it does: it is always in the ring or the window
+    live_frame_t **slot = &source->ring[source->next_number % (uint64_t)source->capacity];
+    if (source->segment != NULL && *slot != NULL) {
+        spill_frame(source, *slot);
+    }
+
+    pthread_mutex_lock(&source->mutex);
+    frame->number = source->next_number++;
+    live_frame_t *dropped = *slot;
+    *slot = frame;
+    source->total_bytes += size;
+    if (source->width == 0) {
+        source->width = width;
+        source->height = height;
+    }
+    pthread_cond_broadcast(&source->cond);
+    pthread_mutex_unlock(&source->mutex);
+
+    live_frame_release(dropped);
+    metrics_counter_add(METRIC_LIVE_FRAMES_RECEIVED, 1);
+}
+
+static void on_frame(const mjpeg_frame_t *frame, void *arg) {
+    live_source_t *source = (live_source_t *)arg;
+    publish_frame(source, source->pending + (frame->offset - source->pending_offset),
+        frame->size, frame->width, frame->height);
+}
+
+void live_feed(live_source_t *source, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        size_t chunk = len < LIVE_FEED_CHUNK ? len : LIVE_FEED_CHUNK;
+        memcpy(source->pending + source->pending_len, data, chunk);
+        mjpeg_framer_feed(&source->framer, source->pending + source->pending_len, chunk, on_frame, source);
+        source->pending_len += chunk;
+        data += chunk;
+        len -= chunk;
+
+        // Keep only the frame still being received
+        int64_t start = mjpeg_framer_pending_start(&source->framer);
+        uint64_t keep_from = start >= 0 ? (uint64_t)start : source->framer.position;
+        if (source->framer.position - keep_from > LIVE_MAX_FRAME_SIZE) {
+            logger_log("live source %s: frame over %d bytes dropped", source->name, LIVE_MAX_FRAME_SIZE);
+            mjpeg_framer_drop(&source->framer);
+            keep_from = source->framer.position;
+        }
+        size_t discard = (size_t)(keep_from - source->pending_offset);
+        memmove(source->pending, source->pending + discard, source->pending_len - discard);
+        source->pending_len -= discard;
+        source->pending_offset = keep_from;
+    }
+}
+
+static uint64_t ring_oldest_locked(const live_source_t *source) {
+    uint64_t capacity = (uint64_t)source->capacity;
+    return source->next_number > capacity ? source->next_number - capacity : 0;
+}
+
+static uint64_t oldest_locked(const live_source_t *source) {
+    return source->dvr_first < source->dvr_next ? source->dvr_first : ring_oldest_locked(source);
+}
+
+static uint64_t latest_locked(const live_source_t *source) {
+    return source->next_number > 0 ? source->next_number - 1 : 0;
+}
+
+// Arrival time of a frame in the window
+static uint64_t arrival_locked(const live_source_t *source, uint64_t number) {
+    if (number >= ring_oldest_locked(source)) {
+        return source->ring[number % (uint64_t)source->capacity]->arrival_us;
+    }
+    return source->dvr[number % (uint64_t)source->dvr_capacity].arrival_us;
+}
+
+int live_has_dvr(live_source_t *source) {
+    return source->segment != NULL;
+}
+
+uint64_t live_seek_frame(live_source_t *source, uint64_t number) {
+    pthread_mutex_lock(&source->mutex);
+    uint64_t oldest = oldest_locked(source);
+    uint64_t latest = latest_locked(source);
+    pthread_mutex_unlock(&source->mutex);
+    return number < oldest ? oldest : number > latest ? latest : number;
+}
+
+uint64_t live_seek_time(live_source_t *source, double seconds) {
+    uint64_t target_us = source->start_us + (uint64_t)(seconds > 0 ? seconds * 1000000 : 0);
+
+    // Arrival times only grow with the frame number
+    pthread_mutex_lock(&source->mutex);
+    uint64_t low = oldest_locked(source);
+    uint64_t high = latest_locked(source);
+    while (source->next_number > 0 && low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (arrival_locked(source, middle) < target_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    pthread_mutex_unlock(&source->mutex);
+    return low;
+}
+
+double live_avg_frame_size(live_source_t *source) {
+    pthread_mutex_lock(&source->mutex);
+    double avg = source->next_number > 0 ? (double)source->total_bytes / source->next_number : 0;
+    pthread_mutex_unlock(&source->mutex);
+    return avg;
+}
+
+void live_describe(live_source_t *source, int *width, int *height) {
+    pthread_mutex_lock(&source->mutex);
+    *width = source->width;
+    *height = source->height;
+    pthread_mutex_unlock(&source->mutex);
+}
+
+// Copy frame *cursor out of the segment, with the lock held on entry and
+// exit. The copy is made without it and kept only if the frame is still in
+// the window afterwards, a frame overwritten meanwhile leaves it first
+// Return the copy, or NULL if the frame left the window or on error
+static live_frame_t *read_dvr_frame(live_source_t *source, uint64_t number) {
+    live_dvr_entry_t entry = source->dvr[number % (uint64_t)source->dvr_capacity];
+    pthread_mutex_unlock(&source->mutex);
+
+    live_frame_t *frame = (live_frame_t *)malloc(sizeof(live_frame_t) + entry.size);
+    if (frame != NULL) {
+        atomic_init(&frame->refs, 1);
+        frame->number = number;
+        frame->arrival_us = entry.arrival_us;
+        frame->size = entry.size;
+        memcpy(frame->data, source->segment + entry.offset, entry.size);
+    }
+
+    pthread_mutex_lock(&source->mutex);
+    if (frame != NULL && number < source->dvr_first) {
+        free(frame);
+        frame = NULL;
+    }
+    return frame;
+}
+
+live_frame_t *live_next(live_source_t *source, uint64_t *cursor, int timeout_ms, int *ended) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    live_frame_t *frame = NULL;
+    pthread_mutex_lock(&source->mutex);
+    while (1) {
+        if (*cursor == LIVE_CURSOR_LATEST) {
+            *cursor = latest_locked(source);
+        }
+        if (*cursor < source->next_number) {
+            if (*cursor >= ring_oldest_locked(source)) {
+                frame = source->ring[*cursor % (uint64_t)source->capacity];
+                atomic_fetch_add(&frame->refs, 1);
+                (*cursor)++;
+                break;
+            }
+            if (*cursor >= source->dvr_first && *cursor < source->dvr_next) {
+                frame = read_dvr_frame(source, *cursor);
+                if (frame != NULL) {
+                    (*cursor)++;
+                    break;
+                }
+                if (*cursor >= source->dvr_first) {
+                    break; // out of memory, try again later
+                }
+                continue; // overwritten while copying
+            }
+
+            // Fell out of the window: skip ahead rather than slowing anyone
+            // else down, as little as time-shift allows
+            uint64_t target = latest_locked(source);
+            if (source->segment != NULL) {
+                uint64_t oldest = oldest_locked(source);
+                target = oldest > *cursor ? oldest : ring_oldest_locked(source);
+            }
+            metrics_counter_add(METRIC_LIVE_FRAMES_SKIPPED, target - *cursor);
+            *cursor = target;
+            continue;
+        }
+        if (source->ended) {
+            *ended = 1;
+            break;
+        }
+        if (pthread_cond_timedwait(&source->cond, &source->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&source->mutex);
+    return frame;
+}
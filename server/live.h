@@ -0,0 +1,144 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include "mjpeg_framer.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// "live/<name>" is a live source: a producer pushes JPEG frames into it with
+// ANNOUNCE and RECORD, and viewers play from the latest frame on
+#define LIVE_PREFIX "live/"
+
+// Frames a source keeps for its viewers, older ones are dropped
+#define LIVE_DEFAULT_RING_FRAMES 64
+
+// Largest frame accepted from a producer, the client's default buffer size
+#define LIVE_MAX_FRAME_SIZE 524288
+
+// Size of a source's time-shift segment file unless configured
+#define LIVE_DVR_DEFAULT_SEGMENT_MIB 64
+
+// Cursor value that starts a viewer at the latest frame
+#define LIVE_CURSOR_LATEST UINT64_MAX
+
+// A published frame, never modified. The ring holds one reference and each
+// viewer sending it another, so the producer never waits for a viewer
+typedef struct {
+    _Atomic int refs;
+    uint64_t number;     // 0 for the source's first frame
+    uint64_t arrival_us; // when it was published (metrics_now_us)
+    size_t size;
+    uint8_t data[];
+} live_frame_t;
+
+// Where a frame that left the ring is kept in the time-shift segment
+typedef struct {
+    uint64_t arrival_us;
+    size_t offset;
+    size_t size;
+} live_dvr_entry_t;
+
+typedef struct live_source {
+    char name[256];
+    int refcount; // producer and viewers, protected by the registry lock
+
+    double fps;   // announced by the producer
+    uint64_t start_us;
+
+    // Latest frames, protected by mutex. Frame n is in ring[n % capacity]
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // broadcast on each new frame and at the end
+    live_frame_t **ring;
+    int capacity;
+    uint64_t next_number;
+    uint64_t total_bytes;
+    int width;  // from the first frame's SOF marker, 0 until then
+    int height;
+    int ended;  // the producer is gone, no more frames will come
+
+    // Time-shift window: frames that leave the ring are copied, in order,
+    // into a memory mapped segment file used as a circular log, and indexed
+    // by number in dvr (frame n at dvr[n % dvr_capacity]). The window is
+    // frames [dvr_first, dvr_next), dvr_next is the ring's oldest frame.
+    // Protected by mutex, segment is NULL when time-shift is off
+    uint8_t *segment;
+    size_t segment_size;
+    size_t segment_head; // where the next frame is written
+    live_dvr_entry_t *dvr;
+    int dvr_capacity;
+    uint64_t dvr_first;
+    uint64_t dvr_next;
+
+    // Producer side, only used by the thread feeding the source
+    mjpeg_framer_t framer;
+    uint8_t *pending;        // bytes of the frame being received
+    size_t pending_len;
+    uint64_t pending_offset; // stream offset of pending[0]
+
+    struct live_source *next;
+} live_source_t;
+
+// Whether a request URL ("[rtsp://host/]live/<name>") names a live source
+int live_url_is_live(const char *url);
+
+// Frames each source keeps, for sources announced afterwards
+void live_set_ring_frames(int frames);
+
+// Bytes a source's ring can hold at most
+uint64_t live_ring_memory(void);
+
+// Keep up to seconds of each source announced afterwards for time-shifting,
+// in a segment file of segment_mib under $TMPDIR (default /var/tmp). The
+// file is unlinked at once, so it goes away with the source or the server
+void live_set_dvr(double seconds, int segment_mib);
+
+// Start a source for a producer, frames are then pushed with live_feed
+// Return the source, or NULL if name already has a producer or on error
+live_source_t *live_announce(const char *name, double fps);
+
+// The producer is done: viewers get the frames left, then the end
+void live_end(live_source_t *source);
+
+// Join the source a producer is pushing to name
+// Return the source, or NULL if there is none
+live_source_t *live_acquire(const char *name);
+
+// Leave a source, the last one out frees it
+void live_release(live_source_t *source);
+
+// Viewers holding the source, every reference but the producer's
+int live_viewer_count(live_source_t *source);
+
+// Push the next bytes of the producer's MJPEG stream (raw or length
+// prefixed). Every complete frame is published, older ones drop out
+void live_feed(live_source_t *source, const uint8_t *data, size_t len);
+
+// Whether viewers of the source can pause and seek within a window
+int live_has_dvr(live_source_t *source);
+
+// Cursor for frame number, or the nearest frame still in the window
+uint64_t live_seek_frame(live_source_t *source, uint64_t number);
+
+// Cursor for the first frame that arrived seconds after the source started,
+// or the nearest frame still in the window
+uint64_t live_seek_time(live_source_t *source, double seconds);
+
+// Average size of the frames pushed so far, 0 before the first
+double live_avg_frame_size(live_source_t *source);
+
+// Resolution of the source's frames, 0x0 before the first one
+void live_describe(live_source_t *source, int *width, int *height);
+
+// Wait up to timeout_ms for frame *cursor and advance the cursor past it.
+// LIVE_CURSOR_LATEST starts at the latest frame. A viewer so far behind
+// that its frame left the window skips to the oldest one still in it, or
+// to the latest without time-shift. Frames from the segment are copies
+// Return the frame (give it back with live_frame_release), or NULL on
+// timeout or once the source ended, which sets *ended
+live_frame_t *live_next(live_source_t *source, uint64_t *cursor, int timeout_ms, int *ended);
+
+void live_frame_release(live_frame_t *frame);
+
+#endif // LIVE_H
@@ -1,5 +1,20 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../common/logger.h"
+#include "async_io.h"
+#include "catalog.h"
+#include "channel.h"
+#include "congestion.h"
+#include "fec.h"
+#include "listener.h"
+#include "live.h"
+#include "metrics.h"
+#include "placement.h"
+#include "relay.h"
+#include "retransmit.h"
 #include "server_worker.h"
+#include "session_table.h"
+#include "video_stream.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -23,100 +38,199 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-#define BACKLOG 10
+// Threads doing blocking reads when io_uring is unavailable
+#define READ_POOL_THREADS 8
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m metrics_port] [-r fps] [-k read_ahead_frames] [-K] [-c cached_videos]\n"
+        "       [-C max_connections] [-S max_sessions] [-b egress_mbps] [-M frame_mib] [-T timeout_s]\n"
+        "       [-l listeners] [-B backlog] [-a] [-P] [-N nic] [-g group] [-L ttl] [-I if_addr]\n"
+        "       [-R live_ring_frames] [-D dvr_seconds] [-Z dvr_segment_mib]\n"
+        "       [-U upstream_host:port] [-W retransmit_packets] [-F fec_group] [-A] [port]\n", prog);
+    exit(EXIT_FAILURE);
+}
 
 int main(int argc, char *argv[]) {
     logger_init(LOG_SRC_SERVER);
     srand(time(NULL));
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s [port]\n", argv[0]);
-        exit(EXIT_FAILURE);
+    int metrics_port = 0;
+    int read_ahead = 0;
+    int force_read_pool = 0;
+    int place_sessions = 0;
+    const char *placement_nic = NULL;
+    const char *multicast_group = NULL;
+    const char *multicast_interface = NULL;
+    int multicast_ttl = CHANNEL_MULTICAST_DEFAULT_TTL;
+    double dvr_seconds = 0;
+    int dvr_segment_mib = LIVE_DVR_DEFAULT_SEGMENT_MIB;
+    session_limits_t limits;
+    memset(&limits, 0, sizeof(limits));
+    limits.timeout_s = SESSION_TABLE_DEFAULT_TIMEOUT_S;
+    listener_config_t listen_config;
+    memset(&listen_config, 0, sizeof(listen_config));
+    listen_config.count = 1;
+    listen_config.backlog = LISTENER_DEFAULT_BACKLOG;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "m:r:k:Kc:C:S:b:M:T:l:B:aPN:g:L:I:R:D:Z:U:W:F:A")) != -1) {
+        switch (opt_char) {
+        case 'm':
+            metrics_port = atoi(optarg);
+            break;
+        case 'r':
+            // Frame rate for videos without a sidecar index
+            if (atof(optarg) <= 0) {
+                fprintf(stderr, "Error: invalid frame rate\n");
+                exit(EXIT_FAILURE);
+            }
+            video_stream_set_default_fps(atof(optarg));
+            break;
+        case 'k':
+            read_ahead = atoi(optarg);
+            break;
+        case 'K':
+            // Use the pread thread pool even where io_uring works
+            force_read_pool = 1;
+            break;
+        case 'c':
+            // Videos kept open and indexed after their last session ends
+            catalog_set_capacity(atoi(optarg));
+            break;
+        case 'C':
+            limits.max_connections = atoi(optarg);
+            break;
+        case 'S':
+            limits.max_sessions = atoi(optarg);
+            break;
+        case 'b':
+            // Egress budget in Mbit/s
+            limits.max_egress_bps = (uint64_t)(atof(optarg) * 1000000);
+            break;
+        case 'M':
+            // Frame buffer budget in MiB
+            limits.max_frame_memory = (uint64_t)atol(optarg) * 1024 * 1024;
+            break;
+        case 'T':
+            // Idle seconds before a connection is closed, 0 keeps it forever
+            limits.timeout_s = atoi(optarg);
+            break;
+        case 'l':
+            // Accept threads, each with its own SO_REUSEPORT socket
+            listen_config.count = atoi(optarg);
+            if (listen_config.count < 1) {
+                fprintf(stderr, "Error: invalid listener count\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'B':
+            listen_config.backlog = atoi(optarg);
+            break;
+        case 'a':
+            // Pin listener i, and the sessions it accepts, to CPU i
+            listen_config.pin_cpus = 1;
+            break;
+        case 'P':
+            // Pin each session's threads to the least loaded core
+            place_sessions = 1;
+            break;
+        case 'N':
+            // Like -P, preferring cores on this network interface's node
+            place_sessions = 1;
+            placement_nic = optarg;
+            break;
+        case 'g':
+            // First multicast group for channels, enables multicast SETUP
+            multicast_group = optarg;
+            break;
+        case 'L':
+            multicast_ttl = atoi(optarg);
+            break;
+        case 'I':
+            // Address of the interface multicast is sent from
+            multicast_interface = optarg;
+            break;
+        case 'R':
+            // Frames each live source keeps for its viewers
+            live_set_ring_frames(atoi(optarg));
+            break;
+        case 'D':
+            // Seconds of each live source kept for pausing and seeking
+            dvr_seconds = atof(optarg);
+            break;
+        case 'Z':
+            // Time-shift segment file size per live source
+            dvr_segment_mib = atoi(optarg);
+            break;
+        case 'U':
+            // Upstream server "relay/<path>" pulls from
+            if (relay_set_upstream(optarg) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'W':
+            // Packets each session keeps for retransmission, 0 turns it off
+            retransmit_set_packets(atoi(optarg));
+            break;
+        case 'F':
+            // Fragments per parity packet, 0 (the default) sends none
+            fec_set_group(atoi(optarg));
+            break;
+        case 'A':
+            // Send every frame whatever loss the clients report
+            congestion_set_adaptive(0);
+            break;
+        default:
+            usage(argv[0]);
+        }
     }
-    int server_port = atoi(argv[1]);
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    int server_port = atoi(argv[optind]);
     if (server_port <= 0) {
         fprintf(stderr, "Error: invalid port number\n");
         exit(EXIT_FAILURE);
     }
+    listen_config.port = server_port;
     logger_log("server starting up");
 
-    int server_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket_fd < 0) {
-        logger_log("error creating socket");
-        exit(EXIT_FAILURE);
+    // Metrics are optional, the server runs fine without the endpoint
+    if (metrics_port > 0 && metrics_start_http(metrics_port) != 0) {
+        logger_log("warning: metrics endpoint disabled");
     }
 
-    // Set the SO_REUSEADDR option, allow restarting the server immediately
-    // without waiting for the OS to the free the port
-    int opt = 1;
-    if (setsockopt(server_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        logger_log("error setting socket options");
+    if (session_table_init(&limits) != 0) {
         exit(EXIT_FAILURE);
     }
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(server_port);
-
-    if (bind(server_socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        logger_log("error binding socket");
-        exit(EXIT_FAILURE);
+    if (dvr_seconds > 0) {
+        live_set_dvr(dvr_seconds, dvr_segment_mib);
     }
 
-    if (listen(server_socket_fd, BACKLOG) < 0) {
-        logger_log("error listening on socket");
+    if (multicast_group != NULL &&
+        channel_set_multicast(multicast_group, multicast_ttl, multicast_interface) != 0) {
         exit(EXIT_FAILURE);
     }
 
-    logger_log("server listening on port %d", server_port);
-
-    while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-
-        // Blocking here, waiting for new client to connect
-        int client_socket_fd = accept(
-            server_socket_fd, (struct sockaddr *)&client_addr, &client_len
-        );
-        if (client_socket_fd < 0) {
-            logger_log("error accepting connection");
-            continue;
-        }
-
-        // WHEN CLIENT CONNECTED
-        session_t *session = (session_t *)malloc(sizeof(session_t));
-        if (session == NULL) {
-            logger_log("error allocating memory for session");
-            close(client_socket_fd);
-            continue;
-        }
+    if (place_sessions && placement_init(placement_nic) != 0) {
+        logger_log("warning: session placement disabled");
+    }
 
-        session->rtsp_socket_fd = client_socket_fd;
-        session->client_addr = client_addr;
-        session->state = STATE_INIT;
-        session->session_id = 0;
-        logger_log("new connection from %s:%d",
-            inet_ntoa(client_addr.sin_addr),
-            ntohs(client_addr.sin_port)
-        );
-
-        // SPAWN SERVER WORKER THREAD
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, server_worker_thread, (void*)session) != 0) {
-            logger_log("error creating client thread");
-            close(client_socket_fd);
-            free(session);
-            continue;
+    // Read-ahead is optional too, without the engine frames are read in place
+    if (read_ahead > 0) {
+        if (async_io_init(force_read_pool, READ_POOL_THREADS) == 0) {
+            server_worker_set_read_ahead(read_ahead);
+        } else {
+            logger_log("warning: read-ahead disabled");
         }
+    }
 
-        // This thread will now run independently
-        pthread_detach(thread_id);
+    if (listener_run(&listen_config) != 0) {
+        exit(EXIT_FAILURE);
     }
 
     // This code is never reached in this design
-    close(server_socket_fd);
     logger_log("server shutting down");
     return EXIT_SUCCESS;
 }
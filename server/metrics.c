@@ -0,0 +1,399 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "metrics.h"
+#include "../common/logger.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Every thread that records a metric claims one shard for its lifetime.
+// RTP threads come and go with PLAY/PAUSE, so shards are recycled on thread
+// exit; totals survive because counters are only ever added to. Shards are
+// allocated as threads need them, so there are as many as threads ever ran
+// at once
+#define METRICS_RENDER_BUFFER_SIZE (256 * 1024)
+#define METRICS_HTTP_BACKLOG 4
+
+typedef struct {
+    _Atomic uint64_t buckets[METRICS_HIST_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+} metrics_hist_shard_t;
+
+// Aligned to a cache line so two sender threads never share one
+typedef struct metrics_shard {
+    _Alignas(64) _Atomic int in_use;
+    struct metrics_shard *next; // set before the shard is published
+    _Atomic uint64_t counters[METRIC_COUNTER_COUNT];
+    metrics_hist_shard_t hists[METRIC_HIST_COUNT];
+} metrics_shard_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+} metric_desc_t;
+
+static const metric_desc_t g_counter_desc[METRIC_COUNTER_COUNT] = {
+    [METRIC_SESSIONS_OPENED] = {"streamsrv_sessions_opened_total", "RTSP connections accepted"},
+    [METRIC_SESSIONS_CLOSED] = {"streamsrv_sessions_closed_total", "RTSP connections closed"},
+    [METRIC_FRAMES_SENT] = {"streamsrv_frames_sent_total", "Video frames sent over RTP"},
+    [METRIC_PACKETS_SENT] = {"streamsrv_packets_sent_total", "RTP packets sent"},
+    [METRIC_BYTES_SENT] = {"streamsrv_bytes_sent_total", "RTP bytes sent, headers included"},
+    [METRIC_SEND_ERRORS] = {"streamsrv_send_errors_total", "Failed RTP sendto calls"},
+    [METRIC_SEEKS] = {"streamsrv_seeks_total", "Seeks served from PLAY requests"},
+    [METRIC_CACHE_HITS] = {"streamsrv_cache_hits_total", "Lookups served from a server cache"},
+    [METRIC_CACHE_MISSES] = {"streamsrv_cache_misses_total", "Lookups that had to go to disk"},
+    [METRIC_CONNECTIONS_REJECTED] = {"streamsrv_connections_rejected_total",
+                                     "Connections closed because the session table was full"},
+    [METRIC_SETUPS_REJECTED] = {"streamsrv_setups_rejected_total",
+                                "SETUPs refused by admission control"},
+    [METRIC_SESSIONS_REAPED] = {"streamsrv_sessions_reaped_total",
+                                "Connections closed after the session timeout"},
+    [METRIC_LIVE_FRAMES_RECEIVED] = {"streamsrv_live_frames_received_total",
+                                     "Frames pushed by live producers"},
+    [METRIC_LIVE_FRAMES_SKIPPED] = {"streamsrv_live_frames_skipped_total",
+                                    "Live frames slow viewers skipped to catch up"},
+    [METRIC_RETRANSMITS] = {"streamsrv_rtp_retransmits_total",
+                            "RTP packets sent again for a client NACK"},
+    [METRIC_RETRANSMIT_MISSES] = {"streamsrv_rtp_retransmit_misses_total",
+                                  "NACKed packets no longer kept for retransmission"},
+    [METRIC_FEC_PACKETS_SENT] = {"streamsrv_fec_packets_sent_total",
+                                 "Parity packets sent for forward error correction"},
+    [METRIC_FRAMES_SKIPPED] = {"streamsrv_frames_skipped_total",
+                               "Frames congestion control kept off a congested link"},
+};
+
+static const metric_desc_t g_hist_desc[METRIC_HIST_COUNT] = {
+    [METRIC_HIST_PACING_LATENESS_US] = {"streamsrv_pacing_lateness_us",
+                                        "How late the sender woke up for a frame"},
+    [METRIC_HIST_SEEK_LATENCY_US] = {"streamsrv_seek_latency_us",
+                                     "Time to reposition a stream for a seek"},
+    [METRIC_HIST_FRAME_READ_US] = {"streamsrv_frame_read_us",
+                                   "Time the sender waited for a frame from disk"},
+    [METRIC_HIST_RTT_US] = {"streamsrv_rtcp_rtt_us",
+                            "Round trip times from clients' RTCP receiver reports"},
+};
+
+// Every shard ever allocated, newest first. Shards are never freed, so the
+// scraper walks the list without a lock
+static metrics_shard_t g_first_shard;
+static metrics_shard_t *_Atomic g_shards = &g_first_shard;
+static _Thread_local metrics_shard_t *t_shard;
+static pthread_key_t g_shard_key;
+static pthread_once_t g_shard_once = PTHREAD_ONCE_INIT;
+static _Atomic metrics_render_cb_t g_render_callback;
+
+static void release_shard(void *arg) {
+    metrics_shard_t *shard = (metrics_shard_t *)arg;
+    atomic_store_explicit(&shard->in_use, 0, memory_order_release);
+}
+
+static void init_shard_key(void) {
+    pthread_key_create(&g_shard_key, release_shard);
+}
+
+// Claim a free shard for the calling thread (only runs once per thread)
+static metrics_shard_t *claim_shard(void) {
+    pthread_once(&g_shard_once, init_shard_key);
+
+    // One a finished thread released
+    metrics_shard_t *shard = atomic_load_explicit(&g_shards, memory_order_acquire);
+    for (; shard != NULL; shard = shard->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&shard->in_use, &expected, 1)) {
+            pthread_setspecific(g_shard_key, shard);
+            return shard;
+        }
+    }
+
+    // Every shard is owned: add one
+    shard = (metrics_shard_t *)aligned_alloc(_Alignof(metrics_shard_t), sizeof(metrics_shard_t));
+    if (shard == NULL) {
+        // Share the first one. Updates are atomic so this is still correct,
+        // it just stops being contention free
+        logger_log("error allocating metrics shard");
+        return &g_first_shard;
+    }
+    memset(shard, 0, sizeof(*shard));
+    atomic_init(&shard->in_use, 1);
+    shard->next = atomic_load_explicit(&g_shards, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&g_shards, &shard->next, shard,
+                                                  memory_order_release, memory_order_relaxed)) {
+    }
+    pthread_setspecific(g_shard_key, shard);
+    return shard;
+}
+
+static inline metrics_shard_t *get_shard(void) {
+    if (t_shard == NULL) {
+        t_shard = claim_shard();
+    }
+    return t_shard;
+}
+
+static int hist_bucket(uint64_t value) {
+    if (value < METRICS_HIST_SUB_COUNT) {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= METRICS_HIST_MAX_BITS) {
+        return METRICS_HIST_BUCKETS - 1;
+    }
+    int sub = (int)((value >> (msb - METRICS_HIST_SUB_BITS)) & (METRICS_HIST_SUB_COUNT - 1));
+    return (msb - METRICS_HIST_SUB_BITS + 1) * METRICS_HIST_SUB_COUNT + sub;
+}
+
+// Largest value that falls in the given bucket
+static uint64_t hist_bucket_upper(int index) {
+    if (index < METRICS_HIST_SUB_COUNT) {
+        return (uint64_t)index;
+    }
+    int group = index / METRICS_HIST_SUB_COUNT;
+    int sub = index % METRICS_HIST_SUB_COUNT;
+    return ((uint64_t)(METRICS_HIST_SUB_COUNT + sub + 1) << (group - 1)) - 1;
+}
+
+void metrics_counter_add(metric_counter_t id, uint64_t value) {
+    metrics_shard_t *shard = get_shard();
+    atomic_fetch_add_explicit(&shard->counters[id], value, memory_order_relaxed);
+}
+
+void metrics_hist_record(metric_hist_t id, uint64_t value) {
+    metrics_hist_shard_t *hist = &get_shard()->hists[id];
+    atomic_fetch_add_explicit(&hist->buckets[hist_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t len;
+} render_buffer_t;
+
+static void render_append(render_buffer_t *out, const char *format, ...) {
+    if (out->len >= out->size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(out->data + out->len, out->size - out->len, format, args);
+    va_end(args);
+
+    if (written > 0) {
+        out->len += (size_t)written;
+        if (out->len > out->size - 1) {
+            out->len = out->size - 1; // truncated
+        }
+    }
+}
+
+static uint64_t hist_quantile(const uint64_t *buckets, uint64_t count, double quantile) {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(quantile * (double)count);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return hist_bucket_upper(i);
+        }
+    }
+    return hist_bucket_upper(METRICS_HIST_BUCKETS - 1);
+}
+
+static void render_hist(render_buffer_t *out, metric_hist_t id) {
+    uint64_t buckets[METRICS_HIST_BUCKETS] = {0};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    metrics_shard_t *shard = atomic_load_explicit(&g_shards, memory_order_acquire);
+    for (; shard != NULL; shard = shard->next) {
+        metrics_hist_shard_t *hist = &shard->hists[id];
+        for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+            buckets[i] += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        }
+        count += atomic_load_explicit(&hist->count, memory_order_relaxed);
+        sum += atomic_load_explicit(&hist->sum, memory_order_relaxed);
+    }
+
+    const char *name = g_hist_desc[id].name;
+    render_append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, g_hist_desc[id].help, name);
+
+    // Only expose one boundary per power of two, the sub-buckets are too
+    // fine grained to be useful as Prometheus series
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        cumulative += buckets[i];
+        if (i % METRICS_HIST_SUB_COUNT == METRICS_HIST_SUB_COUNT - 1) {
+            render_append(out, "%s_bucket{le=\"%llu\"} %llu\n",
+                name, (unsigned long long)hist_bucket_upper(i), (unsigned long long)cumulative);
+        }
+    }
+    render_append(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+    render_append(out, "%s_sum %llu\n%s_count %llu\n",
+        name, (unsigned long long)sum, name, (unsigned long long)count);
+
+    // Precise quantiles from the full resolution buckets
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    render_append(out, "# TYPE %s_quantile gauge\n", name);
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        render_append(out, "%s_quantile{quantile=\"%g\"} %llu\n",
+            name, quantiles[q], (unsigned long long)hist_quantile(buckets, count, quantiles[q]));
+    }
+}
+
+size_t metrics_render(char *buffer, size_t buffer_size) {
+    render_buffer_t out = {buffer, buffer_size, 0};
+    if (buffer_size == 0) {
+        return 0;
+    }
+    buffer[0] = '\0';
+
+    uint64_t totals[METRIC_COUNTER_COUNT] = {0};
+    metrics_shard_t *shard = atomic_load_explicit(&g_shards, memory_order_acquire);
+    for (; shard != NULL; shard = shard->next) {
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+            totals[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+        }
+    }
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        const char *name = g_counter_desc[i].name;
+        render_append(&out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+            name, g_counter_desc[i].help, name, name, (unsigned long long)totals[i]);
+    }
+
+    // Derived gauge, cheaper than keeping a shared up/down counter
+    uint64_t active = totals[METRIC_SESSIONS_OPENED] - totals[METRIC_SESSIONS_CLOSED];
+    render_append(&out, "# HELP streamsrv_sessions_active RTSP connections currently open\n"
+                        "# TYPE streamsrv_sessions_active gauge\n"
+                        "streamsrv_sessions_active %llu\n",
+        (unsigned long long)active);
+
+    for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+        render_hist(&out, (metric_hist_t)i);
+    }
+
+    metrics_render_cb_t render = atomic_load(&g_render_callback);
+    if (render != NULL && out.len < out.size - 1) {
+        out.len += render(out.data + out.len, out.size - out.len);
+    }
+    return out.len;
+}
+
+void metrics_set_render_callback(metrics_render_cb_t render) {
+    atomic_store(&g_render_callback, render);
+}
+
+static void serve_http_request(int client_fd, char *body_buffer) {
+    char request[1024];
+    ssize_t bytes_read = read(client_fd, request, sizeof(request) - 1);
+    if (bytes_read <= 0) {
+        return;
+    }
+    request[bytes_read] = '\0';
+
+    char header[256];
+    if (strncmp(request, "GET /metrics", 12) != 0) {
+        int len = snprintf(header, sizeof(header),
+            "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        send(client_fd, header, len, 0);
+        return;
+    }
+
+    size_t body_len = metrics_render(body_buffer, METRICS_RENDER_BUFFER_SIZE);
+    int len = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n",
+        body_len);
+    send(client_fd, header, len, 0);
+    send(client_fd, body_buffer, body_len, 0);
+}
+
+static void *metrics_http_thread(void *arg) {
+    int listen_fd = (int)(intptr_t)arg;
+
+    // Scrapes are rare, so a single reusable render buffer is enough
+    char *body_buffer = (char *)malloc(METRICS_RENDER_BUFFER_SIZE);
+    if (body_buffer == NULL) {
+        logger_log("error allocating metrics buffer");
+        close(listen_fd);
+        return NULL;
+    }
+
+    while (1) {
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logger_log("error accepting metrics connection: %s", strerror(errno));
+            break;
+        }
+        serve_http_request(client_fd, body_buffer);
+        close(client_fd);
+    }
+
+    free(body_buffer);
+    close(listen_fd);
+    return NULL;
+}
+
+int metrics_start_http(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        logger_log("error creating metrics socket: %s", strerror(errno));
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Local only, the endpoint has no authentication
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, METRICS_HTTP_BACKLOG) < 0) {
+        logger_log("error binding metrics endpoint on port %d: %s", port, strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, metrics_http_thread, (void *)(intptr_t)listen_fd) != 0) {
+        logger_log("error creating metrics thread");
+        close(listen_fd);
+        return -1;
+    }
+    pthread_detach(thread_id);
+
+    logger_log("metrics available at http://127.0.0.1:%d/metrics", port);
+    return 0;
+}
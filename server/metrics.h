@@ -0,0 +1,67 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Monotonic counters, summed across all per-thread shards when scraped
+typedef enum {
+    METRIC_SESSIONS_OPENED,
+    METRIC_SESSIONS_CLOSED,
+    METRIC_FRAMES_SENT,
+    METRIC_PACKETS_SENT,
+    METRIC_BYTES_SENT,
+    METRIC_SEND_ERRORS,
+    METRIC_SEEKS,
+    METRIC_CACHE_HITS,
+    METRIC_CACHE_MISSES,
+    METRIC_CONNECTIONS_REJECTED,
+    METRIC_SETUPS_REJECTED,
+    METRIC_SESSIONS_REAPED,
+    METRIC_LIVE_FRAMES_RECEIVED,
+    METRIC_LIVE_FRAMES_SKIPPED,
+    METRIC_RETRANSMITS,
+    METRIC_RETRANSMIT_MISSES,
+    METRIC_FEC_PACKETS_SENT,
+    METRIC_FRAMES_SKIPPED,
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+// Latency histograms, values recorded in microseconds
+typedef enum {
+    METRIC_HIST_PACING_LATENESS_US,
+    METRIC_HIST_SEEK_LATENCY_US,
+    METRIC_HIST_FRAME_READ_US,
+    METRIC_HIST_RTT_US,
+    METRIC_HIST_COUNT
+} metric_hist_t;
+
+// HDR-style log-linear buckets: 8 sub-buckets per power of two, which keeps
+// the relative error under 12.5% for any recorded value
+#define METRICS_HIST_SUB_BITS 3
+#define METRICS_HIST_SUB_COUNT (1 << METRICS_HIST_SUB_BITS)
+#define METRICS_HIST_MAX_BITS 36 // values above ~19 hours are clamped
+#define METRICS_HIST_BUCKETS ((METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 1) * METRICS_HIST_SUB_COUNT)
+
+// These never take a lock: each thread writes into its own shard
+void metrics_counter_add(metric_counter_t id, uint64_t value);
+void metrics_hist_record(metric_hist_t id, uint64_t value);
+
+// Microseconds from a monotonic clock, for latency measurements
+uint64_t metrics_now_us(void);
+
+// Render every metric in Prometheus text format into buffer
+// Return the number of bytes written (output is truncated to buffer_size)
+size_t metrics_render(char *buffer, size_t buffer_size);
+
+// Add series to every rendering, written by render into buffer after the
+// built-in ones
+// Return the number of bytes written (output is truncated to buffer_size)
+typedef size_t (*metrics_render_cb_t)(char *buffer, size_t buffer_size);
+void metrics_set_render_callback(metrics_render_cb_t render);
+
+// Serve "GET /metrics" over HTTP on 127.0.0.1:port from a background thread
+// Return 0 on success, -1 on error
+int metrics_start_http(int port);
+
+#endif // METRICS_H
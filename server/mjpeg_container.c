@@ -0,0 +1,52 @@
+#include "mjpeg_container.h"
+#include "../common/byte_order.h"
+
+#include <string.h>
+
+// File header layout:
+// 0: magic "MJV2", 4: version, 8: fps numerator, 12: fps denominator,
+// 16: width, 20: height, 24: frame count, 28: largest frame,
+// 32: index offset, 40: reserved up to MJPEG_CONTAINER_HEADER_SIZE
+
+void mjpeg_container_encode_header(uint8_t *buf, const mjpeg_container_header_t *header) {
+    memset(buf, 0, MJPEG_CONTAINER_HEADER_SIZE);
+    memcpy(buf, MJPEG_CONTAINER_MAGIC, 4);
+    write_le32(buf + 4, MJPEG_CONTAINER_VERSION);
+    write_le32(buf + 8, header->fps_num);
+    write_le32(buf + 12, header->fps_den);
+    write_le32(buf + 16, header->width);
+    write_le32(buf + 20, header->height);
+    write_le32(buf + 24, header->frame_count);
+    write_le32(buf + 28, header->max_frame_size);
+    write_le64(buf + 32, header->index_offset);
+}
+
+int mjpeg_container_decode_header(const uint8_t *buf, mjpeg_container_header_t *header) {
+    if (memcmp(buf, MJPEG_CONTAINER_MAGIC, 4) != 0 || read_le32(buf + 4) != MJPEG_CONTAINER_VERSION) {
+        return -1;
+    }
+    header->fps_num = read_le32(buf + 8);
+    header->fps_den = read_le32(buf + 12);
+    header->width = read_le32(buf + 16);
+    header->height = read_le32(buf + 20);
+    header->frame_count = read_le32(buf + 24);
+    header->max_frame_size = read_le32(buf + 28);
+    header->index_offset = read_le64(buf + 32);
+    return 0;
+}
+
+void mjpeg_container_encode_frame_header(uint8_t *buf, uint32_t frame_number, uint32_t payload_size) {
+    memcpy(buf, MJPEG_CONTAINER_FRAME_MAGIC, 4);
+    write_le32(buf + 4, frame_number);
+    write_le32(buf + 8, payload_size);
+    write_le32(buf + 12, 0);
+}
+
+int mjpeg_container_decode_frame_header(const uint8_t *buf, uint32_t *frame_number, uint32_t *payload_size) {
+    if (memcmp(buf, MJPEG_CONTAINER_FRAME_MAGIC, 4) != 0) {
+        return -1;
+    }
+    *frame_number = read_le32(buf + 4);
+    *payload_size = read_le32(buf + 8);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef MJPEG_CONTAINER_H
+#define MJPEG_CONTAINER_H
+
+#include <stdint.h>
+
+// Binary MJPEG container, all fields little-endian:
+//
+//   0                 file header (MJPEG_CONTAINER_HEADER_SIZE bytes), the
+//                     rest of the first block is zero
+//   payload - 16      frame header: magic "MJFR", frame number, payload size,
+//                     reserved
+//   payload           JPEG data, starting on an MJPEG_CONTAINER_ALIGN boundary
+//   index_offset      one {u64 payload offset, u32 size, u32 reserved} entry
+//                     per frame, also aligned
+//
+// Aligned payloads let a frame be read with one pread, or with O_DIRECT into
+// an aligned buffer. The frame headers make the file recoverable without its
+// index
+#define MJPEG_CONTAINER_MAGIC "MJV2"
+#define MJPEG_CONTAINER_VERSION 2
+#define MJPEG_CONTAINER_ALIGN 4096
+#define MJPEG_CONTAINER_HEADER_SIZE 64
+
+#define MJPEG_CONTAINER_FRAME_MAGIC "MJFR"
+#define MJPEG_CONTAINER_FRAME_HEADER_SIZE 16
+#define MJPEG_CONTAINER_INDEX_ENTRY_SIZE 16
+
+typedef struct {
+    uint32_t fps_num;
+    uint32_t fps_den;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_count;
+    uint32_t max_frame_size;
+    uint64_t index_offset;
+} mjpeg_container_header_t;
+
+// Round an offset up to the next MJPEG_CONTAINER_ALIGN boundary
+static inline uint64_t mjpeg_container_align(uint64_t offset) {
+    return (offset + MJPEG_CONTAINER_ALIGN - 1) & ~(uint64_t)(MJPEG_CONTAINER_ALIGN - 1);
+}
+
+// Offset of the next payload when the previous record ended at `end`,
+// leaving room for its frame header
+static inline uint64_t mjpeg_container_next_payload(uint64_t end) {
+    return mjpeg_container_align(end + MJPEG_CONTAINER_FRAME_HEADER_SIZE);
+}
+
+void mjpeg_container_encode_header(uint8_t *buf, const mjpeg_container_header_t *header);
+
+// Return 0 if buf holds a container header of a supported version, -1 otherwise
+int mjpeg_container_decode_header(const uint8_t *buf, mjpeg_container_header_t *header);
+
+void mjpeg_container_encode_frame_header(uint8_t *buf, uint32_t frame_number, uint32_t payload_size);
+
+// Return 0 if buf holds a frame header, -1 otherwise
+int mjpeg_container_decode_frame_header(const uint8_t *buf, uint32_t *frame_number, uint32_t *payload_size);
+
+#endif // MJPEG_CONTAINER_H
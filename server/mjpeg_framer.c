@@ -0,0 +1,190 @@
+#include "mjpeg_framer.h"
+
+#include <string.h>
+
+enum {
+    FRAMER_SEEK_SOI,     // between frames, looking for FF
+    FRAMER_SEEK_SOI_D8,  // saw FF, expecting D8
+    FRAMER_MARKER,       // expecting the FF of the next marker
+    FRAMER_MARKER_CODE,  // saw FF, expecting the marker code
+    FRAMER_LENGTH_HI,
+    FRAMER_LENGTH_LO,
+    FRAMER_SEGMENT,      // skipping a marker segment
+    FRAMER_ENTROPY,      // inside entropy-coded scan data
+    FRAMER_ENTROPY_FF    // saw FF inside scan data
+};
+
+// SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+static int is_sof(uint8_t marker) {
+    return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+void mjpeg_framer_init(mjpeg_framer_t *framer) {
+    memset(framer, 0, sizeof(mjpeg_framer_t));
+    framer->state = FRAMER_SEEK_SOI;
+}
+
+static void start_frame(mjpeg_framer_t *framer, uint64_t soi_offset) {
+    framer->frame_start = soi_offset;
+    framer->has_sof = 0;
+    framer->width = 0;
+    framer->height = 0;
+    framer->state = FRAMER_MARKER;
+}
+
+static void drop_frame(mjpeg_framer_t *framer) {
+    framer->invalid_frames++;
+    framer->state = FRAMER_SEEK_SOI;
+}
+
+// Handle the code byte of a marker, pos is the offset of that byte
+static void handle_marker(mjpeg_framer_t *framer, uint8_t code, uint64_t pos, mjpeg_frame_cb_t on_frame, void *arg) {
+    if (code == 0xD8) {
+        // A new frame before the previous one ended
+        drop_frame(framer);
+        start_frame(framer, pos - 1);
+    } else if (code == 0xD9) {
+        // A frame needs a frame header and scan data before its EOI
+        if (!framer->has_sof || framer->state != FRAMER_ENTROPY_FF) {
+            drop_frame(framer);
+            return;
+        }
+        mjpeg_frame_t frame;
+        frame.offset = framer->frame_start;
+        frame.size = (uint32_t)(pos + 1 - framer->frame_start);
+        frame.width = framer->width;
+        frame.height = framer->height;
+        framer->frames++;
+        framer->state = FRAMER_SEEK_SOI;
+        if (on_frame != NULL) {
+            on_frame(&frame, arg);
+        }
+    } else if (code == 0x01 || (code >= 0xD0 && code <= 0xD7)) {
+        framer->state = FRAMER_MARKER; // standalone marker, no length
+    } else if (code == 0x00) {
+        drop_frame(framer);
+    } else {
+        framer->marker = code;
+        framer->state = FRAMER_LENGTH_HI;
+    }
+}
+
+// The segment of framer->marker has been read completely
+static void end_segment(mjpeg_framer_t *framer) {
+    if (is_sof(framer->marker) && framer->sof_len == (int)sizeof(framer->sof)) {
+        framer->height = (framer->sof[1] << 8) | framer->sof[2];
+        framer->width = (framer->sof[3] << 8) | framer->sof[4];
+        framer->has_sof = 1;
+    }
+    framer->state = framer->marker == 0xDA ? FRAMER_ENTROPY : FRAMER_MARKER;
+}
+
+void mjpeg_framer_feed(mjpeg_framer_t *framer,
+                       const uint8_t *data,
+                       size_t len,
+                       mjpeg_frame_cb_t on_frame,
+                       void *arg) {
+    size_t i = 0;
+    while (i < len) {
+        uint64_t pos = framer->position + i;
+        uint8_t byte = data[i];
+
+        switch (framer->state) {
+        case FRAMER_SEEK_SOI: {
+            const uint8_t *ff = memchr(data + i, 0xFF, len - i);
+            size_t skip = ff != NULL ? (size_t)(ff - (data + i)) : len - i;
+            framer->skipped_bytes += skip;
+            i += skip;
+            if (ff != NULL) {
+                framer->state = FRAMER_SEEK_SOI_D8;
+                i++;
+            }
+            continue;
+        }
+        case FRAMER_SEEK_SOI_D8:
+            if (byte == 0xD8) {
+                start_frame(framer, pos - 1);
+            } else if (byte != 0xFF) {
+                framer->skipped_bytes += 2;
+                framer->state = FRAMER_SEEK_SOI;
+            }
+            break;
+        case FRAMER_MARKER:
+            if (byte == 0xFF) {
+                framer->state = FRAMER_MARKER_CODE;
+            } else {
+                drop_frame(framer);
+            }
+            break;
+        case FRAMER_MARKER_CODE:
+            if (byte != 0xFF) { // FF fill bytes may precede the code
+                handle_marker(framer, byte, pos, on_frame, arg);
+            }
+            break;
+        case FRAMER_LENGTH_HI:
+            framer->remaining = (uint32_t)byte << 8;
+            framer->state = FRAMER_LENGTH_LO;
+            break;
+        case FRAMER_LENGTH_LO:
+            framer->remaining |= byte;
+            if (framer->remaining < 2) {
+                drop_frame(framer);
+                break;
+            }
+            framer->remaining -= 2;
+            framer->sof_len = 0;
+            if (framer->remaining == 0) {
+                end_segment(framer);
+            } else {
+                framer->state = FRAMER_SEGMENT;
+            }
+            break;
+        case FRAMER_SEGMENT: {
+            size_t n = len - i < framer->remaining ? len - i : framer->remaining;
+            // The segment may be split across chunks
+            for (size_t k = 0; is_sof(framer->marker) && framer->sof_len < (int)sizeof(framer->sof) && k < n; k++) {
+                framer->sof[framer->sof_len++] = data[i + k];
+            }
+            framer->remaining -= (uint32_t)n;
+            i += n;
+            if (framer->remaining == 0) {
+                end_segment(framer);
+            }
+            continue;
+        }
+        case FRAMER_ENTROPY: {
+            const uint8_t *ff = memchr(data + i, 0xFF, len - i);
+            if (ff == NULL) {
+                i = len;
+                continue;
+            }
+            i = (size_t)(ff - data) + 1;
+            framer->state = FRAMER_ENTROPY_FF;
+            continue;
+        }
+        case FRAMER_ENTROPY_FF:
+            if (byte == 0x00 || (byte >= 0xD0 && byte <= 0xD7)) {
+                framer->state = FRAMER_ENTROPY; // stuffed byte or restart marker
+            } else if (byte != 0xFF) {
+                // End of scan: EOI, or tables and another scan (progressive)
+                handle_marker(framer, byte, pos, on_frame, arg);
+            }
+            break;
+        }
+        i++;
+    }
+    framer->position += len;
+}
+
+int64_t mjpeg_framer_pending_start(const mjpeg_framer_t *framer) {
+    if (framer->state == FRAMER_SEEK_SOI || framer->state == FRAMER_SEEK_SOI_D8) {
+        return -1;
+    }
+    return (int64_t)framer->frame_start;
+}
+
+void mjpeg_framer_drop(mjpeg_framer_t *framer) {
+    if (mjpeg_framer_pending_start(framer) >= 0) {
+        drop_frame(framer);
+    }
+}
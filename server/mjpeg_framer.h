@@ -0,0 +1,55 @@
+#ifndef MJPEG_FRAMER_H
+#define MJPEG_FRAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental JPEG framer: bytes are fed in chunks of any size and every
+// complete, well-formed frame (SOI through EOI) is reported with its offset
+// in the stream. Marker segments are skipped by their length, so thumbnails
+// inside APPn segments don't end a frame early. Bytes outside frames, like
+// ASCII length prefixes, are skipped
+typedef struct {
+    uint64_t offset; // stream offset of the SOI marker
+    uint32_t size;   // bytes up to and including the EOI marker
+    int width;       // from the SOF marker
+    int height;
+} mjpeg_frame_t;
+
+typedef void (*mjpeg_frame_cb_t)(const mjpeg_frame_t *frame, void *arg);
+
+typedef struct {
+    int state;
+    uint64_t position;    // stream offset of the next byte fed
+    uint64_t frame_start; // SOI offset of the frame being parsed
+    uint8_t marker;       // marker whose segment is being read
+    uint32_t remaining;   // bytes left in the current segment
+    uint8_t sof[5];       // first bytes of the SOF segment
+    int sof_len;
+    int has_sof;
+    int width;
+    int height;
+
+    // Statistics
+    uint64_t frames;
+    uint64_t invalid_frames; // frames dropped for a malformed marker structure
+    uint64_t skipped_bytes;  // bytes outside of any frame
+} mjpeg_framer_t;
+
+void mjpeg_framer_init(mjpeg_framer_t *framer);
+
+// Feed the next chunk of the stream, calling on_frame for each frame that
+// ends inside it
+void mjpeg_framer_feed(mjpeg_framer_t *framer,
+                       const uint8_t *data,
+                       size_t len,
+                       mjpeg_frame_cb_t on_frame,
+                       void *arg);
+
+// Stream offset of the frame being parsed, or -1 if between frames
+int64_t mjpeg_framer_pending_start(const mjpeg_framer_t *framer);
+
+// Give up on the frame being parsed, e.g. because it grew too large
+void mjpeg_framer_drop(mjpeg_framer_t *framer);
+
+#endif // MJPEG_FRAMER_H
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include "placement.h"
+#include "../common/logger.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// From <linux/mempolicy.h>, without depending on libnuma
+#define PLACEMENT_MPOL_PREFERRED 1
+#define PLACEMENT_MPOL_MF_MOVE (1 << 1)
+
+typedef struct {
+    int cpus[PLACEMENT_MAX_CPUS];
+    int cpu_count;
+} placement_node_t;
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_enabled;
+static int g_preferred_node = -1; // the NIC's node, -1 if unknown
+static placement_node_t g_nodes[PLACEMENT_MAX_NODES];
+static int g_node_count;
+static int g_sessions_on_cpu[PLACEMENT_MAX_CPUS];
+
+// Node of the calling thread, set by placement_bind_thread
+static _Thread_local int t_node = -1;
+
+// Parse a sysfs CPU list such as "0-3,8-11"
+static void parse_cpu_list(const char *list, placement_node_t *node) {
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < PLACEMENT_MAX_CPUS; cpu++) {
+            if (node->cpu_count < PLACEMENT_MAX_CPUS) {
+                node->cpus[node->cpu_count++] = (int)cpu;
+            }
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+}
+
+static int read_line(const char *path, char *buffer, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int ok = fgets(buffer, (int)size, file) != NULL;
+    fclose(file);
+    return ok ? 0 : -1;
+}
+
+int placement_init(const char *nic) {
+    char path[256];
+    char line[1024];
+
+    memset(g_nodes, 0, sizeof(g_nodes));
+    g_node_count = 0;
+    for (int n = 0; n < PLACEMENT_MAX_NODES; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        if (read_line(path, line, sizeof(line)) != 0) {
+            continue;
+        }
+        parse_cpu_list(line, &g_nodes[n]);
+        if (g_nodes[n].cpu_count > 0) {
+            g_node_count = n + 1;
+        }
+    }
+
+    // No NUMA information: one node with every online CPU
+    if (g_node_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus < 1) {
+            logger_log("placement: no cpus found");
+            return -1;
+        }
+        snprintf(line, sizeof(line), "0-%ld", cpus - 1);
+        parse_cpu_list(line, &g_nodes[0]);
+        g_node_count = 1;
+    }
+
+    if (nic != NULL) {
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", nic);
+        if (read_line(path, line, sizeof(line)) == 0) {
+            g_preferred_node = atoi(line);
+        }
+        if (g_preferred_node < 0 || g_preferred_node >= g_node_count ||
+            g_nodes[g_preferred_node].cpu_count == 0) {
+            logger_log("placement: no numa node for %s, using every node", nic);
+            g_preferred_node = -1;
+        }
+    }
+
+    for (int n = 0; n < g_node_count; n++) {
+        logger_log("placement: node %d has %d cpus%s", n, g_nodes[n].cpu_count,
+            n == g_preferred_node ? " (nic)" : "");
+    }
+    g_enabled = 1;
+    return 0;
+}
+
+// Least loaded core of a node, -1 if it has none
+static int least_loaded_cpu(const placement_node_t *node) {
+    int best = -1;
+    for (int i = 0; i < node->cpu_count; i++) {
+        int cpu = node->cpus[i];
+        if (best < 0 || g_sessions_on_cpu[cpu] < g_sessions_on_cpu[best]) {
+            best = cpu;
+        }
+    }
+    return best;
+}
+
+placement_t placement_assign(void) {
+    placement_t placement = {-1, -1};
+    if (!g_enabled) {
+        return placement;
+    }
+
+    pthread_mutex_lock(&g_mutex);
+    if (g_preferred_node >= 0) {
+        placement.node = g_preferred_node;
+        placement.cpu = least_loaded_cpu(&g_nodes[g_preferred_node]);
+    } else {
+        // Without a NIC to stay close to, spread over every node
+        for (int n = 0; n < g_node_count; n++) {
+            int cpu = least_loaded_cpu(&g_nodes[n]);
+            if (cpu >= 0 && (placement.cpu < 0 || g_sessions_on_cpu[cpu] < g_sessions_on_cpu[placement.cpu])) {
+                placement.cpu = cpu;
+                placement.node = n;
+            }
+        }
+    }
+    if (placement.cpu >= 0) {
+        g_sessions_on_cpu[placement.cpu]++;
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return placement;
+}
+
+void placement_release(placement_t placement) {
+    if (placement.cpu < 0) {
+        return;
+    }
+    pthread_mutex_lock(&g_mutex);
+    g_sessions_on_cpu[placement.cpu]--;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void placement_bind_thread(placement_t placement) {
+    if (placement.cpu < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(placement.cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        logger_log("placement: could not pin thread to cpu %d", placement.cpu);
+        return;
+    }
+    t_node = placement.node;
+}
+
+void placement_bind_memory(void *addr, size_t length) {
+    // On one node every page is already local
+    if (t_node < 0 || g_node_count < 2) {
+        return;
+    }
+    unsigned long mask = 1UL << t_node;
+    if (syscall(SYS_mbind, addr, length, PLACEMENT_MPOL_PREFERRED, &mask,
+                sizeof(mask) * 8, PLACEMENT_MPOL_MF_MOVE) != 0) {
+        logger_log("placement: mbind to node %d failed: %s", t_node, strerror(errno));
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+// Limits of the topology read from sysfs, larger machines are truncated
+#define PLACEMENT_MAX_NODES 8
+#define PLACEMENT_MAX_CPUS 256
+
+// A core a session's threads run on, and the NUMA node it belongs to
+typedef struct {
+    int cpu;  // -1 when placement is off
+    int node;
+} placement_t;
+
+// Read the CPU and NUMA topology and turn placement on. Sessions go to the
+// node of network interface nic when it has one (NULL for no preference)
+// Return 0 on success, -1 on error
+int placement_init(const char *nic);
+
+// Pick the least loaded core for a new session, on the NIC's node if known
+placement_t placement_assign(void);
+
+// Give back a core taken by placement_assign, no-op if placement is off
+void placement_release(placement_t placement);
+
+// Pin the calling thread to the placement's core. Memory the thread touches
+// first is then allocated on its node by the kernel
+void placement_bind_thread(placement_t placement);
+
+// Move already allocated pages (page-aligned addr) to the node of the
+// calling thread's placement, no-op if it has none
+void placement_bind_memory(void *addr, size_t length);
+
+#endif // PLACEMENT_H
@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "relay.h"
+#include "../client/rtp_client.h"
+#include "../client/rtsp_client.h"
+#include "../common/logger.h"
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+// How long to wait for each upstream reply, and then for the first frame
+#define RELAY_REPLY_TIMEOUT_MS 3000
+#define RELAY_FIRST_FRAME_MS 3000
+
+// A relay stops once no one watched it for RELAY_LINGER_MS, so a viewer
+// reconnecting doesn't restart the pull, or once upstream sent nothing for
+// RELAY_STALL_MS, e.g. because its video or live source ended
+#define RELAY_LINGER_MS 5000
+#define RELAY_STALL_MS 5000
+#define RELAY_POLL_MS 100
+
+typedef struct {
+    char path[256];         // on the upstream server
+    rtsp_client_t rtsp;
+    rtp_client_t rtp;
+    int rtp_open;
+    live_source_t *source;  // the relay is its producer
+    _Atomic uint64_t last_frame_us;
+
+    // Reply the starting thread waits for, matched by CSeq
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int awaited_cseq;
+    int status;             // 0 until it arrives
+} relay_t;
+
+static char g_upstream_host[256];
+static int g_upstream_port; // 0 when relaying is off
+
+// A relay being set up upstream, on the stack of the thread starting it.
+// Others asking for the same path wait for that start instead of pulling
+// it twice, and share its result
+typedef struct relay_start {
+    const char *name;
+    struct relay_start *next;
+} relay_start_t;
+
+// Guards the starts and is held while a relay decides to stop, so no viewer
+// joins a relay ending. Not held while upstream is talked to
+static pthread_mutex_t g_relay_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_relay_started = PTHREAD_COND_INITIALIZER;
+static relay_start_t *g_starts;
+
+int relay_set_upstream(const char *address) {
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || colon == address || (size_t)(colon - address) >= sizeof(g_upstream_host) ||
+        atoi(colon + 1) <= 0) {
+        logger_log("invalid upstream %s, expected host:port", address);
+        return -1;
+    }
+    memcpy(g_upstream_host, address, (size_t)(colon - address));
+    g_upstream_host[colon - address] = '\0';
+    g_upstream_port = atoi(colon + 1);
+    logger_log("relaying from %s:%d", g_upstream_host, g_upstream_port);
+    return 0;
+}
+
+// The upstream path of a relay URL, NULL if it isn't one. The prefix must
+// start the path, "rtsp://relay/video" is a video on host "relay"
+static const char *upstream_path(const char *url) {
+    const char *path = strstr(url, "://");
+    if (path != NULL) {
+        path = strchr(path + 3, '/');
+        if (path == NULL) {
+            return NULL;
+        }
+    } else {
+        path = url;
+    }
+    while (*path == '/') {
+        path++;
+    }
+    size_t prefix_len = strlen(RELAY_PREFIX);
+    return strncmp(path, RELAY_PREFIX, prefix_len) == 0 && path[prefix_len] != '\0' ?
+        path + prefix_len : NULL;
+}
+
+int relay_url_is_relay(const char *url) {
+    return upstream_path(url) != NULL;
+}
+
+static relay_start_t *find_start(const char *name) {
+    relay_start_t *start = g_starts;
+    while (start != NULL && strcmp(start->name, name) != 0) {
+        start = start->next;
+    }
+    return start;
+}
+
+static void remove_start(relay_start_t *start) {
+    relay_start_t **link = &g_starts;
+    while (*link != start) {
+        link = &(*link)->next;
+    }
+    *link = start->next;
+}
+
+static void on_reply(rtsp_client_t *client, const rtsp_reply_t *reply, void *arg) {
+    (void)client;
+    relay_t *relay = (relay_t *)arg;
+    pthread_mutex_lock(&relay->mutex);
+    if (reply->cseq == relay->awaited_cseq) {
+        relay->status = reply->status_code;
+        pthread_cond_signal(&relay->cond);
+    }
+    pthread_mutex_unlock(&relay->mutex);
+}
+
+// Send a request upstream and wait for its reply
+// Return the reply status, -1 on error or timeout
+static int exchange(relay_t *relay, int (*send_request)(rtsp_client_t *, rtsp_reply_cb_t, void *)) {
+    // Held across the send: a reply arriving before send_request returns
+    // waits in on_reply until the CSeq it must match is known
+    pthread_mutex_lock(&relay->mutex);
+    relay->status = 0;
+    int cseq = send_request(&relay->rtsp, on_reply, relay);
+    if (cseq < 0) {
+        pthread_mutex_unlock(&relay->mutex);
+        return -1;
+    }
+    relay->awaited_cseq = cseq;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += RELAY_REPLY_TIMEOUT_MS / 1000;
+    while (relay->status == 0 &&
+           pthread_cond_timedwait(&relay->cond, &relay->mutex, &deadline) != ETIMEDOUT) {
+    }
+    int status = relay->status != 0 ? relay->status : -1;
+    relay->awaited_cseq = 0;
+    pthread_mutex_unlock(&relay->mutex);
+    return status;
+}
+
+// Frames are fed on the RTP listen thread, the source's only producer
+static void on_frame(const uint8_t *data, size_t size, uint8_t epoch, void *arg) {
+    (void)epoch;
+    relay_t *relay = (relay_t *)arg;
+    live_feed(relay->source, data, size);
+    atomic_store(&relay->last_frame_us, metrics_now_us());
+}
+
+// Stop pulling and free the relay, whatever stage it got to
+static void close_relay(relay_t *relay) {
+    if (relay->rtsp.state != STATE_INIT) {
+        rtsp_client_send_teardown(&relay->rtsp, NULL, NULL);
+    }
+    if (relay->rtp_open) {
+        rtp_client_stop_listener(&relay->rtp);
+    }
+    if (relay->rtsp.rtsp_socket_fd >= 0) {
+        rtsp_client_disconnect(&relay->rtsp);
+    }
+    live_release(relay->source);
+    pthread_cond_destroy(&relay->cond);
+    pthread_mutex_destroy(&relay->mutex);
+    free(relay);
+}
+
+static void *relay_thread(void *arg) {
+    relay_t *relay = (relay_t *)arg;
+    struct timespec poll = {0, RELAY_POLL_MS * 1000000L};
+    uint64_t watched_us = metrics_now_us();
+
+    for (;;) {
+        nanosleep(&poll, NULL);
+        rtsp_client_keepalive(&relay->rtsp);
+        uint64_t now_us = metrics_now_us();
+
+        // Checked under the lock viewers are acquired under, so none joins a
+        // relay ending
+        pthread_mutex_lock(&g_relay_mutex);
+        if (live_viewer_count(relay->source) > 0) {
+            watched_us = now_us;
+        }
+        int unwatched = now_us - watched_us > RELAY_LINGER_MS * 1000ULL;
+        int stalled = now_us - atomic_load(&relay->last_frame_us) > RELAY_STALL_MS * 1000ULL;
+        if (unwatched || stalled) {
+            live_end(relay->source);
+        }
+        pthread_mutex_unlock(&g_relay_mutex);
+
+        if (unwatched || stalled) {
+            logger_log("relay of %s stopped, %s", relay->path, unwatched ? "no viewers" : "upstream stalled");
+            break;
+        }
+    }
+
+    close_relay(relay);
+    return NULL;
+}
+
+// Set up relay->path upstream and start receiving it into a new live
+// source named name. The source is ended again if PLAY fails
+// Return 0 on success, -1 on error
+static int pull(relay_t *relay, const char *name) {
+    const char *path = relay->path;
+    if (rtsp_client_connect(&relay->rtsp, g_upstream_host, g_upstream_port, path, 0) != 0 ||
+        rtsp_client_start_reply_listener(&relay->rtsp) != 0) {
+        return -1;
+    }
+    int status = exchange(relay, rtsp_client_send_describe);
+    if (status != 200) {
+        logger_log("relay of %s: upstream DESCRIBE failed with %d", path, status);
+        return -1;
+    }
+
+    // Any free port, SETUP tells upstream which one
+    if (rtp_client_open_port(&relay->rtp, 0, relay->rtsp.max_frame_size, NULL) != 0) {
+        return -1;
+    }
+    relay->rtp_open = 1;
+    relay->rtp.stop_thread = 1; // no listener for close_relay to join until one starts
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    if (getsockname(relay->rtp.rtp_socket_fd, (struct sockaddr *)&local, &local_len) != 0) {
+        return -1;
+    }
+    relay->rtsp.rtp_port = ntohs(local.sin_port);
+
+    status = exchange(relay, rtsp_client_send_setup);
+    if (status != 200) {
+        logger_log("relay of %s: upstream SETUP failed with %d", path, status);
+        return -1;
+    }
+    relay->source = live_announce(name, relay->rtsp.framerate);
+    if (relay->source == NULL) {
+        return -1;
+    }
+
+    atomic_store(&relay->last_frame_us, metrics_now_us());
+    rtp_client_set_frame_callback(&relay->rtp, on_frame, relay);
+    if (rtp_client_start_listener(&relay->rtp) != 0) {
+        live_end(relay->source);
+        return -1;
+    }
+    status = exchange(relay, rtsp_client_send_play);
+    if (status != 200) {
+        logger_log("relay of %s: upstream PLAY failed with %d", path, status);
+        live_end(relay->source);
+        return -1;
+    }
+    return 0;
+}
+
+// Pull path from upstream into a new live source named name
+// Return 0 on success, -1 on error
+static int start_relay(const char *path, const char *name) {
+    relay_t *relay = (relay_t *)calloc(1, sizeof(relay_t));
+    if (relay == NULL) {
+        return -1;
+    }
+    snprintf(relay->path, sizeof(relay->path), "%s", path);
+    pthread_mutex_init(&relay->mutex, NULL);
+    pthread_cond_init(&relay->cond, NULL);
+    pthread_mutex_init(&relay->rtsp.state_mutex, NULL);
+    relay->rtsp.rtsp_socket_fd = -1;
+
+    if (pull(relay, name) != 0) {
+        close_relay(relay);
+        return -1;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, relay_thread, relay) != 0) {
+        logger_log("relay of %s: error creating thread", path);
+        live_end(relay->source);
+        close_relay(relay);
+        return -1;
+    }
+    pthread_detach(thread);
+    logger_log("relaying %s from %s:%d at %.3f fps on rtp port %d",
+        path, g_upstream_host, g_upstream_port, relay->rtsp.framerate, relay->rtsp.rtp_port);
+    return 0;
+}
+
+live_source_t *relay_acquire(const char *url) {
+    const char *path = upstream_path(url);
+    if (path == NULL || g_upstream_port == 0) {
+        return NULL;
+    }
+    char name[sizeof(((live_source_t *)NULL)->name)];
+    snprintf(name, sizeof(name), "%s%s", RELAY_PREFIX, path);
+
+    pthread_mutex_lock(&g_relay_mutex);
+    live_source_t *source;
+    int waited = 0;
+    while ((source = live_acquire(name)) == NULL && find_start(name) != NULL) {
+        pthread_cond_wait(&g_relay_started, &g_relay_mutex);
+        waited = 1;
+    }
+    if (source == NULL && !waited) {
+        relay_start_t start = {name, g_starts};
+        g_starts = &start;
+        pthread_mutex_unlock(&g_relay_mutex);
+        int result = start_relay(path, name);
+        pthread_mutex_lock(&g_relay_mutex);
+        remove_start(&start);
+        pthread_cond_broadcast(&g_relay_started);
+        if (result == 0) {
+            source = live_acquire(name);
+        }
+    }
+    pthread_mutex_unlock(&g_relay_mutex);
+    if (source == NULL) {
+        return NULL;
+    }
+
+    // The first frame tells viewers the resolution and frame size
+    uint64_t cursor = LIVE_CURSOR_LATEST;
+    int ended = 0;
+    live_frame_release(live_next(source, &cursor, RELAY_FIRST_FRAME_MS, &ended));
+    return source;
+}
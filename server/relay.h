@@ -0,0 +1,23 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include "live.h"
+
+// "relay/<path>" re-streams <path> (a video, "live/<name>" or
+// "channel/<video>") from the upstream server. The first viewer starts
+// pulling it, once, into a live source that every local viewer shares
+#define RELAY_PREFIX "relay/"
+
+// Pull relays from host:port ("-U")
+// Return 0 on success, -1 if address is malformed
+int relay_set_upstream(const char *address);
+
+// Whether a request URL ("[rtsp://host/]relay/<path>") names a relay
+int relay_url_is_relay(const char *url);
+
+// Join the relay of url, starting to pull it from upstream if no one is
+// watching it yet. Leave it with live_release
+// Return its live source, or NULL if relaying is off or upstream refused
+live_source_t *relay_acquire(const char *url);
+
+#endif // RELAY_H
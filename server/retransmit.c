@@ -0,0 +1,99 @@
+#include "retransmit.h"
+#include "../common/logger.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int g_packets = RETRANSMIT_DEFAULT_PACKETS;
+
+void retransmit_set_packets(int packets) {
+    g_packets = packets > 0 ? packets : 0;
+}
+
+uint64_t retransmit_memory(void) {
+    return (uint64_t)g_packets * (RETRANSMIT_MAX_PACKET + sizeof(uint16_t) * 2 + 1 + sizeof(uint64_t));
+}
+
+int retransmit_cache_init(retransmit_cache_t *cache) {
+    memset(cache, 0, sizeof(*cache));
+    if (g_packets == 0) {
+        return -1;
+    }
+    cache->packets = (uint8_t *)malloc((size_t)g_packets * RETRANSMIT_MAX_PACKET);
+    cache->sizes = (uint16_t *)calloc((size_t)g_packets, sizeof(uint16_t));
+    cache->seqnums = (uint16_t *)calloc((size_t)g_packets, sizeof(uint16_t));
+    cache->frag_indexes = (uint8_t *)calloc((size_t)g_packets, 1);
+    cache->resent_us = (uint64_t *)calloc((size_t)g_packets, sizeof(uint64_t));
+    if (cache->packets == NULL || cache->sizes == NULL || cache->seqnums == NULL || cache->frag_indexes == NULL ||
+        cache->resent_us == NULL) {
+        logger_log("error allocating retransmit cache");
+        retransmit_cache_free(cache);
+        return -1;
+    }
+    cache->capacity = g_packets;
+    return 0;
+}
+
+void retransmit_cache_store(retransmit_cache_t *cache,
+                            uint16_t seqnum,
+                            uint8_t frag_index,
+                            const struct iovec *iov,
+                            int iovcnt) {
+    if (cache->capacity == 0) {
+        return;
+    }
+    size_t size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size += iov[i].iov_len;
+    }
+    if (size > RETRANSMIT_MAX_PACKET) {
+        return; // larger than any packet the server sends
+    }
+    int slot = (int)(cache->stored % (uint64_t)cache->capacity);
+    uint8_t *packet = cache->packets + (size_t)slot * RETRANSMIT_MAX_PACKET;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(packet, iov[i].iov_base, iov[i].iov_len);
+        packet += iov[i].iov_len;
+    }
+    cache->sizes[slot] = (uint16_t)size;
+    cache->seqnums[slot] = seqnum;
+    cache->frag_indexes[slot] = frag_index;
+    cache->resent_us[slot] = 0;
+    cache->stored++;
+}
+
+const uint8_t *retransmit_cache_find(const retransmit_cache_t *cache,
+                                     uint16_t seqnum,
+                                     uint8_t frag_index,
+                                     size_t *size) {
+    // Newest first, a NACK is about packets sent moments ago
+    uint64_t kept = cache->stored < (uint64_t)cache->capacity ? cache->stored : (uint64_t)cache->capacity;
+    for (uint64_t n = 0; n < kept; n++) {
+        int slot = (int)((cache->stored - 1 - n) % (uint64_t)cache->capacity);
+        if (cache->seqnums[slot] == seqnum && cache->frag_indexes[slot] == frag_index) {
+            *size = cache->sizes[slot];
+            return cache->packets + (size_t)slot * RETRANSMIT_MAX_PACKET;
+        }
+    }
+    return NULL;
+}
+
+int retransmit_cache_resent_within(retransmit_cache_t *cache, const uint8_t *packet, uint64_t interval_us) {
+    size_t slot = (size_t)(packet - cache->packets) / RETRANSMIT_MAX_PACKET;
+    uint64_t now_us = metrics_now_us();
+    if (cache->resent_us[slot] != 0 && now_us - cache->resent_us[slot] < interval_us) {
+        return 1;
+    }
+    cache->resent_us[slot] = now_us;
+    return 0;
+}
+
+void retransmit_cache_free(retransmit_cache_t *cache) {
+    free(cache->packets);
+    free(cache->sizes);
+    free(cache->seqnums);
+    free(cache->frag_indexes);
+    free(cache->resent_us);
+    memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,59 @@
+#ifndef RETRANSMIT_H
+#define RETRANSMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Packets each session keeps for retransmission unless configured
+#define RETRANSMIT_DEFAULT_PACKETS 512
+
+// Largest packet kept: RTP header, fragment header and a full fragment
+#define RETRANSMIT_MAX_PACKET 1420
+
+// A session's most recently sent RTP packets, so fragments its client
+// reports lost with an RTCP NACK can be sent again without rereading the
+// frame. Packet n sent is in slot n % capacity. Only the RTP thread of the
+// session uses it
+typedef struct {
+    uint8_t *packets;  // capacity slots of RETRANSMIT_MAX_PACKET bytes
+    uint16_t *sizes;
+    uint16_t *seqnums; // frame sequence number of each packet
+    uint8_t *frag_indexes;
+    uint64_t *resent_us;  // when each was last sent again, 0 if it wasn't
+    int capacity;
+    uint64_t stored;   // packets stored so far
+} retransmit_cache_t;
+
+// Packets each session keeps, 0 turns retransmission off
+void retransmit_set_packets(int packets);
+
+// Bytes a session's cache takes
+uint64_t retransmit_memory(void);
+
+// Return 0 on success, -1 on error or when retransmission is off, which
+// leaves the cache empty
+int retransmit_cache_init(retransmit_cache_t *cache);
+
+// Keep a sent packet, given as the parts it was sent from
+void retransmit_cache_store(retransmit_cache_t *cache,
+                            uint16_t seqnum,
+                            uint8_t frag_index,
+                            const struct iovec *iov,
+                            int iovcnt);
+
+// Return the packet with fragment frag_index of frame seqnum and set *size,
+// or NULL if it is no longer kept
+const uint8_t *retransmit_cache_find(const retransmit_cache_t *cache,
+                                     uint16_t seqnum,
+                                     uint8_t frag_index,
+                                     size_t *size);
+
+// Whether a packet find returned was sent again less than interval_us ago,
+// so a NACK sent before that copy could arrive is not answered twice.
+// Otherwise it is recorded as sent again now
+int retransmit_cache_resent_within(retransmit_cache_t *cache, const uint8_t *packet, uint64_t interval_us);
+
+void retransmit_cache_free(retransmit_cache_t *cache);
+
+#endif // RETRANSMIT_H
@@ -0,0 +1,63 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "rtcp_report.h"
+#include "../common/logger.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+// Seconds from the NTP epoch (1900) to the Unix one
+#define NTP_UNIX_OFFSET 2208988800u
+
+static void ntp_now(uint32_t *seconds, uint32_t *fraction) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *seconds = (uint32_t)ts.tv_sec + NTP_UNIX_OFFSET;
+    *fraction = (uint32_t)(((uint64_t)ts.tv_nsec << 32) / 1000000000u);
+}
+
+void rtcp_sender_count(rtcp_sender_t *sender, int packets, size_t octets, uint32_t timestamp) {
+    sender->packets += (uint32_t)packets;
+    sender->octets += (uint32_t)octets;
+    sender->timestamp = timestamp;
+}
+
+void rtcp_sender_report(rtcp_sender_t *sender, int socket_fd, const struct sockaddr_in *addr) {
+    uint64_t now_us = metrics_now_us();
+    if (now_us < sender->next_report_us) {
+        return;
+    }
+    sender->next_report_us = now_us + RTCP_REPORT_INTERVAL_MS * 1000ULL;
+
+    rtcp_sr_t sr = {
+        .ssrc = 0, // the session's RTP packets carry SSRC 0 too
+        .rtp_timestamp = sender->timestamp,
+        .packets = sender->packets,
+        .octets = sender->octets,
+    };
+    ntp_now(&sr.ntp_seconds, &sr.ntp_fraction);
+    uint8_t packet[RTCP_SR_SIZE];
+    size_t size = rtcp_sr_encode(packet, &sr);
+    if (sendto(socket_fd, packet, size, 0, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        logger_log("error sending sender report: %s", strerror(errno));
+    }
+}
+
+int64_t rtcp_round_trip_us(const rtcp_report_block_t *block) {
+    if (block->lsr == 0) {
+        return -1;
+    }
+    uint32_t seconds;
+    uint32_t fraction;
+    ntp_now(&seconds, &fraction);
+
+    // All in 1/65536 seconds, modulo 2^32 like the timestamps
+    uint32_t rtt = rtcp_ntp_middle(seconds, fraction) - block->lsr - block->dlsr;
+    if (rtt > 0x7FFFFFFF) {
+        return -1; // clock step or a stale report, not a sample
+    }
+    return (int64_t)(((uint64_t)rtt * 1000000) >> 16);
+}
@@ -0,0 +1,33 @@
+#ifndef RTCP_REPORT_H
+#define RTCP_REPORT_H
+
+#include "../common/rtcp.h"
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// How often a playing session sends its client a sender report, which the
+// client answers with a receiver report
+#define RTCP_REPORT_INTERVAL_MS 1000
+
+// What a session sent, for its sender reports. Only its RTP thread uses it
+typedef struct {
+    uint32_t packets;
+    uint32_t octets;         // payload bytes
+    uint32_t timestamp;      // of the latest frame
+    uint64_t next_report_us; // 0 sends one right away
+} rtcp_sender_t;
+
+// Count a frame sent in packets carrying octets bytes of payload
+void rtcp_sender_count(rtcp_sender_t *sender, int packets, size_t octets, uint32_t timestamp);
+
+// Send a sender report to addr if one is due
+void rtcp_sender_report(rtcp_sender_t *sender, int socket_fd, const struct sockaddr_in *addr);
+
+// Round trip time from a receiver report that just arrived
+// Return it in microseconds, -1 if the report answers no sender report or
+// the result is negative (a clock step or a stale report)
+int64_t rtcp_round_trip_us(const rtcp_report_block_t *block);
+
+#endif // RTCP_REPORT_H
@@ -0,0 +1,205 @@
+#include "rtp_hint.h"
+#include "../common/byte_order.h"
+#include "../common/logger.h"
+#include "../common/rtp_packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hint file layout (little-endian):
+// 0: magic "MJHT", 4: version, 8: frame count, 12: packet count,
+// 16: payload bytes per fragment, 20: reserved, 24: size of the video file,
+// 32: (frame count + 1) u32 first packet indexes,
+// then one {header[20], u32 payload offset, u16 payload size, u16 pad} per packet
+#define RTP_HINT_FILE_HEADER_SIZE 32
+#define RTP_HINT_FILE_PACKET_SIZE (RTP_HINT_HEADER_SIZE + 8)
+
+static int alloc_track(rtp_hint_track_t *track, int total_frames, uint32_t total_packets) {
+    track->total_frames = total_frames;
+    track->total_packets = total_packets;
+    track->frame_first_packet = (uint32_t *)malloc(((size_t)total_frames + 1) * sizeof(uint32_t));
+    track->packets = (rtp_hint_packet_t *)malloc((size_t)total_packets * sizeof(rtp_hint_packet_t));
+    if (track->frame_first_packet == NULL || (total_packets > 0 && track->packets == NULL)) {
+        logger_log("error allocating hint track");
+        rtp_hint_free(track);
+        return -1;
+    }
+    return 0;
+}
+
+int rtp_hint_build(rtp_hint_track_t *track, const video_stream_t *stream) {
+    memset(track, 0, sizeof(rtp_hint_track_t));
+
+    uint32_t total_packets = 0;
+    for (int f = 0; f < stream->total_frames; f++) {
+        total_packets += (uint32_t)rtp_calc_fragments(stream->index[f].size);
+    }
+    if (alloc_track(track, stream->total_frames, total_packets) != 0) {
+        return -1;
+    }
+
+    // Same layout as the per-packet path: fragments of RTP_MTU_PAYLOAD
+    // bytes, marker set on the last one
+    uint32_t p = 0;
+    uint8_t frag_header[RTP_FRAG_HEADER_SIZE];
+    for (int f = 0; f < stream->total_frames; f++) {
+        uint32_t frame_size = stream->index[f].size;
+        int total_frags = rtp_calc_fragments(frame_size);
+        track->frame_first_packet[f] = p;
+
+        for (int i = 0; i < total_frags; i++, p++) {
+            uint32_t offset = (uint32_t)i * RTP_MTU_PAYLOAD;
+            uint32_t chunk_size = frame_size - offset;
+            if (chunk_size > RTP_MTU_PAYLOAD) {
+                chunk_size = RTP_MTU_PAYLOAD;
+            }
+
+            rtp_frag_encode(frag_header, i, total_frags, frame_size, 0);
+            rtp_packet_encode(
+                track->packets[p].header, RTP_HINT_HEADER_SIZE,
+                2, 0, 0, 0,
+                0,
+                (i == total_frags - 1) ? 1 : 0,
+                MJPEG_TYPE, 0, 0,
+                frag_header, RTP_FRAG_HEADER_SIZE
+            );
+            track->packets[p].payload_offset = offset;
+            track->packets[p].payload_size = (uint16_t)chunk_size;
+        }
+    }
+    track->frame_first_packet[stream->total_frames] = p;
+    return 0;
+}
+
+int rtp_hint_load(rtp_hint_track_t *track, const char *filename, const video_stream_t *stream) {
+    memset(track, 0, sizeof(rtp_hint_track_t));
+
+    char hint_path[512];
+    snprintf(hint_path, sizeof(hint_path), "%s%s", filename, RTP_HINT_SUFFIX);
+    FILE *file = fopen(hint_path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    uint8_t header[RTP_HINT_FILE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, RTP_HINT_MAGIC, 4) != 0 ||
+        read_le32(header + 4) != RTP_HINT_VERSION) {
+        logger_log("ignoring invalid hint file %s", hint_path);
+        fclose(file);
+        return -1;
+    }
+
+    uint32_t frame_count = read_le32(header + 8);
+    uint32_t packet_count = read_le32(header + 12);
+    uint64_t video_size = read_le64(header + 24);
+
+    // Hints for another version of the video or another MTU are useless
+    if ((int)frame_count != stream->total_frames ||
+        read_le32(header + 16) != RTP_MTU_PAYLOAD ||
+        video_size != (uint64_t)stream->file_size) {
+        logger_log("hint file %s does not match the video, ignoring it", hint_path);
+        fclose(file);
+        return -1;
+    }
+    if (alloc_track(track, (int)frame_count, packet_count) != 0) {
+        fclose(file);
+        return -1;
+    }
+
+    uint8_t entry[RTP_HINT_FILE_PACKET_SIZE];
+    int ok = 1;
+    for (uint32_t f = 0; ok && f <= frame_count; f++) {
+        ok = fread(entry, 1, 4, file) == 4;
+        track->frame_first_packet[f] = read_le32(entry);
+        ok = ok && track->frame_first_packet[f] <= packet_count &&
+            (f == 0 || track->frame_first_packet[f] >= track->frame_first_packet[f - 1]);
+    }
+    for (uint32_t p = 0; ok && p < packet_count; p++) {
+        ok = fread(entry, 1, sizeof(entry), file) == sizeof(entry);
+        memcpy(track->packets[p].header, entry, RTP_HINT_HEADER_SIZE);
+        track->packets[p].payload_offset = read_le32(entry + RTP_HINT_HEADER_SIZE);
+        track->packets[p].payload_size = (uint16_t)(entry[RTP_HINT_HEADER_SIZE + 4] |
+                                                    (entry[RTP_HINT_HEADER_SIZE + 5] << 8));
+    }
+    fclose(file);
+
+    // Never let a corrupt hint send bytes from outside the frame or packets
+    // the client cannot reassemble: each frame must be laid out exactly as
+    // rtp_hint_build would, full fragments in order with matching headers
+    for (uint32_t f = 0; ok && f < frame_count; f++) {
+        uint32_t frame_size = stream->index[f].size;
+        int total_frags = rtp_calc_fragments(frame_size);
+        uint32_t first = track->frame_first_packet[f];
+        ok = track->frame_first_packet[f + 1] - first == (uint32_t)total_frags;
+        for (int i = 0; ok && i < total_frags; i++) {
+            const rtp_hint_packet_t *packet = &track->packets[first + (uint32_t)i];
+            uint32_t offset = (uint32_t)i * RTP_MTU_PAYLOAD;
+            uint32_t chunk_size = frame_size - offset < RTP_MTU_PAYLOAD ? frame_size - offset : RTP_MTU_PAYLOAD;
+            rtp_frag_header_t frag;
+            rtp_frag_decode(packet->header + RTP_HEADER_SIZE, &frag);
+            ok = packet->payload_offset == offset && packet->payload_size == chunk_size &&
+                frag.frag_index == (uint8_t)i && frag.total_frags == (uint8_t)total_frags &&
+                frag.total_size == frame_size;
+        }
+    }
+    if (!ok) {
+        logger_log("corrupt hint file %s, ignoring it", hint_path);
+        rtp_hint_free(track);
+        return -1;
+    }
+
+    logger_log("loaded hint file %s: %u packets", hint_path, packet_count);
+    return 0;
+}
+
+int rtp_hint_save(const rtp_hint_track_t *track, const char *filename, const video_stream_t *stream) {
+    char hint_path[512];
+    snprintf(hint_path, sizeof(hint_path), "%s%s", filename, RTP_HINT_SUFFIX);
+    FILE *file = fopen(hint_path, "wb");
+    if (file == NULL) {
+        logger_log("failed to create hint file %s", hint_path);
+        return -1;
+    }
+
+    uint8_t header[RTP_HINT_FILE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, RTP_HINT_MAGIC, 4);
+    write_le32(header + 4, RTP_HINT_VERSION);
+    write_le32(header + 8, (uint32_t)track->total_frames);
+    write_le32(header + 12, track->total_packets);
+    write_le32(header + 16, RTP_MTU_PAYLOAD);
+    write_le64(header + 24, (uint64_t)stream->file_size);
+    int ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    uint8_t entry[RTP_HINT_FILE_PACKET_SIZE];
+    for (int f = 0; ok && f <= track->total_frames; f++) {
+        write_le32(entry, track->frame_first_packet[f]);
+        ok = fwrite(entry, 1, 4, file) == 4;
+    }
+    for (uint32_t p = 0; ok && p < track->total_packets; p++) {
+        memset(entry, 0, sizeof(entry));
+        memcpy(entry, track->packets[p].header, RTP_HINT_HEADER_SIZE);
+        write_le32(entry + RTP_HINT_HEADER_SIZE, track->packets[p].payload_offset);
+        entry[RTP_HINT_HEADER_SIZE + 4] = (uint8_t)track->packets[p].payload_size;
+        entry[RTP_HINT_HEADER_SIZE + 5] = (uint8_t)(track->packets[p].payload_size >> 8);
+        ok = fwrite(entry, 1, sizeof(entry), file) == sizeof(entry);
+    }
+
+    if (fclose(file) != 0 || !ok) {
+        logger_log("error writing hint file %s", hint_path);
+        remove(hint_path);
+        return -1;
+    }
+    return 0;
+}
+
+void rtp_hint_free(rtp_hint_track_t *track) {
+    free(track->packets);
+    free(track->frame_first_packet);
+    track->packets = NULL;
+    track->frame_first_packet = NULL;
+    track->total_frames = 0;
+    track->total_packets = 0;
+}
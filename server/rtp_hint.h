@@ -0,0 +1,63 @@
+#ifndef RTP_HINT_H
+#define RTP_HINT_H
+
+#include "../common/protocol.h"
+#include "../common/rtp_fragment.h"
+#include "video_stream.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Precomputed packet layout ("hint track") written next to a video as
+// "<video>.hint". With it the sender only patches the per-session fields
+// of a prebuilt header and sends the payload straight from the frame
+#define RTP_HINT_SUFFIX ".hint"
+#define RTP_HINT_MAGIC "MJHT"
+#define RTP_HINT_VERSION 1
+
+// RTP header followed by the fragment header
+#define RTP_HINT_HEADER_SIZE (RTP_HEADER_SIZE + RTP_FRAG_HEADER_SIZE)
+
+typedef struct {
+    uint8_t header[RTP_HINT_HEADER_SIZE]; // seqnum, timestamp, ssrc and epoch left zero
+    uint32_t payload_offset;              // within the frame
+    uint16_t payload_size;
+} rtp_hint_packet_t;
+
+typedef struct {
+    rtp_hint_packet_t *packets;
+    uint32_t *frame_first_packet; // packets of frame f are [first[f], first[f + 1])
+    int total_frames;
+    uint32_t total_packets;
+} rtp_hint_track_t;
+
+// Lay out the packets of every frame in the stream's index
+// Return 0 on success, -1 on error
+int rtp_hint_build(rtp_hint_track_t *track, const video_stream_t *stream);
+
+// Load "<filename>.hint" if it exists and matches the stream
+// Return 0 on success, -1 if there is no usable hint file
+int rtp_hint_load(rtp_hint_track_t *track, const char *filename, const video_stream_t *stream);
+
+// Write the track to "<filename>.hint"
+// Return 0 on success, -1 on error
+int rtp_hint_save(const rtp_hint_track_t *track, const char *filename, const video_stream_t *stream);
+
+void rtp_hint_free(rtp_hint_track_t *track);
+
+// Fill in the per-session fields of a copied packet header
+static inline void rtp_hint_patch(uint8_t *header, uint16_t seqnum, uint32_t timestamp, uint32_t ssrc, uint8_t epoch) {
+    header[2] = (uint8_t)(seqnum >> 8);
+    header[3] = (uint8_t)seqnum;
+    header[4] = (uint8_t)(timestamp >> 24);
+    header[5] = (uint8_t)(timestamp >> 16);
+    header[6] = (uint8_t)(timestamp >> 8);
+    header[7] = (uint8_t)timestamp;
+    header[8] = (uint8_t)(ssrc >> 24);
+    header[9] = (uint8_t)(ssrc >> 16);
+    header[10] = (uint8_t)(ssrc >> 8);
+    header[11] = (uint8_t)ssrc;
+    header[RTP_HEADER_SIZE + 3] = epoch;
+}
+
+#endif // RTP_HINT_H
@@ -1,104 +1,325 @@
 #include "rtsp_parser.h"
 
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <strings.h>
 
-static void parse_request_line(const char *line, rtsp_request_info_t *info) {
-    char method_str[32];
-    char url[256];
-    char version[32];
+// Numbers stop growing past this rather than overflowing, further digits
+// are skipped
+#define RTSP_MAX_INT ((INT_MAX - 9) / 10)
 
-    // sscanf is a simple way to parse a fixed format like this
-    if (sscanf(line, "%31s %255s %31s", method_str, url, version) != 3) {
-        return;
+static int slice_equals(rtsp_slice_t slice, const char *str) {
+    size_t len = strlen(str);
+    return slice.len == len && memcmp(slice.ptr, str, len) == 0;
+}
+
+static int slice_equals_nocase(rtsp_slice_t slice, const char *str) {
+    size_t len = strlen(str);
+    if (slice.len != len) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char a = slice.ptr[i];
+        char b = str[i];
+        if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+        if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+        if (a != b) {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    // Since we only care about the filename, take the part after final "/"
-    char *filename = strrchr(url, '/');
-    if (filename != NULL) {
-        filename++; // move pas the last "/"
-    } else {
-        filename = url; // no "/" at all
-    }
-    strncpy(info->filename, filename, sizeof(info->filename) - 1);
-    info->filename[sizeof(info->filename) - 1] = '\0';
-
-    // Convert method in string into enum
-    if (strcmp(method_str, "SETUP") == 0) {
-        info->method = METHOD_SETUP;
-    } else if (strcmp(method_str, "PLAY") == 0) {
-        info->method = METHOD_PLAY;
-    } else if (strcmp(method_str, "PAUSE") == 0) {
-        info->method = METHOD_PAUSE;
-    } else if (strcmp(method_str, "TEARDOWN") == 0) {
-        info->method = METHOD_TEARDOWN;
+// Parse leading decimal digits of [*pos, end), advancing pos past them
+// Return -1 if there are no digits
+static int parse_uint(const char **pos, const char *end) {
+    const char *p = *pos;
+    int value = 0;
+    if (p >= end || *p < '0' || *p > '9') {
+        return -1;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (value <= RTSP_MAX_INT) {
+            value = value * 10 + (*p - '0');
+        }
+        p++;
+    }
+    *pos = p;
+    return value;
+}
+
+static int slice_to_int(rtsp_slice_t slice) {
+    const char *p = slice.ptr;
+    int value = parse_uint(&p, slice.ptr + slice.len);
+    return value < 0 ? 0 : value;
+}
+
+// Find needle inside the slice, returning its offset or -1
+static long slice_find(rtsp_slice_t slice, const char *needle) {
+    size_t n = strlen(needle);
+    for (size_t i = 0; i + n <= slice.len; i++) {
+        if (memcmp(slice.ptr + i, needle, n) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static rtsp_method_t parse_method(rtsp_slice_t method) {
+    if (slice_equals(method, "SETUP")) {
+        return METHOD_SETUP;
+    } else if (slice_equals(method, "PLAY")) {
+        return METHOD_PLAY;
+    } else if (slice_equals(method, "PAUSE")) {
+        return METHOD_PAUSE;
+    } else if (slice_equals(method, "TEARDOWN")) {
+        return METHOD_TEARDOWN;
+    } else if (slice_equals(method, "DESCRIBE")) {
+        return METHOD_DESCRIBE;
+    } else if (slice_equals(method, "GET_PARAMETER")) {
+        return METHOD_GET_PARAMETER;
+    } else if (slice_equals(method, "ANNOUNCE")) {
+        return METHOD_ANNOUNCE;
+    } else if (slice_equals(method, "RECORD")) {
+        return METHOD_RECORD;
     }
+    return METHOD_UNKNOWN;
 }
 
-static void parse_header_line(const char *line, rtsp_request_info_t *info) {
-    char header_name[64];
-    char header_value[256];
+// Request line: "METHOD url RTSP/1.0"
+static int parse_request_line(const char *line, const char *end, rtsp_request_info_t *info) {
+    const char *sp1 = memchr(line, ' ', end - line);
+    if (sp1 == NULL) {
+        return -1;
+    }
+    const char *url = sp1 + 1;
+    const char *sp2 = memchr(url, ' ', end - url);
+    if (sp2 == NULL || sp2 == url) {
+        return -1;
+    }
+
+    info->method = parse_method((rtsp_slice_t){line, (size_t)(sp1 - line)});
+    info->url = (rtsp_slice_t){url, (size_t)(sp2 - url)};
+
+    // Since we only care about the filename, take the part after final "/"
+    const char *filename = url;
+    for (const char *p = url; p < sp2; p++) {
+        if (*p == '/') {
+            filename = p + 1;
+        }
+    }
+    info->filename = (rtsp_slice_t){filename, (size_t)(sp2 - filename)};
+    return 0;
+}
 
-    // Look for Name: Value format
-    if (sscanf(line, "%63[^:]: %255[^\r\n]", header_name, header_value) != 2) {
+// Range: "npt=SS.frac-", "npt=MM:SS.frac-" (only the start matters)
+static void parse_range(rtsp_slice_t value, rtsp_request_info_t *info) {
+    const char *p = value.ptr;
+    const char *end = value.ptr + value.len;
+    if (value.len < 4 || memcmp(p, "npt=", 4) != 0) {
         return;
     }
+    p += 4;
 
-    if (strcasecmp(header_name, "CSeq") == 0) {
-        info->cseq = atoi(header_value);
-    } else if (strcasecmp(header_name, "Session") == 0) {
-        info->session_id = atoi(header_value);
-    } else if (strcasecmp(header_name, "Transport") == 0) {
-        char *port_str = strstr(header_value, "client_port=");
-        if (port_str != NULL) {
-            port_str += 12; // move past "client_port="
-            info->rtp_port = atoi(port_str);
+    int first = parse_uint(&p, end);
+    if (first < 0) {
+        return;
+    }
+    double seconds = first;
+    if (p < end && *p == ':') {
+        p++;
+        int secs = parse_uint(&p, end);
+        if (secs < 0) {
+            return;
         }
-    } else if (strcasecmp(header_name, "Range") == 0) {
-        // Parse Range header: "Range: npt=MM:SS.FF-" or "Range: npt=MM:SS.FF-MM:SS.FF"
-        // We only care about the start position
-        int minutes = 0, seconds = 0, centiseconds = 0;
-        if (sscanf(header_value, "npt=%d:%d.%d", &minutes, &seconds, &centiseconds) == 3) {
-            info->seek_position = minutes * 60 + seconds + centiseconds / 100.0;
-            info->has_seek = 1;
+        seconds = first * 60.0 + secs;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        double scale = 0.1;
+        while (p < end && *p >= '0' && *p <= '9') {
+            seconds += (*p - '0') * scale;
+            scale /= 10;
+            p++;
         }
-    } else if (strcasecmp(header_name, "X-Frame") == 0) {
+    }
+    info->seek_position = seconds;
+    info->has_seek = 1;
+}
+
+static void parse_header(rtsp_slice_t name, rtsp_slice_t value, rtsp_request_info_t *info, int *content_length) {
+    if (slice_equals_nocase(name, "CSeq")) {
+        info->cseq = slice_to_int(value);
+    } else if (slice_equals_nocase(name, "Session")) {
+        info->session_id = slice_to_int(value);
+    } else if (slice_equals_nocase(name, "Transport")) {
+        long pos = slice_find(value, "client_port=");
+        if (pos >= 0) {
+            const char *p = value.ptr + pos + 12; // move past "client_port="
+            int port = parse_uint(&p, value.ptr + value.len);
+            info->rtp_port = port < 0 ? 0 : port;
+        }
+        info->multicast = slice_find(value, "multicast") >= 0;
+    } else if (slice_equals_nocase(name, "Range")) {
+        parse_range(value, info);
+    } else if (slice_equals_nocase(name, "X-Frame")) {
         // Parse custom frame number header
-        info->frame_number = atoi(header_value);
+        info->frame_number = slice_to_int(value);
         info->has_frame_seek = 1;
+    } else if (slice_equals_nocase(name, "Content-Length")) {
+        *content_length = slice_to_int(value);
+    }
+}
+
+// Find the blank line ending the headers. Lines may end in "\r\n" or "\n"
+// Return the offset just past it, or 0 if it isn't buffered yet
+static size_t find_headers_end(const char *data, size_t len, size_t from) {
+    for (size_t i = from; i < len; i++) {
+        if (data[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < len && data[i + 1] == '\n') {
+            return i + 2;
+        }
+        if (i + 2 < len && data[i + 1] == '\r' && data[i + 2] == '\n') {
+            return i + 3;
+        }
     }
+    return 0;
 }
 
-void rtsp_parse_request(const char *request_str, rtsp_request_info_t *info) {
+static rtsp_parse_status_t parse_from(const char *data,
+                                      size_t len,
+                                      size_t scan_from,
+                                      rtsp_request_info_t *info,
+                                      size_t *consumed,
+                                      size_t *resume_scan) {
     memset(info, 0, sizeof(rtsp_request_info_t));
     info->method = METHOD_UNKNOWN;
+    *consumed = 0;
+    *resume_scan = 0;
 
-    // Need a mutable copy of request_str because strtok_r will modify it in-place
-    char *buffer = strdup(request_str);
-    if (buffer == NULL) {
-        return;
+    // Tolerate stray line breaks between pipelined requests
+    size_t skip = 0;
+    while (skip < len && (data[skip] == '\r' || data[skip] == '\n')) {
+        skip++;
     }
+    data += skip;
+    len -= skip;
+    scan_from = scan_from > skip ? scan_from - skip : 0;
 
-    char *save_ptr;
-    char *line = strtok_r(buffer, "\n", &save_ptr);
-
-    if (line == NULL) {
-        free(buffer);
-        return;
+    size_t headers_end = find_headers_end(data, len, scan_from);
+    if (headers_end == 0) {
+        // Resume a few bytes back so a terminator split across reads is found
+        *consumed = skip;
+        *resume_scan = len > 3 ? len - 3 : 0;
+        return RTSP_PARSE_INCOMPLETE;
     }
 
-    // The first line is a special request line
-    parse_request_line(line, info);
+    const char *pos = data;
+    const char *end = data + headers_end;
+    int content_length = 0;
+    int first_line = 1;
 
-    // All subsequent lines are headers
-    while((line = strtok_r(NULL, "\n", &save_ptr)) != NULL) {
-        if (strlen(line) <= 1) {
+    while (pos < end) {
+        const char *eol = memchr(pos, '\n', end - pos);
+        const char *line_end = eol;
+        if (line_end > pos && line_end[-1] == '\r') {
+            line_end--;
+        }
+        if (line_end == pos) {
             break; // an empty line signal the end of headers
         }
-        parse_header_line(line, info);
+
+        if (first_line) {
+            // The first line is a special request line
+            if (parse_request_line(pos, line_end, info) != 0) {
+                return RTSP_PARSE_ERROR;
+            }
+            first_line = 0;
+        } else {
+            // All subsequent lines are "Name: Value" headers
+            const char *colon = memchr(pos, ':', line_end - pos);
+            if (colon != NULL) {
+                const char *value = colon + 1;
+                while (value < line_end && (*value == ' ' || *value == '\t')) {
+                    value++;
+                }
+                const char *value_end = line_end;
+                while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+                    value_end--;
+                }
+                parse_header((rtsp_slice_t){pos, (size_t)(colon - pos)},
+                             (rtsp_slice_t){value, (size_t)(value_end - value)},
+                             info,
+                             &content_length);
+            }
+        }
+        pos = eol + 1;
     }
 
-    free(buffer);
+    if (first_line) {
+        return RTSP_PARSE_ERROR;
+    }
+    if (content_length > RTSP_CONN_BUFFER_SIZE) {
+        return RTSP_PARSE_ERROR;
+    }
+    if (headers_end + (size_t)content_length > len) {
+        *consumed = skip;
+        *resume_scan = 0; // headers are complete, only the body is missing
+        return RTSP_PARSE_INCOMPLETE;
+    }
+
+    info->body = (rtsp_slice_t){data + headers_end, (size_t)content_length};
+    info->raw = (rtsp_slice_t){data, headers_end + (size_t)content_length};
+    *consumed = skip + headers_end + (size_t)content_length;
+    return RTSP_PARSE_OK;
+}
+
+rtsp_parse_status_t rtsp_parse_request(const char *data,
+                                       size_t len,
+                                       rtsp_request_info_t *info,
+                                       size_t *consumed) {
+    size_t resume_scan;
+    return parse_from(data, len, 0, info, consumed, &resume_scan);
+}
+
+void rtsp_conn_init(rtsp_conn_buffer_t *conn) {
+    conn->start = 0;
+    conn->len = 0;
+    conn->scanned = 0;
+}
+
+rtsp_parse_status_t rtsp_conn_next(rtsp_conn_buffer_t *conn, rtsp_request_info_t *info) {
+    size_t consumed = 0;
+    size_t resume_scan = 0;
+    rtsp_parse_status_t status = parse_from(
+        conn->data + conn->start, conn->len - conn->start, conn->scanned, info, &consumed, &resume_scan
+    );
+
+    if (status == RTSP_PARSE_OK) {
+        conn->start += consumed;
+        conn->scanned = 0;
+        return status;
+    }
+    if (status == RTSP_PARSE_ERROR) {
+        return status;
+    }
+
+    // Incomplete: drop what's already parsed and move the partial request to
+    // the front so the next read has as much room as possible
+    conn->start += consumed;
+    size_t pending = conn->len - conn->start;
+    if (conn->start > 0) {
+        memmove(conn->data, conn->data + conn->start, pending);
+        conn->start = 0;
+        conn->len = pending;
+    }
+
+    conn->scanned = resume_scan;
+
+    if (conn->len == RTSP_CONN_BUFFER_SIZE) {
+        return RTSP_PARSE_ERROR; // request can never fit
+    }
+    return RTSP_PARSE_INCOMPLETE;
 }
@@ -3,11 +3,33 @@
 
 #include "../common/protocol.h"
 
+#include <stddef.h>
+#include <string.h>
+
+// Largest request (headers + body) a connection may send
+#define RTSP_CONN_BUFFER_SIZE 8192
+
+// A view into the connection buffer, not NUL-terminated
+typedef struct {
+    const char *ptr;
+    size_t len;
+} rtsp_slice_t;
+
+typedef enum {
+    RTSP_PARSE_OK,         // a full request was parsed
+    RTSP_PARSE_INCOMPLETE, // need more bytes from the socket
+    RTSP_PARSE_ERROR       // malformed or oversized request, drop the connection
+} rtsp_parse_status_t;
+
 typedef struct {
     rtsp_method_t method;
-    char filename[256];
+    rtsp_slice_t raw;      // the whole request, for logging
+    rtsp_slice_t url;
+    rtsp_slice_t filename; // part of the url after the final "/"
+    rtsp_slice_t body;     // Content-Length bytes after the headers
     int cseq;
     int rtp_port;
+    int multicast;         // Transport asked for multicast delivery
     int session_id;
     double seek_position;  // Position in seconds for PLAY with Range header
     int has_seek;          // Flag if seek_position is set
@@ -15,6 +37,51 @@ typedef struct {
     int has_frame_seek;    // Flag if frame_number is set
 } rtsp_request_info_t;
 
-void rtsp_parse_request(const char *request_str, rtsp_request_info_t *info);
+// Per-connection receive buffer, requests are parsed in place
+typedef struct {
+    char data[RTSP_CONN_BUFFER_SIZE];
+    size_t start;   // first byte of the next unparsed request
+    size_t len;     // bytes buffered so far
+    size_t scanned; // bytes after start already searched for end of headers
+} rtsp_conn_buffer_t;
+
+void rtsp_conn_init(rtsp_conn_buffer_t *conn);
+
+// Where the next read() should write to, and how much room is left
+static inline char *rtsp_conn_tail(rtsp_conn_buffer_t *conn, size_t *space) {
+    *space = RTSP_CONN_BUFFER_SIZE - conn->len;
+    return conn->data + conn->len;
+}
+
+static inline void rtsp_conn_commit(rtsp_conn_buffer_t *conn, size_t bytes) {
+    conn->len += bytes;
+}
+
+// Bytes received after the last parsed request, for a connection that
+// stops sending requests and streams raw data instead
+static inline const char *rtsp_conn_unparsed(const rtsp_conn_buffer_t *conn, size_t *len) {
+    *len = conn->len - conn->start;
+    return conn->data + conn->start;
+}
+
+// Parse the next complete request out of the buffer. Slices in info point
+// into conn and stay valid until the next call that returns INCOMPLETE
+rtsp_parse_status_t rtsp_conn_next(rtsp_conn_buffer_t *conn, rtsp_request_info_t *info);
+
+// Parse a single request from data without copying or allocating
+// On RTSP_PARSE_OK, consumed is set to the request length including its body
+rtsp_parse_status_t rtsp_parse_request(const char *data,
+                                       size_t len,
+                                       rtsp_request_info_t *info,
+                                       size_t *consumed);
+
+// Copy a slice into a NUL-terminated buffer, truncating if needed
+static inline void rtsp_slice_copy(rtsp_slice_t slice, char *dst, size_t dst_size) {
+    size_t n = slice.len < dst_size - 1 ? slice.len : dst_size - 1;
+    if (n > 0) {
+        memcpy(dst, slice.ptr, n);
+    }
+    dst[n] = '\0';
+}
 
 #endif // RTSP_PARSER_H
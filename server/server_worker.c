@@ -1,16 +1,29 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "../common/logger.h"
+#include "../common/rtcp.h"
 #include "../common/rtp_packet.h"
 #include "../common/rtp_fragment.h"
+#include "channel.h"
+#include "congestion.h"
+#include "fec.h"
+#include "frame_reader.h"
+#include "metrics.h"
+#include "placement.h"
+#include "relay.h"
+#include "retransmit.h"
+#include "rtcp_report.h"
 #include "server_worker.h"
+#include "rtp_hint.h"
 #include "rtsp_parser.h"
+#include "session_table.h"
 #include "video_stream.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,83 +31,211 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 
-#define RECV_BUFFER_SIZE 2048
-#define SEND_BUFFER_SIZE 1024
+#define SEND_BUFFER_SIZE 2048
+
+// Room for the SDP body of a DESCRIBE reply
+#define SDP_BUFFER_SIZE 1024
 
 // 512KB for FHD MJPEG frames
 #define FRAME_BUFFER_SIZE 524288
+// RTP media clock for video (RFC 3551)
+#define RTP_VIDEO_CLOCK_RATE 90000
 // Single RTP packet buffer (for fragments)
 #define RTP_PACKET_BUFFER_SIZE (RTP_MTU_PAYLOAD + RTP_FRAG_HEADER_SIZE + RTP_HEADER_SIZE + 64)
 
+// How long a live viewer's RTP thread waits for a frame before checking
+// whether it was stopped
+#define LIVE_WAIT_MS 100
+
+// A live frame due further ahead than this follows a skip, it is sent at
+// once and pacing starts over from it
+#define LIVE_MAX_PACING_US 1000000
+
+// Producer bytes read per call once a live source is recording
+#define LIVE_RECV_CHUNK 65536
+
+// Frames read ahead per session, 0 reads each frame when it is due
+static int g_read_ahead = 0;
+
+void server_worker_set_read_ahead(int frames) {
+    g_read_ahead = frames > 0 ? frames : 0;
+}
+
+// Send the parity packet of a group of the frame's fragments and start the
+// next group. Parity isn't kept for retransmission, a lost one costs nothing
+static void send_fec_parity(
+    int socket_fd,
+    struct sockaddr_in *addr,
+    rtp_fec_group_t *group,
+    int total_frags,
+    size_t frame_size,
+    uint16_t seqnum,
+    uint32_t timestamp,
+    uint8_t epoch
+) {
+    uint8_t rtp_buffer[RTP_PACKET_BUFFER_SIZE];
+    uint8_t frag_buffer[RTP_MTU_PAYLOAD + RTP_FRAG_HEADER_SIZE];
+    rtp_fec_encode(frag_buffer, group, total_frags, frame_size, epoch);
+    memcpy(frag_buffer + RTP_FRAG_HEADER_SIZE, group->payload, group->size);
+    group->count = 0;
+
+    size_t packet_size = rtp_packet_encode(
+        rtp_buffer, RTP_PACKET_BUFFER_SIZE,
+        2, 0, 0, 0,
+        seqnum, 0,
+        MJPEG_TYPE, timestamp, 0,
+        frag_buffer, RTP_FRAG_HEADER_SIZE + group->size
+    );
+    ssize_t sent = sendto(socket_fd, rtp_buffer, packet_size, 0, (struct sockaddr *)addr, sizeof(*addr));
+    if (sent < 0) {
+        metrics_counter_add(METRIC_SEND_ERRORS, 1);
+        return;
+    }
+    metrics_counter_add(METRIC_FEC_PACKETS_SENT, 1);
+    metrics_counter_add(METRIC_BYTES_SENT, (uint64_t)sent);
+}
+
 // Send a single frame, fragmenting if necessary
+// Every packet carries a fragment header (even single-fragment frames) so
+// the client can read the stream epoch from it. Sent packets are kept in
+// cache for retransmission
 static int send_frame_fragmented(
     int socket_fd,
     struct sockaddr_in *addr,
+    retransmit_cache_t *cache,
     const uint8_t *frame_data,
     size_t frame_size,
-    uint16_t seqnum
+    uint16_t seqnum,
+    uint32_t timestamp,
+    uint8_t epoch
 ) {
     uint8_t rtp_buffer[RTP_PACKET_BUFFER_SIZE];
     uint8_t frag_buffer[RTP_MTU_PAYLOAD + RTP_FRAG_HEADER_SIZE];
+    rtp_fec_group_t parity = {.count = 0};
 
     int total_frags = rtp_calc_fragments(frame_size);
+    size_t offset = 0;
 
-    if (total_frags == 1) {
-        // Small frame - send without fragmentation (backwards compatible)
+    for (int i = 0; i < total_frags; i++) {
+        size_t chunk_size = frame_size - offset;
+        if (chunk_size > RTP_MTU_PAYLOAD) {
+            chunk_size = RTP_MTU_PAYLOAD;
+        }
+
+        // Build fragment: header + data
+        rtp_frag_encode(frag_buffer, i, total_frags, frame_size, epoch);
+        memcpy(frag_buffer + RTP_FRAG_HEADER_SIZE, frame_data + offset, chunk_size);
+
+        // Wrap in RTP packet
         size_t packet_size = rtp_packet_encode(
             rtp_buffer, RTP_PACKET_BUFFER_SIZE,
-            2, 0, 0, 0,     // version, padding, extension, cc
-            seqnum,
-            1, MJPEG_TYPE, 0, // marker=1 for complete frame
-            frame_data, frame_size
+            2, 0, 0, 0,
+            seqnum,  // Same seqnum for all fragments of this frame
+            (i == total_frags - 1) ? 1 : 0,  // marker=1 on last fragment
+            MJPEG_TYPE, timestamp, 0,
+            frag_buffer, RTP_FRAG_HEADER_SIZE + chunk_size
         );
 
         if (packet_size > 0) {
             ssize_t sent = sendto(socket_fd, rtp_buffer, packet_size, 0,
                 (struct sockaddr *)addr, sizeof(*addr));
             if (sent < 0) {
-                logger_log("error sending rtp packet: %s", strerror(errno));
+                logger_log("error sending fragment %d/%d: %s", i + 1, total_frags, strerror(errno));
+                metrics_counter_add(METRIC_SEND_ERRORS, 1);
                 return -1;
             }
+            metrics_counter_add(METRIC_PACKETS_SENT, 1);
+            metrics_counter_add(METRIC_BYTES_SENT, (uint64_t)sent);
+
+            struct iovec packet = {rtp_buffer, packet_size};
+            retransmit_cache_store(cache, seqnum, (uint8_t)i, &packet, 1);
         }
-    } else {
-        // Large frame - fragment it
-        size_t offset = 0;
 
-        for (int i = 0; i < total_frags; i++) {
-            size_t chunk_size = frame_size - offset;
-            if (chunk_size > RTP_MTU_PAYLOAD) {
-                chunk_size = RTP_MTU_PAYLOAD;
+        if (fec_group() > 0) {
+            rtp_fec_add(&parity, i, frame_data + offset, chunk_size);
+            if (fec_group_done(&parity, i, total_frags)) {
+                send_fec_parity(socket_fd, addr, &parity, total_frags, frame_size, seqnum, timestamp, epoch);
             }
+        }
 
-            // Build fragment: header + data
-            rtp_frag_encode(frag_buffer, i, total_frags, frame_size);
-            memcpy(frag_buffer + RTP_FRAG_HEADER_SIZE, frame_data + offset, chunk_size);
-
-            // Wrap in RTP packet
-            size_t packet_size = rtp_packet_encode(
-                rtp_buffer, RTP_PACKET_BUFFER_SIZE,
-                2, 0, 0, 0,
-                seqnum,  // Same seqnum for all fragments of this frame
-                (i == total_frags - 1) ? 1 : 0,  // marker=1 on last fragment
-                MJPEG_TYPE, 0,
-                frag_buffer, RTP_FRAG_HEADER_SIZE + chunk_size
-            );
+        offset += chunk_size;
 
-            if (packet_size > 0) {
-                ssize_t sent = sendto(socket_fd, rtp_buffer, packet_size, 0,
-                    (struct sockaddr *)addr, sizeof(*addr));
-                if (sent < 0) {
-                    logger_log("error sending fragment %d/%d: %s", i + 1, total_frags, strerror(errno));
-                    return -1;
-                }
-            }
+        // Small delay between fragments to avoid overwhelming the network
+        if (i < total_frags - 1) {
+            usleep(100);  // 0.1ms
+        }
+    }
+
+    return 0;
+}
 
-            offset += chunk_size;
+// Send a frame using its precomputed packet layout: each packet is a copied
+// header with the session fields patched in, sent together with its slice
+// of the frame without assembling it in a separate buffer. Only the cache
+// for retransmission copies it
+static int send_frame_hinted(
+    int socket_fd,
+    struct sockaddr_in *addr,
+    retransmit_cache_t *cache,
+    const rtp_hint_track_t *hints,
+    int frame_index,
+    const uint8_t *frame_data,
+    uint16_t seqnum,
+    uint32_t timestamp,
+    uint8_t epoch
+) {
+    uint8_t header[RTP_HINT_HEADER_SIZE];
+    struct iovec iov[2];
+    struct msghdr msg;
+    rtp_fec_group_t parity = {.count = 0};
+    int fec = fec_group() > 0;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = sizeof(*addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    uint32_t first = hints->frame_first_packet[frame_index];
+    uint32_t last = hints->frame_first_packet[frame_index + 1];
+    for (uint32_t p = first; p < last; p++) {
+        const rtp_hint_packet_t *packet = &hints->packets[p];
+        memcpy(header, packet->header, RTP_HINT_HEADER_SIZE);
+        rtp_hint_patch(header, seqnum, timestamp, 0, epoch);
+
+        iov[0].iov_base = header;
+        iov[0].iov_len = RTP_HINT_HEADER_SIZE;
+        iov[1].iov_base = (void *)(frame_data + packet->payload_offset);
+        iov[1].iov_len = packet->payload_size;
+
+        ssize_t sent = sendmsg(socket_fd, &msg, 0);
+        if (sent < 0) {
+            logger_log("error sending hinted packet %u/%u: %s", p - first + 1, last - first, strerror(errno));
+            metrics_counter_add(METRIC_SEND_ERRORS, 1);
+            return -1;
+        }
+        metrics_counter_add(METRIC_PACKETS_SENT, 1);
+        metrics_counter_add(METRIC_BYTES_SENT, (uint64_t)sent);
+        retransmit_cache_store(cache, seqnum, (uint8_t)(p - first), iov, 2);
+
+        if (fec) {
+            rtp_frag_header_t frag;
+            rtp_frag_decode(header + RTP_HEADER_SIZE, &frag);
+            // A packet too big for the parity would leave a gap in the
+            // group, so the rest of the frame goes without
+            if (rtp_fec_add(&parity, frag.frag_index, iov[1].iov_base, packet->payload_size) != 0) {
+                logger_log("hinted packet %u is larger than a parity payload, no parity for the frame", p);
+                fec = 0;
+            } else if (fec_group_done(&parity, frag.frag_index, frag.total_frags)) {
+                send_fec_parity(socket_fd, addr, &parity, frag.total_frags, frag.total_size,
+                    seqnum, timestamp, epoch);
+            }
+        }
 
-            // Small delay between fragments to avoid overwhelming the network
+        // Small delay between fragments to avoid overwhelming the network
+        if (p < last - 1) {
             usleep(100);  // 0.1ms
         }
     }
@@ -102,11 +243,154 @@ static int send_frame_fragmented(
     return 0;
 }
 
+// Export what congestion control made of the session's link, and log when
+// it backed off (for reason) or went back to sending every frame
+static void publish_congestion(session_t *session, const congestion_t *congestion, double share, const char *reason) {
+    atomic_store_explicit(&session->link_estimate_bps, (uint64_t)congestion->estimate_bps, memory_order_relaxed);
+    atomic_store_explicit(&session->link_frame_share, (uint32_t)(congestion->share * 1000 + 0.5),
+        memory_order_relaxed);
+    if (reason != NULL) {
+        logger_log("session %d: link congested (%s), estimate %.0f kbit/s, sending %.0f%% of frames",
+            session->session_id, reason, congestion->estimate_bps / 1000, congestion->share * 100);
+    } else if (congestion->share == 1 && share < 1) {
+        logger_log("session %d: link recovered, sending every frame", session->session_id);
+    }
+}
+
+// Store a receiver report from the session's client, see session_t, and
+// adapt the frames sent to the loss it reports
+static void record_link_report(session_t *session, const rtcp_report_block_t *block, congestion_t *congestion) {
+    int64_t rtt_us = rtcp_round_trip_us(block);
+    if (rtt_us >= 0) {
+        atomic_store_explicit(&session->link_rtt_us, (uint32_t)rtt_us, memory_order_relaxed);
+        metrics_hist_record(METRIC_HIST_RTT_US, (uint64_t)rtt_us);
+    }
+    uint32_t jitter_us = (uint32_t)((uint64_t)block->jitter * 1000000 / RTP_VIDEO_CLOCK_RATE);
+    atomic_store_explicit(&session->link_jitter_us, jitter_us, memory_order_relaxed);
+    atomic_store_explicit(&session->link_fraction_lost, block->fraction_lost, memory_order_relaxed);
+    atomic_store_explicit(&session->link_packets_lost, block->cumulative_lost, memory_order_relaxed);
+    atomic_store_explicit(&session->link_report_us, metrics_now_us(), memory_order_relaxed);
+
+    double share = congestion->share;
+    int cut = congestion_report(congestion, block->fraction_lost);
+    publish_congestion(session, congestion, share, cut ? "loss" : NULL);
+}
+
+// Handle what the client sent to the session's RTP socket (RTCP on the RTP
+// ports): receiver reports update the session's link quality and
+// congestion control, and NACKed fragments are sent again as long as they
+// are still kept and the link has room. Only the client's own address is
+// listened to, others can't make the server send to it
+static void serve_rtcp(session_t *session,
+                       struct sockaddr_in *addr,
+                       retransmit_cache_t *cache,
+                       congestion_t *congestion) {
+    int socket_fd = session->rtp_socket_fd;
+    uint8_t packet[RTCP_NACK_HEADER_SIZE + RTCP_NACK_MAX_ENTRIES * RTCP_NACK_ENTRY_SIZE];
+    rtcp_nack_entry_t entries[RTCP_NACK_MAX_ENTRIES];
+    uint64_t rtt_us = atomic_load_explicit(&session->link_rtt_us, memory_order_relaxed);
+    struct sockaddr_in from;
+    for (;;) {
+        socklen_t from_len = sizeof(from);
+        ssize_t size = recvfrom(socket_fd, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (size <= 0) {
+            break;
+        }
+        if (from.sin_addr.s_addr != addr->sin_addr.s_addr) {
+            continue;
+        }
+        rtcp_report_block_t block;
+        if (rtcp_rr_decode(packet, (size_t)size, &block) == 0) {
+            record_link_report(session, &block, congestion);
+            continue;
+        }
+
+        int count = rtcp_nack_decode(packet, (size_t)size, entries, RTCP_NACK_MAX_ENTRIES);
+        for (int i = 0; i < count; i++) {
+            for (int bit = -1; bit < 8; bit++) {
+                if (bit >= 0 && (entries[i].following & (1u << bit)) == 0) {
+                    continue;
+                }
+                int frag_index = entries[i].frag_index + bit + 1;
+                size_t packet_size;
+                const uint8_t *kept = frag_index <= UINT8_MAX ?
+                    retransmit_cache_find(cache, entries[i].seqnum, (uint8_t)frag_index, &packet_size) : NULL;
+                if (kept == NULL) {
+                    metrics_counter_add(METRIC_RETRANSMIT_MISSES, 1);
+                    continue;
+                }
+                if (retransmit_cache_resent_within(cache, kept, rtt_us)) {
+                    continue; // a copy sent less than a round trip ago may still arrive
+                }
+                if (!congestion_admit_resend(congestion, packet_size)) {
+                    continue;
+                }
+                ssize_t sent = sendto(socket_fd, kept, packet_size, 0, (struct sockaddr *)addr, sizeof(*addr));
+                if (sent > 0) {
+                    metrics_counter_add(METRIC_RETRANSMITS, 1);
+                    metrics_counter_add(METRIC_BYTES_SENT, (uint64_t)sent);
+                }
+            }
+        }
+    }
+
+    double share = congestion->share;
+    if (congestion_check_feedback(congestion)) {
+        publish_congestion(session, congestion, share, "no receiver reports");
+    }
+}
+
+// Reposition the session in its video, or in its live source's time-shift
+// window, where the time counts from the source's start and frames are
+// numbered from its first one. Live positions outside the window go to
+// the nearest frame in it
+// Return 0 on success, -1 if the seek failed
+static int seek_session(session_t *session, int is_time, double seconds, int frame) {
+    if (session->live != NULL) {
+        session->live_cursor = is_time ?
+            live_seek_time(session->live, seconds) :
+            live_seek_frame(session->live, frame > 0 ? (uint64_t)frame : 0);
+        return 0;
+    }
+    int result = is_time ?
+        video_stream_seek_time(&session->video_stream, seconds) :
+        video_stream_seek_frame(&session->video_stream, frame);
+    return result < 0 ? -1 : 0;
+}
+
+// Reposition the stream for a seek requested while playing
+// Called by the RTP thread with event_mutex held
+static void apply_pending_seek(session_t *session) {
+    if (session->seek_is_time) {
+        logger_log("applying seek to %.2f seconds (epoch %u)",
+            session->seek_time, (unsigned)session->stream_epoch);
+    } else {
+        logger_log("applying seek to frame %d (epoch %u)",
+            session->seek_frame, (unsigned)session->stream_epoch);
+    }
+    int result = seek_session(session, session->seek_is_time, session->seek_time, session->seek_frame);
+    if (result < 0) {
+        logger_log("seek failed, continuing from current position");
+    }
+
+    session->seek_pending = 0;
+    metrics_counter_add(METRIC_SEEKS, 1);
+    metrics_hist_record(METRIC_HIST_SEEK_LATENCY_US, metrics_now_us() - session->seek_requested_us);
+}
+
 static void *send_rtp_thread(void *arg) {
     session_t *session = (session_t *)arg;
 
+    // Pinned before the frame buffer is touched, so it lands on our node
+    placement_bind_thread(session->placement);
+
     uint8_t frame_buffer[FRAME_BUFFER_SIZE];
 
+    // With read-ahead, frames come from the reader's buffers instead
+    frame_reader_t reader;
+    int use_reader = g_read_ahead > 0 &&
+        frame_reader_init(&reader, &session->video_stream, g_read_ahead) == 0;
+
     // Set up the client's UDP address struct for sendto
     struct sockaddr_in rtp_addr;
     memset(&rtp_addr, 0, sizeof(rtp_addr));
@@ -119,56 +403,110 @@ static void *send_rtp_thread(void *arg) {
         ntohs(rtp_addr.sin_port)
     );
 
+    // Packets kept for NACKs, the cache stays empty if that is off
+    retransmit_cache_t retransmit;
+    retransmit_cache_init(&retransmit);
+    rtcp_sender_t reporter = {0};
+    congestion_t congestion;
+    congestion_init(&congestion);
+
     struct timespec wait_time;
     struct timeval now;
 
+    // Pace at the media frame rate rather than a fixed 30 FPS
+    long frame_interval_us = (long)(1000000.0 / session->video_stream.fps);
+
     // Lock the mutex, the C-idiom way for a condition-variable-controlled-loop
     pthread_mutex_lock(&session->event_mutex);
 
     // Loop as long as the stop_rtp_thread is 0
     while (session->stop_rtp_thread == 0) {
+        // A seek only repositions the file, the thread and socket stay up
+        if (session->seek_pending) {
+            apply_pending_seek(session);
+        }
+        uint8_t epoch = session->stream_epoch;
+
         // Unlock -> Send -> Re-lock
 
         // Unlock
         pthread_mutex_unlock(&session->event_mutex);
 
-        // Read frame
-        ssize_t frame_size = video_stream_next_frame(
-            &session->video_stream, frame_buffer, FRAME_BUFFER_SIZE
-        );
+        // Read frame, timing how long sending waits on the disk
+        const uint8_t *frame_data = frame_buffer;
+        uint64_t read_start_us = metrics_now_us();
+        ssize_t frame_size = use_reader ?
+            frame_reader_next(&reader, &frame_data) :
+            video_stream_next_frame(&session->video_stream, frame_buffer, FRAME_BUFFER_SIZE);
+        metrics_hist_record(METRIC_HIST_FRAME_READ_US, metrics_now_us() - read_start_us);
         if (frame_size <= 0) {
             logger_log("end of video stream or read error");
             break;
         }
 
-        // Send frame (with fragmentation if needed)
-        // Log the frame index being sent for debugging seek behavior
-        logger_log("sending frame %d (size %zd bytes) with rtp_seqnum %u",
-            session->video_stream.frame_num,
-            frame_size,
-            (unsigned)session->rtp_seqnum
-        );
+        // Timestamp on the 90kHz media clock, derived from the frame index so
+        // it stays exact across seeks
+        int frame_index = session->video_stream.frame_num - 1;
+        uint32_t timestamp = (uint32_t)(frame_index * (double)RTP_VIDEO_CLOCK_RATE / session->video_stream.fps + 0.5);
+
+        // A frame the link has no room for is skipped, it still takes its
+        // frame interval and the client shows the next one sent for longer
+        if (!congestion_admit_frame(&congestion, (size_t)frame_size)) {
+            metrics_counter_add(METRIC_FRAMES_SKIPPED, 1);
+        } else {
+            // Send frame (with fragmentation if needed)
+            // Log the frame index being sent for debugging seek behavior
+            logger_log("sending frame %d (size %zd bytes) with rtp_seqnum %u",
+                session->video_stream.frame_num,
+                frame_size,
+                (unsigned)session->rtp_seqnum
+            );
 
-        send_frame_fragmented(
-            session->rtp_socket_fd,
-            &rtp_addr,
-            frame_buffer,
-            frame_size,
-            session->rtp_seqnum
-        );
-        
-        // Increment RTP sequence number for next frame
-        session->rtp_seqnum++;
+            if (session->hints != NULL) {
+                send_frame_hinted(
+                    session->rtp_socket_fd,
+                    &rtp_addr,
+                    &retransmit,
+                    session->hints,
+                    frame_index,
+                    frame_data,
+                    session->rtp_seqnum,
+                    timestamp,
+                    epoch
+                );
+            } else {
+                send_frame_fragmented(
+                    session->rtp_socket_fd,
+                    &rtp_addr,
+                    &retransmit,
+                    frame_data,
+                    frame_size,
+                    session->rtp_seqnum,
+                    timestamp,
+                    epoch
+                );
+            }
 
-        // Wait ~33ms for 30 FPS video (matches client consume rate)
+            // Increment RTP sequence number for next frame
+            session->rtp_seqnum++;
+            metrics_counter_add(METRIC_FRAMES_SENT, 1);
+            int packets = rtp_calc_fragments((size_t)frame_size);
+            rtcp_sender_count(&reporter, packets + fec_parity_packets(packets), (size_t)frame_size, timestamp);
+        }
+
+        // Reports and NACKs, exchanged once a frame
+        rtcp_sender_report(&reporter, session->rtp_socket_fd, &rtp_addr);
+        serve_rtcp(session, &rtp_addr, &retransmit, &congestion);
+
+        // Wait one frame interval (matches client consume rate)
         gettimeofday(&now, NULL);
 
         // Convert us to ns by multiplying by 1000
         wait_time.tv_sec = now.tv_sec;
-        wait_time.tv_nsec = (now.tv_usec + 33333) * 1000;  // 33.333ms = 30 FPS
+        wait_time.tv_nsec = (now.tv_usec + frame_interval_us) * 1000;
 
         // Handle nanosecond overflow (if > 1 billion)
-        if (wait_time.tv_nsec >= 1000000000) {
+        while (wait_time.tv_nsec >= 1000000000) {
             wait_time.tv_sec++;
             wait_time.tv_nsec -= 1000000000;
         }
@@ -176,19 +514,157 @@ static void *send_rtp_thread(void *arg) {
         // Re-lock
         pthread_mutex_lock(&session->event_mutex);
 
+        // A seek that arrived while sending is served right away, the target
+        // frame shouldn't wait out the rest of the frame interval
+        if (session->seek_pending || session->stop_rtp_thread) {
+            continue;
+        }
+
         // This will wait until "wait_time" OR until signaled by another thread (e.g. PAUSE)
         // It will automatically unlocks the mutex, waits and re-locks it
-        pthread_cond_timedwait(&session->event_cond, &session->event_mutex, &wait_time);
+        int wait_result = pthread_cond_timedwait(&session->event_cond, &session->event_mutex, &wait_time);
+
+        // When the wait ran its full course, record how far past the deadline
+        // the scheduler actually woke us up
+        if (wait_result == ETIMEDOUT) {
+            gettimeofday(&now, NULL);
+            int64_t late_us = ((int64_t)now.tv_sec - wait_time.tv_sec) * 1000000
+                + now.tv_usec - wait_time.tv_nsec / 1000;
+            metrics_hist_record(METRIC_HIST_PACING_LATENESS_US, late_us > 0 ? (uint64_t)late_us : 0);
+        }
     }
 
     // Unclock one last time before exiting
     pthread_mutex_unlock(&session->event_mutex);
 
+    if (use_reader) {
+        frame_reader_close(&reader);
+    }
+    retransmit_cache_free(&retransmit);
     logger_log("rtp sending thread stopping");
     return NULL;
 }
 
-static void send_rtsp_reply(session_t *session, rtsp_status_t status, int cseq) {
+// Sleep until due_us (metrics_now_us) unless a seek or stop comes first
+// Return 0 once due, -1 if interrupted
+static int wait_until_due(session_t *session, uint64_t due_us) {
+    uint64_t now_us = metrics_now_us();
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t wake_us = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_usec + (due_us - now_us);
+    struct timespec wait_time = {(time_t)(wake_us / 1000000), (long)(wake_us % 1000000) * 1000};
+
+    pthread_mutex_lock(&session->event_mutex);
+    while (!session->stop_rtp_thread && !session->seek_pending &&
+           pthread_cond_timedwait(&session->event_cond, &session->event_mutex, &wait_time) != ETIMEDOUT) {
+    }
+    int interrupted = session->stop_rtp_thread || session->seek_pending;
+    pthread_mutex_unlock(&session->event_mutex);
+    return interrupted ? -1 : 0;
+}
+
+// Send a live source's frames as they are pushed, so the producer paces
+// the session. Frames from behind the live edge, after a pause or a seek
+// into the time-shift window, go out at the pace they arrived in. A frame
+// is only referenced while it is being sent
+static void *send_live_thread(void *arg) {
+    session_t *session = (session_t *)arg;
+    placement_bind_thread(session->placement);
+
+    struct sockaddr_in rtp_addr;
+    memset(&rtp_addr, 0, sizeof(rtp_addr));
+    rtp_addr.sin_family = AF_INET;
+    rtp_addr.sin_addr = session->client_addr.sin_addr;
+    rtp_addr.sin_port = htons(session->rtp_port);
+
+    logger_log("live rtp thread started for %s at frame %llu, target %s:%d",
+        session->filename, (unsigned long long)session->live_cursor,
+        inet_ntoa(rtp_addr.sin_addr), ntohs(rtp_addr.sin_port));
+
+    retransmit_cache_t retransmit;
+    retransmit_cache_init(&retransmit);
+    rtcp_sender_t reporter = {0};
+    congestion_t congestion;
+    congestion_init(&congestion);
+
+    // When the frame that arrived at base_arrival_us was sent
+    uint64_t base_sent_us = 0;
+    uint64_t base_arrival_us = 0;
+    int rebase = 1;
+
+    pthread_mutex_lock(&session->event_mutex);
+    while (session->stop_rtp_thread == 0) {
+        if (session->seek_pending) {
+            apply_pending_seek(session);
+            rebase = 1;
+        }
+        uint8_t epoch = session->stream_epoch;
+        pthread_mutex_unlock(&session->event_mutex);
+
+        int ended = 0;
+        live_frame_t *frame = live_next(session->live, &session->live_cursor, LIVE_WAIT_MS, &ended);
+        if (frame != NULL) {
+            uint64_t now_us = metrics_now_us();
+            uint64_t due_us = base_sent_us + (frame->arrival_us - base_arrival_us);
+            if (rebase || frame->arrival_us < base_arrival_us || due_us > now_us + LIVE_MAX_PACING_US) {
+                base_sent_us = now_us;
+                base_arrival_us = frame->arrival_us;
+                due_us = now_us;
+                rebase = 0;
+            }
+            if (due_us > now_us && wait_until_due(session, due_us) != 0) {
+                session->live_cursor = frame->number; // not sent, resume at it
+                live_frame_release(frame);
+                pthread_mutex_lock(&session->event_mutex);
+                continue;
+            }
+
+            // Timestamp from the arrival time, a producer need not be steady
+            uint32_t timestamp = (uint32_t)((frame->arrival_us - session->live->start_us) * RTP_VIDEO_CLOCK_RATE / 1000000);
+            if (!congestion_admit_frame(&congestion, frame->size)) {
+                metrics_counter_add(METRIC_FRAMES_SKIPPED, 1);
+            } else {
+                send_frame_fragmented(
+                    session->rtp_socket_fd,
+                    &rtp_addr,
+                    &retransmit,
+                    frame->data,
+                    frame->size,
+                    session->rtp_seqnum,
+                    timestamp,
+                    epoch
+                );
+                session->rtp_seqnum++;
+                metrics_counter_add(METRIC_FRAMES_SENT, 1);
+                int packets = rtp_calc_fragments(frame->size);
+                rtcp_sender_count(&reporter, packets + fec_parity_packets(packets), frame->size, timestamp);
+            }
+            live_frame_release(frame);
+        }
+        rtcp_sender_report(&reporter, session->rtp_socket_fd, &rtp_addr);
+        serve_rtcp(session, &rtp_addr, &retransmit, &congestion);
+
+        pthread_mutex_lock(&session->event_mutex);
+        if (ended) {
+            logger_log("live source %s ended", session->filename);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&session->event_mutex);
+
+    retransmit_cache_free(&retransmit);
+    logger_log("live rtp thread stopping");
+    return NULL;
+}
+
+// Send a reply with optional extra header lines (each ending in "\r\n")
+// and an optional body of the given content type
+static void send_rtsp_reply_with_body(session_t *session,
+                                      rtsp_status_t status,
+                                      int cseq,
+                                      const char *extra_headers,
+                                      const char *content_type,
+                                      const char *body) {
     char send_buffer[SEND_BUFFER_SIZE];
     char status_str[64];
 
@@ -199,25 +675,82 @@ static void send_rtsp_reply(session_t *session, rtsp_status_t status, int cseq)
     case STATUS_NOT_FOUND_404:
         strcpy(status_str, "404 Not Found");
         break;
+    case STATUS_SESSION_NOT_FOUND_454:
+        strcpy(status_str, "454 Session Not Found");
+        break;
+    case STATUS_INVALID_STATE_455:
+        strcpy(status_str, "455 Method Not Valid in This State");
+        break;
+    case STATUS_NOT_IMPLEMENTED_501:
+        strcpy(status_str, "501 Not Implemented");
+        break;
+    case STATUS_NOT_ENOUGH_BANDWIDTH_453:
+        strcpy(status_str, "453 Not Enough Bandwidth");
+        break;
+    case STATUS_UNAVAILABLE_503:
+        strcpy(status_str, "503 Service Unavailable");
+        break;
+    case STATUS_UNSUPPORTED_TRANSPORT_461:
+        strcpy(status_str, "461 Unsupported Transport");
+        break;
     case STATUS_SRV_ERR_500:
     default:
         strcpy(status_str, "500 Internal Server Error");
         break;
     }
 
-    // The session ID will be sent in every reply
-    sprintf(send_buffer, "%s %s\r\nCSeq: %d\r\nSession: %d\r\n\r\n",
+    // The session ID will be sent in every reply, with the idle timeout once
+    // there is a session to keep alive (RFC 2326, 12.37)
+    int len = snprintf(send_buffer, sizeof(send_buffer), "%s %s\r\nCSeq: %d\r\nSession: %d",
         RTSP_VERSION, status_str, cseq, session->session_id
     );
+    if (session->session_id != 0 && session_table_timeout() > 0) {
+        len += snprintf(send_buffer + len, sizeof(send_buffer) - len, ";timeout=%d", session_table_timeout());
+    }
+    len += snprintf(send_buffer + len, sizeof(send_buffer) - len, "\r\n%s",
+        extra_headers != NULL ? extra_headers : ""
+    );
+    if (body != NULL) {
+        len += snprintf(send_buffer + len, sizeof(send_buffer) - len,
+            "Content-Type: %s\r\nContent-Length: %zu\r\n\r\n%s",
+            content_type, strlen(body), body
+        );
+    } else {
+        len += snprintf(send_buffer + len, sizeof(send_buffer) - len, "\r\n");
+    }
+    if (len >= (int)sizeof(send_buffer)) {
+        logger_log("reply too large, not sent");
+        return;
+    }
     logger_log("sending reply:\n%s", send_buffer);
 
-    if (send(session->rtsp_socket_fd, send_buffer, strlen(send_buffer), 0) < 0) {
+    if (send(session->rtsp_socket_fd, send_buffer, (size_t)len, 0) < 0) {
         logger_log("error sending reply: %s", strerror(errno));
     }
 }
 
+static void send_rtsp_reply_with_headers(session_t *session,
+                                         rtsp_status_t status,
+                                         int cseq,
+                                         const char *extra_headers) {
+    send_rtsp_reply_with_body(session, status, cseq, extra_headers, NULL, NULL);
+}
+
+static void send_rtsp_reply(session_t *session, rtsp_status_t status, int cseq) {
+    send_rtsp_reply_with_headers(session, status, cseq, NULL);
+}
+
 static void stop_rtp_streaming(session_t *session) {
-    if (session->state != STATE_PLAYING) {
+    // A recording producer has no RTP thread
+    if (session->state != STATE_PLAYING || session->live_producer) {
+        return;
+    }
+    if (session->channel != NULL && session->multicast) {
+        channel_leave_multicast(session->channel);
+        return;
+    }
+    if (session->channel != NULL) {
+        channel_unsubscribe(session->channel, session->channel_subscriber);
         return;
     }
     logger_log("stop rtp streaming");
@@ -237,26 +770,225 @@ static void stop_rtp_streaming(session_t *session) {
     }
 }
 
-static void handle_setup(session_t *session, rtsp_request_info_t *info) {
-    if (session->state != STATE_INIT) {
-        logger_log("received setup in non-init state");
-        return;
+// Release the session's video, channel and live source, ending one it produces
+static void close_session_video(session_t *session) {
+    channel_release(session->channel);
+    session->channel = NULL;
+    if (session->live_producer) {
+        live_end(session->live);
+        session->live_producer = 0;
     }
+    live_release(session->live);
+    session->live = NULL;
+    video_stream_close(&session->video_stream);
+    catalog_release(session->video_entry);
+    session->video_entry = NULL;
+    session->hints = NULL;
+}
 
-    logger_log("processing setup for file: %s", info->filename);
+// Open the requested video, reusing it if a DESCRIBE already opened it
+static int open_session_video(session_t *session, const char *filename) {
+    if (session->video_entry != NULL) {
+        if (strcmp(session->filename, filename) == 0) {
+            session->video_stream.frame_num = 0; // rewind
+            return 0;
+        }
+        close_session_video(session);
+    }
 
-    // Try to open the video file
-    if (video_stream_open(&session->video_stream, info->filename) != 0) {
-        logger_log("file not found: %s", info->filename);
+    // A video other sessions play is already open and indexed
+    catalog_entry_t *entry = catalog_acquire(filename);
+    if (entry == NULL) {
+        return -1;
+    }
+    session->video_entry = entry;
+    video_stream_attach(&session->video_stream, &entry->stream);
+    session->hints = entry->hints.frame_first_packet != NULL ? &entry->hints : NULL;
+    memcpy(session->filename, filename, sizeof(session->filename));
+    return 0;
+}
+
+// Whether url plays from a live source, pushed by a producer or relayed
+// from upstream
+static int url_is_live(const char *url) {
+    return live_url_is_live(url) || relay_url_is_relay(url);
+}
+
+// Join the live source a producer pushes to name, or the relay url names
+static int open_session_live(session_t *session, const char *url, const char *filename) {
+    if (session->live != NULL && strcmp(session->filename, filename) == 0) {
+        return 0;
+    }
+    close_session_video(session);
+
+    session->live = relay_url_is_relay(url) ? relay_acquire(url) : live_acquire(filename);
+    if (session->live == NULL) {
+        return -1;
+    }
+    memcpy(session->filename, filename, sizeof(session->filename));
+    return 0;
+}
+
+// SDP describing the video, with the frame size taken from the JPEG SOF
+// marker and the frame rate, count and largest frame from the index. A live
+// source has no end and no index, its frames are only bounded in size
+static int build_sdp(session_t *session, char *buffer, size_t size) {
+    const video_stream_t *stream = &session->video_stream;
+    double fps = stream->fps;
+    int width = stream->width;
+    int height = stream->height;
+    int total_frames = stream->total_frames;
+    size_t max_frame_size = stream->max_frame_size;
+    char range[32];
+    snprintf(range, sizeof(range), "npt=0-%.3f", total_frames / fps);
+
+    if (session->live != NULL) {
+        fps = session->live->fps;
+        live_describe(session->live, &width, &height);
+        total_frames = 0;
+        max_frame_size = LIVE_MAX_FRAME_SIZE;
+        snprintf(range, sizeof(range), "npt=now-");
+    }
+
+    int len = snprintf(buffer, size,
+        "v=0\r\n"
+        "o=- %d 1 IN IP4 0.0.0.0\r\n"
+        "s=%s\r\n"
+        "t=0 0\r\n"
+        "a=range:%s\r\n"
+        "m=video 0 RTP/AVP %d\r\n"
+        "a=rtpmap:%d JPEG/%d\r\n"
+        "a=framerate:%.3f\r\n"
+        "a=x-dimensions:%d,%d\r\n"
+        "a=x-frame-count:%d\r\n"
+        "a=x-max-frame-size:%zu\r\n",
+        session->session_id, session->filename, range,
+        MJPEG_TYPE, MJPEG_TYPE, RTP_VIDEO_CLOCK_RATE,
+        fps, width, height,
+        total_frames, max_frame_size
+    );
+    return len < (int)size ? 0 : -1;
+}
+
+static void handle_describe(session_t *session, rtsp_request_info_t *info) {
+    char filename[sizeof(session->filename)];
+    rtsp_slice_copy(info->filename, filename, sizeof(filename));
+    logger_log("processing describe for file: %s", filename);
+
+    // Once set up, the session is bound to its video
+    if (session->state != STATE_INIT && strcmp(filename, session->filename) != 0) {
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
+        return;
+    }
+
+    // The stream stays open so the SETUP that follows doesn't index it again
+    char url[sizeof(session->filename)];
+    rtsp_slice_copy(info->url, url, sizeof(url));
+    int opened = url_is_live(url) ?
+        open_session_live(session, url, filename) :
+        open_session_video(session, filename);
+    if (opened != 0) {
+        logger_log("file not found: %s", filename);
         send_rtsp_reply(session, STATUS_NOT_FOUND_404, info->cseq);
         return;
     }
 
+    char sdp[SDP_BUFFER_SIZE];
+    if (build_sdp(session, sdp, sizeof(sdp)) != 0) {
+        send_rtsp_reply(session, STATUS_SRV_ERR_500, info->cseq);
+        return;
+    }
+    send_rtsp_reply_with_body(session, STATUS_OK_200, info->cseq, NULL, "application/sdp", sdp);
+}
+
+// Egress of a session playing the whole video: average frame plus the RTP,
+// fragment, UDP and IPv4 headers of its packets, at the media frame rate
+static uint64_t estimate_egress_bps(double avg_frame_size, double fps) {
+    int packets = rtp_calc_fragments((size_t)avg_frame_size);
+    double frame_bytes = avg_frame_size + packets * (RTP_HEADER_SIZE + RTP_FRAG_HEADER_SIZE + 28);
+    int parity = fec_parity_packets(packets);
+    frame_bytes += parity * (RTP_MTU_PAYLOAD + RTP_HEADER_SIZE + RTP_FRAG_HEADER_SIZE + 28);
+    return (uint64_t)(frame_bytes * 8 * fps);
+}
+
+// Frame buffers the RTP thread holds: its own plus the read-ahead window
+static uint64_t estimate_frame_memory(const video_stream_t *stream) {
+    return FRAME_BUFFER_SIZE + (uint64_t)g_read_ahead * stream->max_frame_size;
+}
+
+// Set the session up for the requested video, source or channel
+// Return STATUS_OK_200 with the media headers to reply with, or the status
+// to refuse with
+static rtsp_status_t setup_session(session_t *session,
+                                   rtsp_request_info_t *info,
+                                   char *media_headers,
+                                   size_t media_headers_size) {
+    if (session->state != STATE_INIT) {
+        logger_log("received setup in non-init state");
+        return STATUS_INVALID_STATE_455;
+    }
+
+    // The parsed filename is a slice of the receive buffer, terminate a copy
+    char filename[sizeof(session->filename)];
+    rtsp_slice_copy(info->filename, filename, sizeof(filename));
+    logger_log("processing setup for file: %s", filename);
+
+    // Only channels can be sent to a multicast group
+    char url[sizeof(session->filename)];
+    rtsp_slice_copy(info->url, url, sizeof(url));
+    int is_channel = !relay_url_is_relay(url) && channel_url_is_channel(url);
+    if (info->multicast && !is_channel) {
+        logger_log("multicast requested for %s, which is not a channel", filename);
+        return STATUS_UNSUPPORTED_TRANSPORT_461;
+    }
+
+    // Try to open the video file, or join the live source
+    int is_live = url_is_live(url);
+    int opened = is_live ?
+        open_session_live(session, url, filename) :
+        open_session_video(session, filename);
+    if (opened != 0) {
+        logger_log("file not found: %s", filename);
+        return STATUS_NOT_FOUND_404;
+    }
+
     logger_log("video stream opened successfully");
+    double fps = is_live ? session->live->fps : session->video_stream.fps;
+    double avg_frame_size = is_live ? live_avg_frame_size(session->live) : session->video_stream.avg_frame_size;
+
+    // Only admit what the server can still carry, the session keeps its
+    // connection and may retry. Channel viewers share the producer's buffer,
+    // and multicast viewers its packets too. Live viewers send from the ring
+    // and only keep their packets for retransmission
+    uint64_t memory = is_channel ? 0 : retransmit_memory();
+    if (!is_channel && !is_live) {
+        memory += estimate_frame_memory(&session->video_stream);
+    }
+    rtsp_status_t admission = session_table_admit(session,
+        info->multicast ? 0 : estimate_egress_bps(avg_frame_size, fps), memory);
+    if (admission != STATUS_OK_200) {
+        close_session_video(session);
+        return admission;
+    }
+
+    if (is_channel) {
+        session->channel = channel_acquire(filename);
+        if (session->channel == NULL) {
+            session_table_release(session);
+            close_session_video(session);
+            return STATUS_SRV_ERR_500;
+        }
+        if (info->multicast && session->channel->group.sin_family != AF_INET) {
+            logger_log("multicast requested but not enabled (-g)");
+            session_table_release(session);
+            close_session_video(session);
+            return STATUS_UNSUPPORTED_TRANSPORT_461;
+        }
+    }
 
     // Now the file exists, store the request details
-    strncpy(session->filename, info->filename, sizeof(session->filename));
     session->rtp_port = info->rtp_port;
+    session->multicast = info->multicast;
 
     // Generate a random session ID for the client
     if (session->session_id == 0) {
@@ -270,35 +1002,124 @@ static void handle_setup(session_t *session, rtsp_request_info_t *info) {
     session->stop_rtp_thread = 1;
     session->rtp_socket_fd = -1;
     session->rtp_seqnum = 0;  // Initialize RTP sequence number
+    session->seek_pending = 0;
+    session->stream_epoch = 0;
+    session->live_cursor = LIVE_CURSOR_LATEST;
+
+    // Tell the client the media clock so it can step and seek by frame
+    int len = snprintf(media_headers, media_headers_size, "X-Framerate: %.3f\r\nX-Frame-Count: %d\r\n",
+        fps, is_live ? 0 : session->video_stream.total_frames);
+
+    // Where to receive a multicast channel (RFC 2326, 12.39)
+    if (session->multicast) {
+        const struct sockaddr_in *group = &session->channel->group;
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &group->sin_addr, address, sizeof(address));
+        snprintf(media_headers + len, media_headers_size - len,
+            "Transport: RTP/AVP;multicast;destination=%s;port=%d-%d;ttl=%d\r\n",
+            address, ntohs(group->sin_port), ntohs(group->sin_port) + 1, channel_multicast_ttl());
+    }
+    return STATUS_OK_200;
+}
+
+static void handle_setup(session_t *session, rtsp_request_info_t *info) {
+    char media_headers[256];
+    rtsp_status_t status = setup_session(session, info, media_headers, sizeof(media_headers));
+    send_rtsp_reply_with_headers(session, status, info->cseq, status == STATUS_OK_200 ? media_headers : NULL);
+}
+
+// Viewers join a channel where it is, its producer does all the sending
+static void handle_channel_play(session_t *session, rtsp_request_info_t *info) {
+    if (info->has_seek || info->has_frame_seek) {
+        logger_log("seek on live channel %s refused", session->filename);
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
+        return;
+    }
+    if (session->state == STATE_PLAYING) {
+        send_rtsp_reply(session, STATUS_OK_200, info->cseq);
+        return;
+    }
+
+    struct sockaddr_in rtp_addr;
+    memset(&rtp_addr, 0, sizeof(rtp_addr));
+    rtp_addr.sin_family = AF_INET;
+    rtp_addr.sin_addr = session->client_addr.sin_addr;
+    rtp_addr.sin_port = htons(session->rtp_port);
 
+    // The session ID doubles as the viewer's SSRC. Multicast viewers all
+    // receive the group's packets
+    if (session->multicast) {
+        session->channel_subscriber = channel_join_multicast(session->channel);
+    } else {
+        session->channel_subscriber = channel_subscribe(session->channel, &rtp_addr, (uint32_t)session->session_id);
+    }
+    if (session->channel_subscriber < 0) {
+        send_rtsp_reply(session, STATUS_SRV_ERR_500, info->cseq);
+        return;
+    }
+    session->state = STATE_PLAYING;
     send_rtsp_reply(session, STATUS_OK_200, info->cseq);
 }
 
 static void handle_play(session_t *session, rtsp_request_info_t *info) {
-    // Only do SETUP on first PLAY
+    // Only do SETUP on first PLAY, the PLAY reply answers for both
     if (session->state == STATE_INIT) {
-        handle_setup(session, info);
+        char media_headers[256];
+        rtsp_status_t status = setup_session(session, info, media_headers, sizeof(media_headers));
+        if (status != STATUS_OK_200) {
+            send_rtsp_reply(session, status, info->cseq);
+            return;
+        }
     }
 
     if (session->state != STATE_READY && session->state != STATE_PLAYING) {
         logger_log("received play in non-ready state");
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
+        return;
+    }
+
+    if (session->channel != NULL) {
+        handle_channel_play(session, info);
         return;
     }
 
     logger_log("processing play");
+    uint64_t seek_start_us = metrics_now_us();
+    int has_seek = info->has_seek || info->has_frame_seek;
 
-    // If a seek is requested while currently playing, stop the RTP thread
-    // so we can reposition the file and restart sending from the seek point.
-    if ((info->has_seek || info->has_frame_seek) && session->state == STATE_PLAYING) {
-        logger_log("play request contains seek while playing - stopping current RTP thread to reposition");
-        stop_rtp_streaming(session);
-        session->state = STATE_READY;
+    // Without time-shift a live source only has its latest frames
+    if (session->live != NULL && has_seek && !live_has_dvr(session->live)) {
+        logger_log("seek on live source %s refused", session->filename);
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
+        return;
+    }
+
+    // Seek while playing: hand the new position to the running RTP thread
+    // and start a new epoch. The thread wakes up at once and sends the
+    // target frame next, without being joined or losing its socket
+    if (has_seek && session->state == STATE_PLAYING) {
+        pthread_mutex_lock(&session->event_mutex);
+        session->seek_pending = 1;
+        session->seek_is_time = info->has_seek && !info->has_frame_seek;
+        session->seek_time = info->seek_position;
+        session->seek_frame = info->frame_number;
+        session->seek_requested_us = seek_start_us;
+        session->stream_epoch++;
+        uint8_t epoch = session->stream_epoch;
+        pthread_cond_signal(&session->event_cond);
+        pthread_mutex_unlock(&session->event_mutex);
+
+        logger_log("seek while playing, new stream epoch %u", (unsigned)epoch);
+        char epoch_header[32];
+        snprintf(epoch_header, sizeof(epoch_header), "X-Epoch: %u\r\n", (unsigned)epoch);
+        send_rtsp_reply_with_headers(session, STATUS_OK_200, info->cseq, epoch_header);
+        return;
     }
 
     // Handle seek if Range header is present (time-based)
     if (info->has_seek) {
         logger_log("seek requested to %.2f seconds", info->seek_position);
-        if (video_stream_seek_time(&session->video_stream, info->seek_position) < 0) {
+        if (seek_session(session, 1, info->seek_position, 0) != 0) {
             logger_log("seek failed");
             send_rtsp_reply(session, STATUS_SRV_ERR_500, info->cseq);
             return;
@@ -308,13 +1129,22 @@ static void handle_play(session_t *session, rtsp_request_info_t *info) {
     // Handle frame-based seek if X-Frame header is present
     if (info->has_frame_seek) {
         logger_log("frame seek requested to frame %d", info->frame_number);
-        if (video_stream_seek_frame(&session->video_stream, info->frame_number) < 0) {
+        if (seek_session(session, 0, 0, info->frame_number) != 0) {
             logger_log("frame seek failed");
             send_rtsp_reply(session, STATUS_SRV_ERR_500, info->cseq);
             return;
         }
     }
 
+    // Packets still in flight from before the pause belong to the old epoch
+    char epoch_header[32] = "";
+    if (has_seek) {
+        session->stream_epoch++;
+        snprintf(epoch_header, sizeof(epoch_header), "X-Epoch: %u\r\n", (unsigned)session->stream_epoch);
+        metrics_counter_add(METRIC_SEEKS, 1);
+        metrics_hist_record(METRIC_HIST_SEEK_LATENCY_US, metrics_now_us() - seek_start_us);
+    }
+
     // If already playing and no seek was requested, acknowledge and continue
     if (session->state == STATE_PLAYING) {
         logger_log("already playing, restarting stream");
@@ -344,13 +1174,22 @@ static void handle_play(session_t *session, rtsp_request_info_t *info) {
     session->state = STATE_PLAYING;
 
     // Send the reply before starting the thread
-    send_rtsp_reply(session, STATUS_OK_200, info->cseq);
+    send_rtsp_reply_with_headers(session, STATUS_OK_200, info->cseq, epoch_header);
 
     pthread_mutex_lock(&session->event_mutex);
     session->stop_rtp_thread = 0; // set to play
     pthread_mutex_unlock(&session->event_mutex);
 
-    if (pthread_create(&session->rtp_thread_id, NULL, send_rtp_thread, (void *)session) != 0) {
+    // Live viewers start at the latest frame, and also resume there unless
+    // time-shift kept where they paused
+    void *(*rtp_thread)(void *) = send_rtp_thread;
+    if (session->live != NULL) {
+        if (!has_seek && !live_has_dvr(session->live)) {
+            session->live_cursor = LIVE_CURSOR_LATEST;
+        }
+        rtp_thread = send_live_thread;
+    }
+    if (pthread_create(&session->rtp_thread_id, NULL, rtp_thread, (void *)session) != 0) {
         logger_log("error creating rtp thread");
         session->state = STATE_READY; // revert state
     }
@@ -359,6 +1198,7 @@ static void handle_play(session_t *session, rtsp_request_info_t *info) {
 static void handle_pause(session_t *session, rtsp_request_info_t *info) {
     if (session->state != STATE_PLAYING) {
         logger_log("received pause in non-playing state");
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
         return;
     }
 
@@ -373,38 +1213,133 @@ static void handle_teardown(session_t *session, rtsp_request_info_t *info) {
     logger_log("processing teardown");
 
     stop_rtp_streaming(session);
+    session_table_release(session);
     send_rtsp_reply(session, STATUS_OK_200, info->cseq);
     session->state = STATE_INIT;
 }
 
-static int process_rtsp_request(session_t *session, char *request) {
-    rtsp_request_info_t info;
-    rtsp_parse_request(request, &info);
+// A producer announces live/<name>, with its frame rate in an SDP body
+// like the one DESCRIBE returns
+static void handle_announce(session_t *session, rtsp_request_info_t *info) {
+    char filename[sizeof(session->filename)];
+    char url[sizeof(session->filename)];
+    rtsp_slice_copy(info->filename, filename, sizeof(filename));
+    rtsp_slice_copy(info->url, url, sizeof(url));
+    logger_log("processing announce for %s", filename);
+
+    if (session->state != STATE_INIT || !live_url_is_live(url) || relay_url_is_relay(url)) {
+        logger_log("announce is only valid for a new live/ source");
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
+        return;
+    }
 
-    // Check if the session ID match, unless it is a SETUP request
-    if (info.method != METHOD_SETUP && info.session_id != session->session_id) {
+    double fps = VIDEO_DEFAULT_FPS;
+    char sdp[SDP_BUFFER_SIZE];
+    rtsp_slice_copy(info->body, sdp, sizeof(sdp));
+    const char *framerate = strstr(sdp, "a=framerate:");
+    if (framerate != NULL && atof(framerate + strlen("a=framerate:")) > 0) {
+        fps = atof(framerate + strlen("a=framerate:"));
+    }
+
+    // The producer's ring is what the source costs
+    rtsp_status_t admission = session_table_admit(session, 0, live_ring_memory());
+    if (admission != STATUS_OK_200) {
+        send_rtsp_reply(session, admission, info->cseq);
+        return;
+    }
+    close_session_video(session);
+    session->live = live_announce(filename, fps);
+    if (session->live == NULL) {
+        session_table_release(session);
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
+        return;
+    }
+    session->live_producer = 1;
+    memcpy(session->filename, filename, sizeof(session->filename));
+    if (session->session_id == 0) {
+        session->session_id = (rand() % 899999) + 100000;
+    }
+    session->state = STATE_READY;
+    send_rtsp_reply(session, STATUS_OK_200, info->cseq);
+}
+
+// After RECORD the producer's connection carries its MJPEG stream instead
+// of requests, see receive_live_frames
+static void handle_record(session_t *session, rtsp_request_info_t *info) {
+    if (!session->live_producer || session->state != STATE_READY) {
+        logger_log("received record without announce");
+        send_rtsp_reply(session, STATUS_INVALID_STATE_455, info->cseq);
+        return;
+    }
+    session->state = STATE_PLAYING;
+    send_rtsp_reply(session, STATUS_OK_200, info->cseq);
+}
+
+// Feed everything the producer sends into its live source until it closes
+// the connection. Each read counts as activity for the idle timeout
+static void receive_live_frames(session_t *session, const rtsp_conn_buffer_t *conn) {
+    logger_log("receiving live frames for %s", session->filename);
+
+    size_t len;
+    const char *unparsed = rtsp_conn_unparsed(conn, &len);
+    live_feed(session->live, (const uint8_t *)unparsed, len);
+
+    uint8_t buffer[LIVE_RECV_CHUNK];
+    ssize_t bytes_read;
+    while ((bytes_read = read(session->rtsp_socket_fd, buffer, sizeof(buffer))) > 0) {
+        session_table_touch(session);
+        live_feed(session->live, buffer, (size_t)bytes_read);
+    }
+    logger_log("live producer for %s disconnected", session->filename);
+}
+
+// Keepalive, any request refreshes the session and this one does nothing else
+static void handle_get_parameter(session_t *session, rtsp_request_info_t *info) {
+    send_rtsp_reply(session, STATUS_OK_200, info->cseq);
+}
+
+static int process_rtsp_request(session_t *session, rtsp_request_info_t *info) {
+    // Check if the session ID match, unless it is a SETUP, DESCRIBE or
+    // ANNOUNCE request
+    if (info->method != METHOD_SETUP && info->method != METHOD_DESCRIBE &&
+        info->method != METHOD_ANNOUNCE && info->session_id != session->session_id) {
         logger_log("session id mismatch. expected %d, got %d",
-            session->session_id, info.session_id
+            session->session_id, info->session_id
         );
+        // Always reply, clients match replies to requests by CSeq
+        send_rtsp_reply(session, STATUS_SESSION_NOT_FOUND_454, info->cseq);
         return 0; // continue
     }
 
     // Route the request based on the parsed method
-    switch (info.method) {
+    switch (info->method) {
     case METHOD_SETUP:
-        handle_setup(session, &info);
+        handle_setup(session, info);
         break;
     case METHOD_PLAY:
-        handle_play(session, &info);
+        handle_play(session, info);
         break;
     case METHOD_PAUSE:
-        handle_pause(session, &info);
+        handle_pause(session, info);
         break;
     case METHOD_TEARDOWN:
-        handle_teardown(session, &info);
+        handle_teardown(session, info);
         return 1; // signal to exit loop
+    case METHOD_DESCRIBE:
+        handle_describe(session, info);
+        break;
+    case METHOD_GET_PARAMETER:
+        handle_get_parameter(session, info);
+        break;
+    case METHOD_ANNOUNCE:
+        handle_announce(session, info);
+        break;
+    case METHOD_RECORD:
+        handle_record(session, info);
+        break;
     default:
         logger_log("received unknown or malformed request");
+        send_rtsp_reply(session, STATUS_NOT_IMPLEMENTED_501, info->cseq);
         break;
     }
     return 0; // continue
@@ -413,25 +1348,55 @@ static int process_rtsp_request(session_t *session, char *request) {
 void *server_worker_thread(void *arg) {
     session_t *session = (session_t *)arg;
 
-    char buffer[RECV_BUFFER_SIZE];
-    ssize_t bytes_read;
+    // Requests are parsed in place, a read may hold a partial request or
+    // several pipelined ones
+    rtsp_conn_buffer_t conn;
+    rtsp_conn_init(&conn);
+    rtsp_request_info_t info;
+    int done = 0;
 
     logger_log("new client thread started");
+    metrics_counter_add(METRIC_SESSIONS_OPENED, 1);
+
+    session->placement = placement_assign();
+    placement_bind_thread(session->placement);
+    if (session->placement.cpu >= 0) {
+        logger_log("session placed on cpu %d, node %d", session->placement.cpu, session->placement.node);
+    }
 
-    while(1) {
+    while (!done) {
         // Blocking here, waiting for data from the client
-        bytes_read = read(session->rtsp_socket_fd, buffer, RECV_BUFFER_SIZE - 1);
+        size_t space;
+        char *tail = rtsp_conn_tail(&conn, &space);
+        ssize_t bytes_read = read(session->rtsp_socket_fd, tail, space);
 
         if (bytes_read <= 0) {
             logger_log("client disconnected or read error");
             break;
         }
-        buffer[bytes_read] = '\0';
-        logger_log("received data:\n%s", buffer);
+        rtsp_conn_commit(&conn, (size_t)bytes_read);
+
+        rtsp_parse_status_t status;
+        while ((status = rtsp_conn_next(&conn, &info)) == RTSP_PARSE_OK) {
+            logger_log("received request:\n%.*s", (int)info.raw.len, info.raw.ptr);
+            session_table_touch(session);
 
-        int teardown_signal = process_rtsp_request(session, buffer);
-        if (teardown_signal) {
-            logger_log("received teardown request");
+            if (process_rtsp_request(session, &info)) {
+                logger_log("received teardown request");
+                done = 1;
+                break;
+            }
+
+            // A recording producer sends frames from here on
+            if (session->live_producer && session->state == STATE_PLAYING) {
+                receive_live_frames(session, &conn);
+                done = 1;
+                break;
+            }
+        }
+
+        if (status == RTSP_PARSE_ERROR) {
+            logger_log("malformed or oversized request, closing connection");
             break;
         }
     }
@@ -444,14 +1409,17 @@ void *server_worker_thread(void *arg) {
     // Clean up resources
     pthread_mutex_destroy(&session->event_mutex);
     pthread_cond_destroy(&session->event_cond);
-    video_stream_close(&session->video_stream);
+    close_session_video(session);
 
     // Clean up socket
     if (session->rtp_socket_fd > 0) {
         close(session->rtp_socket_fd);
     }
-    close(session->rtsp_socket_fd);
 
-    free(session);
+    placement_release(session->placement);
+
+    // Also closes the RTSP socket
+    session_table_close(session);
+    metrics_counter_add(METRIC_SESSIONS_CLOSED, 1);
     return NULL;
 }
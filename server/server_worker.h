@@ -2,27 +2,67 @@
 #define SERVER_WORKER_H
 
 #include "../common/protocol.h"
+#include "catalog.h"
+#include "channel.h"
+#include "live.h"
+#include "placement.h"
+#include "rtp_hint.h"
 #include "video_stream.h"
 
 #include <netinet/in.h>
 #include <pthread.h>
+#include <stdint.h>
 
 typedef struct {
+    // Index in the session table
+    int table_slot;
+
+    // What admission reserved for this session, see session_table_admit
+    int admitted;
+    uint64_t egress_bps;
+    uint64_t frame_memory;
+
     // Client's RTSP (TCP) socket
     int rtsp_socket_fd;
     struct sockaddr_in client_addr;
 
+    // When the client last sent a request (metrics_now_us), and whether the
+    // reaper already shut the socket down for being idle too long
+    _Atomic uint64_t last_active_us;
+    int reaped;
+
     // Client's state
     client_state_t state;
     int session_id;
 
-    // Client's RTP (UDP) port
+    // Core the worker and RTP threads run on, see placement_assign
+    placement_t placement;
+
+    // Client's RTP (UDP) port, unused when it receives a channel's
+    // multicast group instead
     int rtp_port;
+    int multicast;
 
-    // Video stream section
+    // Video stream section, a position in a video shared through the catalog
+    catalog_entry_t *video_entry;
     video_stream_t video_stream;
     char filename[256];
 
+    // Live channel the session watches ("channel/<video>"), NULL otherwise,
+    // and its subscription while playing
+    channel_t *channel;
+    int channel_subscriber;
+
+    // Live source the session watches ("live/<name>"), or pushes frames to
+    // when live_producer is set, NULL otherwise. live_cursor is the next
+    // frame the RTP thread sends
+    live_source_t *live;
+    int live_producer;
+    uint64_t live_cursor;
+
+    // Packet layout from "<video>.hint", NULL without one
+    const rtp_hint_track_t *hints;
+
     // RTP (UDP) socket for sending data
     int rtp_socket_fd;
 
@@ -36,8 +76,35 @@ typedef struct {
     
     // RTP sequence number counter (independent from video file frame count)
     uint16_t rtp_seqnum;
+
+    // Seek handed over to a running RTP thread (protected by event_mutex)
+    int seek_pending;
+    int seek_is_time;            // 1 = seek_time, 0 = seek_frame
+    double seek_time;
+    int seek_frame;
+    uint64_t seek_requested_us;
+
+    // Bumped on every seek and carried in each packet, so the client can
+    // drop packets sent before the seek without a stop/restart round trip
+    uint8_t stream_epoch;
+
+    // Link quality from the client's latest RTCP receiver report, zero until
+    // one arrives. The RTP thread writes it, metrics scrapes read it
+    _Atomic uint64_t link_report_us;      // when it arrived (metrics_now_us)
+    _Atomic uint32_t link_rtt_us;
+    _Atomic uint32_t link_jitter_us;
+    _Atomic uint32_t link_fraction_lost;  // since the previous one, in 1/256
+    _Atomic uint32_t link_packets_lost;   // fragments, since the session began
+
+    // What congestion control made of those reports, see congestion_t
+    _Atomic uint64_t link_estimate_bps;
+    _Atomic uint32_t link_frame_share;    // of the frames sent, in 1/1000
 } session_t;
 
 void *server_worker_thread(void *arg);
 
+// Frames each session reads ahead through the async I/O engine, 0 to read
+// every frame synchronously when it is due (the default)
+void server_worker_set_read_ahead(int frames);
+
 #endif // SERVER_WORKER_H
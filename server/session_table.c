@@ -0,0 +1,257 @@
+#include "session_table.h"
+#include "../common/logger.h"
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// How often the reaper looks for idle connections
+#define REAPER_INTERVAL_MS 1000
+
+typedef struct {
+    session_limits_t limits;
+    session_t **slots;
+    int free_hint; // slot to try first
+
+    // Totals over the admitted sessions
+    int sessions;
+    uint64_t egress_bps;
+    uint64_t frame_memory;
+} session_table_t;
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static session_table_t g_table;
+
+// Shut down the socket of every connection that sent nothing for timeout_s.
+// The worker's blocking read then returns and tears the session down as if
+// the client had left, so the reaper never touches session state itself
+static void *reaper_thread(void *arg) {
+    (void)arg;
+    uint64_t timeout_us = (uint64_t)g_table.limits.timeout_s * 1000000;
+    struct timespec interval = {REAPER_INTERVAL_MS / 1000, (REAPER_INTERVAL_MS % 1000) * 1000000L};
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        uint64_t now = metrics_now_us();
+
+        pthread_mutex_lock(&g_mutex);
+        for (int i = 0; i < g_table.limits.max_connections; i++) {
+            session_t *session = g_table.slots[i];
+            if (session == NULL || session->reaped) {
+                continue;
+            }
+            uint64_t last = atomic_load_explicit(&session->last_active_us, memory_order_relaxed);
+            if (now > last && now - last > timeout_us) {
+                logger_log("session %d idle for %llu s, closing it",
+                    session->session_id, (unsigned long long)((now - last) / 1000000));
+                session->reaped = 1;
+                shutdown(session->rtsp_socket_fd, SHUT_RDWR);
+                metrics_counter_add(METRIC_SESSIONS_REAPED, 1);
+            }
+        }
+        pthread_mutex_unlock(&g_mutex);
+    }
+    return NULL;
+}
+
+typedef struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} link_series_t;
+
+// Per-session gauges from the clients' RTCP receiver reports, so viewers
+// with a bad link stand out, and what congestion control did about it
+static const link_series_t g_link_series[] = {
+    {"streamsrv_session_rtt_us", "gauge", "Round trip time to the client"},
+    {"streamsrv_session_jitter_us", "gauge", "Interarrival jitter the client measured"},
+    {"streamsrv_session_loss_ratio", "gauge", "Fraction of packets lost between the last two reports"},
+    {"streamsrv_session_packets_lost_total", "counter", "Packets lost on the way to the client"},
+    {"streamsrv_session_estimate_bps", "gauge", "Payload bandwidth congestion control estimates"},
+    {"streamsrv_session_frame_ratio", "gauge", "Share of the frames sent, the rest are skipped"},
+};
+
+static void append(char *buffer, size_t size, size_t *len, const char *format, ...) {
+    if (*len >= size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + *len, size - *len, format, args);
+    va_end(args);
+    if (written > 0) {
+        *len = *len + (size_t)written < size ? *len + (size_t)written : size - 1; // truncated
+    }
+}
+
+static size_t render_links(char *buffer, size_t size) {
+    size_t len = 0;
+    pthread_mutex_lock(&g_mutex);
+    for (size_t m = 0; m < sizeof(g_link_series) / sizeof(g_link_series[0]); m++) {
+        const link_series_t *series = &g_link_series[m];
+        append(buffer, size, &len, "# HELP %s %s\n# TYPE %s %s\n",
+            series->name, series->help, series->name, series->type);
+        for (int i = 0; i < g_table.limits.max_connections; i++) {
+            session_t *session = g_table.slots[i];
+            if (session == NULL || atomic_load_explicit(&session->link_report_us, memory_order_relaxed) == 0) {
+                continue;
+            }
+            double value = 0;
+            switch (m) {
+            case 0:
+                value = atomic_load_explicit(&session->link_rtt_us, memory_order_relaxed);
+                break;
+            case 1:
+                value = atomic_load_explicit(&session->link_jitter_us, memory_order_relaxed);
+                break;
+            case 2:
+                value = atomic_load_explicit(&session->link_fraction_lost, memory_order_relaxed) / 256.0;
+                break;
+            case 3:
+                value = atomic_load_explicit(&session->link_packets_lost, memory_order_relaxed);
+                break;
+            case 4:
+                value = (double)atomic_load_explicit(&session->link_estimate_bps, memory_order_relaxed);
+                break;
+            default:
+                value = atomic_load_explicit(&session->link_frame_share, memory_order_relaxed) / 1000.0;
+                break;
+            }
+            char client[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &session->client_addr.sin_addr, client, sizeof(client));
+            append(buffer, size, &len, "%s{session=\"%d\",client=\"%s:%d\"} %.10g\n",
+                series->name, session->session_id, client, session->rtp_port, value);
+        }
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return len;
+}
+
+int session_table_init(const session_limits_t *limits) {
+    g_table.limits = *limits;
+    if (g_table.limits.max_connections <= 0) {
+        g_table.limits.max_connections = SESSION_TABLE_DEFAULT_CONNECTIONS;
+    }
+    g_table.slots = (session_t **)calloc((size_t)g_table.limits.max_connections, sizeof(session_t *));
+    if (g_table.slots == NULL) {
+        logger_log("error allocating session table");
+        return -1;
+    }
+    metrics_set_render_callback(render_links);
+    logger_log("session table: %d connections, %d sessions, %llu bit/s, %llu frame bytes (0 = unlimited)",
+        g_table.limits.max_connections, g_table.limits.max_sessions,
+        (unsigned long long)g_table.limits.max_egress_bps,
+        (unsigned long long)g_table.limits.max_frame_memory);
+
+    if (g_table.limits.timeout_s > 0) {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, reaper_thread, NULL) != 0) {
+            logger_log("error creating reaper thread");
+            return -1;
+        }
+        pthread_detach(thread_id);
+        logger_log("reaping connections idle for %d s", g_table.limits.timeout_s);
+    }
+    return 0;
+}
+
+session_t *session_table_open(int rtsp_socket_fd) {
+    pthread_mutex_lock(&g_mutex);
+    int count = g_table.limits.max_connections;
+    int slot = -1;
+    for (int i = 0; i < count; i++) {
+        int candidate = (g_table.free_hint + i) % count;
+        if (g_table.slots[candidate] == NULL) {
+            slot = candidate;
+            break;
+        }
+    }
+    session_t *session = NULL;
+    if (slot >= 0) {
+        session = (session_t *)calloc(1, sizeof(session_t));
+    }
+    if (session != NULL) {
+        session->table_slot = slot;
+        session->rtsp_socket_fd = rtsp_socket_fd;
+        session->last_active_us = metrics_now_us();
+        g_table.slots[slot] = session;
+        g_table.free_hint = (slot + 1) % count;
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return session;
+}
+
+static void release_locked(session_t *session) {
+    if (!session->admitted) {
+        return;
+    }
+    g_table.sessions--;
+    g_table.egress_bps -= session->egress_bps;
+    g_table.frame_memory -= session->frame_memory;
+    session->admitted = 0;
+}
+
+void session_table_close(session_t *session) {
+    pthread_mutex_lock(&g_mutex);
+    release_locked(session);
+    g_table.slots[session->table_slot] = NULL;
+    pthread_mutex_unlock(&g_mutex);
+
+    // Closed only once the reaper can no longer find the session, so it
+    // never shuts down a descriptor that was reused by a new connection
+    close(session->rtsp_socket_fd);
+    free(session);
+}
+
+void session_table_touch(session_t *session) {
+    atomic_store_explicit(&session->last_active_us, metrics_now_us(), memory_order_relaxed);
+}
+
+int session_table_timeout(void) {
+    return g_table.limits.timeout_s;
+}
+
+rtsp_status_t session_table_admit(session_t *session, uint64_t egress_bps, uint64_t frame_memory) {
+    const session_limits_t *limits = &g_table.limits;
+    rtsp_status_t status = STATUS_OK_200;
+
+    pthread_mutex_lock(&g_mutex);
+    release_locked(session);
+    if (limits->max_sessions > 0 && g_table.sessions >= limits->max_sessions) {
+        status = STATUS_UNAVAILABLE_503;
+    } else if (limits->max_egress_bps > 0 && g_table.egress_bps + egress_bps > limits->max_egress_bps) {
+        status = STATUS_NOT_ENOUGH_BANDWIDTH_453;
+    } else if (limits->max_frame_memory > 0 && g_table.frame_memory + frame_memory > limits->max_frame_memory) {
+        status = STATUS_UNAVAILABLE_503;
+    } else {
+        g_table.sessions++;
+        g_table.egress_bps += egress_bps;
+        g_table.frame_memory += frame_memory;
+        session->admitted = 1;
+        session->egress_bps = egress_bps;
+        session->frame_memory = frame_memory;
+    }
+    int sessions = g_table.sessions;
+    uint64_t total_bps = g_table.egress_bps;
+    pthread_mutex_unlock(&g_mutex);
+
+    if (status != STATUS_OK_200) {
+        logger_log("rejecting setup: %d sessions, %llu bit/s admitted, %llu bit/s requested",
+            sessions, (unsigned long long)total_bps, (unsigned long long)egress_bps);
+        metrics_counter_add(METRIC_SETUPS_REJECTED, 1);
+    }
+    return status;
+}
+
+void session_table_release(session_t *session) {
+    pthread_mutex_lock(&g_mutex);
+    release_locked(session);
+    pthread_mutex_unlock(&g_mutex);
+}
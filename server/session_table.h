@@ -0,0 +1,47 @@
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include "../common/protocol.h"
+#include "server_worker.h"
+
+#include <stdint.h>
+
+// Defaults when no limit is configured
+#define SESSION_TABLE_DEFAULT_CONNECTIONS 1024
+#define SESSION_TABLE_DEFAULT_TIMEOUT_S 60
+
+// 0 means unlimited for every cap but max_connections
+typedef struct {
+    int max_connections;       // RTSP connections held at once
+    int max_sessions;          // sessions admitted by SETUP
+    uint64_t max_egress_bps;   // sum of the admitted sessions' bitrates
+    uint64_t max_frame_memory; // frame buffers of the admitted sessions
+    int timeout_s;             // idle seconds before a connection is reaped
+} session_limits_t;
+
+// Size the table and start reaping idle connections, call once before
+// accepting connections
+// Return 0 on success, -1 on error
+int session_table_init(const session_limits_t *limits);
+
+// Allocate a session for a new connection, which then owns the socket
+// Return the zeroed session, or NULL when max_connections are open
+session_t *session_table_open(int rtsp_socket_fd);
+
+// Release a session's admission, close its socket and free it
+void session_table_close(session_t *session);
+
+// Record a request from the client, which keeps the session alive
+void session_table_touch(session_t *session);
+
+// Idle timeout announced to clients in the Session header, 0 if none
+int session_table_timeout(void);
+
+// Reserve bandwidth and frame memory for a session being set up
+// Return STATUS_OK_200, or the status to reject the SETUP with
+rtsp_status_t session_table_admit(session_t *session, uint64_t egress_bps, uint64_t frame_memory);
+
+// Give back what session_table_admit reserved, no-op if nothing is
+void session_table_release(session_t *session);
+
+#endif // SESSION_TABLE_H
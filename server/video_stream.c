@@ -1,5 +1,10 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "video_stream.h"
+#include "../common/byte_order.h"
 #include "../common/logger.h"
+#include "mjpeg_container.h"
+#include "mjpeg_framer.h"
 
 #include <ctype.h>
 #include <stddef.h>
@@ -7,292 +12,630 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 
 // Maximum digits for frame length (supports up to 999999 bytes = ~1MB per frame)
 #define MAX_FRAME_LEN_DIGITS 10
 
-int video_stream_open(video_stream_t *stream, const char *filename) {
-    stream->file = fopen(filename, "rb");
-    if (stream->file == NULL) {
-        logger_log("failed to open video file: %s", filename);
-        return -1;
+// Read size used when scanning a raw MJPEG file for frame boundaries, also
+// the stdio buffer so the length-prefixed scan skips frames inside it
+#define INDEX_SCAN_CHUNK (256 * 1024)
+
+// Frames announced to the kernel ahead of playback, re-announced once half
+// of them have been played
+#define ADVISE_WINDOW_FRAMES 30
+
+// Played frames are dropped from the page cache once available memory falls
+// below this share of RAM, checked at most once per interval
+#define MEMORY_TIGHT_PERCENT 10
+#define MEMORY_CHECK_INTERVAL_S 1
+
+// Sidecar index layout (little-endian):
+// 0: magic "MJIX", 4: version, 8: fps numerator, 12: fps denominator,
+// 16: frame count, 20: flags, 24: size of the video file it describes,
+// 32: one {u64 offset, u32 size} entry per frame
+#define VIDEO_INDEX_HEADER_SIZE 32
+#define VIDEO_INDEX_ENTRY_SIZE 12
+#define VIDEO_INDEX_FLAG_RAW 0x1
+
+static double g_default_fps = VIDEO_DEFAULT_FPS;
+static int g_cache_hints = 1;
+
+// Shared by every stream, refreshed by whichever one checks first
+static atomic_long g_memory_checked_at;
+static atomic_int g_memory_tight;
+
+void video_stream_set_cache_hints(int enabled) {
+    g_cache_hints = enabled;
+}
+
+void video_stream_set_default_fps(double fps) {
+    if (fps > 0) {
+        g_default_fps = fps;
+    }
+}
+
+// Append a frame to the index, growing it as needed
+static int index_append(video_stream_t *stream, int *capacity, uint64_t offset, uint64_t size) {
+    if (stream->total_frames == *capacity) {
+        int new_capacity = *capacity > 0 ? *capacity * 2 : 1024;
+        video_frame_entry_t *grown = (video_frame_entry_t *)realloc(
+            stream->index, (size_t)new_capacity * sizeof(video_frame_entry_t)
+        );
+        if (grown == NULL) {
+            logger_log("error allocating frame index");
+            return -1;
+        }
+        stream->index = grown;
+        *capacity = new_capacity;
+    }
+    stream->index[stream->total_frames].offset = offset;
+    stream->index[stream->total_frames].size = (uint32_t)size;
+    stream->total_frames++;
+    if (size > stream->max_frame_size) {
+        stream->max_frame_size = (size_t)size;
     }
-    stream->frame_num = 0;
-    stream->total_frames = 0;
-    stream->file_size = 0;
-    stream->avg_frame_size = 0.0;
-    stream->is_raw_mjpeg = 0;
-    
-    // Get file size
-    fseek(stream->file, 0, SEEK_END);
-    stream->file_size = ftell(stream->file);
-    fseek(stream->file, 0, SEEK_SET);
-    
-    logger_log("video file opened: %s, size: %ld bytes, file ptr: %p", filename, stream->file_size, (void*)stream->file);
     return 0;
 }
 
-ssize_t video_stream_next_frame(video_stream_t *stream, uint8_t *buffer, size_t buffer_size) {
-    char frame_len_str[MAX_FRAME_LEN_DIGITS + 1];
-    int header_len = 0;
+typedef struct {
+    video_stream_t *stream;
+    int capacity;
+    int failed;
+} raw_index_ctx_t;
 
-    if (stream->file == NULL) {
-        logger_log("video stream file is NULL!");
+static void on_raw_frame(const mjpeg_frame_t *frame, void *arg) {
+    raw_index_ctx_t *ctx = (raw_index_ctx_t *)arg;
+    if (!ctx->failed && index_append(ctx->stream, &ctx->capacity, frame->offset, frame->size) != 0) {
+        ctx->failed = 1;
+    }
+}
+
+// Raw MJPEG: JPEG frames directly concatenated, split by the shared framer
+static int build_index_raw(video_stream_t *stream) {
+    uint8_t *chunk = (uint8_t *)malloc(INDEX_SCAN_CHUNK);
+    if (chunk == NULL) {
+        logger_log("error allocating scan buffer");
         return -1;
     }
+    raw_index_ctx_t ctx = {stream, 0, 0};
+    mjpeg_framer_t framer;
+    mjpeg_framer_init(&framer);
 
-    // Peek at first byte to detect format
-    int first_byte = fgetc(stream->file);
-    if (first_byte == EOF) {
-        logger_log("end of video reached");
-        return 0;
+    size_t n;
+    while (!ctx.failed && (n = fread(chunk, 1, INDEX_SCAN_CHUNK, stream->file)) > 0) {
+        mjpeg_framer_feed(&framer, chunk, n, on_raw_frame, &ctx);
     }
-    
-    // Check if this looks like a JPEG header (0xFF = 255)
-    if (first_byte == 0xFF) {
-        // Raw MJPEG format: JPEG frames directly concatenated
-        // Find next JPEG frame by scanning for FFD8FFxx pattern (JPEG SOI marker + next marker)
-        buffer[0] = first_byte;
-        size_t pos = 1;
-        
-        // Read rest of file looking for next JPEG start or EOL
-        while (pos < buffer_size) {
-            int ch = fgetc(stream->file);
-            if (ch == EOF) {
-                // End of file - return this frame
-                stream->frame_num++;
-                return pos;
-            }
-            
-            buffer[pos] = ch;
-            
-            // Look for JPEG EOI marker (FFD9) followed by new JPEG SOI (FFD8)
-            if (pos >= 2 && buffer[pos-1] == 0xFF && buffer[pos] == 0xD9) {
-                // Found EOI marker, check if next is SOI
-                int next1 = fgetc(stream->file);
-                if (next1 == EOF) {
-                    stream->frame_num++;
-                    return pos + 1;
-                }
-                
-                if (next1 == 0xFF) {
-                    int next2 = fgetc(stream->file);
-                    if (next2 == 0xD8) {
-                        // Found next JPEG frame start - put them back and return this frame
-                        ungetc(next2, stream->file);
-                        ungetc(next1, stream->file);
-                        stream->frame_num++;
-                        return pos + 1;
-                    } else {
-                        // Not FFD8, continue reading
-                        buffer[pos + 1] = next1;
-                        buffer[pos + 2] = next2;
-                        pos += 2;
-                        continue;
-                    }
-                } else {
-                    // Not 0xFF, continue reading
-                    buffer[pos + 1] = next1;
-                    pos++;
-                    continue;
-                }
-            }
-            
-            pos++;
-        }
-        
-        stream->frame_num++;
-        return pos;
-    } else if (isdigit(first_byte)) {
-        // Format with length header: "NNNNN" + frame_data
-        // first_byte is already the first digit
-        frame_len_str[0] = first_byte;
-        header_len = 1;
-        
-        // Read remaining ASCII digits
+    free(chunk);
+    if (framer.invalid_frames > 0 || mjpeg_framer_pending_start(&framer) >= 0) {
+        logger_log("skipped %llu malformed or truncated frames",
+            (unsigned long long)framer.invalid_frames + (mjpeg_framer_pending_start(&framer) >= 0));
+    }
+    return ctx.failed ? -1 : 0;
+}
+
+// Format with length header: "NNNNN" + frame_data, repeated
+static int build_index_length_prefixed(video_stream_t *stream) {
+    int capacity = 0;
+    char frame_len_str[MAX_FRAME_LEN_DIGITS + 1];
+
+    while (1) {
+        // Read frame header (length)
+        int header_len = 0;
         while (header_len < MAX_FRAME_LEN_DIGITS) {
             int ch = fgetc(stream->file);
             if (ch == EOF) {
                 break;
             }
-            
             if (isdigit(ch)) {
                 frame_len_str[header_len++] = (char)ch;
             } else {
-                // Non-digit found - put it back
                 ungetc(ch, stream->file);
                 break;
             }
         }
+        if (header_len == 0) {
+            break;
+        }
 
         frame_len_str[header_len] = '\0';
-        int frame_len = atoi(frame_len_str);
-        
-        if (frame_len <= 0) {
-            logger_log("invalid frame length: %s", frame_len_str);
+        long frame_len = atol(frame_len_str);
+        long data_offset = ftell(stream->file);
+        if (frame_len <= 0 || data_offset + frame_len > stream->file_size) {
+            logger_log("invalid or truncated frame at offset %ld, index stops at frame %d",
+                data_offset, stream->total_frames);
+            break;
+        }
+
+        if (index_append(stream, &capacity, (uint64_t)data_offset, (uint64_t)frame_len) != 0) {
             return -1;
         }
 
-        // Check if the frame will fit into the buffer
-        if ((size_t)frame_len > buffer_size) {
-            logger_log("frame too large: %d bytes (buffer: %zu)", frame_len, buffer_size);
-            fseek(stream->file, frame_len, SEEK_CUR);
+        // Skip frame data
+        if (fseek(stream->file, frame_len, SEEK_CUR) != 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Load "<filename>.idx" if it exists and describes this exact file
+// Return 0 if the index was loaded, -1 otherwise
+static int load_sidecar_index(video_stream_t *stream, const char *filename) {
+    char index_path[512];
+    snprintf(index_path, sizeof(index_path), "%s%s", filename, VIDEO_INDEX_SUFFIX);
+
+    FILE *file = fopen(index_path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    uint8_t header[VIDEO_INDEX_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, VIDEO_INDEX_MAGIC, 4) != 0 ||
+        read_le32(header + 4) != VIDEO_INDEX_VERSION) {
+        logger_log("ignoring invalid index %s", index_path);
+        fclose(file);
+        return -1;
+    }
+
+    uint32_t fps_num = read_le32(header + 8);
+    uint32_t fps_den = read_le32(header + 12);
+    uint32_t frame_count = read_le32(header + 16);
+    uint32_t flags = read_le32(header + 20);
+    uint64_t indexed_size = read_le64(header + 24);
+
+    // A stale index would send garbage, rebuild instead
+    if (indexed_size != (uint64_t)stream->file_size || frame_count == 0) {
+        logger_log("index %s does not match the video, rebuilding", index_path);
+        fclose(file);
+        return -1;
+    }
+
+    stream->index = (video_frame_entry_t *)malloc(frame_count * sizeof(video_frame_entry_t));
+    if (stream->index == NULL) {
+        fclose(file);
+        return -1;
+    }
+
+    uint8_t entry[VIDEO_INDEX_ENTRY_SIZE];
+    for (uint32_t i = 0; i < frame_count; i++) {
+        if (fread(entry, 1, sizeof(entry), file) != sizeof(entry)) {
+            logger_log("truncated index %s", index_path);
+            free(stream->index);
+            stream->index = NULL;
+            fclose(file);
             return -1;
         }
+        stream->index[i].offset = read_le64(entry);
+        stream->index[i].size = read_le32(entry + 8);
+        if (stream->index[i].offset + stream->index[i].size > indexed_size) {
+            logger_log("index %s points past the end of the video", index_path);
+            free(stream->index);
+            stream->index = NULL;
+            fclose(file);
+            return -1;
+        }
+        if (stream->index[i].size > stream->max_frame_size) {
+            stream->max_frame_size = stream->index[i].size;
+        }
+    }
+    fclose(file);
+
+    stream->total_frames = (int)frame_count;
+    stream->format = (flags & VIDEO_INDEX_FLAG_RAW) ? VIDEO_FORMAT_RAW : VIDEO_FORMAT_LENGTH_PREFIXED;
+    if (fps_num > 0 && fps_den > 0) {
+        stream->fps = (double)fps_num / fps_den;
+    }
+    logger_log("loaded index %s: %u frames at %.3f fps", index_path, frame_count, stream->fps);
+    return 0;
+}
 
-        // Read frame data
-        size_t bytes_read = fread(buffer, 1, frame_len, stream->file);
-        if (bytes_read != (size_t)frame_len) {
-            logger_log("incomplete frame read: got %zu, expected %d", bytes_read, frame_len);
+// Load the index of a binary container, which carries the frame rate and
+// resolution in its header. Return 0 if the file is a valid container, 1 if
+// it is not a container at all, -1 if it is a broken one
+static int load_container_index(video_stream_t *stream) {
+    uint8_t buf[MJPEG_CONTAINER_HEADER_SIZE];
+    mjpeg_container_header_t header;
+    if (pread(fileno(stream->file), buf, sizeof(buf), 0) != (ssize_t)sizeof(buf) ||
+        mjpeg_container_decode_header(buf, &header) != 0) {
+        return 1;
+    }
+
+    uint64_t index_size = (uint64_t)header.frame_count * MJPEG_CONTAINER_INDEX_ENTRY_SIZE;
+    if (header.frame_count == 0 || header.index_offset + index_size > (uint64_t)stream->file_size) {
+        logger_log("container index out of range");
+        return -1;
+    }
+
+    // The whole index in one read
+    uint8_t *entries = (uint8_t *)malloc(index_size);
+    stream->index = (video_frame_entry_t *)malloc(header.frame_count * sizeof(video_frame_entry_t));
+    if (entries == NULL || stream->index == NULL ||
+        pread(fileno(stream->file), entries, index_size, (off_t)header.index_offset) != (ssize_t)index_size) {
+        logger_log("error reading container index");
+        free(entries);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < header.frame_count; i++) {
+        const uint8_t *entry = entries + (size_t)i * MJPEG_CONTAINER_INDEX_ENTRY_SIZE;
+        stream->index[i].offset = read_le64(entry);
+        stream->index[i].size = read_le32(entry + 8);
+        if (stream->index[i].offset < MJPEG_CONTAINER_ALIGN ||
+            stream->index[i].offset + stream->index[i].size > header.index_offset) {
+            logger_log("container index entry %u points outside the frame data", i);
+            free(entries);
             return -1;
         }
-        stream->frame_num++;
-        return frame_len;
-    } else {
-        logger_log("unknown frame format: first byte 0x%02X", first_byte);
+        if (stream->index[i].size > stream->max_frame_size) {
+            stream->max_frame_size = stream->index[i].size;
+        }
+    }
+    free(entries);
+
+    stream->total_frames = (int)header.frame_count;
+    stream->format = VIDEO_FORMAT_CONTAINER;
+    stream->width = (int)header.width;
+    stream->height = (int)header.height;
+    if (header.fps_num > 0 && header.fps_den > 0) {
+        stream->fps = (double)header.fps_num / header.fps_den;
+    }
+    logger_log("loaded container index: %u frames at %.3f fps", header.frame_count, stream->fps);
+    return 0;
+}
+
+// Walk the marker segments of the first frame up to its SOF (start of
+// frame) marker, which holds the resolution. Only segment headers are read
+static void probe_resolution(video_stream_t *stream) {
+    if (stream->total_frames == 0) {
+        return;
+    }
+    uint64_t pos = stream->index[0].offset + 2; // skip SOI
+    uint64_t end = stream->index[0].offset + stream->index[0].size;
+    uint8_t segment[9];
+
+    while (pos + 4 <= end) {
+        if (fseek(stream->file, (long)pos, SEEK_SET) != 0) {
+            break;
+        }
+        size_t n = fread(segment, 1, sizeof(segment), stream->file);
+        if (n < 4 || segment[0] != 0xFF) {
+            break;
+        }
+        uint8_t marker = segment[1];
+        uint16_t length = (uint16_t)((segment[2] << 8) | segment[3]);
+
+        // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (n < sizeof(segment)) {
+                break;
+            }
+            stream->height = (segment[5] << 8) | segment[6];
+            stream->width = (segment[7] << 8) | segment[8];
+            return;
+        }
+        if (marker == 0xDA || length < 2) {
+            break; // scan data started without a SOF
+        }
+        pos += 2 + length;
+    }
+    logger_log("could not find the frame size in the first frame");
+}
+
+int video_stream_write_index(const char *filename,
+                             const video_frame_entry_t *index,
+                             int total_frames,
+                             uint32_t fps_num,
+                             uint32_t fps_den,
+                             int is_raw_mjpeg,
+                             uint64_t file_size) {
+    char index_path[512];
+    snprintf(index_path, sizeof(index_path), "%s%s", filename, VIDEO_INDEX_SUFFIX);
+    FILE *file = fopen(index_path, "wb");
+    if (file == NULL) {
+        logger_log("failed to create index %s", index_path);
+        return -1;
+    }
+
+    uint8_t header[VIDEO_INDEX_HEADER_SIZE];
+    memcpy(header, VIDEO_INDEX_MAGIC, 4);
+    write_le32(header + 4, VIDEO_INDEX_VERSION);
+    write_le32(header + 8, fps_num);
+    write_le32(header + 12, fps_den);
+    write_le32(header + 16, (uint32_t)total_frames);
+    write_le32(header + 20, is_raw_mjpeg ? VIDEO_INDEX_FLAG_RAW : 0);
+    write_le64(header + 24, file_size);
+    int ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    uint8_t entry[VIDEO_INDEX_ENTRY_SIZE];
+    for (int i = 0; ok && i < total_frames; i++) {
+        write_le64(entry, index[i].offset);
+        write_le32(entry + 8, index[i].size);
+        ok = fwrite(entry, 1, sizeof(entry), file) == sizeof(entry);
+    }
+
+    if (fclose(file) != 0 || !ok) {
+        logger_log("error writing index %s", index_path);
+        remove(index_path);
         return -1;
     }
+    return 0;
 }
 
-void video_stream_close(video_stream_t *stream) {
-    if (stream->file) {
-        fclose(stream->file);
-        stream->file = NULL;
+static int build_index(video_stream_t *stream) {
+    fseek(stream->file, 0, SEEK_SET);
+    int first_byte = fgetc(stream->file);
+    if (first_byte == EOF) {
+        return 0; // empty file, no frames
     }
+    ungetc(first_byte, stream->file);
+
+    int result;
+    if (first_byte == 0xFF) {
+        stream->format = VIDEO_FORMAT_RAW;
+        result = build_index_raw(stream);
+    } else if (isdigit(first_byte)) {
+        stream->format = VIDEO_FORMAT_LENGTH_PREFIXED;
+        result = build_index_length_prefixed(stream);
+    } else {
+        logger_log("unknown frame format: first byte 0x%02X", first_byte);
+        return -1;
+    }
+
+    logger_log("indexed %d frames (%s)", stream->total_frames,
+        stream->format == VIDEO_FORMAT_RAW ? "raw MJPEG" : "header format");
+    return result;
 }
 
-// Get total number of frames by scanning entire file
-// For raw MJPEG: scans backwards from end (faster than forward scan)
-// This is slow but only called once for validation
-int video_stream_get_total_frames(video_stream_t *stream) {
+int video_stream_open(video_stream_t *stream, const char *filename) {
+    stream->file = fopen(filename, "rb");
     if (stream->file == NULL) {
+        logger_log("failed to open video file: %s", filename);
+        return -1;
+    }
+    stream->frame_num = 0;
+    stream->total_frames = 0;
+    stream->file_size = 0;
+    stream->avg_frame_size = 0.0;
+    stream->format = VIDEO_FORMAT_LENGTH_PREFIXED;
+    stream->fps = g_default_fps;
+    stream->index = NULL;
+    stream->max_frame_size = 0;
+    stream->width = 0;
+    stream->height = 0;
+    stream->advise_start = 0;
+    stream->advise_end = 0;
+    atomic_store(&stream->played_until, 0);
+    stream->source = NULL;
+    pthread_mutex_init(&stream->views_mutex, NULL);
+    stream->views = NULL;
+    stream->next_view = NULL;
+    stream->released_until = 0;
+    setvbuf(stream->file, NULL, _IOFBF, INDEX_SCAN_CHUNK);
+
+    // Get file size
+    fseek(stream->file, 0, SEEK_END);
+    stream->file_size = ftell(stream->file);
+    fseek(stream->file, 0, SEEK_SET);
+
+    // A container indexes itself. For the legacy formats prefer the sidecar
+    // index, it also carries the frame rate. Otherwise scan the file once so
+    // every later seek is a single lookup
+    int container = load_container_index(stream);
+    if (container < 0 ||
+        (container > 0 && load_sidecar_index(stream, filename) != 0 && build_index(stream) != 0)) {
+        video_stream_close(stream);
         return -1;
     }
-    
-    // If already cached, return it
     if (stream->total_frames > 0) {
-        return stream->total_frames;
+        stream->avg_frame_size = (double)stream->file_size / stream->total_frames;
+    }
+    if (stream->width == 0) {
+        probe_resolution(stream);
     }
-    
-    // Save current position
-    long current_pos = ftell(stream->file);
-    int current_frame = stream->frame_num;
-    
-    // Seek to beginning to detect format
     fseek(stream->file, 0, SEEK_SET);
-    int total_frames = 0;
-    
-    // Detect format from first byte
-    int first_byte = fgetc(stream->file);
-    if (first_byte == EOF) {
-        fseek(stream->file, current_pos, SEEK_SET);
+
+    // Playback reads forward, let the kernel use a larger readahead window
+    if (g_cache_hints) {
+        posix_fadvise(fileno(stream->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    logger_log("video file opened: %s, size: %ld bytes, %d frames at %.3f fps, %dx%d",
+        filename, stream->file_size, stream->total_frames, stream->fps, stream->width, stream->height);
+    return 0;
+}
+
+// Whether available memory is below MEMORY_TIGHT_PERCENT of RAM, from
+// /proc/meminfo and cached for MEMORY_CHECK_INTERVAL_S
+static int memory_is_tight(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long checked_at = atomic_load(&g_memory_checked_at);
+    if (now.tv_sec - checked_at < MEMORY_CHECK_INTERVAL_S ||
+        !atomic_compare_exchange_strong(&g_memory_checked_at, &checked_at, (long)now.tv_sec)) {
+        return atomic_load(&g_memory_tight);
+    }
+
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (meminfo == NULL) {
         return 0;
     }
-    
-    if (first_byte == 0xFF) {
-        // Raw MJPEG format - count FFD9 (EOI) markers from end (faster!)
-        stream->is_raw_mjpeg = 1;
-        
-        // Seek to end of file
-        fseek(stream->file, 0, SEEK_END);
-        long file_size = ftell(stream->file);
-        
-        // Scan backwards from end, looking for FFD9 markers
-        int prev_byte = -1;
-        
-        for (long pos = file_size - 1; pos >= 0; pos--) {
-            fseek(stream->file, pos, SEEK_SET);
-            int ch = fgetc(stream->file);
-            if (ch == EOF) break;
-            
-            // Look for FFD9 (JPEG EOI marker) to count frames
-            // When scanning backwards: if current is 0xD9 and next (which was previous) is 0xFF
-            if (prev_byte == 0xD9 && ch == 0xFF) {
-                total_frames++;
-            }
-            
-            prev_byte = ch;
+    unsigned long long total_kb = 0;
+    unsigned long long available_kb = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), meminfo) != NULL) {
+        sscanf(line, "MemTotal: %llu kB", &total_kb);
+        sscanf(line, "MemAvailable: %llu kB", &available_kb);
+    }
+    fclose(meminfo);
+
+    int tight = total_kb > 0 && available_kb * 100 < total_kb * MEMORY_TIGHT_PERCENT;
+    if (tight != atomic_exchange(&g_memory_tight, tight)) {
+        logger_log("memory %s: %llu of %llu kB available", tight ? "tight" : "no longer tight",
+            available_kb, total_kb);
+    }
+    return tight;
+}
+
+// Under memory pressure give back what was played instead of letting the
+// kernel evict frames that are still ahead of some session. Streams attached
+// to one file release only what all of them played
+static void release_played(video_stream_t *stream) {
+    if (!memory_is_tight()) {
+        return;
+    }
+    video_stream_t *owner = stream->source != NULL ? stream->source : stream;
+    pthread_mutex_lock(&owner->views_mutex);
+    uint64_t played_until = atomic_load(&stream->played_until);
+    for (video_stream_t *view = owner->views; view != NULL; view = view->next_view) {
+        uint64_t position = atomic_load(&view->played_until);
+        if (position < played_until) {
+            played_until = position;
         }
-        
-        // Calculate average frame size for seeking
-        if (total_frames > 0) {
-            stream->avg_frame_size = (double)file_size / total_frames;
+    }
+    if (played_until > owner->released_until) {
+        posix_fadvise(fileno(owner->file), (off_t)owner->released_until,
+            (off_t)(played_until - owner->released_until), POSIX_FADV_DONTNEED);
+    }
+    // After a backward seek, or a session joining, nothing ahead is released
+    // again
+    owner->released_until = played_until;
+    pthread_mutex_unlock(&owner->views_mutex);
+}
+
+void video_stream_advise(video_stream_t *stream, int frame) {
+    if (!g_cache_hints || frame >= stream->total_frames) {
+        return;
+    }
+    int fd = fileno(stream->file);
+
+    atomic_store(&stream->played_until, stream->index[frame].offset);
+
+    // Announce the next window when playback is halfway through the current
+    // one, or right away after a seek left it: generic readahead only kicks
+    // in after a few sequential misses at the new position
+    int seeked = frame < stream->advise_start || frame >= stream->advise_end;
+    if (seeked || frame >= stream->advise_end - ADVISE_WINDOW_FRAMES / 2) {
+        int from = seeked ? frame : stream->advise_end;
+        int to = frame + ADVISE_WINDOW_FRAMES;
+        if (to > stream->total_frames) {
+            to = stream->total_frames;
         }
-        
-        logger_log("video_stream_get_total_frames: detected %d frames (raw MJPEG), avg_frame_size=%.0f bytes", 
-                   total_frames, stream->avg_frame_size);
-    } else if (isdigit(first_byte)) {
-        // Format with length header - must scan from beginning
-        stream->is_raw_mjpeg = 0;
-        char frame_len_str[MAX_FRAME_LEN_DIGITS + 1];
-        frame_len_str[0] = first_byte;
-        int header_len = 1;
-        
-        while (1) {
-            // Read frame header (length)
-            while (header_len < MAX_FRAME_LEN_DIGITS) {
-                int ch = fgetc(stream->file);
-                if (ch == EOF) {
-                    break;
-                }
-                if (isdigit(ch)) {
-                    frame_len_str[header_len++] = (char)ch;
-                } else {
-                    ungetc(ch, stream->file);
-                    break;
-                }
-            }
-            
-            if (header_len == 0) {
-                break;
-            }
-            
-            frame_len_str[header_len] = '\0';
-            int frame_len = atoi(frame_len_str);
-            
-            if (frame_len <= 0) {
-                break;
-            }
-            
-            // Skip frame data
-            if (fseek(stream->file, frame_len, SEEK_CUR) != 0) {
-                break;
-            }
-            
-            total_frames++;
-            header_len = 0;
+        if (from < to) {
+            uint64_t start = stream->index[from].offset;
+            uint64_t end = stream->index[to - 1].offset + stream->index[to - 1].size;
+            posix_fadvise(fd, (off_t)start, (off_t)(end - start), POSIX_FADV_WILLNEED);
         }
-        
-        logger_log("video_stream_get_total_frames: detected %d frames (header format)", total_frames);
-    }
-    
-    // Cache results
-    stream->total_frames = total_frames;
-    
-    // Restore position
-    fseek(stream->file, current_pos, SEEK_SET);
-    stream->frame_num = current_frame;
-    
-    return total_frames;
+        stream->advise_start = frame;
+        stream->advise_end = to;
+        release_played(stream);
+    }
 }
 
-// Seek to a specific time in seconds (assumes 20 FPS)
-int video_stream_seek_time(video_stream_t *stream, double time_seconds) {
+ssize_t video_stream_next_frame(video_stream_t *stream, uint8_t *buffer, size_t buffer_size) {
     if (stream->file == NULL) {
+        logger_log("video stream file is NULL!");
         return -1;
     }
-    
+
+    if (stream->frame_num >= stream->total_frames) {
+        logger_log("end of video reached");
+        return 0;
+    }
+
+    const video_frame_entry_t *entry = &stream->index[stream->frame_num];
+
+    // Check if the frame will fit into the buffer
+    if (entry->size > buffer_size) {
+        logger_log("frame too large: %u bytes (buffer: %zu)", entry->size, buffer_size);
+        stream->frame_num++;
+        return -1;
+    }
+
+    video_stream_advise(stream, stream->frame_num);
+
+    // One positioned read per frame, whatever the format
+    ssize_t bytes_read = pread(fileno(stream->file), buffer, entry->size, (off_t)entry->offset);
+    if (bytes_read != (ssize_t)entry->size) {
+        logger_log("incomplete frame read: got %zd, expected %u", bytes_read, entry->size);
+        return -1;
+    }
+    stream->frame_num++;
+    return (ssize_t)entry->size;
+}
+
+void video_stream_attach(video_stream_t *stream, video_stream_t *source) {
+    *stream = *source;
+    stream->frame_num = 0;
+    stream->advise_start = 0;
+    stream->advise_end = 0;
+    atomic_store(&stream->played_until, 0);
+    stream->source = source;
+    stream->views = NULL;
+
+    pthread_mutex_lock(&source->views_mutex);
+    stream->next_view = source->views;
+    source->views = stream;
+    pthread_mutex_unlock(&source->views_mutex);
+}
+
+void video_stream_close(video_stream_t *stream) {
+    if (stream->source != NULL) {
+        video_stream_t *source = stream->source;
+        pthread_mutex_lock(&source->views_mutex);
+        video_stream_t **link = &source->views;
+        while (*link != stream) {
+            link = &(*link)->next_view;
+        }
+        *link = stream->next_view;
+        pthread_mutex_unlock(&source->views_mutex);
+        stream->source = NULL;
+        stream->file = NULL;
+        stream->index = NULL;
+        return;
+    }
+    if (stream->file) {
+        fclose(stream->file);
+        stream->file = NULL;
+        pthread_mutex_destroy(&stream->views_mutex);
+    }
+    free(stream->index);
+    stream->index = NULL;
+}
+
+int video_stream_get_total_frames(video_stream_t *stream) {
+    if (stream->file == NULL) {
+        return -1;
+    }
+    return stream->total_frames;
+}
+
+int video_stream_time_to_frame(const video_stream_t *stream, double time_seconds) {
     // Clamp to non-negative
     if (time_seconds < 0) {
         time_seconds = 0;
     }
-    
-    // Assuming 20 FPS frame rate
-    const double FPS = 20.0;
-    int target_frame = (int)(time_seconds * FPS);
-    
-    // Just use frame-based seeking
-    return video_stream_seek_frame(stream, target_frame);
+
+    // Frame f covers [f / fps, (f + 1) / fps). The epsilon keeps exact
+    // multiples like 3 * (1 / 30) from rounding down a frame
+    double frame = time_seconds * stream->fps + 1e-6;
+
+    // Past the end clamps before the cast, a huge npt would overflow the int
+    if (frame >= stream->total_frames) {
+        return stream->total_frames;
+    }
+    return (int)frame;
+}
+
+int video_stream_seek_time(video_stream_t *stream, double time_seconds) {
+    if (stream->file == NULL) {
+        return -1;
+    }
+    return video_stream_seek_frame(stream, video_stream_time_to_frame(stream, time_seconds));
 }
 
 // Seek to a specific frame number (0-indexed)
@@ -300,101 +643,21 @@ int video_stream_seek_frame(video_stream_t *stream, int frame_number) {
     if (stream->file == NULL) {
         return -1;
     }
-    
+
     // Clamp to non-negative
     if (frame_number < 0) {
         frame_number = 0;
     }
-    
-    // Always seek from beginning for reliable positioning
-    if (fseek(stream->file, 0, SEEK_SET) != 0) {
-        logger_log("failed to seek to file start");
-        return -1;
-    }
 
-    // Detect format from first byte
-    int first_byte = fgetc(stream->file);
-    if (first_byte == EOF) {
-        return -1;
+    // Past the end: park at EOF so the next read reports end of video
+    if (frame_number >= stream->total_frames) {
+        logger_log("seek to frame %d is past the end (%d frames)", frame_number, stream->total_frames);
+        stream->frame_num = stream->total_frames;
+        return stream->total_frames;
     }
-    
-    if (first_byte == 0xFF) {
-        // Raw MJPEG format - scan for FFD8 (SOI) markers
-        ungetc(first_byte, stream->file);
-        int frames_scanned = 0;
-        int prev_byte = -1;
-        
-        while (1) {
-            int ch = fgetc(stream->file);
-            if (ch == EOF) {
-                logger_log("reached EOF while seeking to frame %d (stopped at %d)", frame_number, frames_scanned);
-                stream->frame_num = frames_scanned;
-                return frames_scanned;
-            }
-            
-            // Look for FFD8 (JPEG SOI marker)
-            if (prev_byte == 0xFF && ch == 0xD8) {
-                if (frames_scanned == frame_number) {
-                    // Found target frame - back up to read full frame
-                    fseek(stream->file, -2, SEEK_CUR);
-                    stream->frame_num = frame_number;
-                    logger_log("seeked to frame %d (raw MJPEG)", frame_number);
-                    return frame_number;
-                }
-                frames_scanned++;
-            }
-            
-            prev_byte = ch;
-        }
-    } else if (isdigit(first_byte)) {
-        // Format with length header
-        char frame_len_str[MAX_FRAME_LEN_DIGITS + 1];
-        frame_len_str[0] = first_byte;
-        int header_len = 1;
-        
-        for (int i = 0; i < frame_number; i++) {
-            // Read frame header
-            while (header_len < MAX_FRAME_LEN_DIGITS) {
-                int ch = fgetc(stream->file);
-                if (ch == EOF) {
-                    logger_log("reached EOF while seeking to frame %d (stopped at %d)", frame_number, i);
-                    return stream->frame_num;
-                }
-                if (isdigit(ch)) {
-                    frame_len_str[header_len++] = (char)ch;
-                } else {
-                    ungetc(ch, stream->file);
-                    break;
-                }
-            }
-            
-            if (header_len == 0) {
-                logger_log("invalid frame header while seeking at frame %d", i);
-                return -1;
-            }
-            
-            frame_len_str[header_len] = '\0';
-            int frame_len = atoi(frame_len_str);
-            
-            if (frame_len <= 0) {
-                logger_log("invalid frame length while seeking: %d", frame_len);
-                return -1;
-            }
-
-            // Skip frame data
-            if (fseek(stream->file, frame_len, SEEK_CUR) != 0) {
-                logger_log("seek failed at frame %d", i);
-                return -1;
-            }
-
-            stream->frame_num++;
-            header_len = 0;
-        }
 
-        logger_log("seeked to frame %d (header format)", frame_number);
-        return frame_number;
-    } else {
-        logger_log("unknown video format when seeking");
-        return -1;
-    }
+    // The read itself seeks to the indexed offset
+    stream->frame_num = frame_number;
+    logger_log("seeked to frame %d", frame_number);
+    return frame_number;
 }
@@ -1,29 +1,108 @@
 #ifndef VIDEO_STREAM_H
 #define VIDEO_STREAM_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <sys/types.h>
 
+// Frame rate used when neither the file nor its sidecar index carries one
+#define VIDEO_DEFAULT_FPS 30.0
+
+// Sidecar index written next to a video as "<video>.idx"
+#define VIDEO_INDEX_SUFFIX ".idx"
+#define VIDEO_INDEX_MAGIC "MJIX"
+#define VIDEO_INDEX_VERSION 1
+
+// On-disk layouts served behind the same API
+typedef enum {
+    VIDEO_FORMAT_LENGTH_PREFIXED, // "NNNNN" + frame data, repeated
+    VIDEO_FORMAT_RAW,             // JPEG frames directly concatenated
+    VIDEO_FORMAT_CONTAINER        // binary container, see mjpeg_container.h
+} video_format_t;
+
+// Location of one frame's JPEG data inside the file
 typedef struct {
+    uint64_t offset;
+    uint32_t size;
+} video_frame_entry_t;
+
+typedef struct video_stream {
     FILE *file;
-    int frame_num;
+    int frame_num;         // Next frame to be read (0-indexed)
     int total_frames;      // Cached total frame count
     long file_size;        // Total file size in bytes
-    double avg_frame_size; // Average bytes per frame (for seeking in raw MJPEG)
-    int is_raw_mjpeg;      // 1 if raw MJPEG, 0 if header format
+    double avg_frame_size; // Average bytes per frame
+    video_format_t format;
+    double fps;            // Media frame rate, from the index or the default
+
+    // One entry per frame, so seeking is a single lookup
+    video_frame_entry_t *index;
+    size_t max_frame_size;
+
+    // Resolution from the first frame's SOF marker, 0 if it couldn't be read
+    int width;
+    int height;
+
+    // Page cache hints: frames [advise_start, advise_end) were announced
+    // with WILLNEED, played_until is the offset playback got to
+    int advise_start;
+    int advise_end;
+    _Atomic uint64_t played_until;
+
+    // The stream this one was attached to, which owns file and index, NULL
+    // for one that was opened
+    struct video_stream *source;
+
+    // Of an opened stream: the streams attached to it, and where the last
+    // DONTNEED check was. Pages are only released below every attached
+    // stream's position, they all read through the same file
+    pthread_mutex_t views_mutex;
+    struct video_stream *views;
+    struct video_stream *next_view;
+    uint64_t released_until;
 } video_stream_t;
 
+// Write "<filename>.idx" describing the frames of a video
+// Return 0 on success, -1 on error
+int video_stream_write_index(const char *filename,
+                             const video_frame_entry_t *index,
+                             int total_frames,
+                             uint32_t fps_num,
+                             uint32_t fps_den,
+                             int is_raw_mjpeg,
+                             uint64_t file_size);
+
+// Frame rate assumed for files without one in their index
+void video_stream_set_default_fps(double fps);
+
+// Enable or disable page cache hints for streams opened afterwards (default on)
+void video_stream_set_cache_hints(int enabled);
+
 int video_stream_open(video_stream_t *stream, const char *filename);
 
+// Make stream a view of an open stream, sharing its file and index but with
+// its own position. The source must stay open until stream is closed
+void video_stream_attach(video_stream_t *stream, video_stream_t *source);
+
+// Tell the kernel which bytes playback needs next from frame on, and drop
+// the ones already played when memory is tight. video_stream_next_frame
+// calls it, readers that bypass it call it themselves
+void video_stream_advise(video_stream_t *stream, int frame);
+
 // Read next frame from the file into the buffer
 // Return the size of the frame, or 0 if EOF, or -1 on error
 ssize_t video_stream_next_frame(video_stream_t *stream, uint8_t *buffer, size_t buffer_size);
 
-// Get total number of frames in video (by scanning file, slow operation)
+// Get total number of frames in video (cached by the index)
 int video_stream_get_total_frames(video_stream_t *stream);
 
+// Frame shown at a given time, using the media frame rate, clamped to
+// [0, total_frames]
+int video_stream_time_to_frame(const video_stream_t *stream, double time_seconds);
+
 // Seek to a specific time in seconds and get frame number
 // Returns frame number (0-indexed) or -1 if seek failed
 int video_stream_seek_time(video_stream_t *stream, double time_seconds);
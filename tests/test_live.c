@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/logger.h"
+#include "../server/live.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pushes frames of mixed sizes through a live source with a small
+// time-shift segment, so the segment wraps many times with frames of
+// every size at the head, and checks after each frame that the window
+// holds no two frames sharing bytes and that every frame in it reads back
+// as pushed
+
+#define RING_FRAMES 2
+#define SEGMENT_MIB 1
+#define TEST_FRAMES 200
+#define TEST_FPS 30.0
+
+// Frames from 20 KiB to about 420 KiB, so two to fifty fit in the segment
+#define MIN_FRAME_SIZE (20 * 1024)
+#define MAX_FRAME_SIZE (420 * 1024)
+
+// SOI, SOF0 and SOS headers before the entropy data
+#define JPEG_HEADER_SIZE 35
+
+static int g_checks;
+static int g_failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static int check(int ok, const char *what, int line) {
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        if (g_failures <= 20) {
+            fprintf(stderr, "test_live.c:%d: check failed: %s\n", line, what);
+        }
+    }
+    return ok;
+}
+
+static size_t frame_size(uint64_t number) {
+    return MIN_FRAME_SIZE + (size_t)((number * 2654435761u) % (MAX_FRAME_SIZE - MIN_FRAME_SIZE));
+}
+
+// Entropy byte i of frame number, never 0xFF so no marker is formed
+static uint8_t frame_byte(uint64_t number, size_t i) {
+    return (uint8_t)((number * 31 + i) % 251);
+}
+
+// A well formed 16x16 JPEG of size bytes whose data identifies number
+static void make_frame(uint8_t *out, uint64_t number, size_t size) {
+    static const uint8_t header[JPEG_HEADER_SIZE] = {
+        0xFF, 0xD8,
+        0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x10, 0x00, 0x10, 0x03,
+        0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+        0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3F, 0x00,
+    };
+    memcpy(out, header, JPEG_HEADER_SIZE);
+    for (size_t i = JPEG_HEADER_SIZE; i < size - 2; i++) {
+        out[i] = frame_byte(number, i);
+    }
+    out[size - 2] = 0xFF;
+    out[size - 1] = 0xD9;
+}
+
+static int frame_matches(const uint8_t *data, size_t size, uint64_t number) {
+    if (size != frame_size(number)) {
+        return 0;
+    }
+    for (size_t i = JPEG_HEADER_SIZE; i < size - 2; i++) {
+        if (data[i] != frame_byte(number, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Every frame in the window has its own bytes of the segment, unchanged
+static void check_window(live_source_t *source) {
+    pthread_mutex_lock(&source->mutex);
+    uint64_t capacity = (uint64_t)source->dvr_capacity;
+    size_t window_bytes = 0;
+    for (uint64_t n = source->dvr_first; n < source->dvr_next; n++) {
+        const live_dvr_entry_t *entry = &source->dvr[n % capacity];
+        window_bytes += entry->size;
+        CHECK(entry->offset + entry->size <= source->segment_size);
+        CHECK(frame_matches(source->segment + entry->offset, entry->size, n));
+        for (uint64_t m = n + 1; m < source->dvr_next; m++) {
+            const live_dvr_entry_t *other = &source->dvr[m % capacity];
+            CHECK(other->offset >= entry->offset + entry->size || entry->offset >= other->offset + other->size);
+        }
+    }
+    CHECK(window_bytes <= source->segment_size);
+    CHECK(source->dvr_next - source->dvr_first <= capacity);
+    pthread_mutex_unlock(&source->mutex);
+}
+
+static void test_segment_wrap(void) {
+    live_set_ring_frames(RING_FRAMES);
+    live_set_dvr(TEST_FRAMES / TEST_FPS, SEGMENT_MIB);
+    live_source_t *source = live_announce("test", TEST_FPS);
+    if (!CHECK(source != NULL) || !CHECK(live_has_dvr(source))) {
+        if (source != NULL) {
+            live_end(source);
+            live_release(source);
+        }
+        return;
+    }
+
+    static uint8_t frame[MAX_FRAME_SIZE];
+    int wraps = 0;
+    size_t head = 0;
+    for (uint64_t n = 0; n < TEST_FRAMES; n++) {
+        size_t size = frame_size(n);
+        make_frame(frame, n, size);
+        live_feed(source, frame, size);
+        check_window(source);
+        wraps += source->segment_head < head;
+        head = source->segment_head;
+    }
+    CHECK(wraps > 10);
+    CHECK(source->next_number == TEST_FRAMES);
+
+    // A viewer from the start skips to the oldest frame kept, then gets
+    // every frame in order, out of the segment and then the ring
+    pthread_mutex_lock(&source->mutex);
+    uint64_t oldest = source->dvr_first;
+    pthread_mutex_unlock(&source->mutex);
+    CHECK(oldest > 0);
+    uint64_t cursor = 0;
+    int ended = 0;
+    for (uint64_t n = oldest; n < TEST_FRAMES; n++) {
+        live_frame_t *got = live_next(source, &cursor, 0, &ended);
+        if (!CHECK(got != NULL)) {
+            break;
+        }
+        CHECK(got->number == n && frame_matches(got->data, got->size, n));
+        live_frame_release(got);
+    }
+
+    live_end(source);
+    live_release(source);
+}
+
+int main(void) {
+    logger_init(LOG_SRC_SERVER);
+    test_segment_wrap();
+
+    fprintf(stderr, "test_live: %d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
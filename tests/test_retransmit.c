@@ -0,0 +1,106 @@
+#include "../common/logger.h"
+#include "../server/retransmit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stores packets in a small retransmit cache until its ring wraps several
+// times and checks that exactly the newest capacity packets are found, as
+// stored, and that older ones miss even where their slot was reused
+
+#define TEST_CAPACITY 8
+#define FRAGS_PER_FRAME 3
+#define TEST_PACKETS 100
+
+static int g_checks;
+static int g_failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static int check(int ok, const char *what, int line) {
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        if (g_failures <= 20) {
+            fprintf(stderr, "test_retransmit.c:%d: check failed: %s\n", line, what);
+        }
+    }
+    return ok;
+}
+
+// Packet n is fragment n % FRAGS_PER_FRAME of frame n / FRAGS_PER_FRAME,
+// sent as a header part and a payload part of sizes varying with n
+static uint16_t packet_seqnum(int n) {
+    return (uint16_t)(65530 + n / FRAGS_PER_FRAME); // wraps too
+}
+
+static size_t packet_size(int n) {
+    return 20 + (size_t)(n * 37) % (RETRANSMIT_MAX_PACKET - 20);
+}
+
+static void fill_packet(uint8_t *out, int n) {
+    for (size_t i = 0; i < packet_size(n); i++) {
+        out[i] = (uint8_t)(n + i * 7);
+    }
+}
+
+static void store_packet(retransmit_cache_t *cache, int n) {
+    uint8_t packet[RETRANSMIT_MAX_PACKET];
+    fill_packet(packet, n);
+    struct iovec iov[2] = {{packet, 20}, {packet + 20, packet_size(n) - 20}};
+    retransmit_cache_store(cache, packet_seqnum(n), (uint8_t)(n % FRAGS_PER_FRAME), iov, 2);
+}
+
+static void test_wrap(void) {
+    retransmit_set_packets(TEST_CAPACITY);
+    retransmit_cache_t cache;
+    if (!CHECK(retransmit_cache_init(&cache) == 0)) {
+        return;
+    }
+
+    size_t size;
+    CHECK(retransmit_cache_find(&cache, packet_seqnum(0), 0, &size) == NULL);
+    for (int stored = 1; stored <= TEST_PACKETS; stored++) {
+        store_packet(&cache, stored - 1);
+        for (int n = 0; n < stored; n++) {
+            const uint8_t *found = retransmit_cache_find(&cache, packet_seqnum(n), (uint8_t)(n % FRAGS_PER_FRAME),
+                &size);
+            if (n < stored - TEST_CAPACITY) {
+                CHECK(found == NULL);
+                continue;
+            }
+            uint8_t expected[RETRANSMIT_MAX_PACKET];
+            fill_packet(expected, n);
+            CHECK(found != NULL && size == packet_size(n) && memcmp(found, expected, size) == 0);
+        }
+        // Slots not stored to yet hold no packet, not frame 0's first
+        if (stored < TEST_CAPACITY) {
+            CHECK(retransmit_cache_find(&cache, 0, 0, &size) == NULL);
+        }
+    }
+
+    // Larger than any packet sent: not kept, and nothing evicted for it
+    uint8_t big[RETRANSMIT_MAX_PACKET + 1] = {0};
+    struct iovec iov = {big, sizeof(big)};
+    retransmit_cache_store(&cache, 1234, 0, &iov, 1);
+    CHECK(retransmit_cache_find(&cache, 1234, 0, &size) == NULL);
+    int oldest = TEST_PACKETS - TEST_CAPACITY;
+    CHECK(retransmit_cache_find(&cache, packet_seqnum(oldest), (uint8_t)(oldest % FRAGS_PER_FRAME), &size) != NULL);
+
+    retransmit_cache_free(&cache);
+
+    // Turned off, nothing is kept
+    retransmit_set_packets(0);
+    CHECK(retransmit_cache_init(&cache) == -1);
+    store_packet(&cache, 0);
+    CHECK(retransmit_cache_find(&cache, packet_seqnum(0), 0, &size) == NULL);
+}
+
+int main(void) {
+    logger_init(LOG_SRC_SERVER);
+    test_wrap();
+
+    fprintf(stderr, "test_retransmit: %d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,175 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../client/rtp_client.h"
+#include "../common/logger.h"
+#include "../common/protocol.h"
+#include "../common/rtp_fec.h"
+#include "../common/rtp_packet.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Sends a client frames with one fragment lost and the parity of the
+// frame's fragments, the way the server does with -F, and checks the
+// client rebuilds the lost one: a full fragment from the middle of the
+// frame, and the short last one
+
+#define TEST_FRAGS 5
+#define TEST_FRAME_SIZE ((TEST_FRAGS - 1) * RTP_MTU_PAYLOAD + 321)
+
+static int g_checks;
+static int g_failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static int check(int ok, const char *what, int line) {
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        if (g_failures <= 20) {
+            fprintf(stderr, "test_rtp_fec.c:%d: check failed: %s\n", line, what);
+        }
+    }
+    return ok;
+}
+
+// The last frame the client handed on
+static pthread_mutex_t g_frame_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_frame_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t g_frame[TEST_FRAME_SIZE];
+static size_t g_frame_size;
+static int g_frames;
+
+static void on_frame(const uint8_t *data, size_t size, uint8_t epoch, void *arg) {
+    (void)epoch;
+    (void)arg;
+    pthread_mutex_lock(&g_frame_mutex);
+    g_frame_size = size <= sizeof(g_frame) ? size : 0;
+    memcpy(g_frame, data, g_frame_size);
+    g_frames++;
+    pthread_cond_broadcast(&g_frame_cond);
+    pthread_mutex_unlock(&g_frame_mutex);
+}
+
+// Wait up to a second for frame number count
+static int wait_frame(int count) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    pthread_mutex_lock(&g_frame_mutex);
+    while (g_frames < count && pthread_cond_timedwait(&g_frame_cond, &g_frame_mutex, &deadline) == 0) {
+    }
+    int arrived = g_frames >= count;
+    pthread_mutex_unlock(&g_frame_mutex);
+    return arrived;
+}
+
+static void send_packet(int socket_fd, const struct sockaddr_in *addr, uint16_t seqnum, int marker,
+                        const uint8_t *frag_header, const uint8_t *data, size_t size) {
+    uint8_t payload[RTP_FRAG_HEADER_SIZE + RTP_MTU_PAYLOAD];
+    uint8_t packet[RTP_HEADER_SIZE + sizeof(payload)];
+    memcpy(payload, frag_header, RTP_FRAG_HEADER_SIZE);
+    memcpy(payload + RTP_FRAG_HEADER_SIZE, data, size);
+    size_t packet_size = rtp_packet_encode(
+        packet, sizeof(packet),
+        2, 0, 0, 0,
+        seqnum, marker,
+        MJPEG_TYPE, seqnum * 3000u, 0,
+        payload, RTP_FRAG_HEADER_SIZE + size
+    );
+    CHECK(sendto(socket_fd, packet, packet_size, 0, (const struct sockaddr *)addr, sizeof(*addr)) ==
+          (ssize_t)packet_size);
+}
+
+// Send frame seqnum without fragment lost, then the parity of all of them
+static void send_frame(int socket_fd, const struct sockaddr_in *addr, uint16_t seqnum,
+                       const uint8_t *frame, int lost) {
+    uint8_t frag_header[RTP_FRAG_HEADER_SIZE];
+    rtp_fec_group_t parity = {.count = 0};
+    for (int i = 0; i < TEST_FRAGS; i++) {
+        size_t offset = (size_t)i * RTP_MTU_PAYLOAD;
+        size_t size = TEST_FRAME_SIZE - offset < RTP_MTU_PAYLOAD ? TEST_FRAME_SIZE - offset : RTP_MTU_PAYLOAD;
+        CHECK(rtp_fec_add(&parity, i, frame + offset, size) == 0);
+        if (i != lost) {
+            rtp_frag_encode(frag_header, i, TEST_FRAGS, TEST_FRAME_SIZE, 0);
+            send_packet(socket_fd, addr, seqnum, i == TEST_FRAGS - 1, frag_header, frame + offset, size);
+        }
+    }
+    CHECK(parity.count == TEST_FRAGS && parity.size == RTP_MTU_PAYLOAD);
+    rtp_fec_encode(frag_header, &parity, TEST_FRAGS, TEST_FRAME_SIZE, 0);
+    send_packet(socket_fd, addr, seqnum, 0, frag_header, parity.payload, parity.size);
+}
+
+// A fragment larger than a parity payload is refused, not XORed past it
+static void test_add_bounds(void) {
+    static uint8_t data[RTP_MTU_PAYLOAD + 1];
+    rtp_fec_group_t group = {.count = 0};
+    CHECK(rtp_fec_add(&group, 0, data, sizeof(data)) == -1);
+    CHECK(group.count == 0);
+    CHECK(rtp_fec_add(&group, 0, data, RTP_MTU_PAYLOAD) == 0);
+    CHECK(rtp_fec_add(&group, 1, data, sizeof(data)) == -1);
+    CHECK(group.count == 1 && group.size == RTP_MTU_PAYLOAD);
+}
+
+static void test_repair(void) {
+    static rtp_client_t rtp;
+    if (!CHECK(rtp_client_open_port(&rtp, 0, TEST_FRAME_SIZE, NULL) == 0)) {
+        return;
+    }
+    rtp_client_set_frame_callback(&rtp, on_frame, NULL);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (!CHECK(socket_fd >= 0) ||
+        !CHECK(getsockname(rtp.rtp_socket_fd, (struct sockaddr *)&addr, &addr_len) == 0) ||
+        !CHECK(rtp_client_start_listener(&rtp) == 0)) {
+        if (socket_fd >= 0) {
+            close(socket_fd);
+        }
+        rtp_client_stop_listener(&rtp);
+        return;
+    }
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    static uint8_t frame[TEST_FRAME_SIZE];
+    for (size_t i = 0; i < sizeof(frame); i++) {
+        frame[i] = (uint8_t)rand();
+    }
+
+    // A full fragment from the middle of the frame
+    send_frame(socket_fd, &addr, 100, frame, 2);
+    if (CHECK(wait_frame(1))) {
+        CHECK(g_frame_size == TEST_FRAME_SIZE && memcmp(g_frame, frame, TEST_FRAME_SIZE) == 0);
+    }
+
+    // The short last fragment, rebuilt from a parity padded to a full one
+    frame[TEST_FRAME_SIZE - 1] ^= 0xFF;
+    send_frame(socket_fd, &addr, 101, frame, TEST_FRAGS - 1);
+    if (CHECK(wait_frame(2))) {
+        CHECK(g_frame_size == TEST_FRAME_SIZE && memcmp(g_frame, frame, TEST_FRAME_SIZE) == 0);
+    }
+
+    rtp_stats_t stats;
+    rtp_client_get_stats(&rtp, &stats);
+    CHECK(stats.fragments_repaired == 2);
+
+    close(socket_fd);
+    rtp_client_stop_listener(&rtp);
+}
+
+int main(void) {
+    logger_init(LOG_SRC_CLIENT);
+    srand(1);
+    test_add_bounds();
+    test_repair();
+
+    fprintf(stderr, "test_rtp_fec: %d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
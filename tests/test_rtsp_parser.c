@@ -0,0 +1,240 @@
+#include "../server/rtsp_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Feeds streams of random pipelined requests to rtsp_conn_next split at
+// random points, the way reads come off a socket, and checks every request
+// comes out whole, in order and with its Content-Length body
+
+#define RUNS 500
+#define MAX_REQUESTS 40
+#define MAX_BODY 300
+
+typedef struct {
+    rtsp_method_t method;
+    char filename[64];
+    int cseq;
+    int session_id;
+    int rtp_port;
+    int multicast;
+    int has_seek;
+    double seek_position;
+    int has_frame_seek;
+    int frame_number;
+    char body[MAX_BODY + 1];
+    size_t body_len;
+} expected_request_t;
+
+static const char *g_methods[] = {"SETUP", "PLAY", "PAUSE", "TEARDOWN", "DESCRIBE", "GET_PARAMETER", "ANNOUNCE", "RECORD"};
+
+static int g_checks;
+static int g_failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static int check(int ok, const char *what, int line) {
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        if (g_failures <= 20) {
+            fprintf(stderr, "test_rtsp_parser.c:%d: check failed: %s\n", line, what);
+        }
+    }
+    return ok;
+}
+
+static int random_between(int low, int high) {
+    return low + rand() % (high - low + 1);
+}
+
+// Append one random request to out, recording what it should parse to
+static size_t write_request(char *out, size_t size, int cseq, expected_request_t *expected) {
+    memset(expected, 0, sizeof(*expected));
+    int method = random_between(0, (int)(sizeof(g_methods) / sizeof(g_methods[0])) - 1);
+    expected->method = (rtsp_method_t)method;
+    expected->cseq = cseq;
+    snprintf(expected->filename, sizeof(expected->filename), "video%d.mjpeg", random_between(0, 999));
+    const char *eol = rand() % 4 == 0 ? "\n" : "\r\n";
+
+    size_t len = 0;
+    // Stray line breaks between pipelined requests are tolerated
+    if (rand() % 8 == 0) {
+        len += (size_t)snprintf(out + len, size - len, "\r\n");
+    }
+    len += (size_t)snprintf(out + len, size - len, "%s rtsp://127.0.0.1:8554/dir/%s RTSP/1.0%sCSeq: %d%s",
+        g_methods[method], expected->filename, eol, cseq, eol);
+    if (rand() % 2) {
+        expected->session_id = random_between(100000, 999999);
+        len += (size_t)snprintf(out + len, size - len, "Session: %d%s", expected->session_id, eol);
+    }
+    if (rand() % 3 == 0) {
+        expected->rtp_port = random_between(1024, 65535);
+        expected->multicast = rand() % 4 == 0;
+        len += (size_t)snprintf(out + len, size - len, "Transport: RTP/AVP;%s;client_port=%d-%d%s",
+            expected->multicast ? "multicast" : "unicast", expected->rtp_port, expected->rtp_port + 1, eol);
+    }
+    if (rand() % 3 == 0) {
+        int minutes = random_between(0, 59);
+        int seconds = random_between(0, 59);
+        int millis = random_between(0, 999);
+        expected->has_seek = 1;
+        expected->seek_position = minutes * 60.0 + seconds + millis / 1000.0;
+        if (minutes > 0 && rand() % 2) {
+            len += (size_t)snprintf(out + len, size - len, "Range: npt=%d:%02d.%03d-%s", minutes, seconds, millis, eol);
+        } else {
+            len += (size_t)snprintf(out + len, size - len, "Range: npt=%d.%03d-%s", minutes * 60 + seconds, millis, eol);
+        }
+    }
+    if (rand() % 4 == 0) {
+        expected->has_frame_seek = 1;
+        expected->frame_number = random_between(0, 100000);
+        len += (size_t)snprintf(out + len, size - len, "X-Frame: %d%s", expected->frame_number, eol);
+    }
+
+    // Bodies may look like headers or hold blank lines, only the length counts
+    if (rand() % 2) {
+        expected->body_len = (size_t)random_between(0, MAX_BODY);
+        for (size_t i = 0; i < expected->body_len; i++) {
+            static const char alphabet[] = "abc: 123\r\n";
+            expected->body[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        len += (size_t)snprintf(out + len, size - len, "%s: %zu%s",
+            rand() % 2 ? "Content-Length" : "content-length", expected->body_len, eol);
+    }
+    len += (size_t)snprintf(out + len, size - len, "%s", eol);
+    memcpy(out + len, expected->body, expected->body_len);
+    return len + expected->body_len;
+}
+
+static void check_request(const rtsp_request_info_t *info, const expected_request_t *expected) {
+    char filename[64];
+    rtsp_slice_copy(info->filename, filename, sizeof(filename));
+    CHECK(info->method == expected->method);
+    CHECK(info->cseq == expected->cseq);
+    CHECK(strcmp(filename, expected->filename) == 0);
+    CHECK(info->session_id == expected->session_id);
+    CHECK(info->rtp_port == expected->rtp_port);
+    CHECK(info->multicast == expected->multicast);
+    CHECK(info->has_seek == expected->has_seek);
+    if (expected->has_seek) {
+        double error = info->seek_position - expected->seek_position;
+        CHECK(error < 1e-9 && error > -1e-9);
+    }
+    CHECK(info->has_frame_seek == expected->has_frame_seek);
+    CHECK(info->frame_number == expected->frame_number);
+    CHECK(info->body.len == expected->body_len &&
+          memcmp(info->body.ptr, expected->body, expected->body_len) == 0);
+}
+
+// One connection: random requests, delivered in random chunks
+static void run_stream(void) {
+    static char stream[MAX_REQUESTS * (1024 + MAX_BODY)];
+    static expected_request_t expected[MAX_REQUESTS];
+    int count = random_between(1, MAX_REQUESTS);
+    size_t stream_len = 0;
+    for (int i = 0; i < count; i++) {
+        stream_len += write_request(stream + stream_len, sizeof(stream) - stream_len, i + 1, &expected[i]);
+    }
+
+    // Mostly short reads, sometimes all the buffer has room for
+    int max_chunk = rand() % 2 ? random_between(1, 64) : RTSP_CONN_BUFFER_SIZE;
+    rtsp_conn_buffer_t conn;
+    rtsp_conn_init(&conn);
+    size_t fed = 0;
+    int parsed = 0;
+    while (fed < stream_len) {
+        size_t space;
+        char *tail = rtsp_conn_tail(&conn, &space);
+        size_t chunk = (size_t)random_between(1, max_chunk);
+        if (chunk > space) {
+            chunk = space;
+        }
+        if (chunk > stream_len - fed) {
+            chunk = stream_len - fed;
+        }
+        if (!CHECK(chunk > 0)) {
+            return;
+        }
+        memcpy(tail, stream + fed, chunk);
+        rtsp_conn_commit(&conn, chunk);
+        fed += chunk;
+
+        rtsp_request_info_t info;
+        rtsp_parse_status_t status;
+        while ((status = rtsp_conn_next(&conn, &info)) == RTSP_PARSE_OK) {
+            if (!CHECK(parsed < count)) {
+                return;
+            }
+            check_request(&info, &expected[parsed]);
+            parsed++;
+        }
+        if (!CHECK(status == RTSP_PARSE_INCOMPLETE)) {
+            return;
+        }
+    }
+    CHECK(parsed == count);
+    size_t left;
+    rtsp_conn_unparsed(&conn, &left);
+    CHECK(left == 0);
+}
+
+// Slices in info point into conn, the caller keeps both
+static rtsp_parse_status_t parse_into(rtsp_conn_buffer_t *conn, const char *request, rtsp_request_info_t *info) {
+    rtsp_conn_init(conn);
+    size_t space;
+    char *tail = rtsp_conn_tail(conn, &space);
+    size_t len = strlen(request) < space ? strlen(request) : space;
+    memcpy(tail, request, len);
+    rtsp_conn_commit(conn, len);
+    return rtsp_conn_next(conn, info);
+}
+
+static rtsp_parse_status_t parse_all(const char *request) {
+    static rtsp_conn_buffer_t conn;
+    rtsp_request_info_t info;
+    return parse_into(&conn, request, &info);
+}
+
+static void test_rejects(void) {
+    // A body that can never fit in the buffer
+    CHECK(parse_all("ANNOUNCE live/a RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 100000\r\n\r\n") == RTSP_PARSE_ERROR);
+    // No URL in the request line
+    CHECK(parse_all("PLAY\r\nCSeq: 1\r\n\r\n") == RTSP_PARSE_ERROR);
+    // Headers that never end fill the buffer
+    static char huge[RTSP_CONN_BUFFER_SIZE + 1];
+    memset(huge, 'a', RTSP_CONN_BUFFER_SIZE);
+    memcpy(huge, "PLAY a RTSP/1.0\r\nX-Pad: ", 24);
+    CHECK(parse_all(huge) == RTSP_PARSE_ERROR);
+    // A body not fully read yet
+    CHECK(parse_all("ANNOUNCE live/a RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 10\r\n\r\n12345") == RTSP_PARSE_INCOMPLETE);
+}
+
+// Numbers too large for an int saturate instead of overflowing
+static void test_large_numbers(void) {
+    static rtsp_conn_buffer_t conn;
+    rtsp_request_info_t info;
+    CHECK(parse_into(&conn, "PLAY a RTSP/1.0\r\nCSeq: 9999999999\r\nSession: 99999999999999999999\r\n"
+        "X-Frame: 2147483648\r\nRange: npt=99999999999:59.5-\r\n\r\n", &info) == RTSP_PARSE_OK);
+    CHECK(info.cseq == 999999999);
+    CHECK(info.session_id == 999999999);
+    CHECK(info.has_frame_seek && info.frame_number == 214748364);
+    CHECK(info.has_seek && info.seek_position == 999999999 * 60.0 + 59.5);
+    // The largest value still read exactly
+    CHECK(parse_into(&conn, "PLAY a RTSP/1.0\r\nCSeq: 2147483639\r\n\r\n", &info) == RTSP_PARSE_OK);
+    CHECK(info.cseq == 2147483639);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 10) : 1;
+    srand(seed);
+    for (int run = 0; run < RUNS; run++) {
+        run_stream();
+    }
+    test_rejects();
+    test_large_numbers();
+
+    fprintf(stderr, "test_rtsp_parser (seed %u): %d checks, %d failed\n", seed, g_checks, g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/logger.h"
+#include "../server/video_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Seeks by time at common frame rates, NTSC ones included: every frame's
+// start time must map back to that frame. Plain truncation of time * fps
+// gets some of them wrong, (int)(frame / fps * fps) can land a frame early
+
+#define TEST_SECONDS 120
+#define FRAME_DATA_SIZE 16
+
+typedef struct {
+    uint32_t num;
+    uint32_t den;
+} frame_rate_t;
+
+static const frame_rate_t g_rates[] = {{24000, 1001}, {25, 1}, {30000, 1001}, {30, 1}};
+
+static int g_checks;
+static int g_failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static int check(int ok, const char *what, int line) {
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        if (g_failures <= 20) {
+            fprintf(stderr, "test_video_stream.c:%d: check failed: %s\n", line, what);
+        }
+    }
+    return ok;
+}
+
+// A length-prefixed video of total_frames frames with a sidecar index
+// carrying the frame rate, the way mjpeg-index writes one
+static int write_video(const char *path, int total_frames, frame_rate_t rate) {
+    FILE *file = fopen(path, "wb");
+    video_frame_entry_t *index = (video_frame_entry_t *)malloc((size_t)total_frames * sizeof(video_frame_entry_t));
+    if (file == NULL || index == NULL) {
+        if (file != NULL) {
+            fclose(file);
+        }
+        free(index);
+        return -1;
+    }
+    uint8_t data[FRAME_DATA_SIZE] = {0xFF, 0xD8};
+    data[FRAME_DATA_SIZE - 2] = 0xFF;
+    data[FRAME_DATA_SIZE - 1] = 0xD9;
+    uint64_t offset = 0;
+    for (int i = 0; i < total_frames; i++) {
+        fprintf(file, "%05d", FRAME_DATA_SIZE);
+        fwrite(data, 1, sizeof(data), file);
+        index[i].offset = offset + 5;
+        index[i].size = FRAME_DATA_SIZE;
+        offset += 5 + FRAME_DATA_SIZE;
+    }
+    int result = fclose(file) == 0 ? 0 : -1;
+    if (result == 0) {
+        result = video_stream_write_index(path, index, total_frames, rate.num, rate.den, 0, offset);
+    }
+    free(index);
+    return result;
+}
+
+static void test_rate(frame_rate_t rate) {
+    char path[] = "/tmp/streamsrv-test-XXXXXX";
+    int fd = mkstemp(path);
+    if (!CHECK(fd >= 0)) {
+        return;
+    }
+    close(fd);
+    char index_path[sizeof(path) + sizeof(VIDEO_INDEX_SUFFIX)];
+    snprintf(index_path, sizeof(index_path), "%s%s", path, VIDEO_INDEX_SUFFIX);
+
+    double fps = (double)rate.num / rate.den;
+    int total_frames = (int)(TEST_SECONDS * fps);
+    video_stream_t stream;
+    if (!CHECK(write_video(path, total_frames, rate) == 0) || !CHECK(video_stream_open(&stream, path) == 0)) {
+        remove(path);
+        remove(index_path);
+        return;
+    }
+    CHECK(stream.fps == fps);
+    CHECK(stream.total_frames == total_frames);
+
+    for (int frame = 0; frame < total_frames; frame++) {
+        // Exactly on the frame's start, computed both ways a caller would
+        double start = frame / stream.fps;
+        double stepped = frame * (1.0 / stream.fps);
+        CHECK(video_stream_time_to_frame(&stream, start) == frame);
+        CHECK(video_stream_time_to_frame(&stream, stepped) == frame);
+
+        // Anywhere inside the frame, up to just before the next one
+        CHECK(video_stream_time_to_frame(&stream, (frame + 0.5) / stream.fps) == frame);
+        CHECK(video_stream_time_to_frame(&stream, (frame + 0.999) / stream.fps) == frame);
+
+        // time -> frame -> time lands on the start of the frame shown
+        double time = (frame + (double)rand() / RAND_MAX * 0.999) / stream.fps;
+        int shown = video_stream_time_to_frame(&stream, time);
+        CHECK(shown == frame);
+        CHECK(shown / stream.fps <= time);
+        CHECK(video_stream_time_to_frame(&stream, shown / stream.fps) == shown);
+    }
+    // Seeks go through the same mapping, and clamp at both ends
+    CHECK(video_stream_seek_time(&stream, 100 / stream.fps) == 100);
+    CHECK(stream.frame_num == 100);
+    CHECK(video_stream_seek_time(&stream, -1) == 0);
+    CHECK(video_stream_seek_time(&stream, TEST_SECONDS + 1) == total_frames);
+    CHECK(video_stream_seek_time(&stream, (total_frames - 1) / stream.fps) == total_frames - 1);
+
+    // Times far past any int frame number clamp instead of overflowing
+    CHECK(video_stream_time_to_frame(&stream, 999999999) == total_frames);
+    CHECK(video_stream_time_to_frame(&stream, 1e300) == total_frames);
+    CHECK(video_stream_seek_time(&stream, 999999999.0 * 60) == total_frames);
+    CHECK(video_stream_time_to_frame(&stream, -1e300) == 0);
+    video_stream_close(&stream);
+    remove(path);
+    remove(index_path);
+}
+
+int main(void) {
+    logger_init(LOG_SRC_SERVER);
+    srand(1);
+    for (size_t i = 0; i < sizeof(g_rates) / sizeof(g_rates[0]); i++) {
+        test_rate(g_rates[i]);
+    }
+
+    fprintf(stderr, "test_video_stream: %d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
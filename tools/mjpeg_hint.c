@@ -0,0 +1,215 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/logger.h"
+#include "../common/protocol.h"
+#include "../common/rtp_fragment.h"
+#include "../common/rtp_packet.h"
+#include "../server/rtp_hint.h"
+#include "../server/video_stream.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Frames kept in memory for the benchmark, so file reads don't skew it
+#define BENCH_MAX_FRAMES 64
+#define BENCH_SECONDS 2.0
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    uint8_t *data[BENCH_MAX_FRAMES];
+    size_t size[BENCH_MAX_FRAMES];
+    int count;
+} bench_frames_t;
+
+// Per-packet path, as the server does without hints: encode the fragment
+// header, copy the chunk after it, then encode the RTP header and copy again
+static uint64_t bench_packetize(const bench_frames_t *frames, int socket_fd, struct sockaddr_in *addr) {
+    uint8_t rtp_buffer[RTP_MTU_PAYLOAD + RTP_HINT_HEADER_SIZE];
+    uint8_t frag_buffer[RTP_MTU_PAYLOAD + RTP_FRAG_HEADER_SIZE];
+    uint64_t packets = 0;
+    uint16_t seqnum = 0;
+    double deadline = now_seconds() + BENCH_SECONDS;
+
+    while (now_seconds() < deadline) {
+        for (int f = 0; f < frames->count; f++, seqnum++) {
+            size_t frame_size = frames->size[f];
+            int total_frags = rtp_calc_fragments(frame_size);
+            size_t offset = 0;
+            for (int i = 0; i < total_frags; i++) {
+                size_t chunk_size = frame_size - offset;
+                if (chunk_size > RTP_MTU_PAYLOAD) {
+                    chunk_size = RTP_MTU_PAYLOAD;
+                }
+                rtp_frag_encode(frag_buffer, i, total_frags, frame_size, 0);
+                memcpy(frag_buffer + RTP_FRAG_HEADER_SIZE, frames->data[f] + offset, chunk_size);
+                size_t packet_size = rtp_packet_encode(
+                    rtp_buffer, sizeof(rtp_buffer),
+                    2, 0, 0, 0,
+                    seqnum,
+                    (i == total_frags - 1) ? 1 : 0,
+                    MJPEG_TYPE, (uint32_t)f * 3000, 0,
+                    frag_buffer, RTP_FRAG_HEADER_SIZE + chunk_size
+                );
+                if (socket_fd >= 0) {
+                    sendto(socket_fd, rtp_buffer, packet_size, 0, (struct sockaddr *)addr, sizeof(*addr));
+                }
+                offset += chunk_size;
+                packets++;
+            }
+        }
+    }
+    return packets;
+}
+
+// Hinted path: copy a prebuilt header, patch it and send it with the
+// payload slice in place
+static uint64_t bench_hinted(const bench_frames_t *frames,
+                             const rtp_hint_track_t *hints,
+                             int socket_fd,
+                             struct sockaddr_in *addr) {
+    uint8_t header[RTP_HINT_HEADER_SIZE];
+    struct iovec iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = sizeof(*addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    uint64_t packets = 0;
+    uint16_t seqnum = 0;
+    volatile uint8_t sink = 0;
+    double deadline = now_seconds() + BENCH_SECONDS;
+
+    while (now_seconds() < deadline) {
+        for (int f = 0; f < frames->count; f++, seqnum++) {
+            uint32_t last = hints->frame_first_packet[f + 1];
+            for (uint32_t p = hints->frame_first_packet[f]; p < last; p++) {
+                const rtp_hint_packet_t *packet = &hints->packets[p];
+                memcpy(header, packet->header, RTP_HINT_HEADER_SIZE);
+                rtp_hint_patch(header, seqnum, (uint32_t)f * 3000, 0, 0);
+                iov[0].iov_base = header;
+                iov[0].iov_len = RTP_HINT_HEADER_SIZE;
+                iov[1].iov_base = frames->data[f] + packet->payload_offset;
+                iov[1].iov_len = packet->payload_size;
+                if (socket_fd >= 0) {
+                    sendmsg(socket_fd, &msg, 0);
+                } else {
+                    sink ^= header[3];
+                }
+                packets++;
+            }
+        }
+    }
+    (void)sink;
+    return packets;
+}
+
+static void run_bench(video_stream_t *stream, const rtp_hint_track_t *hints) {
+    bench_frames_t frames;
+    frames.count = 0;
+    while (frames.count < BENCH_MAX_FRAMES && frames.count < stream->total_frames) {
+        uint8_t *buffer = (uint8_t *)malloc(stream->max_frame_size);
+        ssize_t size = buffer != NULL ? video_stream_next_frame(stream, buffer, stream->max_frame_size) : -1;
+        if (size <= 0) {
+            free(buffer);
+            break;
+        }
+        frames.data[frames.count] = buffer;
+        frames.size[frames.count] = (size_t)size;
+        frames.count++;
+    }
+    if (frames.count == 0) {
+        fprintf(stderr, "no frames to benchmark\n");
+        return;
+    }
+
+    // Send to a loopback socket nobody reads, the kernel drops what
+    // overflows its buffer but the send path is fully exercised
+    int sink_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sink_fd < 0 || send_fd < 0 ||
+        bind(sink_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(sink_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        fprintf(stderr, "could not create benchmark sockets\n");
+        return;
+    }
+
+    printf("benchmark over %d frames, %.0f s per run, one core\n", frames.count, BENCH_SECONDS);
+    uint64_t packets = bench_packetize(&frames, -1, &addr);
+    printf("  packetize only, per-packet: %10.0f packets/s\n", packets / BENCH_SECONDS);
+    packets = bench_hinted(&frames, hints, -1, &addr);
+    printf("  packetize only, hinted:     %10.0f packets/s\n", packets / BENCH_SECONDS);
+    packets = bench_packetize(&frames, send_fd, &addr);
+    printf("  send, per-packet:           %10.0f packets/s\n", packets / BENCH_SECONDS);
+    packets = bench_hinted(&frames, hints, send_fd, &addr);
+    printf("  send, hinted:               %10.0f packets/s\n", packets / BENCH_SECONDS);
+
+    close(sink_fd);
+    close(send_fd);
+    for (int f = 0; f < frames.count; f++) {
+        free(frames.data[f]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    logger_init(LOG_SRC_SERVER);
+
+    int bench = 0;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "b")) != -1) {
+        switch (opt_char) {
+        case 'b':
+            bench = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-b] video...\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-b] video...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int failed = 0;
+    for (int i = optind; i < argc; i++) {
+        video_stream_t stream;
+        if (video_stream_open(&stream, argv[i]) != 0) {
+            failed = 1;
+            continue;
+        }
+
+        rtp_hint_track_t hints;
+        if (rtp_hint_build(&hints, &stream) != 0 || rtp_hint_save(&hints, argv[i], &stream) != 0) {
+            fprintf(stderr, "failed to write hints for %s\n", argv[i]);
+            failed = 1;
+        } else {
+            printf("%s%s: %d frames, %u packets\n", argv[i], RTP_HINT_SUFFIX, hints.total_frames, hints.total_packets);
+            if (bench) {
+                run_bench(&stream, &hints);
+            }
+        }
+
+        rtp_hint_free(&hints);
+        video_stream_close(&stream);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,421 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/byte_order.h"
+#include "../common/logger.h"
+#include "../server/mjpeg_container.h"
+#include "../server/mjpeg_framer.h"
+#include "../server/video_stream.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Input is read in chunks of this size
+#define READ_CHUNK_SIZE (1024 * 1024)
+
+// Frames larger than this are dropped, so memory stays bounded at one chunk
+// plus one frame no matter how large the input is
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+// Width of the ASCII length prefix, wider only for frames that need it
+#define LENGTH_PREFIX_DIGITS 5
+
+typedef enum {
+    OUTPUT_INDEX_ONLY, // write the sidecar index for the input as it is
+    OUTPUT_RAW,        // concatenated JPEGs
+    OUTPUT_LENGTH_PREFIXED,
+    OUTPUT_CONTAINER       // binary container with aligned frames
+} output_format_t;
+
+typedef struct {
+    output_format_t format;
+    uint32_t fps_num;
+    uint32_t fps_den;
+    const char *out_dir; // NULL: next to the input
+    const char *suffix;  // inserted before the extension of remuxed files
+
+    char **files;
+    int file_count;
+    atomic_int next_file;
+    atomic_int failed;
+} job_t;
+
+// State for one file being processed
+typedef struct {
+    const job_t *job;
+    uint8_t *buffer;      // input bytes from buffer_offset on
+    size_t buffered;
+    uint64_t buffer_offset;
+
+    FILE *out;
+    uint64_t out_size;
+    int write_failed;
+    uint64_t oversized;
+
+    video_frame_entry_t *index;
+    int total_frames;
+    int capacity;
+    uint32_t max_frame_size;
+    int width; // from the first frame
+    int height;
+} file_ctx_t;
+
+static int append_entry(file_ctx_t *ctx, uint64_t offset, uint32_t size) {
+    if (ctx->total_frames == ctx->capacity) {
+        int new_capacity = ctx->capacity > 0 ? ctx->capacity * 2 : 1024;
+        video_frame_entry_t *grown = realloc(ctx->index, (size_t)new_capacity * sizeof(video_frame_entry_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        ctx->index = grown;
+        ctx->capacity = new_capacity;
+    }
+    ctx->index[ctx->total_frames].offset = offset;
+    ctx->index[ctx->total_frames].size = size;
+    ctx->total_frames++;
+    return 0;
+}
+
+// Zero-fill the output up to an offset
+static int pad_to(file_ctx_t *ctx, uint64_t offset) {
+    static const uint8_t zeros[MJPEG_CONTAINER_ALIGN];
+    while (ctx->out_size < offset) {
+        size_t n = offset - ctx->out_size < sizeof(zeros) ? (size_t)(offset - ctx->out_size) : sizeof(zeros);
+        if (fwrite(zeros, 1, n, ctx->out) != n) {
+            return 0;
+        }
+        ctx->out_size += n;
+    }
+    return 1;
+}
+
+// Pad so the payload that follows starts aligned, then write its frame header
+static int write_frame_header(file_ctx_t *ctx, uint32_t payload_size) {
+    uint8_t header[MJPEG_CONTAINER_FRAME_HEADER_SIZE];
+    uint64_t payload_offset = mjpeg_container_next_payload(ctx->out_size);
+    if (!pad_to(ctx, payload_offset - sizeof(header))) {
+        return 0;
+    }
+    mjpeg_container_encode_frame_header(header, (uint32_t)ctx->total_frames, payload_size);
+    ctx->out_size += sizeof(header);
+    return fwrite(header, 1, sizeof(header), ctx->out) == sizeof(header);
+}
+
+// Reserve the file header block, filled in by finish_container
+static int start_container(file_ctx_t *ctx) {
+    uint8_t header[MJPEG_CONTAINER_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    ctx->out_size = sizeof(header);
+    return fwrite(header, 1, sizeof(header), ctx->out) == sizeof(header);
+}
+
+// Append the aligned index, then write the file header now that the frame
+// count and index offset are known
+static int finish_container(file_ctx_t *ctx) {
+    mjpeg_container_header_t header;
+    header.fps_num = ctx->job->fps_num;
+    header.fps_den = ctx->job->fps_den;
+    header.width = (uint32_t)ctx->width;
+    header.height = (uint32_t)ctx->height;
+    header.frame_count = (uint32_t)ctx->total_frames;
+    header.max_frame_size = ctx->max_frame_size;
+    header.index_offset = mjpeg_container_align(ctx->out_size);
+    if (!pad_to(ctx, header.index_offset)) {
+        return -1;
+    }
+
+    uint8_t entry[MJPEG_CONTAINER_INDEX_ENTRY_SIZE];
+    for (int i = 0; i < ctx->total_frames; i++) {
+        memset(entry, 0, sizeof(entry));
+        write_le64(entry, ctx->index[i].offset);
+        write_le32(entry + 8, ctx->index[i].size);
+        if (fwrite(entry, 1, sizeof(entry), ctx->out) != sizeof(entry)) {
+            return -1;
+        }
+        ctx->out_size += sizeof(entry);
+    }
+
+    uint8_t buf[MJPEG_CONTAINER_HEADER_SIZE];
+    mjpeg_container_encode_header(buf, &header);
+    if (fseek(ctx->out, 0, SEEK_SET) != 0 || fwrite(buf, 1, sizeof(buf), ctx->out) != sizeof(buf)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void on_frame(const mjpeg_frame_t *frame, void *arg) {
+    file_ctx_t *ctx = (file_ctx_t *)arg;
+    if (ctx->write_failed) {
+        return;
+    }
+    if (ctx->job->format == OUTPUT_INDEX_ONLY) {
+        ctx->write_failed = append_entry(ctx, frame->offset, frame->size) != 0;
+        return;
+    }
+
+    const uint8_t *data = ctx->buffer + (frame->offset - ctx->buffer_offset);
+    uint32_t size = frame->size;
+
+    // Like the old converter, drop a comment segment right after SOI
+    uint32_t skip = 0;
+    if (size > 6 && data[2] == 0xFF && data[3] == 0xFE) {
+        uint32_t comment_len = ((uint32_t)data[4] << 8) | data[5];
+        if (4 + comment_len < size) {
+            skip = 2 + comment_len;
+        }
+    }
+
+    int ok = 1;
+    if (ctx->job->format == OUTPUT_LENGTH_PREFIXED) {
+        int prefix_len = fprintf(ctx->out, "%0*u", LENGTH_PREFIX_DIGITS, size - skip);
+        ctx->out_size += prefix_len > 0 ? (uint64_t)prefix_len : 0;
+    } else if (ctx->job->format == OUTPUT_CONTAINER) {
+        ok = write_frame_header(ctx, size - skip);
+        if (ctx->total_frames == 0) {
+            ctx->width = frame->width;
+            ctx->height = frame->height;
+        }
+    }
+    uint64_t data_offset = ctx->out_size;
+    ok = ok && fwrite(data, 1, 2, ctx->out) == 2 &&
+        fwrite(data + 2 + skip, 1, size - 2 - skip, ctx->out) == size - 2 - skip;
+    ctx->out_size += size - skip;
+
+    if (!ok || append_entry(ctx, data_offset, size - skip) != 0) {
+        ctx->write_failed = 1;
+    }
+    if (size - skip > ctx->max_frame_size) {
+        ctx->max_frame_size = size - skip;
+    }
+}
+
+// "<dir>/<stem><suffix><ext>"
+static void output_path(const job_t *job, const char *input, char *out, size_t out_size) {
+    const char *base = strrchr(input, '/');
+    base = base != NULL ? base + 1 : input;
+    const char *ext = strrchr(base, '.');
+    size_t stem_len = ext != NULL ? (size_t)(ext - base) : strlen(base);
+    int dir_len = job->out_dir != NULL ? (int)strlen(job->out_dir) : (int)(base - input);
+    const char *dir = job->out_dir != NULL ? job->out_dir : input;
+
+    snprintf(out, out_size, "%.*s%s%.*s%s%s",
+        dir_len, dir,
+        job->out_dir != NULL ? "/" : "",
+        (int)stem_len, base,
+        job->suffix,
+        ext != NULL ? ext : "");
+}
+
+static int process_file(const job_t *job, const char *input) {
+    FILE *in = fopen(input, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "%s: cannot open\n", input);
+        return -1;
+    }
+
+    file_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.job = job;
+    ctx.buffer = (uint8_t *)malloc(READ_CHUNK_SIZE + MAX_FRAME_SIZE);
+    if (ctx.buffer == NULL) {
+        fclose(in);
+        return -1;
+    }
+
+    char out_path[1024];
+    char tmp_path[1100];
+    if (job->format != OUTPUT_INDEX_ONLY) {
+        output_path(job, input, out_path, sizeof(out_path));
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+        ctx.out = fopen(tmp_path, "wb");
+        if (ctx.out == NULL) {
+            fprintf(stderr, "%s: cannot create\n", tmp_path);
+            free(ctx.buffer);
+            fclose(in);
+            return -1;
+        }
+        if (job->format == OUTPUT_CONTAINER && !start_container(&ctx)) {
+            ctx.write_failed = 1;
+        }
+    }
+
+    // Length-prefixed inputs work too: the framer skips the ASCII digits
+    int first_byte = fgetc(in);
+    int input_is_raw = first_byte == 0xFF;
+    ungetc(first_byte, in);
+
+    mjpeg_framer_t framer;
+    mjpeg_framer_init(&framer);
+
+    size_t n;
+    while (!ctx.write_failed && (n = fread(ctx.buffer + ctx.buffered, 1, READ_CHUNK_SIZE, in)) > 0) {
+        mjpeg_framer_feed(&framer, ctx.buffer + ctx.buffered, n, on_frame, &ctx);
+        ctx.buffered += n;
+
+        // Keep only the frame still being parsed, indexing needs no bytes
+        int64_t pending = mjpeg_framer_pending_start(&framer);
+        uint64_t keep_from = pending >= 0 && job->format != OUTPUT_INDEX_ONLY ? (uint64_t)pending : framer.position;
+        if (framer.position - keep_from > MAX_FRAME_SIZE) {
+            mjpeg_framer_drop(&framer);
+            ctx.oversized++;
+            keep_from = framer.position;
+        }
+        size_t discard = (size_t)(keep_from - ctx.buffer_offset);
+        memmove(ctx.buffer, ctx.buffer + discard, ctx.buffered - discard);
+        ctx.buffered -= discard;
+        ctx.buffer_offset = keep_from;
+    }
+    int truncated = mjpeg_framer_pending_start(&framer) >= 0;
+    fclose(in);
+
+    int result = ctx.write_failed ? -1 : 0;
+    const char *indexed_path = input;
+    int indexed_raw = input_is_raw;
+    uint64_t indexed_size = framer.position;
+    if (ctx.out != NULL) {
+        if (result == 0 && job->format == OUTPUT_CONTAINER && ctx.total_frames > 0 && finish_container(&ctx) != 0) {
+            result = -1;
+        }
+        if (fclose(ctx.out) != 0 || result != 0 || rename(tmp_path, out_path) != 0) {
+            remove(tmp_path);
+            result = -1;
+        }
+        indexed_path = out_path;
+        indexed_raw = job->format == OUTPUT_RAW;
+        indexed_size = ctx.out_size;
+    }
+    if (result == 0 && ctx.total_frames == 0) {
+        fprintf(stderr, "%s: no JPEG frames found\n", input);
+        result = -1;
+    }
+    // A container carries its own index
+    if (result == 0 && job->format != OUTPUT_CONTAINER) {
+        result = video_stream_write_index(indexed_path, ctx.index, ctx.total_frames,
+            job->fps_num, job->fps_den, indexed_raw, indexed_size);
+    }
+
+    if (result == 0) {
+        printf("%s: %d frames, %llu malformed, %llu oversized, %d truncated, %llu stray bytes\n",
+            indexed_path, ctx.total_frames,
+            (unsigned long long)framer.invalid_frames, (unsigned long long)ctx.oversized,
+            truncated, (unsigned long long)framer.skipped_bytes);
+    } else {
+        fprintf(stderr, "%s: failed\n", input);
+    }
+
+    free(ctx.index);
+    free(ctx.buffer);
+    return result;
+}
+
+static void *worker(void *arg) {
+    job_t *job = (job_t *)arg;
+    int i;
+    while ((i = atomic_fetch_add(&job->next_file, 1)) < job->file_count) {
+        if (process_file(job, job->files[i]) != 0) {
+            atomic_store(&job->failed, 1);
+        }
+    }
+    return NULL;
+}
+
+// "30", "29.97" or "30000/1001"
+static int parse_fps(const char *str, uint32_t *num, uint32_t *den) {
+    unsigned long n;
+    unsigned long d;
+    if (sscanf(str, "%lu/%lu", &n, &d) == 2 && n > 0 && d > 0) {
+        *num = (uint32_t)n;
+        *den = (uint32_t)d;
+        return 0;
+    }
+    double fps = atof(str);
+    if (fps <= 0) {
+        return -1;
+    }
+    *num = (uint32_t)(fps * 1000 + 0.5);
+    *den = 1000;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-j jobs] [-f raw|lp|v2] [-r fps] [-o out_dir] [-s suffix] video...\n", prog);
+    fprintf(stderr, "  without -f only the sidecar index is written, next to each video\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    logger_init(LOG_SRC_SERVER);
+
+    job_t job;
+    memset(&job, 0, sizeof(job));
+    job.format = OUTPUT_INDEX_ONLY;
+    job.fps_num = (uint32_t)VIDEO_DEFAULT_FPS;
+    job.fps_den = 1;
+    job.suffix = NULL;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "j:f:r:o:s:")) != -1) {
+        switch (opt_char) {
+        case 'j':
+            jobs = atol(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "raw") == 0) {
+                job.format = OUTPUT_RAW;
+            } else if (strcmp(optarg, "lp") == 0) {
+                job.format = OUTPUT_LENGTH_PREFIXED;
+            } else if (strcmp(optarg, "v2") == 0) {
+                job.format = OUTPUT_CONTAINER;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'r':
+            if (parse_fps(optarg, &job.fps_num, &job.fps_den) != 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'o':
+            job.out_dir = optarg;
+            break;
+        case 's':
+            job.suffix = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+    }
+    if (job.suffix == NULL) {
+        job.suffix = job.format == OUTPUT_RAW ? "_raw" : job.format == OUTPUT_CONTAINER ? "_v2" : "_lp";
+    }
+
+    job.files = argv + optind;
+    job.file_count = argc - optind;
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > job.file_count) {
+        jobs = job.file_count;
+    }
+
+    pthread_t *threads = (pthread_t *)malloc((size_t)jobs * sizeof(pthread_t));
+    if (threads == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (long t = 0; t < jobs; t++) {
+        pthread_create(&threads[t], NULL, worker, &job);
+    }
+    for (long t = 0; t < jobs; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    return atomic_load(&job.failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
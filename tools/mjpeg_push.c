@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/logger.h"
+#include "../common/protocol.h"
+#include "../server/video_stream.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Pushes a video to a server's live source like a camera would: ANNOUNCE
+// and RECORD "live/<name>", then write each JPEG frame to the connection at
+// the video's frame rate. Viewers play it from "live/<name>" meanwhile
+
+// Send a request and read its reply status, -1 if there is none, and the
+// session ID it carries
+static int exchange(int fd, const char *request, int *session_id) {
+    if (send(fd, request, strlen(request), 0) < 0) {
+        return -1;
+    }
+    char reply[2048];
+    size_t len = 0;
+    while (len < sizeof(reply) - 1) {
+        ssize_t n = recv(fd, reply + len, sizeof(reply) - 1 - len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        len += (size_t)n;
+        reply[len] = '\0';
+        if (strstr(reply, "\r\n\r\n") != NULL) {
+            int status = -1;
+            sscanf(reply, "RTSP/1.0 %d", &status);
+            const char *session = strstr(reply, "Session: ");
+            if (session != NULL) {
+                *session_id = atoi(session + strlen("Session: "));
+            }
+            return status;
+        }
+    }
+    return -1;
+}
+
+static int send_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-r fps] [-n loops] host port live/<name> video\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    logger_init(LOG_SRC_SERVER);
+
+    double fps = 0;
+    int loops = 1; // 0 loops forever
+    int opt;
+    while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+        switch (opt) {
+        case 'r':
+            fps = atof(optarg);
+            break;
+        case 'n':
+            loops = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 4 || loops < 0) {
+        usage(argv[0]);
+    }
+    const char *host = argv[optind];
+    int port = atoi(argv[optind + 1]);
+    const char *path = argv[optind + 2];
+    const char *video = argv[optind + 3];
+
+    video_stream_t stream;
+    if (video_stream_open(&stream, video) != 0) {
+        fprintf(stderr, "%s: cannot open\n", video);
+        return EXIT_FAILURE;
+    }
+    if (fps <= 0) {
+        fps = stream.fps;
+    }
+    uint8_t *frame = (uint8_t *)malloc(stream.max_frame_size > 0 ? stream.max_frame_size : 1);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (frame == NULL || fd < 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "cannot connect to %s:%d\n", host, port);
+        return EXIT_FAILURE;
+    }
+
+    // The frame rate goes in an SDP body, as DESCRIBE reports it
+    char sdp[128];
+    snprintf(sdp, sizeof(sdp), "v=0\r\nm=video 0 RTP/AVP %d\r\na=framerate:%.3f\r\n", MJPEG_TYPE, fps);
+    char request[512];
+    snprintf(request, sizeof(request),
+        "ANNOUNCE %s %s\r\nCSeq: 1\r\nContent-Type: application/sdp\r\nContent-Length: %zu\r\n\r\n%s",
+        path, RTSP_VERSION, strlen(sdp), sdp);
+    int session_id = 0;
+    int status = exchange(fd, request, &session_id);
+    if (status != 200) {
+        fprintf(stderr, "ANNOUNCE %s refused with %d\n", path, status);
+        return EXIT_FAILURE;
+    }
+    snprintf(request, sizeof(request), "RECORD %s %s\r\nCSeq: 2\r\nSession: %d\r\n\r\n",
+        path, RTSP_VERSION, session_id);
+    status = exchange(fd, request, &session_id);
+    if (status != 200) {
+        fprintf(stderr, "RECORD %s refused with %d\n", path, status);
+        return EXIT_FAILURE;
+    }
+    printf("pushing %s to %s at %.3f fps\n", video, path, fps);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long interval_ns = (long)(1e9 / fps);
+    uint64_t frames = 0;
+    for (int loop = 0; loops == 0 || loop < loops; loop++) {
+        video_stream_seek_frame(&stream, 0);
+        ssize_t size;
+        while ((size = video_stream_next_frame(&stream, frame, stream.max_frame_size)) > 0) {
+            if (send_all(fd, frame, (size_t)size) != 0) {
+                fprintf(stderr, "connection closed after %llu frames\n", (unsigned long long)frames);
+                return EXIT_FAILURE;
+            }
+            frames++;
+
+            // Absolute deadlines, so send time doesn't accumulate as drift
+            next.tv_nsec += interval_ns;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    printf("pushed %llu frames\n", (unsigned long long)frames);
+
+    close(fd);
+    free(frame);
+    video_stream_close(&stream);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/logger.h"
+#include "../server/async_io.h"
+#include "../server/frame_reader.h"
+#include "../server/video_stream.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Simulates playing sessions the way the RTP thread reads frames: one frame
+// per interval, timing how long each read stalls the sender. Files are
+// dropped from the page cache first so reads go to the disk
+
+#define READ_POOL_THREADS 8
+
+typedef struct {
+    const char *filename;
+    int depth;
+    double fps;
+    double seconds;
+    double seek_every; // seconds between random seeks, 0 for none
+    unsigned seed;
+
+    // Results
+    uint64_t *stalls_us;
+    int frames;
+    int capacity;
+    int failed;
+} bench_session_t;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void drop_page_cache(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static void *session_thread(void *arg) {
+    bench_session_t *session = (bench_session_t *)arg;
+    video_stream_t stream;
+    if (video_stream_open(&stream, session->filename) != 0) {
+        session->failed = 1;
+        return NULL;
+    }
+    // Opening scans or loads the index, start from a cold cache again
+    drop_page_cache(session->filename);
+
+    frame_reader_t reader;
+    int use_reader = session->depth > 0 && frame_reader_init(&reader, &stream, session->depth) == 0;
+    uint8_t *buffer = (uint8_t *)malloc(stream.max_frame_size + 1);
+    session->capacity = (int)(session->seconds * session->fps) + 1;
+    session->stalls_us = (uint64_t *)malloc((size_t)session->capacity * sizeof(uint64_t));
+    if (buffer == NULL || session->stalls_us == NULL) {
+        session->failed = 1;
+    }
+
+    uint64_t interval_us = (uint64_t)(1000000.0 / session->fps);
+    int seek_frames = (int)(session->seek_every * session->fps);
+    uint64_t next_us = now_us();
+    while (!session->failed && session->frames < session->capacity) {
+        if (stream.frame_num >= stream.total_frames) {
+            video_stream_seek_frame(&stream, 0); // loop the video
+        }
+        if (seek_frames > 0 && session->frames > 0 && session->frames % seek_frames == 0) {
+            video_stream_seek_frame(&stream, rand_r(&session->seed) % stream.total_frames);
+        }
+        const uint8_t *data = buffer;
+        uint64_t start = now_us();
+        ssize_t size = use_reader ?
+            frame_reader_next(&reader, &data) :
+            video_stream_next_frame(&stream, buffer, stream.max_frame_size + 1);
+        if (size < 0) {
+            session->failed = 1;
+            break;
+        }
+        session->stalls_us[session->frames++] = now_us() - start;
+
+        next_us += interval_us;
+        uint64_t now = now_us();
+        if (next_us > now) {
+            struct timespec wait = {(time_t)((next_us - now) / 1000000), (long)((next_us - now) % 1000000) * 1000};
+            nanosleep(&wait, NULL);
+        }
+    }
+
+    if (use_reader) {
+        frame_reader_close(&reader);
+    }
+    free(buffer);
+    video_stream_close(&stream);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s sessions] [-k read_ahead_frames] [-K] [-n] [-r fps] [-t seconds] [-S seek_every] video...\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    logger_init(LOG_SRC_SERVER);
+
+    int sessions = 100;
+    int depth = 0;
+    int force_threads = 0;
+    double fps = VIDEO_DEFAULT_FPS;
+    double seconds = 10.0;
+    double seek_every = 0;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "s:k:Knr:t:S:")) != -1) {
+        switch (opt_char) {
+        case 's':
+            sessions = atoi(optarg);
+            break;
+        case 'k':
+            depth = atoi(optarg);
+            break;
+        case 'K':
+            force_threads = 1;
+            break;
+        case 'r':
+            fps = atof(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'S':
+            seek_every = atof(optarg);
+            break;
+        case 'n':
+            video_stream_set_cache_hints(0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc || sessions < 1 || fps <= 0 || seconds <= 0) {
+        usage(argv[0]);
+    }
+
+    if (depth > 0 && async_io_init(force_threads, READ_POOL_THREADS) != 0) {
+        return EXIT_FAILURE;
+    }
+    for (int i = optind; i < argc; i++) {
+        drop_page_cache(argv[i]);
+    }
+
+    bench_session_t *states = (bench_session_t *)calloc((size_t)sessions, sizeof(bench_session_t));
+    pthread_t *threads = (pthread_t *)malloc((size_t)sessions * sizeof(pthread_t));
+    if (states == NULL || threads == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < sessions; i++) {
+        states[i].filename = argv[optind + i % (argc - optind)];
+        states[i].depth = depth;
+        states[i].fps = fps;
+        states[i].seconds = seconds;
+        states[i].seek_every = seek_every;
+        states[i].seed = (unsigned)i + 1;
+        pthread_create(&threads[i], NULL, session_thread, &states[i]);
+    }
+
+    size_t total = 0;
+    int failed = 0;
+    for (int i = 0; i < sessions; i++) {
+        pthread_join(threads[i], NULL);
+        total += (size_t)states[i].frames;
+        failed += states[i].failed;
+    }
+
+    uint64_t *all = (uint64_t *)malloc((total > 0 ? total : 1) * sizeof(uint64_t));
+    size_t n = 0;
+    uint64_t interval_us = (uint64_t)(1000000.0 / fps);
+    uint64_t late = 0;
+    for (int i = 0; i < sessions; i++) {
+        for (int f = 0; all != NULL && f < states[i].frames; f++) {
+            all[n++] = states[i].stalls_us[f];
+            late += states[i].stalls_us[f] > interval_us;
+        }
+        free(states[i].stalls_us);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    if (n > 0) {
+        qsort(all, n, sizeof(uint64_t), compare_u64);
+        printf("%d sessions, read-ahead %d (%s): %zu frames, stall p50 %llu us, p99 %llu us, "
+               "max %llu us, %llu over one frame interval, %ld major faults, %ld blocks read, "
+               "%d failed sessions\n",
+            sessions, depth, depth > 0 ? async_io_backend_name() : "sync", n,
+            (unsigned long long)all[n / 2], (unsigned long long)all[n * 99 / 100],
+            (unsigned long long)all[n - 1], (unsigned long long)late,
+            usage.ru_majflt, usage.ru_inblock, failed);
+    }
+
+    free(all);
+    free(states);
+    free(threads);
+    if (depth > 0) {
+        async_io_shutdown();
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,383 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/rtcp.h"
+#include "../common/rtp_fec.h"
+#include "../common/rtp_packet.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Sits between the server and a client as a lossy link: SETUP the client
+// with the proxy's port as its RTP port, and the proxy forwards the video
+// to the client's real port, dropping packets at random, and the client's
+// RTCP back to the server. At the end it reports how many frames loss hit
+// and how many of those the parity packets (-F on the server) can rebuild.
+// With a rate limit the video also goes through a token bucket in front of
+// a drop-tail queue, like a bottleneck router
+
+#define PROXY_BUFFER_SIZE 65536
+#define PROXY_POLL_MS 100
+#define TRACKED_FRAMES 64
+
+// Rate limited links: queued packets are at most PROXY_PACKET_SIZE bytes,
+// and the bucket holds PROXY_BURST_MS of the rate (at least one packet)
+#define PROXY_PACKET_SIZE 2048
+#define PROXY_DEFAULT_QUEUE 64
+#define PROXY_BURST_MS 10
+
+// What the link did to one frame, counting only the first time each
+// packet was sent (retransmissions come later, with the same seqnum)
+typedef struct {
+    int valid;
+    uint16_t seqnum;
+    uint8_t epoch;
+    int total_frags;
+    uint32_t data_seen[8];
+    uint32_t data_lost[8];
+    uint8_t group_size[256];  // parity group starting at each index, 0 if none
+    uint32_t parity_lost[8];
+} frame_record_t;
+
+typedef struct {
+    uint64_t forwarded;
+    uint64_t dropped;
+    uint64_t data_packets;
+    uint64_t data_bytes;
+    uint64_t parity_packets;
+    uint64_t parity_bytes;
+    uint64_t retransmits;
+    uint64_t rtcp;
+    uint64_t frames;
+    uint64_t frames_hit;
+    uint64_t frames_rebuildable;
+    uint64_t queue_dropped;
+    uint64_t forwarded_bytes;
+} proxy_stats_t;
+
+// Packets waiting for tokens, oldest at head
+typedef struct {
+    uint8_t (*packets)[PROXY_PACKET_SIZE];
+    size_t *sizes;
+    int capacity;
+    int head;
+    int count;
+    double tokens;       // bytes that may be sent right away
+    double burst;        // most tokens the bucket holds
+    double bytes_per_us;
+    uint64_t filled_us;  // when tokens were last added
+} link_queue_t;
+
+static volatile sig_atomic_t g_stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+static int test_bit(const uint32_t *bits, int index) {
+    return (bits[index / 32] & (1u << (index % 32))) != 0;
+}
+
+static void set_bit(uint32_t *bits, int index) {
+    bits[index / 32] |= 1u << (index % 32);
+}
+
+// Whether the parity of each group can rebuild every fragment lost
+static int rebuildable(const frame_record_t *frame) {
+    for (int i = 0; i < frame->total_frags; i++) {
+        if (!test_bit(frame->data_lost, i)) {
+            continue;
+        }
+        int covered = 0;
+        for (int first = 0; first <= i && !covered; first++) {
+            int size = frame->group_size[first];
+            if (size == 0 || i >= first + size || test_bit(frame->parity_lost, first)) {
+                continue;
+            }
+            int lost = 0;
+            for (int j = first; j < first + size && j < frame->total_frags; j++) {
+                lost += test_bit(frame->data_lost, j);
+            }
+            covered = lost == 1;
+        }
+        if (!covered) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void finish_frame(frame_record_t *frame, proxy_stats_t *stats) {
+    if (!frame->valid || frame->total_frags == 0) {
+        return;
+    }
+    stats->frames++;
+    int hit = 0;
+    for (int i = 0; i < 8; i++) {
+        hit |= frame->data_lost[i] != 0;
+    }
+    if (hit) {
+        stats->frames_hit++;
+        stats->frames_rebuildable += rebuildable(frame);
+    }
+    frame->valid = 0;
+}
+
+// Account for a packet from the server, dropped or not
+static void track_packet(frame_record_t *frames, proxy_stats_t *stats,
+                         const uint8_t *packet, size_t size, int dropped) {
+    rtp_header_t header;
+    uint8_t *payload;
+    size_t payload_size = rtp_packet_decode(&header, &payload, packet, size);
+    if (payload_size < RTP_FRAG_HEADER_SIZE || (payload[0] == 0xFF && payload[1] == 0xD8)) {
+        return;
+    }
+    rtp_frag_header_t frag;
+    rtp_frag_decode(payload, &frag);
+
+    frame_record_t *frame = &frames[header.seqnum % TRACKED_FRAMES];
+    if (frame->valid && (frame->seqnum != header.seqnum || frame->epoch != frag.epoch)) {
+        finish_frame(frame, stats);
+    }
+    if (!frame->valid) {
+        memset(frame, 0, sizeof(*frame));
+        frame->valid = 1;
+        frame->seqnum = header.seqnum;
+        frame->epoch = frag.epoch;
+        frame->total_frags = frag.total_frags;
+    }
+
+    if (rtp_frag_is_parity(&frag)) {
+        stats->parity_packets++;
+        stats->parity_bytes += size;
+        frame->group_size[frag.frag_index] = (uint8_t)rtp_fec_group_size(&frag);
+        if (dropped) {
+            set_bit(frame->parity_lost, frag.frag_index);
+        }
+    } else if (test_bit(frame->data_seen, frag.frag_index)) {
+        stats->retransmits++;
+    } else {
+        stats->data_packets++;
+        stats->data_bytes += size;
+        set_bit(frame->data_seen, frag.frag_index);
+        if (dropped) {
+            set_bit(frame->data_lost, frag.frag_index);
+        }
+    }
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Send the queued packets the bucket has tokens for
+// Return the microseconds until the next one may go, -1 if none is queued
+static int64_t drain_queue(link_queue_t *queue, int fd, const struct sockaddr_in *client, proxy_stats_t *stats) {
+    uint64_t now = now_us();
+    queue->tokens += (double)(now - queue->filled_us) * queue->bytes_per_us;
+    if (queue->tokens > queue->burst) {
+        queue->tokens = queue->burst;
+    }
+    queue->filled_us = now;
+
+    while (queue->count > 0) {
+        size_t size = queue->sizes[queue->head];
+        if (queue->tokens < (double)size) {
+            return (int64_t)(((double)size - queue->tokens) / queue->bytes_per_us) + 1;
+        }
+        queue->tokens -= (double)size;
+        sendto(fd, queue->packets[queue->head], size, 0, (const struct sockaddr *)client, sizeof(*client));
+        stats->forwarded++;
+        stats->forwarded_bytes += size;
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    return -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-l loss_percent] [-s seed] [-t seconds] [-c client_host] [-r kbit_per_s] "
+        "[-q queue_packets]\n       listen_port client_port\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    double loss = 1.0;
+    unsigned seed = 1;
+    double seconds = 0; // until interrupted
+    const char *client_host = "127.0.0.1";
+    double rate_kbps = 0; // unlimited
+    int queue_packets = PROXY_DEFAULT_QUEUE;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "l:s:t:c:r:q:")) != -1) {
+        switch (opt_char) {
+        case 'l':
+            loss = atof(optarg);
+            break;
+        case 's':
+            seed = (unsigned)atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'c':
+            client_host = optarg;
+            break;
+        case 'r':
+            rate_kbps = atof(optarg);
+            break;
+        case 'q':
+            queue_packets = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 2) {
+        usage(argv[0]);
+    }
+
+    struct sockaddr_in client;
+    memset(&client, 0, sizeof(client));
+    client.sin_family = AF_INET;
+    client.sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, client_host, &client.sin_addr) != 1) {
+        fprintf(stderr, "Error: invalid client address %s\n", client_host);
+        return EXIT_FAILURE;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)atoi(argv[optind]));
+    if (fd < 0 || bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    frame_record_t *frames = (frame_record_t *)calloc(TRACKED_FRAMES, sizeof(frame_record_t));
+    uint8_t *buffer = (uint8_t *)malloc(PROXY_BUFFER_SIZE);
+    if (frames == NULL || buffer == NULL) {
+        return EXIT_FAILURE;
+    }
+    link_queue_t queue;
+    memset(&queue, 0, sizeof(queue));
+    if (rate_kbps > 0) {
+        queue.capacity = queue_packets > 0 ? queue_packets : 1;
+        queue.packets = malloc((size_t)queue.capacity * PROXY_PACKET_SIZE);
+        queue.sizes = (size_t *)calloc((size_t)queue.capacity, sizeof(size_t));
+        if (queue.packets == NULL || queue.sizes == NULL) {
+            return EXIT_FAILURE;
+        }
+        queue.bytes_per_us = rate_kbps * 1000 / 8 / 1e6;
+        queue.burst = rate_kbps * 1000 / 8 * PROXY_BURST_MS / 1000;
+        if (queue.burst < PROXY_PACKET_SIZE) {
+            queue.burst = PROXY_PACKET_SIZE;
+        }
+        queue.tokens = queue.burst;
+        queue.filled_us = now_us();
+    }
+    proxy_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    struct sockaddr_in server;
+    int server_known = 0;
+    uint64_t started_us = now_us();
+    uint64_t deadline = seconds > 0 ? started_us + (uint64_t)(seconds * 1e6) : 0;
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int64_t wait_us = -1;
+    while (!g_stop && (deadline == 0 || now_us() < deadline)) {
+        int timeout_ms = wait_us >= 0 && wait_us / 1000 < PROXY_POLL_MS ? (int)(wait_us / 1000) : PROXY_POLL_MS;
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (rate_kbps > 0) {
+            wait_us = drain_queue(&queue, fd, &client, &stats);
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t size = recvfrom(fd, buffer, PROXY_BUFFER_SIZE, 0, (struct sockaddr *)&from, &from_len);
+        if (size <= 0) {
+            continue;
+        }
+
+        // Feedback from the client goes back to the server unharmed
+        if (from.sin_addr.s_addr == client.sin_addr.s_addr && from.sin_port == client.sin_port) {
+            if (server_known && rtcp_is_rtcp(buffer, (size_t)size)) {
+                sendto(fd, buffer, (size_t)size, 0, (struct sockaddr *)&server, sizeof(server));
+                stats.rtcp++;
+            }
+            continue;
+        }
+        server = from;
+        server_known = 1;
+
+        int dropped = rand_r(&seed) < loss / 100.0 * ((double)RAND_MAX + 1);
+        int queue_full = rate_kbps > 0 && (queue.count == queue.capacity || size > PROXY_PACKET_SIZE);
+        track_packet(frames, &stats, buffer, (size_t)size, dropped || queue_full);
+        if (dropped || queue_full) {
+            stats.dropped++;
+            stats.queue_dropped += !dropped;
+            continue;
+        }
+        if (rate_kbps > 0) {
+            int tail = (queue.head + queue.count) % queue.capacity;
+            memcpy(queue.packets[tail], buffer, (size_t)size);
+            queue.sizes[tail] = (size_t)size;
+            queue.count++;
+            wait_us = drain_queue(&queue, fd, &client, &stats);
+            continue;
+        }
+        sendto(fd, buffer, (size_t)size, 0, (struct sockaddr *)&client, sizeof(client));
+        stats.forwarded++;
+        stats.forwarded_bytes += (uint64_t)size;
+    }
+
+    for (int i = 0; i < TRACKED_FRAMES; i++) {
+        finish_frame(&frames[i], &stats);
+    }
+    uint64_t total = stats.forwarded + stats.dropped;
+    printf("%llu packets: %llu forwarded, %llu dropped (%.2f%%), %llu rtcp packets returned\n",
+        (unsigned long long)total, (unsigned long long)stats.forwarded, (unsigned long long)stats.dropped,
+        total > 0 ? 100.0 * stats.dropped / total : 0.0, (unsigned long long)stats.rtcp);
+    double elapsed_s = (double)(now_us() - started_us) / 1e6;
+    if (rate_kbps > 0) {
+        printf("  rate limit %.0f kbit/s: %llu dropped by the full queue, %.0f kbit/s delivered\n",
+            rate_kbps, (unsigned long long)stats.queue_dropped, stats.forwarded_bytes * 8 / 1000.0 / elapsed_s);
+    }
+    if (stats.data_packets > 0) {
+        printf("  parity overhead: %llu packets, %.1f%% of data packets, %.1f%% of data bytes\n",
+            (unsigned long long)stats.parity_packets, 100.0 * stats.parity_packets / stats.data_packets,
+            100.0 * stats.parity_bytes / stats.data_bytes);
+    }
+    if (stats.frames > 0) {
+        printf("  frames: %llu, hit by loss: %llu (%.2f%%), rebuildable from parity: %llu (%.1f%% of those hit)\n",
+            (unsigned long long)stats.frames, (unsigned long long)stats.frames_hit,
+            100.0 * stats.frames_hit / stats.frames, (unsigned long long)stats.frames_rebuildable,
+            stats.frames_hit > 0 ? 100.0 * stats.frames_rebuildable / stats.frames_hit : 0.0);
+        printf("  retransmitted packets: %llu\n", (unsigned long long)stats.retransmits);
+    }
+
+    free(queue.packets);
+    free(queue.sizes);
+    free(frames);
+    free(buffer);
+    close(fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,317 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/protocol.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// Opens many RTSP sessions at once and plays them, then reports how many
+// were admitted and how steady playback was for those. Each client is a
+// thread doing SETUP, PLAY and TEARDOWN over plain sockets. With -t 0 the
+// clients tear down right after PLAY, which measures connection setup alone
+
+#define CLIENT_STACK_SIZE (256 * 1024)
+#define MAX_GAPS 4096
+#define REPLY_TIMEOUT_S 10
+
+typedef struct {
+    const char *host;
+    int port;
+    const char *filename;
+    int rtp_port;
+    double seconds;
+
+    // Results
+    int connected;
+    uint64_t connect_us; // connect() alone, SYN retries included
+    int status;          // SETUP reply status, 0 if none
+    uint64_t setup_us;   // connect() to SETUP reply
+    uint64_t replied_at_us;
+    double fps;
+    int frames;
+    uint64_t gaps_us[MAX_GAPS]; // time between consecutive frames
+    int gap_count;
+} load_client_t;
+
+// Clients wait here until all threads exist, so they connect at once
+static pthread_mutex_t g_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_start_cond = PTHREAD_COND_INITIALIZER;
+static int g_started;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Send a request and read its reply into buffer
+static int exchange(int fd, const char *request, char *buffer, size_t size) {
+    if (send(fd, request, strlen(request), 0) < 0) {
+        return -1;
+    }
+    size_t len = 0;
+    while (len < size - 1) {
+        ssize_t n = recv(fd, buffer + len, size - 1 - len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        len += (size_t)n;
+        buffer[len] = '\0';
+        if (strstr(buffer, "\r\n\r\n") != NULL) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void *client_thread(void *arg) {
+    load_client_t *client = (load_client_t *)arg;
+    char request[512];
+    char reply[2048];
+
+    int rtp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int rtsp_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)client->rtp_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (rtp_fd < 0 || rtsp_fd < 0 || bind(rtp_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        goto done;
+    }
+    struct timeval timeout = {1, 0};
+    setsockopt(rtp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    timeout.tv_sec = REPLY_TIMEOUT_S;
+    setsockopt(rtsp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    addr.sin_port = htons((uint16_t)client->port);
+    inet_pton(AF_INET, client->host, &addr.sin_addr);
+
+    pthread_mutex_lock(&g_start_mutex);
+    while (!g_started) {
+        pthread_cond_wait(&g_start_cond, &g_start_mutex);
+    }
+    pthread_mutex_unlock(&g_start_mutex);
+
+    uint64_t start = now_us();
+    if (connect(rtsp_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        goto done;
+    }
+    client->connect_us = now_us() - start;
+    client->connected = 1;
+
+    snprintf(request, sizeof(request), "SETUP %s %s\r\nCSeq: 1\r\nTransport: RTP/UDP;client_port=%d\r\n\r\n",
+        client->filename, RTSP_VERSION, client->rtp_port);
+    if (exchange(rtsp_fd, request, reply, sizeof(reply)) != 0) {
+        goto done;
+    }
+    client->replied_at_us = now_us();
+    client->setup_us = client->replied_at_us - start;
+    sscanf(reply, "RTSP/1.0 %d", &client->status);
+    if (client->status != 200) {
+        goto done;
+    }
+    int session_id = 0;
+    const char *header = strstr(reply, "Session: ");
+    if (header != NULL) {
+        session_id = atoi(header + 9);
+    }
+    header = strstr(reply, "X-Framerate: ");
+    client->fps = header != NULL ? atof(header + 13) : 30.0;
+
+    snprintf(request, sizeof(request), "PLAY %s %s\r\nCSeq: 2\r\nSession: %d\r\n\r\n",
+        client->filename, RTSP_VERSION, session_id);
+    if (exchange(rtsp_fd, request, reply, sizeof(reply)) != 0) {
+        goto done;
+    }
+
+    // A frame is complete at the packet with the RTP marker bit
+    uint8_t packet[2048];
+    uint64_t deadline = now_us() + (uint64_t)(client->seconds * 1000000);
+    uint64_t last_frame_us = 0;
+    while (now_us() < deadline) {
+        ssize_t n = recv(rtp_fd, packet, sizeof(packet), 0);
+        if (n < RTP_HEADER_SIZE) {
+            continue;
+        }
+        if (packet[1] & 0x80) {
+            uint64_t t = now_us();
+            if (last_frame_us != 0 && client->gap_count < MAX_GAPS) {
+                client->gaps_us[client->gap_count++] = t - last_frame_us;
+            }
+            last_frame_us = t;
+            client->frames++;
+        }
+    }
+
+    snprintf(request, sizeof(request), "TEARDOWN %s %s\r\nCSeq: 3\r\nSession: %d\r\n\r\n",
+        client->filename, RTSP_VERSION, session_id);
+    exchange(rtsp_fd, request, reply, sizeof(reply));
+
+done:
+    if (rtsp_fd >= 0) {
+        close(rtsp_fd);
+    }
+    if (rtp_fd >= 0) {
+        close(rtp_fd);
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n clients] [-h host] [-p port] [-P first_rtp_port] [-t seconds] video\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int count = 100;
+    const char *host = "127.0.0.1";
+    int port = 8554;
+    int rtp_base = 30000;
+    double seconds = 5.0;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "n:h:p:P:t:")) != -1) {
+        switch (opt_char) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'P':
+            rtp_base = atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || count < 1) {
+        usage(argv[0]);
+    }
+
+    load_client_t *clients = (load_client_t *)calloc((size_t)count, sizeof(load_client_t));
+    pthread_t *threads = (pthread_t *)malloc((size_t)count * sizeof(pthread_t));
+    if (clients == NULL || threads == NULL) {
+        return EXIT_FAILURE;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, CLIENT_STACK_SIZE);
+
+    int created = 0;
+    for (int i = 0; i < count; i++) {
+        clients[i].host = host;
+        clients[i].port = port;
+        clients[i].filename = argv[optind];
+        clients[i].rtp_port = rtp_base + 2 * i;
+        clients[i].seconds = seconds;
+        if (pthread_create(&threads[created], &attr, client_thread, &clients[i]) == 0) {
+            created++;
+        }
+    }
+
+    // All clients connect at once
+    pthread_mutex_lock(&g_start_mutex);
+    g_started = 1;
+    uint64_t storm_start = now_us();
+    pthread_cond_broadcast(&g_start_cond);
+    pthread_mutex_unlock(&g_start_mutex);
+    for (int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int admitted = 0;
+    int rejected_453 = 0;
+    int rejected_503 = 0;
+    int unconnected = 0;
+    int failed = 0;
+    int replied = 0;
+    int connected = 0;
+    uint64_t last_reply_us = storm_start;
+    uint64_t *connects = (uint64_t *)malloc((size_t)count * sizeof(uint64_t));
+    uint64_t *setup = (uint64_t *)malloc((size_t)count * sizeof(uint64_t));
+    uint64_t *gaps = (uint64_t *)malloc((size_t)count * MAX_GAPS * sizeof(uint64_t));
+    size_t gap_total = 0;
+    double frames_ratio = 0;
+    for (int i = 0; i < count; i++) {
+        const load_client_t *client = &clients[i];
+        if (client->connected) {
+            connects[connected++] = client->connect_us;
+        }
+        if (client->status != 0) {
+            replied++;
+            if (client->replied_at_us > last_reply_us) {
+                last_reply_us = client->replied_at_us;
+            }
+        }
+        if (client->status == 200) {
+            setup[admitted++] = client->setup_us;
+            memcpy(gaps + gap_total, client->gaps_us, (size_t)client->gap_count * sizeof(uint64_t));
+            gap_total += (size_t)client->gap_count;
+            frames_ratio += client->frames / (client->fps * seconds);
+        } else if (client->status == 453) {
+            rejected_453++;
+        } else if (client->status == 503) {
+            rejected_503++;
+        } else if (!client->connected) {
+            unconnected++;
+        } else {
+            failed++; // dropped by the server or no reply
+        }
+    }
+
+    printf("%d clients: %d admitted, %d rejected 453, %d rejected 503, %d dropped, %d could not connect\n",
+        count, admitted, rejected_453, rejected_503, failed, unconnected);
+    if (connected > 0) {
+        qsort(connects, (size_t)connected, sizeof(uint64_t), compare_u64);
+        printf("  connect latency: p50 %llu us, p99 %llu us, max %llu us\n",
+            (unsigned long long)connects[connected / 2], (unsigned long long)connects[connected * 99 / 100],
+            (unsigned long long)connects[connected - 1]);
+    }
+    if (replied > 0 && last_reply_us > storm_start) {
+        printf("  setup rate: %d SETUP replies in %.3f s, %.0f/s\n", replied,
+            (last_reply_us - storm_start) / 1e6, replied * 1e6 / (double)(last_reply_us - storm_start));
+    }
+    if (admitted > 0) {
+        qsort(setup, (size_t)admitted, sizeof(uint64_t), compare_u64);
+        printf("  admitted SETUP latency: p50 %llu us, p99 %llu us\n",
+            (unsigned long long)setup[admitted / 2], (unsigned long long)setup[admitted * 99 / 100]);
+        if (seconds > 0) {
+            printf("  admitted playback: %.1f%% of expected frames\n", 100 * frames_ratio / admitted);
+        }
+    }
+    if (gap_total > 0) {
+        qsort(gaps, gap_total, sizeof(uint64_t), compare_u64);
+        printf("  frame gap: p50 %llu us, p99 %llu us, max %llu us\n",
+            (unsigned long long)gaps[gap_total / 2], (unsigned long long)gaps[gap_total * 99 / 100],
+            (unsigned long long)gaps[gap_total - 1]);
+    }
+
+    free(connects);
+    free(setup);
+    free(gaps);
+    free(clients);
+    free(threads);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../common/logger.h"
+#include "../server/rtsp_parser.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Requests parsed per second, by the line parser the server used before
+// rtsp_conn_next (copied here as the baseline) and by rtsp_conn_next fed
+// the same requests one read at a time, several pipelined per read, and
+// split across reads. One core, no sockets, so only parsing is measured
+
+#define BENCH_REQUESTS 4
+
+// What a client sends over a session's life, the last one with a body
+static const char *g_requests[BENCH_REQUESTS] = {
+    "SETUP rtsp://127.0.0.1:8554/movie.mjpeg RTSP/1.0\r\nCSeq: 2\r\n"
+    "Transport: RTP/UDP; client_port= 25000\r\n\r\n",
+    "PLAY rtsp://127.0.0.1:8554/movie.mjpeg RTSP/1.0\r\nCSeq: 3\r\nSession: 123456\r\n"
+    "Range: npt=01:30.50-\r\n\r\n",
+    "PLAY rtsp://127.0.0.1:8554/movie.mjpeg RTSP/1.0\r\nCSeq: 4\r\nSession: 123456\r\n"
+    "X-Frame: 2715\r\n\r\n",
+    "GET_PARAMETER rtsp://127.0.0.1:8554/movie.mjpeg RTSP/1.0\r\nCSeq: 5\r\nSession: 123456\r\n"
+    "Content-Type: text/parameters\r\nContent-Length: 12\r\n\r\nposition\r\n\r\n",
+};
+
+// The parser before rtsp_conn_next: one NUL-terminated request per read,
+// copied and split into lines with strtok_r, fields read with sscanf
+
+typedef struct {
+    rtsp_method_t method;
+    char filename[256];
+    int cseq;
+    int rtp_port;
+    int session_id;
+    double seek_position;
+    int has_seek;
+    int frame_number;
+    int has_frame_seek;
+} legacy_request_info_t;
+
+static void legacy_parse_request_line(const char *line, legacy_request_info_t *info) {
+    char method_str[32];
+    char url[256];
+    char version[32];
+    if (sscanf(line, "%31s %255s %31s", method_str, url, version) != 3) {
+        return;
+    }
+    char *filename = strrchr(url, '/');
+    if (filename != NULL) {
+        filename++;
+    } else {
+        filename = url;
+    }
+    strncpy(info->filename, filename, sizeof(info->filename) - 1);
+    info->filename[sizeof(info->filename) - 1] = '\0';
+
+    if (strcmp(method_str, "SETUP") == 0) {
+        info->method = METHOD_SETUP;
+    } else if (strcmp(method_str, "PLAY") == 0) {
+        info->method = METHOD_PLAY;
+    } else if (strcmp(method_str, "PAUSE") == 0) {
+        info->method = METHOD_PAUSE;
+    } else if (strcmp(method_str, "TEARDOWN") == 0) {
+        info->method = METHOD_TEARDOWN;
+    }
+}
+
+static void legacy_parse_header_line(const char *line, legacy_request_info_t *info) {
+    char header_name[64];
+    char header_value[256];
+    if (sscanf(line, "%63[^:]: %255[^\r\n]", header_name, header_value) != 2) {
+        return;
+    }
+
+    if (strcasecmp(header_name, "CSeq") == 0) {
+        info->cseq = atoi(header_value);
+    } else if (strcasecmp(header_name, "Session") == 0) {
+        info->session_id = atoi(header_value);
+    } else if (strcasecmp(header_name, "Transport") == 0) {
+        char *port_str = strstr(header_value, "client_port=");
+        if (port_str != NULL) {
+            info->rtp_port = atoi(port_str + 12);
+        }
+    } else if (strcasecmp(header_name, "Range") == 0) {
+        int minutes = 0, seconds = 0, centiseconds = 0;
+        if (sscanf(header_value, "npt=%d:%d.%d", &minutes, &seconds, &centiseconds) == 3) {
+            info->seek_position = minutes * 60 + seconds + centiseconds / 100.0;
+            info->has_seek = 1;
+        }
+    } else if (strcasecmp(header_name, "X-Frame") == 0) {
+        info->frame_number = atoi(header_value);
+        info->has_frame_seek = 1;
+    }
+}
+
+static void legacy_parse_request(const char *request_str, legacy_request_info_t *info) {
+    memset(info, 0, sizeof(legacy_request_info_t));
+    info->method = METHOD_UNKNOWN;
+    char *buffer = strdup(request_str);
+    if (buffer == NULL) {
+        return;
+    }
+    char *save_ptr;
+    char *line = strtok_r(buffer, "\n", &save_ptr);
+    if (line == NULL) {
+        free(buffer);
+        return;
+    }
+    legacy_parse_request_line(line, info);
+    while ((line = strtok_r(NULL, "\n", &save_ptr)) != NULL) {
+        if (strlen(line) <= 1) {
+            break;
+        }
+        legacy_parse_header_line(line, info);
+    }
+    free(buffer);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Keeps the parsed fields from being optimized away
+static volatile int g_sink;
+
+static double bench_legacy(double seconds) {
+    uint64_t requests = 0;
+    uint64_t start_ns = now_ns();
+    uint64_t deadline_ns = start_ns + (uint64_t)(seconds * 1e9);
+    legacy_request_info_t info;
+    while (now_ns() < deadline_ns) {
+        for (int round = 0; round < 1000; round++) {
+            legacy_parse_request(g_requests[requests % BENCH_REQUESTS], &info);
+            g_sink += info.cseq;
+            requests++;
+        }
+    }
+    return requests / ((now_ns() - start_ns) / 1e9);
+}
+
+// rtsp_conn_next over the requests laid end to end, read chunk bytes at a
+// time, or one request per read with a chunk of 0. A larger chunk
+// pipelines, a smaller one splits requests across reads
+static double bench_conn(const char *stream, size_t stream_len, int stream_requests, size_t chunk, double seconds) {
+    static rtsp_conn_buffer_t conn;
+    uint64_t requests = 0;
+    uint64_t start_ns = now_ns();
+    uint64_t deadline_ns = start_ns + (uint64_t)(seconds * 1e9);
+    rtsp_request_info_t info;
+    while (now_ns() < deadline_ns) {
+        for (int round = 0; round < 100; round++) {
+            rtsp_conn_init(&conn);
+            int parsed = 0;
+            for (size_t fed = 0, reads = 0; fed < stream_len; reads++) {
+                size_t space;
+                char *tail = rtsp_conn_tail(&conn, &space);
+                size_t n = chunk > 0 ? chunk : strlen(g_requests[reads % BENCH_REQUESTS]);
+                n = n < stream_len - fed ? n : stream_len - fed;
+                n = n < space ? n : space;
+                memcpy(tail, stream + fed, n);
+                rtsp_conn_commit(&conn, n);
+                fed += n;
+                while (rtsp_conn_next(&conn, &info) == RTSP_PARSE_OK) {
+                    g_sink += info.cseq;
+                    parsed++;
+                }
+            }
+            if (parsed != stream_requests) {
+                fprintf(stderr, "parsed %d of %d requests\n", parsed, stream_requests);
+                exit(EXIT_FAILURE);
+            }
+            requests += (uint64_t)parsed;
+        }
+    }
+    return requests / ((now_ns() - start_ns) / 1e9);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t seconds] [-p pipelined_requests] [-s split_bytes]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    logger_init(LOG_SRC_SERVER);
+
+    double seconds = 1.0;
+    int pipelined = 8;
+    size_t split = 64;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "t:p:s:")) != -1) {
+        switch (opt_char) {
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'p':
+            pipelined = atoi(optarg);
+            break;
+        case 's':
+            split = (size_t)atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (seconds <= 0 || pipelined < 1 || split < 1) {
+        usage(argv[0]);
+    }
+
+    // A connection's worth of requests, a multiple of the request set
+    static char stream[RTSP_CONN_BUFFER_SIZE * 16];
+    size_t stream_len = 0;
+    size_t max_request = 0;
+    int stream_requests = 0;
+    while (stream_requests < 256) {
+        for (int i = 0; i < BENCH_REQUESTS; i++) {
+            size_t len = strlen(g_requests[i]);
+            memcpy(stream + stream_len, g_requests[i], len);
+            stream_len += len;
+            max_request = len > max_request ? len : max_request;
+        }
+        stream_requests += BENCH_REQUESTS;
+    }
+    size_t pipelined_chunk = max_request * (size_t)pipelined;
+    if (pipelined_chunk > RTSP_CONN_BUFFER_SIZE) {
+        pipelined_chunk = RTSP_CONN_BUFFER_SIZE;
+    }
+
+    printf("%d requests (%zu bytes) per connection, %.1f s per run, one core\n",
+        stream_requests, stream_len, seconds);
+    double legacy = bench_legacy(seconds);
+    printf("old parser, one request per read: %.0f req/s\n", legacy);
+    double whole = bench_conn(stream, stream_len, stream_requests, 0, seconds);
+    printf("rtsp_conn_next, one request per read: %.0f req/s, %.2fx\n", whole, whole / legacy);
+    double batched = bench_conn(stream, stream_len, stream_requests, pipelined_chunk, seconds);
+    printf("rtsp_conn_next, %zu-byte reads (~%d pipelined): %.0f req/s, %.2fx\n",
+        pipelined_chunk, pipelined, batched, batched / legacy);
+    double split_reads = bench_conn(stream, stream_len, stream_requests, split, seconds);
+    printf("rtsp_conn_next, %zu-byte reads (split): %.0f req/s, %.2fx\n", split, split_reads, split_reads / legacy);
+    return EXIT_SUCCESS;
+}